@@ -74,6 +74,19 @@
  * }
  * </programlisting></example>
  *
+ * Plugins whose storage is slow to reach, such as a networked or
+ * encrypted backend, should also implement the asynchronous methods
+ * list_async, get_async, set_async and commit_async, together with their
+ * corresponding finish methods. If they do, Mission Control keeps its own
+ * copy of each of the plugin's accounts, so that it never has to wait for
+ * the plugin to read a setting: it fetches each account's settings in one
+ * call to get_async when the account appears or is altered, and passes all
+ * the changes made to an account since the last commit to set_async in one
+ * call, followed by commit_async. It does not call the synchronous list,
+ * commit, get_attribute, get_parameter, list_typed_parameters,
+ * set_attribute or set_parameter methods on such plugins, although they
+ * must still be implemented, since they are mandatory.
+ *
  * A single object can implement more than one interface; It is currently
  * unlikely that you would find it useful to implement anything other than
  * an account storage plugin in an account storage object, though.
@@ -398,8 +411,27 @@ mcp_account_storage_get_type (void)
  * @list_untyped_parameters: implementation
  *  of mcp_account_storage_list_untyped_parameters()
  * @get_flags: implementation of mcp_account_storage_get_flags()
+ * @list_async: implementation of mcp_account_storage_list_async(); %NULL
+ *  if the plugin is synchronous (since 5.17.0)
+ * @list_finish: implementation of mcp_account_storage_list_finish()
+ *  (since 5.17.0)
+ * @get_async: implementation of mcp_account_storage_get_async(); %NULL
+ *  if the plugin is synchronous (since 5.17.0)
+ * @get_finish: implementation of mcp_account_storage_get_finish()
+ *  (since 5.17.0)
+ * @set_async: implementation of mcp_account_storage_set_async(); %NULL
+ *  if the plugin is synchronous (since 5.17.0)
+ * @set_finish: implementation of mcp_account_storage_set_finish()
+ *  (since 5.17.0)
+ * @commit_async: implementation of mcp_account_storage_commit_async();
+ *  %NULL if the plugin is synchronous (since 5.17.0)
+ * @commit_finish: implementation of mcp_account_storage_commit_finish()
+ *  (since 5.17.0)
  *
  * The interface vtable for an account storage plugin.
+ *
+ * A plugin that implements any of the asynchronous methods must implement
+ * all of them.
  */
 
 /**
@@ -1251,3 +1283,373 @@ mcp_account_storage_has_any_flag (McpAccountStorage *storage,
   return ((mcp_account_storage_get_flags (storage, account) & require_one)
       != 0);
 }
+
+/**
+ * mcp_account_storage_is_async:
+ * @storage: an #McpAccountStorage instance
+ *
+ * Return whether this plugin implements the asynchronous methods
+ * mcp_account_storage_list_async(), mcp_account_storage_get_async(),
+ * mcp_account_storage_set_async() and mcp_account_storage_commit_async().
+ *
+ * Returns: %TRUE if @storage is an asynchronous plugin
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_is_async (McpAccountStorage *storage)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+
+  return (iface->list_async != NULL && iface->get_async != NULL &&
+      iface->set_async != NULL && iface->commit_async != NULL);
+}
+
+static void
+report_not_async (McpAccountStorage *storage,
+    GAsyncReadyCallback callback,
+    gpointer user_data,
+    gpointer source_tag)
+{
+  g_task_report_new_error (storage, callback, user_data, source_tag,
+      TP_ERROR, TP_ERROR_NOT_IMPLEMENTED,
+      "The '%s' storage plugin is not asynchronous",
+      mcp_account_storage_name (storage));
+}
+
+/**
+ * mcp_account_storage_list_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @cancellable: (allow-none): optionally used to (try to) cancel the operation
+ * @callback: called on success or failure
+ * @user_data: data for @callback
+ *
+ * The asynchronous version of mcp_account_storage_list().
+ *
+ * Unlike mcp_account_storage_list(), this may be called after
+ * Mission Control has claimed its D-Bus name, and the plugin may take as
+ * long as it needs to respond. #McpAccountStorage::created and the other
+ * signals may be emitted before it finishes; accounts that are signalled
+ * as created must still be included in the result.
+ *
+ * There is no default implementation: if the plugin does not implement
+ * this method, @callback is called with %TP_ERROR_NOT_IMPLEMENTED.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+
+  g_return_if_fail (iface != NULL);
+
+  if (iface->list_async == NULL)
+    {
+      report_not_async (storage, callback, user_data,
+          mcp_account_storage_list_async);
+      return;
+    }
+
+  iface->list_async (storage, am, cancellable, callback, user_data);
+}
+
+/**
+ * mcp_account_storage_list_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result of mcp_account_storage_list_async()
+ * @error: used to raise an error if %NULL is returned
+ *
+ * Process the result of mcp_account_storage_list_async().
+ *
+ * Returns: (element-type utf8) (transfer full): a list of account names,
+ *  as for mcp_account_storage_list(), or %NULL with @error set on failure
+ *
+ * Since: 5.17.0
+ */
+GList *
+mcp_account_storage_list_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+
+  if (g_async_result_is_tagged (result, mcp_account_storage_list_async))
+    return g_task_propagate_pointer (G_TASK (result), error);
+
+  g_return_val_if_fail (iface != NULL, NULL);
+  g_return_val_if_fail (iface->list_finish != NULL, NULL);
+
+  return iface->list_finish (storage, result, error);
+}
+
+/**
+ * mcp_account_storage_get_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @account: the unique name of the account
+ * @cancellable: (allow-none): optionally used to (try to) cancel the operation
+ * @callback: called on success or failure
+ * @user_data: data for @callback
+ *
+ * Retrieve all of an account's attributes and parameters in one
+ * operation. Mission Control calls this when an asynchronous plugin lists
+ * an account or emits #McpAccountStorage::created for it, and again when
+ * the plugin emits #McpAccountStorage::altered-one or
+ * #McpAccountStorage::reconnect for it; it does not call
+ * mcp_account_storage_get_attribute() or mcp_account_storage_get_parameter()
+ * on asynchronous plugins.
+ *
+ * Parameters must be returned with the types they are stored with; an
+ * asynchronous plugin is expected to store the types of parameters.
+ *
+ * There is no default implementation: if the plugin does not implement
+ * this method, @callback is called with %TP_ERROR_NOT_IMPLEMENTED.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_get_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "%s", account);
+
+  g_return_if_fail (iface != NULL);
+
+  if (iface->get_async == NULL)
+    {
+      report_not_async (storage, callback, user_data,
+          mcp_account_storage_get_async);
+      return;
+    }
+
+  iface->get_async (storage, am, account, cancellable, callback, user_data);
+}
+
+/**
+ * mcp_account_storage_get_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result of mcp_account_storage_get_async()
+ * @attributes: (out) (transfer full): used to return the account's
+ *  attributes, a non-floating variant of type %G_VARIANT_TYPE_VARDICT
+ *  mapping names such as "DisplayName" to values
+ * @parameters: (out) (transfer full): used to return the account's
+ *  parameters, a non-floating variant of type %G_VARIANT_TYPE_VARDICT
+ *  mapping names such as "account" (without the "param-" prefix) to values
+ * @error: used to raise an error if %FALSE is returned
+ *
+ * Process the result of mcp_account_storage_get_async().
+ *
+ * Returns: %TRUE on success, %FALSE if the account could not be read
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_get_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GVariant **attributes,
+    GVariant **parameters,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+
+  g_return_val_if_fail (attributes != NULL, FALSE);
+  g_return_val_if_fail (parameters != NULL, FALSE);
+
+  *attributes = NULL;
+  *parameters = NULL;
+
+  if (g_async_result_is_tagged (result, mcp_account_storage_get_async))
+    return g_task_propagate_boolean (G_TASK (result), error);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (iface->get_finish != NULL, FALSE);
+
+  return iface->get_finish (storage, result, attributes, parameters, error);
+}
+
+/**
+ * mcp_account_storage_set_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @account: the unique name of the account
+ * @attributes: a variant of type a{smv} mapping attribute names to their
+ *  new values, or to nothing if they are to be deleted
+ * @parameters: a variant of type a{smv} mapping parameter names (without
+ *  the "param-" prefix) to their new values, or to nothing if they are to
+ *  be deleted
+ * @cancellable: (allow-none): optionally used to (try to) cancel the operation
+ * @callback: called on success or failure
+ * @user_data: data for @callback
+ *
+ * Store several attributes and parameters at once. This is the
+ * asynchronous version of mcp_account_storage_set_attribute() and
+ * mcp_account_storage_set_parameter(): Mission Control collects the
+ * changes made to an account until it is committed, then passes them all
+ * to this method, followed by mcp_account_storage_commit_async().
+ *
+ * The plugin is not expected to write to its long term storage until
+ * mcp_account_storage_commit_async() is called, although it may.
+ *
+ * The plugin need not emit #McpAccountStorage::altered-one for changes
+ * made by this method: Mission Control already knows about them.
+ *
+ * There is no default implementation: if the plugin does not implement
+ * this method, @callback is called with %TP_ERROR_NOT_IMPLEMENTED.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_set_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *attributes,
+    GVariant *parameters,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  g_return_if_fail (iface != NULL);
+  g_return_if_fail (g_variant_is_of_type (attributes,
+        G_VARIANT_TYPE ("a{smv}")));
+  g_return_if_fail (g_variant_is_of_type (parameters,
+        G_VARIANT_TYPE ("a{smv}")));
+
+  SDEBUG (storage, "%s: %" G_GSIZE_FORMAT " attributes, %" G_GSIZE_FORMAT
+      " parameters", account, g_variant_n_children (attributes),
+      g_variant_n_children (parameters));
+
+  if (iface->set_async == NULL)
+    {
+      report_not_async (storage, callback, user_data,
+          mcp_account_storage_set_async);
+      return;
+    }
+
+  iface->set_async (storage, am, account, attributes, parameters,
+      cancellable, callback, user_data);
+}
+
+/**
+ * mcp_account_storage_set_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result of mcp_account_storage_set_async()
+ * @error: used to raise an error if %FALSE is returned
+ *
+ * Process the result of mcp_account_storage_set_async().
+ *
+ * Returns: %TRUE on success, %FALSE if the changes could not be stored
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_set_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+
+  if (g_async_result_is_tagged (result, mcp_account_storage_set_async))
+    return g_task_propagate_boolean (G_TASK (result), error);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (iface->set_finish != NULL, FALSE);
+
+  return iface->set_finish (storage, result, error);
+}
+
+/**
+ * mcp_account_storage_commit_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @account: the unique name of the account
+ * @cancellable: (allow-none): optionally used to (try to) cancel the operation
+ * @callback: called on success or failure
+ * @user_data: data for @callback
+ *
+ * The asynchronous version of mcp_account_storage_commit(): write the
+ * changes previously passed to mcp_account_storage_set_async() to long
+ * term storage.
+ *
+ * There is no default implementation: if the plugin does not implement
+ * this method, @callback is called with %TP_ERROR_NOT_IMPLEMENTED.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "%s", account);
+
+  g_return_if_fail (iface != NULL);
+
+  if (iface->commit_async == NULL)
+    {
+      report_not_async (storage, callback, user_data,
+          mcp_account_storage_commit_async);
+      return;
+    }
+
+  iface->commit_async (storage, am, account, cancellable, callback,
+      user_data);
+}
+
+/**
+ * mcp_account_storage_commit_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result of mcp_account_storage_commit_async()
+ * @error: used to raise an error if %FALSE is returned
+ *
+ * Process the result of mcp_account_storage_commit_async().
+ *
+ * Returns: %TRUE on success, %FALSE if the account could not be written
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+
+  if (g_async_result_is_tagged (result, mcp_account_storage_commit_async))
+    return g_task_propagate_boolean (G_TASK (result), error);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (iface->commit_finish != NULL, FALSE);
+
+  return iface->commit_finish (storage, result, error);
+}
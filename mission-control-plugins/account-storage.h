@@ -168,6 +168,49 @@ struct _McpAccountStorageIface
 
   McpAccountStorageFlags (*get_flags) (McpAccountStorage *storage,
       const gchar *account);
+
+  void (*list_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  GList *(*list_finish) (McpAccountStorage *storage,
+      GAsyncResult *res,
+      GError **error);
+
+  void (*get_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      const gchar *account,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  gboolean (*get_finish) (McpAccountStorage *storage,
+      GAsyncResult *res,
+      GVariant **attributes,
+      GVariant **parameters,
+      GError **error);
+
+  void (*set_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      const gchar *account,
+      GVariant *attributes,
+      GVariant *parameters,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  gboolean (*set_finish) (McpAccountStorage *storage,
+      GAsyncResult *res,
+      GError **error);
+
+  void (*commit_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      const gchar *account,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  gboolean (*commit_finish) (McpAccountStorage *storage,
+      GAsyncResult *res,
+      GError **error);
 };
 
 /* virtual methods */
@@ -261,6 +304,51 @@ gboolean mcp_account_storage_has_any_flag (
     const gchar *account,
     McpAccountStorageFlags require_one);
 
+gboolean mcp_account_storage_is_async (McpAccountStorage *storage);
+
+void mcp_account_storage_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+GList *mcp_account_storage_list_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error);
+
+void mcp_account_storage_get_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcp_account_storage_get_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GVariant **attributes,
+    GVariant **parameters,
+    GError **error);
+
+void mcp_account_storage_set_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *attributes,
+    GVariant *parameters,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcp_account_storage_set_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error);
+
+void mcp_account_storage_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcp_account_storage_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error);
+
 void mcp_account_storage_emit_created (McpAccountStorage *storage,
     const gchar *account);
 void mcp_account_storage_emit_altered_one (McpAccountStorage *storage,
@@ -62,3 +62,22 @@ mcp_is_debugging (McpDebugFlags flags)
   return FALSE;
 #endif
 }
+
+McpDebugFlags
+mcp_debug_get_flags (void)
+{
+  return debug_flags;
+}
+
+/*
+ * mcp_debug_set_flags:
+ * @flags: the categories to enable
+ *
+ * Replace the categories chosen by $MCP_DEBUG at startup, so that Mission
+ * Control can turn plugin debugging on and off while it is running.
+ */
+void
+mcp_debug_set_flags (McpDebugFlags flags)
+{
+  debug_flags = flags;
+}
@@ -25,8 +25,9 @@
 #error Use <mission-control-plugins/mission-control-plugins.h> instead
 #endif
 
+/* The arguments are not evaluated unless _type is enabled */
 #define MCP_DEBUG(_type, _fmt, ...) \
-  G_STMT_START { if (mcp_is_debugging (_type)) \
+  G_STMT_START { if (G_UNLIKELY (mcp_is_debugging (_type))) \
       g_debug ("%s: " _fmt, G_STRFUNC, ##__VA_ARGS__); } G_STMT_END
 
 G_BEGIN_DECLS
@@ -44,6 +45,8 @@ typedef enum {
 
 gboolean mcp_is_debugging (McpDebugFlags type);
 void mcp_debug_init (void);
+McpDebugFlags mcp_debug_get_flags (void);
+void mcp_debug_set_flags (McpDebugFlags flags);
 
 G_END_DECLS
 
@@ -0,0 +1,197 @@
+/* Mission Control plugin API - in-process channel handlers.
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION:internal-handler
+ * @title: McpInternalHandler
+ * @short_description: In-process channel handler, implemented by plugins
+ * @include: mission-control-plugins/mission-control-plugins.h
+ *
+ * Plugins may implement #McpInternalHandler in order to handle incoming
+ * Telepathy channels inside the Mission Control process, for instance to
+ * provide an embedded logger or auto-reply service.
+ *
+ * This is a fast path: when a new channel that was not requested through
+ * the Channel Dispatcher appears, Mission Control compares its immutable
+ * properties with each internal handler's filters before doing anything
+ * else. If a filter matches, the channel is passed to the internal handler
+ * with the most specific matching filter, and no ChannelDispatchOperation
+ * is created for it. In particular, Observers and Approvers are not
+ * invoked, and no Handler is called over D-Bus; the channel is recorded as
+ * being handled by Mission Control itself.
+ *
+ * To do so, the plugin must implement a #GObject subclass that implements
+ * #McpInternalHandler, then return an instance of that subclass from
+ * mcp_plugin_ref_nth_object().
+ *
+ * A typical plugin might look like this:
+ *
+ * <example><programlisting>
+ * G_DEFINE_TYPE_WITH_CODE (MyPlugin, my_plugin,
+ *    G_TYPE_OBJECT,
+ *    G_IMPLEMENT_INTERFACE (MCP_TYPE_INTERNAL_HANDLER,
+ *      internal_handler_iface_init))
+ * /<!-- -->* ... *<!-- -->/
+ * static void
+ * internal_handler_iface_init (McpInternalHandlerIface *iface,
+ *     gpointer unused G_GNUC_UNUSED)
+ * {
+ *   iface-&gt;get_filters = my_plugin_get_filters;
+ *   iface-&gt;handle_channel = my_plugin_handle_channel;
+ * }
+ * </programlisting></example>
+ *
+ * Since: 5.17.0
+ */
+
+#include "config.h"
+
+#include <mission-control-plugins/mission-control-plugins.h>
+
+GType
+mcp_internal_handler_get_type (void)
+{
+  static gsize once = 0;
+  static GType type = 0;
+
+  if (g_once_init_enter (&once))
+    {
+      static const GTypeInfo info = {
+          sizeof (McpInternalHandlerIface),
+          NULL, /* base_init */
+          NULL, /* base_finalize */
+          NULL, /* class_init */
+          NULL, /* class_finalize */
+          NULL, /* class_data */
+          0, /* instance_size */
+          0, /* n_preallocs */
+          NULL, /* instance_init */
+          NULL /* value_table */
+      };
+
+      type = g_type_register_static (G_TYPE_INTERFACE,
+          "McpInternalHandler", &info, 0);
+      g_type_interface_add_prerequisite (type, G_TYPE_OBJECT);
+
+      g_once_init_leave (&once, 1);
+    }
+
+  return type;
+}
+
+/**
+ * McpInternalHandlerIface:
+ * @parent: the parent type
+ * @get_filters: an implementation of mcp_internal_handler_get_filters();
+ *    %NULL is equivalent to an implementation that returns no filters
+ * @handle_channel: an implementation of
+ *    mcp_internal_handler_handle_channel(); %NULL is equivalent to an
+ *    implementation that always returns %FALSE
+ *
+ * Since: 5.17.0
+ */
+
+/**
+ * McpInternalHandlerGetFiltersFunc:
+ * @self: an implementation of this interface, provided by a plugin
+ *
+ * Signature of an implementation of mcp_internal_handler_get_filters().
+ *
+ * Returns: (transfer none): see mcp_internal_handler_get_filters()
+ *
+ * Since: 5.17.0
+ */
+
+/**
+ * McpInternalHandlerHandleChannelFunc:
+ * @self: an implementation of this interface, provided by a plugin
+ * @account_path: the object path of the account
+ * @channel: the channel
+ *
+ * Signature of an implementation of mcp_internal_handler_handle_channel().
+ *
+ * Returns: see mcp_internal_handler_handle_channel()
+ *
+ * Since: 5.17.0
+ */
+
+/**
+ * mcp_internal_handler_get_filters:
+ * @self: an implementation of this interface, provided by a plugin
+ *
+ * Return the channel classes that this internal handler wants to handle,
+ * in the same format as the HandlerChannelFilter property of a Telepathy
+ * Handler: each element is a #GHashTable mapping property names
+ * (strings) to #GValue<!-- -->s, as created by tp_asv_new().
+ *
+ * This is called for every new channel, so implementations should return
+ * an array that they keep, rather than building a new one.
+ *
+ * Returns: (transfer none) (element-type GLib.HashTable) (allow-none):
+ *  the channel filters, or %NULL if this handler currently wants no
+ *  channels
+ *
+ * Since: 5.17.0
+ */
+GPtrArray *
+mcp_internal_handler_get_filters (McpInternalHandler *self)
+{
+  McpInternalHandlerIface *iface = MCP_INTERNAL_HANDLER_GET_IFACE (self);
+
+  g_return_val_if_fail (iface != NULL, NULL);
+
+  if (iface->get_filters == NULL)
+    return NULL;
+
+  return iface->get_filters (self);
+}
+
+/**
+ * mcp_internal_handler_handle_channel:
+ * @self: an implementation of this interface, provided by a plugin
+ * @account_path: the object path of the account
+ * @channel: a channel that matched one of this handler's filters; it may
+ *  not have been prepared yet
+ *
+ * Offer a new channel to the internal handler. If it returns %TRUE, it
+ * has taken responsibility for @channel, and must close it when it has
+ * finished with it, like any other Handler. If it returns %FALSE, the
+ * channel is offered to other internal handlers, or dispatched normally.
+ *
+ * This method must not block.
+ *
+ * Returns: %TRUE if the handler accepted the channel
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_internal_handler_handle_channel (McpInternalHandler *self,
+    const gchar *account_path,
+    TpChannel *channel)
+{
+  McpInternalHandlerIface *iface = MCP_INTERNAL_HANDLER_GET_IFACE (self);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (TP_IS_CHANNEL (channel), FALSE);
+
+  if (iface->handle_channel == NULL)
+    return FALSE;
+
+  return iface->handle_channel (self, account_path, channel);
+}
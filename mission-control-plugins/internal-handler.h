@@ -0,0 +1,74 @@
+/* Mission Control plugin API - in-process channel handlers.
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCP_INTERNAL_HANDLER_H
+#define MCP_INTERNAL_HANDLER_H
+
+#ifndef _MCP_IN_MISSION_CONTROL_PLUGINS_H
+#error Use <mission-control-plugins/mission-control-plugins.h> instead
+#endif
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+/* API for plugins to implement */
+
+typedef struct _McpInternalHandler McpInternalHandler;
+typedef struct _McpInternalHandlerIface McpInternalHandlerIface;
+
+#define MCP_TYPE_INTERNAL_HANDLER \
+  (mcp_internal_handler_get_type ())
+#define MCP_INTERNAL_HANDLER(o) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((o), MCP_TYPE_INTERNAL_HANDLER, \
+                               McpInternalHandler))
+#define MCP_IS_INTERNAL_HANDLER(o) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((o), MCP_TYPE_INTERNAL_HANDLER))
+#define MCP_INTERNAL_HANDLER_GET_IFACE(o) \
+  (G_TYPE_INSTANCE_GET_INTERFACE ((o), MCP_TYPE_INTERNAL_HANDLER, \
+                                  McpInternalHandlerIface))
+
+GType mcp_internal_handler_get_type (void) G_GNUC_CONST;
+
+/* virtual methods */
+
+typedef GPtrArray *(*McpInternalHandlerGetFiltersFunc) (
+    McpInternalHandler *self);
+
+typedef gboolean (*McpInternalHandlerHandleChannelFunc) (
+    McpInternalHandler *self,
+    const gchar *account_path,
+    TpChannel *channel);
+
+GPtrArray *mcp_internal_handler_get_filters (McpInternalHandler *self);
+
+gboolean mcp_internal_handler_handle_channel (McpInternalHandler *self,
+    const gchar *account_path,
+    TpChannel *channel);
+
+struct _McpInternalHandlerIface {
+    GTypeInterface parent;
+
+    McpInternalHandlerGetFiltersFunc get_filters;
+    McpInternalHandlerHandleChannelFunc handle_channel;
+};
+
+G_END_DECLS
+
+#endif
@@ -32,6 +32,7 @@
 #include <mission-control-plugins/account-storage.h>
 #include <mission-control-plugins/dispatch-operation.h>
 #include <mission-control-plugins/dispatch-operation-policy.h>
+#include <mission-control-plugins/internal-handler.h>
 #include <mission-control-plugins/loader.h>
 #include <mission-control-plugins/request.h>
 #include <mission-control-plugins/request-policy.h>
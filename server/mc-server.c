@@ -41,6 +41,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-service.h"
+#include "mcd-trace.h"
 
 static TpDebugSender *debug_sender;
 static McdService *mcd = NULL;
@@ -108,6 +109,13 @@ quit_event_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     return FALSE;
 }
 
+static gboolean
+dump_trace_cb (gpointer user_data)
+{
+    mcd_trace_dump ();
+    return G_SOURCE_CONTINUE;
+}
+
 static void
 init_quit_pipe (void)
 {
@@ -188,6 +196,9 @@ main (int argc, char **argv)
     act.sa_mask    = empty_mask;
     act.sa_flags   = 0;
     sigaction (SIGINT, &act, NULL);
+
+    /* "kill -USR1" logs the recent dispatcher events */
+    g_unix_signal_add (SIGUSR1, dump_trace_cb, NULL);
 #endif
 
     /* connect */
@@ -26,6 +26,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include "channel-utils.h"
 
 #include <telepathy-glib/telepathy-glib.h>
@@ -21,11 +21,14 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_CLIENT_REGISTRY
+
 #include "client-registry.h"
 
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-debug.h"
+#include "mcd-memory.h"
 
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib.h>
@@ -530,6 +533,13 @@ mcd_client_registry_gone_cb (McdClientProxy *client,
   _mcd_client_registry_remove (self, tp_proxy_get_bus_name (client));
 }
 
+/*
+ * _mcd_client_registry_dup_client_caps:
+ *
+ * Returns: (transfer container): every client's entry for
+ *  UpdateCapabilities, borrowed from the clients, so only valid until
+ *  control returns to the main loop
+ */
 GPtrArray *
 _mcd_client_registry_dup_client_caps (McdClientRegistry *self)
 {
@@ -546,7 +556,7 @@ _mcd_client_registry_dup_client_caps (McdClientRegistry *self)
   while (g_hash_table_iter_next (&iter, NULL, &p))
     {
       g_ptr_array_add (vas,
-          _mcd_client_proxy_dup_handler_capabilities (p));
+          _mcd_client_proxy_get_handler_capabilities (p));
     }
 
   return vas;
@@ -718,3 +728,21 @@ _mcd_client_registry_get_dbus_daemon (McdClientRegistry *self)
     g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
     return self->priv->dbus_daemon;
 }
+
+void
+_mcd_client_registry_add_memory_report (McdClientRegistry *self,
+                                        GVariantBuilder *report,
+                                        guint depth)
+{
+  GHashTableIter iter;
+  gpointer v;
+
+  mcd_memory_report_add (report, depth, self, NULL,
+      mcd_memory_instance_size (self) + sizeof (McdClientRegistryPrivate) +
+      mcd_memory_string_hash_table_size (self->priv->clients, FALSE));
+
+  g_hash_table_iter_init (&iter, self->priv->clients);
+
+  while (g_hash_table_iter_next (&iter, NULL, &v))
+    _mcd_client_proxy_add_memory_report (v, report, depth + 1);
+}
@@ -85,6 +85,9 @@ G_GNUC_INTERNAL GList *_mcd_client_registry_list_possible_handlers (
     GVariant *request_props, TpChannel *channel,
     const gchar *must_have_unique_name);
 
+G_GNUC_INTERNAL void _mcd_client_registry_add_memory_report (
+    McdClientRegistry *self, GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 
 #endif
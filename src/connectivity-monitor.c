@@ -23,6 +23,9 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_CONNECTIVITY
+
 #include "connectivity-monitor.h"
 
 #include <errno.h>
@@ -38,6 +41,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-debug.h"
+#include "mcd-timeout.h"
 
 #define LOGIN1_BUS_NAME "org.freedesktop.login1"
 #define LOGIN1_MANAGER_OBJECT_PATH "/org/freedesktop/login1"
@@ -46,6 +50,13 @@
 #define LOGIN1_MANAGER_PREPARE_FOR_SHUTDOWN "PrepareForShutdown"
 #define LOGIN1_MANAGER_INHIBIT "Inhibit"
 
+/* Network connectivity must have been lost for this long (in milliseconds)
+ * before we disconnect accounts, and regained for this long before we
+ * reconnect them; overridden by $MC_CONNECTIVITY_OFFLINE_GRACE and
+ * $MC_CONNECTIVITY_ONLINE_SETTLE. Suspend and shutdown are never delayed. */
+#define OFFLINE_GRACE_PERIOD 3000
+#define ONLINE_SETTLE_TIME 1000
+
 struct _McdInhibit {
     /* The number of reasons why we should delay sleep/shutdown. This behaves
      * like a refcount: when it reaches 0, we close the fd and free the
@@ -99,6 +110,18 @@ struct _McdConnectivityMonitorPrivate {
 
   Connectivity connectivity;
   gboolean use_conn;
+
+  /* What we last told the accounts via ::state-change; this lags behind
+   * is_connected (connectivity) while damping_timeout is pending */
+  gboolean reported_online;
+  guint damping_timeout;
+  guint offline_grace_period;
+  guint online_settle_time;
+
+  /* the number of times connectivity came back within the grace period,
+   * and was lost again within the settle time, respectively */
+  guint offline_blips;
+  guint online_blips;
 };
 
 enum {
@@ -125,6 +148,91 @@ is_connected (Connectivity connectivity)
       (connectivity & CONNECTIVITY_RUNNING));
 }
 
+static void
+connectivity_monitor_report (McdConnectivityMonitor *self,
+    gboolean online,
+    McdInhibit *inhibit)
+{
+  McdConnectivityMonitorPrivate *priv = self->priv;
+
+  if (priv->damping_timeout != 0)
+    {
+      mcd_timeout_remove (priv->damping_timeout);
+      priv->damping_timeout = 0;
+    }
+
+  if (priv->reported_online == online)
+    return;
+
+  priv->reported_online = online;
+  DEBUG ("%s", online ? "connected" : "disconnected");
+  g_signal_emit (self, signals[STATE_CHANGE], 0, online, inhibit);
+}
+
+static gboolean
+connectivity_monitor_damping_timeout_cb (gpointer user_data)
+{
+  McdConnectivityMonitor *self = MCD_CONNECTIVITY_MONITOR (user_data);
+
+  self->priv->damping_timeout = 0;
+  DEBUG ("connectivity has settled");
+  connectivity_monitor_report (self, is_connected (self->priv->connectivity),
+      NULL);
+  return FALSE;
+}
+
+/*
+ * Wi-Fi roaming and similar can make the network go away for less than a
+ * second. Rather than disconnecting and reconnecting every account each
+ * time, only report that we are offline if it lasts for the grace period,
+ * and that we are online if it lasts for the settle time.
+ */
+static void
+connectivity_monitor_damp (McdConnectivityMonitor *self,
+    gboolean online,
+    McdInhibit *inhibit)
+{
+  McdConnectivityMonitorPrivate *priv = self->priv;
+  guint delay;
+
+  if (online == priv->reported_online)
+    {
+      if (priv->damping_timeout != 0)
+        {
+          mcd_timeout_remove (priv->damping_timeout);
+          priv->damping_timeout = 0;
+
+          if (online)
+            priv->offline_blips++;
+          else
+            priv->online_blips++;
+
+          DEBUG ("ignoring short %s period (%u offline and %u online so far)",
+              online ? "offline" : "online", priv->offline_blips,
+              priv->online_blips);
+        }
+
+      return;
+    }
+
+  delay = online ? priv->online_settle_time : priv->offline_grace_period;
+
+  if (delay == 0)
+    {
+      connectivity_monitor_report (self, online, inhibit);
+      return;
+    }
+
+  DEBUG ("%s; waiting %ums before reporting it",
+      online ? "connected" : "disconnected", delay);
+
+  if (priv->damping_timeout != 0)
+    mcd_timeout_remove (priv->damping_timeout);
+
+  priv->damping_timeout = mcd_timeout_add (delay,
+      connectivity_monitor_damping_timeout_cb, self);
+}
+
 static void
 connectivity_monitor_change_states (
     McdConnectivityMonitor *self,
@@ -136,6 +244,7 @@ connectivity_monitor_change_states (
   Connectivity connectivity = ((priv->connectivity | set) & (~clear));
   gboolean old_total = is_connected (priv->connectivity);
   gboolean new_total = is_connected (connectivity);
+  Connectivity lost = (priv->connectivity & ~connectivity);
 
   if (priv->connectivity == connectivity)
     return;
@@ -152,12 +261,13 @@ connectivity_monitor_change_states (
 
   priv->connectivity = connectivity;
 
-  if (old_total != new_total)
-    {
-      DEBUG ("%s", new_total ? "connected" : "disconnected");
-      g_signal_emit (self, signals[STATE_CHANGE], 0, new_total,
-          inhibit);
-    }
+  /* We must disconnect before suspend or shutdown proceeds, so no delay
+   * then; not even if the network had already gone and we were waiting
+   * out the grace period, in which case old_total == new_total. */
+  if (lost & (CONNECTIVITY_AWAKE | CONNECTIVITY_RUNNING))
+    connectivity_monitor_report (self, FALSE, inhibit);
+  else if (old_total != new_total)
+    connectivity_monitor_damp (self, new_total, inhibit);
 }
 
 /* Calling this function makes us "more online" or has no effect */
@@ -449,6 +559,18 @@ got_system_bus_cb (GObject *source G_GNUC_UNUSED,
   g_object_unref (self);
 }
 
+static guint
+get_delay_from_env (const gchar *variable,
+    guint default_value)
+{
+  const gchar *from_env = g_getenv (variable);
+
+  if (from_env != NULL)
+    return (guint) g_ascii_strtoull (from_env, NULL, 10);
+
+  return default_value;
+}
+
 static void
 mcd_connectivity_monitor_init (McdConnectivityMonitor *connectivity_monitor)
 {
@@ -463,6 +585,11 @@ mcd_connectivity_monitor_init (McdConnectivityMonitor *connectivity_monitor)
   /* Initially, assume everything is good. */
   priv->connectivity = CONNECTIVITY_AWAKE | CONNECTIVITY_STABLE |
     CONNECTIVITY_UP | CONNECTIVITY_RUNNING;
+  priv->reported_online = TRUE;
+  priv->offline_grace_period = get_delay_from_env (
+      "MC_CONNECTIVITY_OFFLINE_GRACE", OFFLINE_GRACE_PERIOD);
+  priv->online_settle_time = get_delay_from_env (
+      "MC_CONNECTIVITY_ONLINE_SETTLE", ONLINE_SETTLE_TIME);
 
   priv->network_monitor = g_network_monitor_get_default ();
 
@@ -501,6 +628,10 @@ mcd_connectivity_monitor_init (McdConnectivityMonitor *connectivity_monitor)
   }
 #endif
 
+  /* there is nothing to damp yet: start from what we actually know */
+  connectivity_monitor_report (connectivity_monitor,
+      is_connected (priv->connectivity), NULL);
+
   g_bus_get (G_BUS_TYPE_SYSTEM, NULL, got_system_bus_cb,
       g_object_ref (connectivity_monitor));
 }
@@ -552,6 +683,12 @@ connectivity_monitor_dispose (GObject *object)
 {
   McdConnectivityMonitor *self = MCD_CONNECTIVITY_MONITOR (object);
 
+  if (self->priv->damping_timeout != 0)
+    {
+      mcd_timeout_remove (self->priv->damping_timeout);
+      self->priv->damping_timeout = 0;
+    }
+
   g_clear_object (&self->priv->network_monitor);
 
 #ifdef ENABLE_CONN_SETTING
@@ -677,7 +814,29 @@ mcd_connectivity_monitor_is_online (McdConnectivityMonitor *connectivity_monitor
 {
   McdConnectivityMonitorPrivate *priv = connectivity_monitor->priv;
 
-  return is_connected (priv->connectivity);
+  return priv->reported_online;
+}
+
+/*
+ * mcd_connectivity_monitor_get_flap_counts:
+ * @offline_blips: (out) (allow-none): the number of times connectivity was
+ *  lost for less than the grace period, so accounts stayed connected
+ * @online_blips: (out) (allow-none): the number of times connectivity came
+ *  back for less than the settle time, so accounts stayed disconnected
+ */
+void
+mcd_connectivity_monitor_get_flap_counts (
+    McdConnectivityMonitor *connectivity_monitor,
+    guint *offline_blips,
+    guint *online_blips)
+{
+  McdConnectivityMonitorPrivate *priv = connectivity_monitor->priv;
+
+  if (offline_blips != NULL)
+    *offline_blips = priv->offline_blips;
+
+  if (online_blips != NULL)
+    *online_blips = priv->online_blips;
 }
 
 gboolean
@@ -63,6 +63,9 @@ GType mcd_connectivity_monitor_get_type (void);
 McdConnectivityMonitor *mcd_connectivity_monitor_new (void);
 
 gboolean mcd_connectivity_monitor_is_online (McdConnectivityMonitor *connectivity);
+void mcd_connectivity_monitor_get_flap_counts (
+    McdConnectivityMonitor *connectivity, guint *offline_blips,
+    guint *online_blips);
 
 gboolean mcd_connectivity_monitor_get_use_conn (McdConnectivityMonitor *connectivity);
 void mcd_connectivity_monitor_set_use_conn (McdConnectivityMonitor *connectivity,
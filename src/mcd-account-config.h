@@ -51,6 +51,12 @@
 /* obsoleted by MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE */
 #define MC_ACCOUNTS_KEY_AUTO_PRESENCE_TYPE "AutomaticPresenceType"
 
+/* signed 32-bit integer, 'i' */
+#define MC_ACCOUNTS_KEY_CONNECTION_PRIORITY "ConnectionPriority"
+
+/* signed 64-bit integer, 'x': seconds since the Unix epoch */
+#define MC_ACCOUNTS_KEY_LAST_USED "LastUsed"
+
 /* boolean, 'b' */
 #define MC_ACCOUNTS_KEY_ALWAYS_DISPATCH "always_dispatch"
 #define MC_ACCOUNTS_KEY_CONNECT_AUTOMATICALLY "ConnectAutomatically"
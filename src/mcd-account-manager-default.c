@@ -21,83 +21,1139 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_STORAGE
+
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <glib/gstdio.h>
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-account-manager-default.h"
+#include "mcd-debug.h"
+#include "mcd-storage.h"
+#include "mcd-misc.h"
+#include "mcd-timeout.h"
+
+#define PLUGIN_NAME "default"
+#define PLUGIN_PRIORITY MCP_ACCOUNT_STORAGE_PLUGIN_PRIO_DEFAULT
+#define PLUGIN_DESCRIPTION "Default account storage backend"
+
+/*
+ * A dictionary of type a{sv} or a{ss}, stored as an immutable serialized
+ * GVariant sorted by key, so that lookups are binary searches and the same
+ * bytes are shared by every value looked up from it, plus a table of the
+ * keys that have changed since then.
+ */
+typedef struct {
+    /* NULL, or an immutable dictionary, sorted by key with no duplicates */
+    GVariant *base;
+    /* NULL, or owned string => owned GVariant (or NULL if removed),
+     * overriding @base; for a{sv} the values are not boxed in variants */
+    GHashTable *overlay;
+} McdDefaultDict;
+
+typedef struct {
+    /* Attributes to be stored in the variant-file. The base is the
+     * whole file, so it includes the reserved keys Parameters and
+     * KeyFileParameters */
+    McdDefaultDict attributes;
+    /* parameters (without "param-") of known type, a{sv}; the base
+     * is the file's Parameters, if that was valid and sorted */
+    McdDefaultDict parameters;
+    /* parameters (without "param-") of unknown type, a{ss}, with values
+     * escaped as for a keyfile; the base is the file's KeyFileParameters */
+    McdDefaultDict untyped_parameters;
+    /* TRUE if the account doesn't really exist, but is here to stop us
+     * loading it from a lower-priority file */
+    gboolean absent;
+    /* TRUE if this account needs saving */
+    gboolean dirty;
+} McdDefaultStoredAccount;
+
+static GVariant *
+variant_ref0 (GVariant *v)
+{
+  return (v == NULL ? NULL : g_variant_ref (v));
+}
+
+static void
+variant_unref0 (gpointer v)
+{
+  if (v != NULL)
+    g_variant_unref (v);
+}
+
+static gboolean
+is_reserved_attribute (const gchar *attribute)
+{
+  return (!tp_strdiff (attribute, "Parameters") ||
+      !tp_strdiff (attribute, "KeyFileParameters"));
+}
+
+/* Return the key of a dict entry, valid as long as @entry is */
+static const gchar *
+entry_key (GVariant *entry)
+{
+  const gchar *key;
+
+  g_variant_get_child (entry, 0, "&s", &key);
+  return key;
+}
+
+/* Return the value of a dict entry, unboxed if it is a variant */
+static GVariant *
+entry_value (GVariant *entry)
+{
+  GVariant *value = g_variant_get_child_value (entry, 1);
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_VARIANT))
+    {
+      GVariant *inner = g_variant_get_variant (value);
+
+      g_variant_unref (value);
+      return inner;
+    }
+
+  return value;
+}
+
+static gint
+compare_entries (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (entry_key (*(GVariant * const *) a),
+      entry_key (*(GVariant * const *) b));
+}
+
+/*
+ * Return @dict (a dictionary, in serialized form) if it is already sorted
+ * by key with no duplicates, or a sorted copy in which the last of any
+ * duplicates wins, as it would in a GHashTable.
+ */
+static GVariant *
+sorted_dict_new (GVariant *dict)
+{
+  gsize n = g_variant_n_children (dict);
+  GPtrArray *entries = g_ptr_array_sized_new (n);
+  GVariant *ret;
+  gboolean sorted = TRUE;
+  gsize i, j;
+
+  for (i = 0; i < n; i++)
+    {
+      g_ptr_array_add (entries, g_variant_get_child_value (dict, i));
+
+      if (i > 0 && compare_entries (&entries->pdata[i - 1],
+            &entries->pdata[i]) >= 0)
+        sorted = FALSE;
+    }
+
+  if (sorted)
+    {
+      g_ptr_array_foreach (entries, (GFunc) g_variant_unref, NULL);
+      g_ptr_array_unref (entries);
+      return g_variant_ref (dict);
+    }
+
+  /* this is a stable sort, so duplicates stay in their original order */
+  g_ptr_array_sort (entries, compare_entries);
+
+  for (i = 0, j = 0; i < entries->len; i++)
+    {
+      if (i + 1 < entries->len && compare_entries (&entries->pdata[i],
+            &entries->pdata[i + 1]) == 0)
+        {
+          g_variant_unref (entries->pdata[i]);
+          continue;
+        }
+
+      entries->pdata[j++] = entries->pdata[i];
+    }
+
+  g_ptr_array_set_size (entries, j);
+  ret = g_variant_ref_sink (g_variant_new_array (
+        g_variant_type_element (g_variant_get_type (dict)),
+        (GVariant * const *) entries->pdata, entries->len));
+  g_ptr_array_foreach (entries, (GFunc) g_variant_unref, NULL);
+  g_ptr_array_unref (entries);
+
+  /* serialize it now, so that it is one block of memory rather than a
+   * tree of GVariants */
+  g_variant_get_data (ret);
+  return ret;
+}
+
+/* Binary-search a sorted dictionary; return a new ref to the (unboxed)
+ * value, or NULL */
+static GVariant *
+sorted_dict_lookup (GVariant *dict,
+    const gchar *key)
+{
+  gsize lo = 0;
+  gsize hi;
+
+  if (dict == NULL)
+    return NULL;
+
+  hi = g_variant_n_children (dict);
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      GVariant *entry = g_variant_get_child_value (dict, mid);
+      gint cmp = strcmp (key, entry_key (entry));
+
+      if (cmp == 0)
+        {
+          GVariant *value = entry_value (entry);
+
+          g_variant_unref (entry);
+          return value;
+        }
+
+      g_variant_unref (entry);
+
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+/* Replace the contents of @dict with @base, discarding any changes */
+static void
+mcd_default_dict_set_base (McdDefaultDict *dict,
+    GVariant *base)
+{
+  GVariant *old = dict->base;
+
+  dict->base = (base == NULL ? NULL : sorted_dict_new (base));
+  tp_clear_pointer (&old, g_variant_unref);
+  tp_clear_pointer (&dict->overlay, g_hash_table_unref);
+}
+
+static void
+mcd_default_dict_clear (McdDefaultDict *dict)
+{
+  mcd_default_dict_set_base (dict, NULL);
+}
+
+/* Return a new ref to the value for @key, or NULL */
+static GVariant *
+mcd_default_dict_lookup (McdDefaultDict *dict,
+    const gchar *key)
+{
+  gpointer v;
+
+  if (dict->overlay != NULL &&
+      g_hash_table_lookup_extended (dict->overlay, key, NULL, &v))
+    return variant_ref0 (v);
+
+  return sorted_dict_lookup (dict->base, key);
+}
+
+/* Set @key to @value, without checking whether it has changed */
+static void
+mcd_default_dict_replace (McdDefaultDict *dict,
+    const gchar *key,
+    GVariant *value)
+{
+  if (dict->overlay == NULL)
+    dict->overlay = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        variant_unref0);
+
+  if (value == NULL)
+    {
+      /* only remember the removal if there is something to remove */
+      GVariant *old = sorted_dict_lookup (dict->base, key);
+
+      if (old == NULL)
+        {
+          g_hash_table_remove (dict->overlay, key);
+        }
+      else
+        {
+          g_hash_table_insert (dict->overlay, g_strdup (key), NULL);
+          g_variant_unref (old);
+        }
+    }
+  else
+    {
+      g_hash_table_insert (dict->overlay, g_strdup (key),
+          g_variant_ref (value));
+    }
+}
+
+/* Set @key to @value, or remove it if @value is NULL; return TRUE if
+ * that changed anything */
+static gboolean
+mcd_default_dict_set (McdDefaultDict *dict,
+    const gchar *key,
+    GVariant *value)
+{
+  GVariant *old = mcd_default_dict_lookup (dict, key);
+  gboolean changed;
+
+  if (old == NULL)
+    changed = (value != NULL);
+  else
+    changed = (value == NULL || !g_variant_equal (old, value));
+
+  tp_clear_pointer (&old, g_variant_unref);
+
+  if (changed)
+    mcd_default_dict_replace (dict, key, value);
+
+  return changed;
+}
+
+static gint
+compare_strings (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+typedef void (*McdDefaultDictFunc) (const gchar *key,
+    GVariant *value,
+    gpointer user_data);
+
+/* Call @func for each key, in sorted order, with its (unboxed) value */
+static void
+mcd_default_dict_foreach (McdDefaultDict *dict,
+    McdDefaultDictFunc func,
+    gpointer user_data)
+{
+  gsize n_base = (dict->base == NULL ? 0 : g_variant_n_children (dict->base));
+  guint n_changed = 0;
+  const gchar **changed = NULL;
+  gsize i = 0;
+  guint j = 0;
+
+  if (dict->overlay != NULL)
+    {
+      changed = (const gchar **) g_hash_table_get_keys_as_array (
+          dict->overlay, &n_changed);
+      qsort (changed, n_changed, sizeof (gchar *), compare_strings);
+    }
+
+  while (i < n_base || j < n_changed)
+    {
+      GVariant *entry = NULL;
+      gint cmp;
+
+      if (i < n_base)
+        entry = g_variant_get_child_value (dict->base, i);
+
+      if (entry == NULL)
+        cmp = 1;
+      else if (j >= n_changed)
+        cmp = -1;
+      else
+        cmp = strcmp (entry_key (entry), changed[j]);
+
+      if (cmp < 0)
+        {
+          GVariant *value = entry_value (entry);
+
+          func (entry_key (entry), value, user_data);
+          g_variant_unref (value);
+          i++;
+        }
+      else
+        {
+          GVariant *value = g_hash_table_lookup (dict->overlay, changed[j]);
+
+          if (value != NULL)
+            func (changed[j], value, user_data);
+
+          /* the overlay replaces the base entry, if any */
+          if (cmp == 0)
+            i++;
+
+          j++;
+        }
+
+      tp_clear_pointer (&entry, g_variant_unref);
+    }
+
+  g_free (changed);
+}
+
+static void
+add_key_cb (const gchar *key,
+    GVariant *value G_GNUC_UNUSED,
+    gpointer user_data)
+{
+  g_ptr_array_add (user_data, g_strdup (key));
+}
+
+static gchar **
+mcd_default_dict_dup_keys (McdDefaultDict *dict)
+{
+  GPtrArray *arr = g_ptr_array_new ();
+
+  mcd_default_dict_foreach (dict, add_key_cb, arr);
+  g_ptr_array_add (arr, NULL);
+  return (gchar **) g_ptr_array_free (arr, FALSE);
+}
+
+static void
+add_entry_cb (const gchar *key,
+    GVariant *value,
+    gpointer user_data)
+{
+  GVariantBuilder *builder = user_data;
+
+  if (g_variant_type_equal (g_variant_builder_get_type (builder),
+        G_VARIANT_TYPE_VARDICT))
+    value = g_variant_new_variant (value);
+
+  g_variant_builder_add_value (builder,
+      g_variant_new_dict_entry (g_variant_new_string (key), value));
+}
+
+/* Return a new ref to a dictionary of type @type with the current
+ * contents, sorted by key */
+static GVariant *
+mcd_default_dict_build (McdDefaultDict *dict,
+    const GVariantType *type)
+{
+  GVariantBuilder builder;
+
+  if (dict->overlay == NULL && dict->base != NULL &&
+      g_variant_is_of_type (dict->base, type))
+    return g_variant_ref (dict->base);
+
+  g_variant_builder_init (&builder, type);
+  mcd_default_dict_foreach (dict, add_entry_cb, &builder);
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static McdDefaultStoredAccount *
+lookup_stored_account (McdAccountManagerDefault *self,
+    const gchar *account)
+{
+  return g_hash_table_lookup (self->accounts, account);
+}
+
+static McdDefaultStoredAccount *
+ensure_stored_account (McdAccountManagerDefault *self,
+    const gchar *account)
+{
+  McdDefaultStoredAccount *sa = lookup_stored_account (self, account);
+
+  if (sa == NULL)
+    {
+      sa = g_slice_new0 (McdDefaultStoredAccount);
+      g_hash_table_insert (self->accounts, g_strdup (account), sa);
+    }
+
+  sa->absent = FALSE;
+  return sa;
+}
+
+/*
+ * Replace @sa's contents with @contents, the a{sv} that would be (or was)
+ * saved in its variant-file, discarding any changes. @source is used in
+ * warnings.
+ */
+static void
+stored_account_set_contents (McdDefaultStoredAccount *sa,
+    GVariant *contents,
+    const gchar *source)
+{
+  GVariant *v;
+
+  /* One block of memory for the whole account: sorted_dict_new() would
+   * do this anyway if it needed to sort, but a parsed or built GVariant
+   * starts out as a tree */
+  g_variant_get_data (contents);
+  mcd_default_dict_set_base (&sa->attributes, contents);
+
+  v = sorted_dict_lookup (sa->attributes.base, "Parameters");
+
+  if (v != NULL && !g_variant_is_of_type (v, G_VARIANT_TYPE_VARDICT))
+    {
+      gchar *repr = g_variant_print (v, TRUE);
+
+      WARNING ("invalid Parameters found in %s, ignoring: %s", source, repr);
+      g_free (repr);
+      tp_clear_pointer (&v, g_variant_unref);
+    }
+
+  mcd_default_dict_set_base (&sa->parameters, v);
+  tp_clear_pointer (&v, g_variant_unref);
+
+  v = sorted_dict_lookup (sa->attributes.base, "KeyFileParameters");
+
+  if (v != NULL && !g_variant_is_of_type (v, G_VARIANT_TYPE ("a{ss}")))
+    {
+      gchar *repr = g_variant_print (v, TRUE);
+
+      WARNING ("invalid KeyFileParameters found in %s, ignoring: %s",
+          source, repr);
+      g_free (repr);
+      tp_clear_pointer (&v, g_variant_unref);
+    }
+
+  mcd_default_dict_set_base (&sa->untyped_parameters, v);
+  tp_clear_pointer (&v, g_variant_unref);
+}
+
+static void
+stored_account_free (gpointer p)
+{
+  McdDefaultStoredAccount *sa = p;
+
+  mcd_default_dict_clear (&sa->attributes);
+  mcd_default_dict_clear (&sa->parameters);
+  mcd_default_dict_clear (&sa->untyped_parameters);
+  g_slice_free (McdDefaultStoredAccount, sa);
+}
+
+/*
+ * Incremental loading.
+ *
+ * The manifest records, for each .account file we have read or written,
+ * its mtime, size, SHA-256 and parsed contents (sorted and serialized, as
+ * in McdDefaultStoredAccount). It is saved in binary GVariant form in the
+ * cache directory, and mapped into memory on the next startup, so that
+ * files whose mtime and size have not changed are neither read nor parsed:
+ * their accounts are backed directly by the mapped cache. Files whose
+ * timestamp changed are read and hashed, but only parsed if their contents
+ * changed too.
+ *
+ * While MC is running, the user's account directory is watched for
+ * changes by other processes; each changed file is re-read on its own.
+ */
+
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(ua{s(xtsa{sv})})"
+#define MANIFEST_TYPE "a{s(xtsa{sv})}"
+/* how long to wait after a change before rewriting the cache */
+#define CACHE_WRITE_DELAY_SECONDS 5
+
+struct _McdAccountManagerDefaultCache {
+    gchar *path;
+    /* full filename => (mtime or -1, size, SHA-256, contents) */
+    McdDefaultDict manifest;
+    /* while loading, the manifest from the cache file, or NULL; the new
+     * manifest is built from scratch, so that files that have gone away
+     * are dropped */
+    GVariant *previous;
+    /* TRUE if @manifest differs from the cache file */
+    gboolean dirty;
+    /* mcd_timeout_add_seconds() ID for writing the cache, or 0 */
+    guint timeout;
+    GFileMonitor *monitor;
+};
+
+static McdAccountManagerDefaultCache *
+am_default_cache_new (void)
+{
+  const gchar *from_env = g_getenv ("MC_ACCOUNT_CACHE_PATH");
+  McdAccountManagerDefaultCache *cache;
+
+  /* an empty path disables incremental loading */
+  if (from_env != NULL && from_env[0] == '\0')
+    return NULL;
+
+  cache = g_slice_new0 (McdAccountManagerDefaultCache);
+
+  if (from_env != NULL)
+    cache->path = g_strdup (from_env);
+  else
+    cache->path = g_build_filename (g_get_user_cache_dir (), "telepathy",
+        "mission-control", "accounts.cache", NULL);
+
+  return cache;
+}
+
+static void
+am_default_read_cache (McdAccountManagerDefault *self)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+  GMappedFile *mapped;
+  GBytes *bytes;
+  GVariant *contents;
+  guint32 version;
+  GError *error = NULL;
+
+  mapped = g_mapped_file_new (cache->path, FALSE, &error);
+
+  if (mapped == NULL)
+    {
+      DEBUG ("No cached accounts: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+  /* untrusted, so GVariant will check it as it is read */
+  contents = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (contents, 0, "u", &version);
+
+  if (version == CACHE_VERSION)
+    {
+      GVariant *manifest = g_variant_get_child_value (contents, 1);
+
+      /* anyone could have written it, so do not assume that it is sorted,
+       * which sorted_dict_lookup() relies on */
+      cache->previous = sorted_dict_new (manifest);
+      g_variant_unref (manifest);
+      DEBUG ("%" G_GSIZE_FORMAT " account files cached in %s",
+          g_variant_n_children (cache->previous), cache->path);
+    }
+  else
+    {
+      DEBUG ("Ignoring %s: unknown version %u", cache->path, version);
+    }
+
+  g_variant_unref (contents);
+}
+
+static gboolean
+am_default_write_cache (McdAccountManagerDefault *self)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+  GVariant *manifest;
+  GVariant *contents;
+  gchar *dir;
+  GError *error = NULL;
+  gboolean ret;
+
+  if (!cache->dirty)
+    return TRUE;
+
+  manifest = mcd_default_dict_build (&cache->manifest,
+      G_VARIANT_TYPE (MANIFEST_TYPE));
+  contents = g_variant_ref_sink (g_variant_new ("(u@" MANIFEST_TYPE ")",
+        CACHE_VERSION, manifest));
+
+  dir = g_path_get_dirname (cache->path);
+  ret = (mcd_ensure_directory (dir, &error) &&
+      g_file_set_contents (cache->path, g_variant_get_data (contents),
+        g_variant_get_size (contents), &error));
+
+  if (ret)
+    {
+      GVariant *written;
+
+      /* it contains every account's parameters, including passwords */
+      _mcd_chmod_private (cache->path);
+
+      DEBUG ("Cached %" G_GSIZE_FORMAT " account files in %s",
+          g_variant_n_children (manifest), cache->path);
+      cache->dirty = FALSE;
+
+      /* what we wrote is now the whole manifest; take it from the
+       * serialized cache, which is one block of memory */
+      written = g_variant_get_child_value (contents, 1);
+      mcd_default_dict_set_base (&cache->manifest, written);
+      g_variant_unref (written);
+    }
+  else
+    {
+      WARNING ("Unable to save account cache to %s: %s", cache->path,
+          error->message);
+      g_error_free (error);
+    }
+
+  g_variant_unref (manifest);
+  g_variant_unref (contents);
+  g_free (dir);
+  return ret;
+}
+
+static gboolean
+write_cache_cb (gpointer user_data)
+{
+  McdAccountManagerDefault *self = user_data;
+
+  self->cache->timeout = 0;
+  am_default_write_cache (self);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+am_default_schedule_cache_write (McdAccountManagerDefault *self)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+
+  cache->dirty = TRUE;
+
+  /* not while loading: that writes it once at the end, if necessary */
+  if (cache->timeout == 0 && cache->previous == NULL && self->loaded)
+    cache->timeout = mcd_timeout_add_seconds (CACHE_WRITE_DELAY_SECONDS,
+        write_cache_cb, self);
+}
+
+/* Return a new ref to the manifest entry for @full_name, or NULL */
+static GVariant *
+am_default_lookup_file (McdAccountManagerDefault *self,
+    const gchar *full_name)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+
+  if (cache->previous != NULL)
+    return sorted_dict_lookup (cache->previous, full_name);
+
+  return mcd_default_dict_lookup (&cache->manifest, full_name);
+}
+
+static void
+am_default_record_file (McdAccountManagerDefault *self,
+    const gchar *full_name,
+    const GStatBuf *st,
+    const gchar *hash,
+    GVariant *contents)
+{
+  gint64 mtime = st->st_mtime;
+  GVariant *entry;
+
+  /* If the file was written in the last second, it could be written
+   * again without changing its mtime or size, so make sure we read and
+   * hash it next time */
+  if (mtime >= g_get_real_time () / G_USEC_PER_SEC - 1)
+    mtime = -1;
+
+  entry = g_variant_ref_sink (g_variant_new ("(xts@a{sv})", mtime,
+        (guint64) st->st_size, hash, contents));
+  mcd_default_dict_replace (&self->cache->manifest, full_name, entry);
+  g_variant_unref (entry);
+
+  am_default_schedule_cache_write (self);
+}
+
+static void
+am_default_forget_file (McdAccountManagerDefault *self,
+    const gchar *full_name)
+{
+  GVariant *entry;
+
+  if (self->cache == NULL)
+    return;
+
+  entry = am_default_lookup_file (self, full_name);
+
+  if (entry != NULL)
+    {
+      mcd_default_dict_replace (&self->cache->manifest, full_name, NULL);
+      am_default_schedule_cache_write (self);
+      g_variant_unref (entry);
+    }
+}
+
+/*
+ * Read an account from @full_name, using the manifest if possible.
+ *
+ * Returns: the account's contents, sorted by key, or %NULL if the file
+ *  could not be read or parsed, or is empty, in which case @masked is
+ *  set to %TRUE
+ */
+static GVariant *
+am_default_read_account_file (McdAccountManagerDefault *self,
+    const gchar *account_tail,
+    const gchar *full_name,
+    gboolean *masked,
+    gboolean *unchanged)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+  GVariant *entry = NULL;
+  GVariant *contents = NULL;
+  GStatBuf st;
+  gchar *text = NULL;
+  gchar *hash = NULL;
+  gsize len;
+  GError *error = NULL;
+
+  *masked = FALSE;
+  *unchanged = FALSE;
+
+  if (cache != NULL)
+    {
+      if (g_stat (full_name, &st) != 0)
+        {
+          int e = errno;
+
+          WARNING ("Unable to read account %s from %s: %s",
+              account_tail, full_name, g_strerror (e));
+          return NULL;
+        }
+
+      entry = am_default_lookup_file (self, full_name);
+
+      if (entry != NULL)
+        {
+          gint64 mtime;
+          guint64 size;
+
+          g_variant_get_child (entry, 0, "x", &mtime);
+          g_variant_get_child (entry, 1, "t", &size);
+
+          if (mtime >= 0 && mtime == st.st_mtime &&
+              size == (guint64) st.st_size)
+            {
+              DEBUG ("%s is unchanged", full_name);
+              contents = g_variant_get_child_value (entry, 3);
+              *unchanged = TRUE;
+
+              /* keep it in the new manifest */
+              if (cache->previous != NULL)
+                mcd_default_dict_replace (&cache->manifest, full_name,
+                    entry);
+
+              goto finally;
+            }
+        }
+    }
+
+  if (!g_file_get_contents (full_name, &text, &len, &error))
+    {
+      WARNING ("Unable to read account %s from %s: %s",
+          account_tail, full_name, error->message);
+      g_error_free (error);
+      goto finally;
+    }
+
+  if (len == 0)
+    {
+      *masked = TRUE;
+      am_default_forget_file (self, full_name);
+      goto finally;
+    }
+
+  if (cache != NULL)
+    {
+      const gchar *old_hash = NULL;
+
+      hash = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+          (const guchar *) text, len);
 
-#include <telepathy-glib/telepathy-glib.h>
+      if (entry != NULL)
+        g_variant_get_child (entry, 2, "&s", &old_hash);
 
-#include "mcd-account-manager-default.h"
-#include "mcd-debug.h"
-#include "mcd-storage.h"
-#include "mcd-misc.h"
+      if (!tp_strdiff (hash, old_hash))
+        {
+          DEBUG ("%s was touched but has not changed", full_name);
+          contents = g_variant_get_child_value (entry, 3);
+          *unchanged = TRUE;
+        }
+    }
 
-#define PLUGIN_NAME "default"
-#define PLUGIN_PRIORITY MCP_ACCOUNT_STORAGE_PLUGIN_PRIO_DEFAULT
-#define PLUGIN_DESCRIPTION "Default account storage backend"
+  if (contents == NULL)
+    {
+      GVariant *parsed = g_variant_parse (G_VARIANT_TYPE_VARDICT,
+          text, text + len, NULL, &error);
 
-typedef struct {
-    /* owned string, attribute => owned GVariant, value
-     * attributes to be stored in the variant-file */
-    GHashTable *attributes;
-    /* owned string, parameter (without "param-") => owned GVariant, value
-     * parameters of known type to be stored in the variant-file */
-    GHashTable *parameters;
-    /* owned string, parameter (without "param-") => owned string, value
-     * parameters of unknwn type to be stored in the variant-file */
-    GHashTable *untyped_parameters;
-    /* TRUE if the account doesn't really exist, but is here to stop us
-     * loading it from a lower-priority file */
-    gboolean absent;
-    /* TRUE if this account needs saving */
-    gboolean dirty;
-} McdDefaultStoredAccount;
+      if (parsed == NULL)
+        {
+          WARNING ("Unable to parse account %s from %s: %s",
+              account_tail, full_name, error->message);
+          g_error_free (error);
+          goto finally;
+        }
 
-static GVariant *
-variant_ref0 (GVariant *v)
+      /* sort and serialize it now, so that the manifest and the stored
+       * account can share it */
+      g_variant_get_data (parsed);
+      contents = sorted_dict_new (parsed);
+      g_variant_unref (parsed);
+    }
+
+  if (cache != NULL)
+    am_default_record_file (self, full_name, &st, hash, contents);
+
+finally:
+  tp_clear_pointer (&entry, g_variant_unref);
+  g_free (hash);
+  g_free (text);
+  return contents;
+}
+
+/*
+ * Emit altered-one for each key whose value differs between the sorted
+ * dictionaries @old and @new, either of which may be %NULL.
+ */
+static void
+am_default_emit_changes (McdAccountManagerDefault *self,
+    const gchar *account,
+    const gchar *prefix,
+    GVariant *old,
+    GVariant *new)
 {
-  return (v == NULL ? NULL : g_variant_ref (v));
+  gsize n_old = (old == NULL ? 0 : g_variant_n_children (old));
+  gsize n_new = (new == NULL ? 0 : g_variant_n_children (new));
+  gsize i = 0;
+  gsize j = 0;
+
+  while (i < n_old || j < n_new)
+    {
+      GVariant *a = (i < n_old ? g_variant_get_child_value (old, i) : NULL);
+      GVariant *b = (j < n_new ? g_variant_get_child_value (new, j) : NULL);
+      const gchar *key;
+      gboolean changed = TRUE;
+      gint cmp;
+
+      if (a == NULL)
+        cmp = 1;
+      else if (b == NULL)
+        cmp = -1;
+      else
+        cmp = strcmp (entry_key (a), entry_key (b));
+
+      if (cmp < 0)
+        {
+          key = entry_key (a);
+          i++;
+        }
+      else if (cmp > 0)
+        {
+          key = entry_key (b);
+          j++;
+        }
+      else
+        {
+          key = entry_key (a);
+          changed = !g_variant_equal (a, b);
+          i++;
+          j++;
+        }
+
+      if (changed && (prefix != NULL || !is_reserved_attribute (key)))
+        {
+          gchar *name = g_strconcat (prefix != NULL ? prefix : "", key,
+              NULL);
+
+          mcp_account_storage_emit_altered_one (MCP_ACCOUNT_STORAGE (self),
+              account, name);
+          g_free (name);
+        }
+
+      tp_clear_pointer (&a, g_variant_unref);
+      tp_clear_pointer (&b, g_variant_unref);
+    }
 }
 
-static McdDefaultStoredAccount *
-lookup_stored_account (McdAccountManagerDefault *self,
-    const gchar *account)
+static gchar *
+account_tail_from_basename (const gchar *basename)
 {
-  return g_hash_table_lookup (self->accounts, account);
+  gchar *account_tail = g_strdup (basename);
+
+  g_strdelimit (account_tail, "-", '/');
+  g_strdelimit (account_tail, ".", '\0');
+  return account_tail;
 }
 
-static McdDefaultStoredAccount *
-ensure_stored_account (McdAccountManagerDefault *self,
-    const gchar *account)
+/* Re-read a file in the user's account directory that another process
+ * has created, changed or deleted */
+static void
+am_default_rescan_file (McdAccountManagerDefault *self,
+    const gchar *basename)
 {
-  McdDefaultStoredAccount *sa = lookup_stored_account (self, account);
+  McpAccountStorage *storage = MCP_ACCOUNT_STORAGE (self);
+  gchar *full_name = g_build_filename (self->directory, basename, NULL);
+  gchar *account_tail = account_tail_from_basename (basename);
+  McdDefaultStoredAccount *sa = lookup_stored_account (self, account_tail);
+  GVariant *contents = NULL;
+  gboolean masked, unchanged;
 
-  if (sa == NULL)
+  if (!g_file_test (full_name, G_FILE_TEST_EXISTS))
     {
-      sa = g_slice_new0 (McdDefaultStoredAccount);
-      sa->attributes = g_hash_table_new_full (g_str_hash, g_str_equal,
-          g_free, (GDestroyNotify) g_variant_unref);
-      sa->parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
-          g_free, (GDestroyNotify) g_variant_unref);
-      sa->untyped_parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
-          g_free, g_free);
-      g_hash_table_insert (self->accounts, g_strdup (account), sa);
+      GVariant *entry = am_default_lookup_file (self, full_name);
+
+      /* If it's not in the manifest, we didn't load the account from it
+       * (and we don't try to find out whether deleting it has revealed an
+       * account in a lower-priority directory) */
+      if (entry == NULL)
+        goto finally;
+
+      g_variant_unref (entry);
+      am_default_forget_file (self, full_name);
+
+      if (sa != NULL && !sa->absent && !sa->dirty)
+        {
+          DEBUG ("%s was deleted: deleting account %s", full_name,
+              account_tail);
+          g_hash_table_remove (self->accounts, account_tail);
+          mcp_account_storage_emit_deleted (storage, account_tail);
+        }
+
+      goto finally;
     }
 
-  sa->absent = FALSE;
-  return sa;
+  if (sa != NULL && sa->dirty)
+    {
+      DEBUG ("Ignoring change to %s: account %s has unsaved changes, "
+          "which will overwrite it", full_name, account_tail);
+      goto finally;
+    }
+
+  contents = am_default_read_account_file (self, account_tail, full_name,
+      &masked, &unchanged);
+
+  if (masked)
+    {
+      if (sa != NULL && !sa->absent)
+        {
+          DEBUG ("%s was emptied: deleting account %s", full_name,
+              account_tail);
+          mcd_default_dict_clear (&sa->attributes);
+          mcd_default_dict_clear (&sa->parameters);
+          mcd_default_dict_clear (&sa->untyped_parameters);
+          sa->absent = TRUE;
+          mcp_account_storage_emit_deleted (storage, account_tail);
+        }
+    }
+  else if (contents == NULL || (unchanged && sa != NULL && !sa->absent))
+    {
+      /* unreadable, or we wrote it ourselves, or it was merely touched */
+    }
+  else if (sa == NULL || sa->absent)
+    {
+      DEBUG ("%s was created: adding account %s", full_name, account_tail);
+      sa = ensure_stored_account (self, account_tail);
+      stored_account_set_contents (sa, contents, full_name);
+      mcp_account_storage_emit_created (storage, account_tail);
+    }
+  else
+    {
+      GVariant *old_attributes = variant_ref0 (sa->attributes.base);
+      GVariant *old_parameters = variant_ref0 (sa->parameters.base);
+      GVariant *old_untyped = variant_ref0 (sa->untyped_parameters.base);
+
+      DEBUG ("%s was changed: reloading account %s", full_name,
+          account_tail);
+      stored_account_set_contents (sa, contents, full_name);
+
+      am_default_emit_changes (self, account_tail, NULL, old_attributes,
+          sa->attributes.base);
+      am_default_emit_changes (self, account_tail, "param-", old_parameters,
+          sa->parameters.base);
+      am_default_emit_changes (self, account_tail, "param-", old_untyped,
+          sa->untyped_parameters.base);
+
+      tp_clear_pointer (&old_attributes, g_variant_unref);
+      tp_clear_pointer (&old_parameters, g_variant_unref);
+      tp_clear_pointer (&old_untyped, g_variant_unref);
+    }
+
+finally:
+  tp_clear_pointer (&contents, g_variant_unref);
+  g_free (account_tail);
+  g_free (full_name);
 }
 
 static void
-stored_account_free (gpointer p)
+monitor_changed_cb (GFileMonitor *monitor,
+    GFile *file,
+    GFile *other_file,
+    GFileMonitorEvent event_type,
+    gpointer user_data)
 {
-  McdDefaultStoredAccount *sa = p;
+  McdAccountManagerDefault *self = user_data;
+  gchar *basename;
 
-  g_hash_table_unref (sa->attributes);
-  g_hash_table_unref (sa->parameters);
-  g_hash_table_unref (sa->untyped_parameters);
-  g_slice_free (McdDefaultStoredAccount, sa);
+  switch (event_type)
+    {
+      case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      case G_FILE_MONITOR_EVENT_CREATED:
+      case G_FILE_MONITOR_EVENT_DELETED:
+        break;
+
+      default:
+        return;
+    }
+
+  basename = g_file_get_basename (file);
+
+  if (g_str_has_suffix (basename, ".account"))
+    am_default_rescan_file (self, basename);
+
+  g_free (basename);
+}
+
+/* Called when the initial list() has finished loading */
+static void
+am_default_finish_loading (McdAccountManagerDefault *self)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+  GFile *directory;
+  GError *error = NULL;
+
+  if (cache == NULL)
+    return;
+
+  if (cache->previous != NULL)
+    {
+      guint n = (cache->manifest.overlay == NULL ? 0 :
+          g_hash_table_size (cache->manifest.overlay));
+
+      /* If every file was unchanged and none have gone away, the new
+       * manifest is the same as the old one, which takes less memory */
+      if (!cache->dirty && n == g_variant_n_children (cache->previous))
+        mcd_default_dict_set_base (&cache->manifest, cache->previous);
+      else
+        cache->dirty = TRUE;
+
+      tp_clear_pointer (&cache->previous, g_variant_unref);
+    }
+
+  if (cache->dirty)
+    am_default_schedule_cache_write (self);
+
+  directory = g_file_new_for_path (self->directory);
+  cache->monitor = g_file_monitor_directory (directory, G_FILE_MONITOR_NONE,
+      NULL, &error);
+  g_object_unref (directory);
+
+  if (cache->monitor == NULL)
+    {
+      DEBUG ("Not watching %s for changes: %s", self->directory,
+          error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_signal_connect (cache->monitor, "changed",
+          G_CALLBACK (monitor_changed_cb), self);
+    }
+}
+
+static void
+am_default_cache_free (McdAccountManagerDefault *self)
+{
+  McdAccountManagerDefaultCache *cache = self->cache;
+
+  if (cache->timeout != 0)
+    mcd_timeout_remove (cache->timeout);
+
+  if (cache->previous == NULL)
+    am_default_write_cache (self);
+
+  if (cache->monitor != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (cache->monitor,
+          monitor_changed_cb, self);
+      g_file_monitor_cancel (cache->monitor);
+      g_object_unref (cache->monitor);
+    }
+
+  mcd_default_dict_clear (&cache->manifest);
+  tp_clear_pointer (&cache->previous, g_variant_unref);
+  g_free (cache->path);
+  g_slice_free (McdAccountManagerDefaultCache, cache);
+  self->cache = NULL;
 }
 
 static void account_storage_iface_init (McpAccountStorageIface *,
@@ -162,12 +1218,31 @@ mcd_account_manager_default_init (McdAccountManagerDefault *self)
   self->accounts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
       stored_account_free);
   self->loaded = FALSE;
+  self->cache = am_default_cache_new ();
+}
+
+static void
+mcd_account_manager_default_finalize (GObject *object)
+{
+  McdAccountManagerDefault *self = MCD_ACCOUNT_MANAGER_DEFAULT (object);
+
+  if (self->cache != NULL)
+    am_default_cache_free (self);
+
+  g_hash_table_unref (self->accounts);
+  g_free (self->directory);
+
+  G_OBJECT_CLASS (mcd_account_manager_default_parent_class)->finalize (
+      object);
 }
 
 static void
 mcd_account_manager_default_class_init (McdAccountManagerDefaultClass *cls)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (cls);
+
   DEBUG ("mcd_account_manager_default_class_init");
+  object_class->finalize = mcd_account_manager_default_finalize;
 }
 
 static McpAccountStorageSetResult
@@ -189,10 +1264,11 @@ set_parameter (McpAccountStorage *self,
     {
       gboolean changed = FALSE;
 
-      changed = g_hash_table_remove (sa->parameters, parameter);
+      changed = mcd_default_dict_set (&sa->parameters, parameter, NULL);
       /* deliberately not ||= - if we removed it from parameters, we
        * still want to remove it from untyped_parameters if it was there */
-      changed |= g_hash_table_remove (sa->untyped_parameters, parameter);
+      changed |= mcd_default_dict_set (&sa->untyped_parameters, parameter,
+          NULL);
 
       if (!changed)
         return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
@@ -201,21 +1277,23 @@ set_parameter (McpAccountStorage *self,
     {
       GVariant *old;
 
-      old = g_hash_table_lookup (sa->parameters, parameter);
+      old = mcd_default_dict_lookup (&sa->parameters, parameter);
 
       if (old != NULL && g_variant_equal (old, val))
         {
+          g_variant_unref (old);
           return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
         }
 
+      tp_clear_pointer (&old, g_variant_unref);
+
       /* We haven't checked whether it's in untyped_parameters with the
        * same value - but if it is, we want to migrate it to parameters
        * anyway (in order to record its type), so treat it as having
        * actually changed. */
 
-      g_hash_table_remove (sa->untyped_parameters, parameter);
-      g_hash_table_insert (sa->parameters, g_strdup (parameter),
-          g_variant_ref (val));
+      mcd_default_dict_set (&sa->untyped_parameters, parameter, NULL);
+      mcd_default_dict_replace (&sa->parameters, parameter, val);
     }
 
   sa->dirty = TRUE;
@@ -236,24 +1314,11 @@ set_attribute (McpAccountStorage *self,
   sa = lookup_stored_account (amd, account);
   g_return_val_if_fail (sa != NULL, MCP_ACCOUNT_STORAGE_SET_RESULT_FAILED);
   g_return_val_if_fail (!sa->absent, MCP_ACCOUNT_STORAGE_SET_RESULT_FAILED);
+  g_return_val_if_fail (!is_reserved_attribute (attribute),
+      MCP_ACCOUNT_STORAGE_SET_RESULT_FAILED);
 
-  if (val == NULL)
-    {
-      if (!g_hash_table_remove (sa->attributes, attribute))
-        return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
-    }
-  else
-    {
-      GVariant *old;
-
-      old = g_hash_table_lookup (sa->attributes, attribute);
-
-      if (old != NULL && g_variant_equal (old, val))
-        return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
-
-      g_hash_table_insert (sa->attributes, g_strdup (attribute),
-          g_variant_ref (val));
-    }
+  if (!mcd_default_dict_set (&sa->attributes, attribute, val))
+    return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
 
   sa->dirty = TRUE;
   return MCP_ACCOUNT_STORAGE_SET_RESULT_CHANGED;
@@ -276,9 +1341,12 @@ get_attribute (McpAccountStorage *self,
   g_return_val_if_fail (sa != NULL, NULL);
   g_return_val_if_fail (!sa->absent, NULL);
 
+  if (is_reserved_attribute (attribute))
+    return NULL;
+
   /* ignore @type, we store every attribute with its type anyway; MC will
    * coerce values to an appropriate type if needed */
-  return variant_ref0 (g_hash_table_lookup (sa->attributes, attribute));
+  return mcd_default_dict_lookup (&sa->attributes, attribute);
 }
 
 static GVariant *
@@ -292,7 +1360,7 @@ get_parameter (McpAccountStorage *self,
   McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
   McdDefaultStoredAccount *sa = lookup_stored_account (amd, account);
   GVariant *variant;
-  gchar *str;
+  GVariant *escaped;
 
   if (flags != NULL)
     *flags = 0;
@@ -300,21 +1368,23 @@ get_parameter (McpAccountStorage *self,
   g_return_val_if_fail (sa != NULL, NULL);
   g_return_val_if_fail (!sa->absent, NULL);
 
-  variant = g_hash_table_lookup (sa->parameters, parameter);
+  variant = mcd_default_dict_lookup (&sa->parameters, parameter);
 
   if (variant != NULL)
-    return g_variant_ref (variant);
+    return variant;
 
   if (type == NULL)
     return NULL;
 
-  str = g_hash_table_lookup (sa->untyped_parameters, parameter);
+  escaped = mcd_default_dict_lookup (&sa->untyped_parameters, parameter);
 
-  if (str == NULL)
+  if (escaped == NULL)
     return NULL;
 
-  return mcp_account_manager_unescape_variant_from_keyfile (am,
-      str, type, NULL);
+  variant = mcp_account_manager_unescape_variant_from_keyfile (am,
+      g_variant_get_string (escaped, NULL), type, NULL);
+  g_variant_unref (escaped);
+  return variant;
 }
 
 static gchar **
@@ -324,23 +1394,11 @@ list_typed_parameters (McpAccountStorage *self,
 {
   McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
   McdDefaultStoredAccount *sa = lookup_stored_account (amd, account);
-  GPtrArray *arr;
-  GHashTableIter iter;
-  gpointer k;
 
   g_return_val_if_fail (sa != NULL, NULL);
   g_return_val_if_fail (!sa->absent, NULL);
 
-  arr = g_ptr_array_sized_new (g_hash_table_size (sa->parameters) + 1);
-
-  g_hash_table_iter_init (&iter, sa->parameters);
-
-  while (g_hash_table_iter_next (&iter, &k, NULL))
-    g_ptr_array_add (arr, g_strdup (k));
-
-  g_ptr_array_add (arr, NULL);
-
-  return (gchar **) g_ptr_array_free (arr, FALSE);
+  return mcd_default_dict_dup_keys (&sa->parameters);
 }
 
 static gchar **
@@ -350,23 +1408,11 @@ list_untyped_parameters (McpAccountStorage *self,
 {
   McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
   McdDefaultStoredAccount *sa = lookup_stored_account (amd, account);
-  GPtrArray *arr;
-  GHashTableIter iter;
-  gpointer k;
 
   g_return_val_if_fail (sa != NULL, NULL);
   g_return_val_if_fail (!sa->absent, NULL);
 
-  arr = g_ptr_array_sized_new (g_hash_table_size (sa->untyped_parameters) + 1);
-
-  g_hash_table_iter_init (&iter, sa->untyped_parameters);
-
-  while (g_hash_table_iter_next (&iter, &k, NULL))
-    g_ptr_array_add (arr, g_strdup (k));
-
-  g_ptr_array_add (arr, NULL);
-
-  return (gchar **) g_ptr_array_free (arr, FALSE);
+  return mcd_default_dict_dup_keys (&sa->untyped_parameters);
 }
 
 static gchar *
@@ -459,6 +1505,7 @@ delete_async (McpAccountStorage *self,
     }
 
   /* clean up the mess */
+  am_default_forget_file (amd, filename);
   g_hash_table_remove (amd->accounts, account);
   mcp_account_storage_emit_deleted (self, account);
 
@@ -483,10 +1530,7 @@ am_default_commit_one (McdAccountManagerDefault *self,
     McdDefaultStoredAccount *sa)
 {
   gchar *filename;
-  GHashTableIter inner;
-  gpointer k, v;
-  GVariantBuilder params_builder;
-  GVariantBuilder attrs_builder;
+  GVariant *params;
   GVariant *content;
   gchar *content_text;
   gboolean ret;
@@ -509,46 +1553,47 @@ am_default_commit_one (McdAccountManagerDefault *self,
 
   DEBUG ("Saving account %s to %s", account_name, filename);
 
-  g_variant_builder_init (&attrs_builder, G_VARIANT_TYPE_VARDICT);
-
-  g_hash_table_iter_init (&inner, sa->attributes);
-
-  while (g_hash_table_iter_next (&inner, &k, &v))
-    {
-      g_variant_builder_add (&attrs_builder, "{sv}", k, v);
-    }
-
-  g_variant_builder_init (&params_builder, G_VARIANT_TYPE ("a{sv}"));
-  g_hash_table_iter_init (&inner, sa->parameters);
-
-  while (g_hash_table_iter_next (&inner, &k, &v))
-    {
-      g_variant_builder_add (&params_builder, "{sv}", k, v);
-    }
-
-  g_variant_builder_add (&attrs_builder, "{sv}",
-      "Parameters", g_variant_builder_end (&params_builder));
-
-  g_variant_builder_init (&params_builder, G_VARIANT_TYPE ("a{ss}"));
-  g_hash_table_iter_init (&inner, sa->untyped_parameters);
+  /* The parameters go into the attributes as reserved keys, so that the
+   * whole file comes out sorted. If nothing has changed since the account
+   * was loaded, these just return the existing serialized data. */
+  params = mcd_default_dict_build (&sa->parameters, G_VARIANT_TYPE_VARDICT);
+  mcd_default_dict_replace (&sa->attributes, "Parameters", params);
+  g_variant_unref (params);
 
-  while (g_hash_table_iter_next (&inner, &k, &v))
-    {
-      g_variant_builder_add (&params_builder, "{ss}", k, v);
-    }
+  params = mcd_default_dict_build (&sa->untyped_parameters,
+      G_VARIANT_TYPE ("a{ss}"));
+  mcd_default_dict_replace (&sa->attributes, "KeyFileParameters", params);
+  g_variant_unref (params);
 
-  g_variant_builder_add (&attrs_builder, "{sv}",
-      "KeyFileParameters", g_variant_builder_end (&params_builder));
-
-  content = g_variant_ref_sink (g_variant_builder_end (&attrs_builder));
+  content = mcd_default_dict_build (&sa->attributes, G_VARIANT_TYPE_VARDICT);
   content_text = g_variant_print (content, TRUE);
   DEBUG ("%s", content_text);
-  g_variant_unref (content);
 
   if (g_file_set_contents (filename, content_text, -1, &error))
     {
+      /* what we saved becomes the new immutable base */
+      stored_account_set_contents (sa, content, filename);
       sa->dirty = FALSE;
       ret = TRUE;
+
+      if (self->cache != NULL)
+        {
+          GStatBuf st;
+
+          if (g_stat (filename, &st) == 0)
+            {
+              gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+                  content_text, -1);
+
+              am_default_record_file (self, filename, &st, hash,
+                  sa->attributes.base);
+              g_free (hash);
+            }
+          else
+            {
+              am_default_forget_file (self, filename);
+            }
+        }
     }
   else
     {
@@ -558,6 +1603,7 @@ am_default_commit_one (McdAccountManagerDefault *self,
       ret = FALSE;
     }
 
+  g_variant_unref (content);
   g_free (filename);
   g_free (content_text);
   return ret;
@@ -632,10 +1678,13 @@ am_default_load_keyfile (McdAccountManagerDefault *self,
           if (g_str_has_prefix (key, "param-"))
             {
               gchar *raw = g_key_file_get_value (keyfile, account, key, NULL);
-
               /* steals ownership of raw */
-              g_hash_table_insert (sa->untyped_parameters, g_strdup (key + 6),
-                  raw);
+              GVariant *escaped = g_variant_ref_sink (
+                  g_variant_new_take_string (raw));
+
+              mcd_default_dict_replace (&sa->untyped_parameters, key + 6,
+                  escaped);
+              g_variant_unref (escaped);
             }
           else
             {
@@ -664,8 +1713,9 @@ am_default_load_keyfile (McdAccountManagerDefault *self,
                 }
               else
                 {
-                  g_hash_table_insert (sa->attributes, g_strdup (key),
-                      g_variant_ref_sink (variant));
+                  g_variant_ref_sink (variant);
+                  mcd_default_dict_replace (&sa->attributes, key, variant);
+                  g_variant_unref (variant);
                 }
             }
         }
@@ -684,13 +1734,8 @@ am_default_load_variant_file (McdAccountManagerDefault *self,
     const gchar *full_name)
 {
   McdDefaultStoredAccount *sa;
-  gchar *text = NULL;
-  gsize len;
   GVariant *contents = NULL;
-  GVariantIter iter;
-  const gchar *k;
-  GVariant *v;
-  GError *error = NULL;
+  gboolean masked, unchanged;
 
   DEBUG ("%s from %s", account_tail, full_name);
 
@@ -703,100 +1748,22 @@ am_default_load_variant_file (McdAccountManagerDefault *self,
       goto finally;
     }
 
-  if (!g_file_get_contents (full_name, &text, &len, &error))
-    {
-      WARNING ("Unable to read account %s from %s: %s",
-          account_tail, full_name, error->message);
-      g_error_free (error);
-      goto finally;
-    }
+  contents = am_default_read_account_file (self, account_tail, full_name,
+      &masked, &unchanged);
 
-  if (len == 0)
+  if (masked)
     {
       DEBUG ("Empty file %s masks account %s", full_name, account_tail);
       ensure_stored_account (self, account_tail)->absent = TRUE;
-      goto finally;
-    }
-
-  contents = g_variant_parse (G_VARIANT_TYPE_VARDICT,
-      text, text + len, NULL, &error);
-
-  if (contents == NULL)
-    {
-      WARNING ("Unable to parse account %s from %s: %s",
-          account_tail, full_name, error->message);
-      g_error_free (error);
-      goto finally;
     }
-
-  sa = ensure_stored_account (self, account_tail);
-
-  g_variant_iter_init (&iter, contents);
-
-  while (g_variant_iter_loop (&iter, "{sv}", &k, &v))
+  else if (contents != NULL)
     {
-      if (!tp_strdiff (k, "KeyFileParameters"))
-        {
-          GVariantIter param_iter;
-          gchar *parameter;
-          gchar *param_value;
-
-          if (!g_variant_is_of_type (v, G_VARIANT_TYPE ("a{ss}")))
-            {
-              gchar *repr = g_variant_print (v, TRUE);
-
-              WARNING ("invalid KeyFileParameters found in %s, "
-                  "ignoring: %s", full_name, repr);
-              g_free (repr);
-              continue;
-            }
-
-          g_variant_iter_init (&param_iter, v);
-
-          while (g_variant_iter_next (&param_iter, "{ss}", &parameter,
-                &param_value))
-            {
-              /* steals parameter, param_value */
-              g_hash_table_insert (sa->untyped_parameters, parameter,
-                  param_value);
-            }
-        }
-      else if (!tp_strdiff (k, "Parameters"))
-        {
-          GVariantIter param_iter;
-          gchar *parameter;
-          GVariant *param_value;
-
-          if (!g_variant_is_of_type (v, G_VARIANT_TYPE ("a{sv}")))
-            {
-              gchar *repr = g_variant_print (v, TRUE);
-
-              WARNING ("invalid Parameters found in %s, "
-                  "ignoring: %s", full_name, repr);
-              g_free (repr);
-              continue;
-            }
-
-          g_variant_iter_init (&param_iter, v);
-
-          while (g_variant_iter_next (&param_iter, "{sv}", &parameter,
-                &param_value))
-            {
-              /* steals parameter, param_value */
-              g_hash_table_insert (sa->parameters, parameter, param_value);
-            }
-        }
-      else
-        {
-          /* an ordinary attribute */
-          g_hash_table_insert (sa->attributes,
-              g_strdup (k), g_variant_ref (v));
-        }
+      sa = ensure_stored_account (self, account_tail);
+      stored_account_set_contents (sa, contents, full_name);
     }
 
 finally:
   tp_clear_pointer (&contents, g_variant_unref);
-  g_free (text);
 }
 
 static void
@@ -851,9 +1818,7 @@ am_default_load_directory (McdAccountManagerDefault *self,
         }
 
       full_name = g_build_filename (directory, basename, NULL);
-      account_tail = g_strdup (basename);
-      g_strdelimit (account_tail, "-", '/');
-      g_strdelimit (account_tail, ".", '\0');
+      account_tail = account_tail_from_basename (basename);
 
       am_default_load_variant_file (self, account_tail, full_name);
 
@@ -872,11 +1837,17 @@ _list (McpAccountStorage *self,
   gchar *migrate_from = NULL;
   gpointer k, v;
   gboolean save = FALSE;
+  gboolean first_time = FALSE;
 
   if (!amd->loaded)
     {
       const gchar * const *iter;
 
+      first_time = TRUE;
+
+      if (amd->cache != NULL)
+        am_default_read_cache (amd);
+
       am_default_load_directory (amd, amd->directory);
 
       /* We do this even if am_default_load_directory() succeeded, and
@@ -1023,6 +1994,9 @@ _list (McpAccountStorage *self,
         rval = g_list_prepend (rval, g_strdup (k));
     }
 
+  if (first_time)
+    am_default_finish_loading (amd);
+
   return rval;
 }
 
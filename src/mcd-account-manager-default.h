@@ -47,11 +47,15 @@ G_BEGIN_DECLS
     (G_TYPE_INSTANCE_GET_CLASS ((o), MCD_TYPE_ACCOUNT_MANAGER_DEFAULT, \
         McdAccountManagerDefaultClass))
 
+typedef struct _McdAccountManagerDefaultCache McdAccountManagerDefaultCache;
+
 typedef struct {
   GObject parent;
   GHashTable *accounts;
   gchar *directory;
   gboolean loaded;
+  /* NULL if incremental loading is disabled */
+  McdAccountManagerDefaultCache *cache;
 } _McdAccountManagerDefault;
 
 typedef struct {
@@ -30,6 +30,9 @@
 
 G_BEGIN_DECLS
 
+#define MC_IFACE_ACCOUNT_MANAGER_INTERFACE_BATCH \
+    "org.freedesktop.Telepathy.AccountManager.Interface.Batch.DRAFT"
+
 G_GNUC_INTERNAL void _mcd_account_manager_setup
     (McdAccountManager *account_manager);
 
@@ -47,6 +50,9 @@ G_GNUC_INTERNAL void _mcd_account_manager_create_account
      const gchar *display_name, GHashTable *params, GHashTable *properties,
      McdGetAccountCb callback, gpointer user_data, GDestroyNotify destroy);
 
+G_GNUC_INTERNAL void _mcd_account_manager_add_memory_report (
+    McdAccountManager *self, GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 
 #endif
@@ -23,6 +23,8 @@
  */
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_ACCOUNT
+
 #include "mcd-account-manager.h"
 
 #include <string.h>
@@ -41,10 +43,13 @@
 #include "mcd-account-config.h"
 #include "mcd-account-priv.h"
 #include "mcd-connection-priv.h"
+#include "mcd-dbusmethod.h"
 #include "mcd-dbusprop.h"
 #include "mcd-master-priv.h"
+#include "mcd-memory.h"
 #include "mcd-misc.h"
 #include "mcd-storage.h"
+#include "mcd-timeout.h"
 #include "mission-control-plugins/mission-control-plugins.h"
 #include "mission-control-plugins/implementation.h"
 #include "plugin-loader.h"
@@ -52,6 +57,18 @@
 #define PARAM_PREFIX "param-"
 #define WRITE_CONF_DELAY    500
 
+/* With more stored accounts than this, accounts that will not go online by
+ * themselves are not turned into McdAccount objects until something needs
+ * them; see _mcd_account_manager_setup(). Overridden by
+ * $MC_LAZY_ACCOUNTS_THRESHOLD. */
+#define LAZY_ACCOUNTS_THRESHOLD 64
+
+/* When many accounts would like to connect at once (at startup, or when
+ * the network comes back), connect them one at a time with this many
+ * milliseconds in between, most important first. Overridden by
+ * $MC_ACCOUNT_CONNECT_INTERVAL; 0 connects them all at once, in order. */
+#define CONNECT_INTERVAL 100
+
 #define MCD_ACCOUNT_MANAGER_PRIV(account_manager) \
     (MCD_ACCOUNT_MANAGER (account_manager)->priv)
 
@@ -85,11 +102,22 @@ struct _McdAccountManagerPrivate
 
     McdStorage *storage;
     GHashTable *accounts;
+    /* unique name => owned McpAccountStorage, for stored accounts that have
+     * not been materialized as McdAccount objects yet */
+    GHashTable *stubs;
+    DBusConnection *stub_filter_connection;
 
     gchar *account_connections_dir;  /* directory for temporary file */
     gchar *account_connections_file; /* in account_connections_dir */
 
     gboolean dbus_registered;
+    McdDBusMethodExport *batch_export;
+
+    /* owned McdAccounts waiting to be connected, most important first */
+    GQueue connect_queue;
+    guint connect_source;
+    guint connect_interval;
+
     /* 1 per thing we need to do before we can take the AccountManager name */
     gint setup_lock;
 };
@@ -145,6 +173,8 @@ static void add_account (McdAccountManager *manager, McdAccount *account,
 static void async_account_loaded (McdAccount *account,
     const GError *error,
     gpointer user_data);
+static McdAccount *materialize_account (McdAccountManager *self,
+    const gchar *name);
 
 static void
 async_altered_one_manager_cb (McdManager *cm,
@@ -427,6 +457,14 @@ deleted_cb (McdStorage *storage,
                                   "in response to McpAccountStorage::deleted");
         g_object_unref (account);
     }
+    else if (g_hash_table_remove (manager->priv->stubs, name))
+    {
+        gchar *object_path = g_strconcat (TP_ACCOUNT_OBJECT_PATH_BASE, name,
+                                          NULL);
+
+        tp_svc_account_manager_emit_account_removed (manager, object_path);
+        g_free (object_path);
+    }
 }
 
 static gboolean
@@ -625,8 +663,7 @@ unref_account (gpointer data)
     g_object_unref (account);
 }
 
-static void _mcd_account_manager_store_account_connections (
-    McdAccountManager *);
+static void account_connections_changed_cb (McdAccountManager *);
 
 static void
 add_account (McdAccountManager *account_manager, McdAccount *account,
@@ -656,7 +693,7 @@ add_account (McdAccountManager *account_manager, McdAccount *account,
     g_signal_connect (account, "removed", G_CALLBACK (on_account_removed),
 		      account_manager);
     tp_g_signal_connect_object (account, "connection-path-changed",
-        G_CALLBACK (_mcd_account_manager_store_account_connections),
+        G_CALLBACK (account_connections_changed_cb),
         account_manager, G_CONNECT_SWAPPED);
 
     /* some reports indicate this doesn't always fire for async backend  *
@@ -729,6 +766,7 @@ complete_account_creation_finish (McdAccount *account,
                                   McdCreateAccountData *cad)
 {
     McdAccountManager *account_manager = cad->account_manager;
+    gchar *name = g_strdup (mcd_account_get_unique_name (account));
 
     if (!cad->ok)
     {
@@ -741,10 +779,12 @@ complete_account_creation_finish (McdAccount *account,
 
     if (account != NULL)
     {
-        mcd_storage_commit (account_manager->priv->storage,
-            mcd_account_get_unique_name (account));
+        mcd_storage_commit (account_manager->priv->storage, name);
     }
 
+    mcd_storage_end_batch (account_manager->priv->storage, name);
+    g_free (name);
+
     if (cad->callback != NULL)
         cad->callback (account_manager, account, cad->error, cad->user_data);
     mcd_create_account_data_free (cad);
@@ -762,6 +802,11 @@ complete_account_creation_set_cb (McdAccount *account, GPtrArray *not_yet,
 
     account_manager = cad->account_manager;
 
+    /* each property set below commits the account: write them together,
+     * in complete_account_creation_finish() */
+    mcd_storage_begin_batch (account_manager->priv->storage,
+                             mcd_account_get_unique_name (account));
+
     if (set_error != NULL)
     {
         cad->ok = FALSE;
@@ -969,6 +1014,269 @@ account_manager_create_account (TpSvcAccountManager *self,
                                          create_account_cb, context, NULL);
 }
 
+/* Batch interface: create or update many accounts in one D-Bus call.
+ * Each item succeeds or fails independently. Each account being updated is
+ * in a storage batch until its item completes, so that it is committed
+ * once rather than once per change, without holding back other accounts. */
+
+typedef struct
+{
+    McdAccountManager *self;
+    McdDBusMethodInvocation *invocation;
+    guint pending;
+    /* one owned GVariant per item, in request order */
+    GVariant **results;
+    guint n_items;
+} BatchData;
+
+static BatchData *
+batch_data_new (McdAccountManager *self,
+                McdDBusMethodInvocation *invocation,
+                guint n_items)
+{
+    BatchData *bd = g_slice_new0 (BatchData);
+
+    bd->self = g_object_ref (self);
+    bd->invocation = invocation;
+    bd->n_items = n_items;
+    bd->results = g_new0 (GVariant *, n_items);
+    /* held until every item has been started, so that synchronous
+     * completions cannot finish the batch early */
+    bd->pending = 1;
+
+    return bd;
+}
+
+static void
+batch_data_release (BatchData *bd,
+                    const gchar *result_type)
+{
+    GVariantBuilder builder;
+    GVariant *results;
+    guint i;
+
+    if (--bd->pending > 0)
+        return;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (result_type));
+
+    for (i = 0; i < bd->n_items; i++)
+    {
+        g_variant_builder_add_value (&builder, bd->results[i]);
+        g_variant_unref (bd->results[i]);
+    }
+
+    results = g_variant_builder_end (&builder);
+    mcd_dbus_method_invocation_return_value (bd->invocation,
+        g_variant_new_tuple (&results, 1));
+
+    g_free (bd->results);
+    g_object_unref (bd->self);
+    g_slice_free (BatchData, bd);
+}
+
+typedef struct
+{
+    BatchData *bd;
+    guint index;
+    /* the unique name of the account in a storage batch, or %NULL */
+    gchar *account;
+} BatchItem;
+
+static BatchItem *
+batch_item_new (BatchData *bd,
+                guint index)
+{
+    BatchItem *item = g_slice_new (BatchItem);
+
+    item->bd = bd;
+    item->index = index;
+    item->account = NULL;
+    bd->pending++;
+    return item;
+}
+
+static GHashTable *
+asv_from_variant (GVariant *variant)
+{
+    GValue value = G_VALUE_INIT;
+    GHashTable *asv;
+
+    dbus_g_value_parse_g_variant (variant, &value);
+    g_assert (G_VALUE_HOLDS (&value, TP_HASH_TYPE_STRING_VARIANT_MAP));
+    asv = g_value_dup_boxed (&value);
+    g_value_unset (&value);
+    return asv;
+}
+
+static void
+batch_create_account_cb (McdAccountManager *account_manager,
+                         McdAccount *account,
+                         const GError *error,
+                         gpointer user_data)
+{
+    BatchItem *item = user_data;
+    GVariant *result;
+
+    if (error != NULL)
+    {
+        gchar *name = g_dbus_error_encode_gerror (error);
+
+        result = g_variant_new ("(oss)", "/", name, error->message);
+        g_free (name);
+    }
+    else
+    {
+        result = g_variant_new ("(oss)", mcd_account_get_object_path (account),
+                                "", "");
+    }
+
+    item->bd->results[item->index] = g_variant_ref_sink (result);
+    batch_data_release (item->bd, "a(oss)");
+    g_slice_free (BatchItem, item);
+}
+
+static void
+account_manager_create_accounts (gpointer svc,
+                                 GVariant *parameters,
+                                 McdDBusMethodInvocation *invocation)
+{
+    McdAccountManager *self = MCD_ACCOUNT_MANAGER (svc);
+    GVariant *items = g_variant_get_child_value (parameters, 0);
+    BatchData *bd;
+    guint i;
+
+    DEBUG ("creating %" G_GSIZE_FORMAT " accounts", g_variant_n_children (items));
+
+    bd = batch_data_new (self, invocation, g_variant_n_children (items));
+
+    /* Start every item before waiting for any of them, so that plugins
+     * identify the accounts concurrently. */
+    for (i = 0; i < bd->n_items; i++)
+    {
+        const gchar *cm, *protocol, *display_name;
+        GVariant *params_variant, *props_variant;
+        GHashTable *params, *props;
+
+        g_variant_get_child (items, i, "(&s&s&s@a{sv}@a{sv})", &cm, &protocol,
+                             &display_name, &params_variant, &props_variant);
+        params = asv_from_variant (params_variant);
+        props = asv_from_variant (props_variant);
+
+        _mcd_account_manager_create_account (self, cm, protocol, display_name,
+                                             params, props,
+                                             batch_create_account_cb,
+                                             batch_item_new (bd, i), NULL);
+
+        g_hash_table_unref (params);
+        g_hash_table_unref (props);
+        g_variant_unref (params_variant);
+        g_variant_unref (props_variant);
+    }
+
+    g_variant_unref (items);
+    batch_data_release (bd, "a(oss)");
+}
+
+static void
+batch_update_account_cb (McdAccount *account,
+                         GPtrArray *not_yet,
+                         const GError *error,
+                         gpointer user_data)
+{
+    BatchItem *item = user_data;
+    GVariant *result;
+
+    if (error != NULL)
+    {
+        gchar *name = g_dbus_error_encode_gerror (error);
+
+        result = g_variant_new ("(@asss)", g_variant_new_strv (NULL, 0),
+                                name, error->message);
+        g_free (name);
+    }
+    else
+    {
+        result = g_variant_new ("(@asss)",
+            g_variant_new_strv ((const gchar * const *) not_yet->pdata,
+                                not_yet->len),
+            "", "");
+    }
+
+    if (item->account != NULL)
+    {
+        mcd_storage_end_batch (item->bd->self->priv->storage, item->account);
+        g_free (item->account);
+    }
+
+    item->bd->results[item->index] = g_variant_ref_sink (result);
+    batch_data_release (item->bd, "a(asss)");
+    g_slice_free (BatchItem, item);
+}
+
+static void
+account_manager_update_accounts (gpointer svc,
+                                 GVariant *parameters,
+                                 McdDBusMethodInvocation *invocation)
+{
+    McdAccountManager *self = MCD_ACCOUNT_MANAGER (svc);
+    GVariant *items = g_variant_get_child_value (parameters, 0);
+    BatchData *bd;
+    guint i;
+
+    DEBUG ("updating %" G_GSIZE_FORMAT " accounts", g_variant_n_children (items));
+
+    bd = batch_data_new (self, invocation, g_variant_n_children (items));
+
+    for (i = 0; i < bd->n_items; i++)
+    {
+        const gchar *path;
+        GVariant *set_variant;
+        const gchar **unset;
+        GHashTable *set;
+        McdAccount *account;
+        BatchItem *item;
+
+        g_variant_get_child (items, i, "(&o@a{sv}^a&s)", &path, &set_variant,
+                             &unset);
+
+        account = mcd_account_manager_lookup_account_by_path (self, path);
+        item = batch_item_new (bd, i);
+
+        if (account == NULL)
+        {
+            GError *error = g_error_new (TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+                                         "No such account %s", path);
+
+            batch_update_account_cb (NULL, NULL, error, item);
+            g_error_free (error);
+        }
+        else
+        {
+            item->account = g_strdup (mcd_account_get_unique_name (account));
+            mcd_storage_begin_batch (self->priv->storage, item->account);
+
+            set = asv_from_variant (set_variant);
+            _mcd_account_update_parameters (account, set, unset,
+                                            batch_update_account_cb, item);
+            g_hash_table_unref (set);
+        }
+
+        g_free (unset);
+        g_variant_unref (set_variant);
+    }
+
+    g_variant_unref (items);
+    batch_data_release (bd, "a(asss)");
+}
+
+static const McdDBusMethod account_manager_batch_methods[] = {
+    { "CreateAccounts", "(a(sssa{sv}a{sv}))",
+      account_manager_create_accounts },
+    { "UpdateAccounts", "(a(oa{sv}as))", account_manager_update_accounts },
+    { NULL }
+};
+
 static void
 account_manager_iface_init (TpSvcAccountManagerClass *iface,
 			    gpointer iface_data)
@@ -980,7 +1288,7 @@ account_manager_iface_init (TpSvcAccountManagerClass *iface,
 }
 
 static void
-accounts_to_gvalue (GHashTable *accounts, gboolean valid, GValue *value)
+accounts_to_gvalue (McdAccountManager *self, gboolean valid, GValue *value)
 {
     static GType ao_type = G_TYPE_INVALID;
     GPtrArray *account_array;
@@ -992,9 +1300,11 @@ accounts_to_gvalue (GHashTable *accounts, gboolean valid, GValue *value)
         ao_type = dbus_g_type_get_collection ("GPtrArray",
                                               DBUS_TYPE_G_OBJECT_PATH);
 
-    account_array = g_ptr_array_sized_new (g_hash_table_size (accounts));
+    account_array = g_ptr_array_sized_new (
+        g_hash_table_size (self->priv->accounts) +
+        (valid ? g_hash_table_size (self->priv->stubs) : 0));
 
-    g_hash_table_iter_init (&iter, accounts);
+    g_hash_table_iter_init (&iter, self->priv->accounts);
 
     while (g_hash_table_iter_next (&iter, &k, (gpointer)&account))
     {
@@ -1005,6 +1315,24 @@ accounts_to_gvalue (GHashTable *accounts, gboolean valid, GValue *value)
         }
     }
 
+    /* We don't know yet whether an account that hasn't been materialized is
+     * valid, and finding out would mean waiting for its connection
+     * manager, which is what leaving it as a stub avoids. Its manager and
+     * protocol were checked in account_can_wait(), and if it turns out to
+     * be invalid when it is materialized, lazy_account_loaded() emits
+     * AccountValidityChanged. */
+    if (valid)
+    {
+        g_hash_table_iter_init (&iter, self->priv->stubs);
+
+        while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+            g_ptr_array_add (account_array,
+                             g_strconcat (TP_ACCOUNT_OBJECT_PATH_BASE, k,
+                                          NULL));
+        }
+    }
+
     g_value_init (value, ao_type);
     g_value_take_boxed (value, account_array);
 }
@@ -1014,10 +1342,9 @@ get_valid_accounts (TpSvcDBusProperties *self, const gchar *name,
 		    GValue *value)
 {
     McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (self);
-    McdAccountManagerPrivate *priv = account_manager->priv;
 
     DEBUG ("called");
-    accounts_to_gvalue (priv->accounts, TRUE, value);
+    accounts_to_gvalue (account_manager, TRUE, value);
 }
 
 static void
@@ -1025,10 +1352,9 @@ get_invalid_accounts (TpSvcDBusProperties *self, const gchar *name,
 		      GValue *value)
 {
     McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (self);
-    McdAccountManagerPrivate *priv = account_manager->priv;
 
     DEBUG ("called");
-    accounts_to_gvalue (priv->accounts, FALSE, value);
+    accounts_to_gvalue (account_manager, FALSE, value);
 }
 
 static void
@@ -1054,10 +1380,33 @@ get_supported_account_properties (TpSvcDBusProperties *svc,
     g_value_set_static_boxed (value, supported);
 }
 
+static void
+get_interfaces (TpSvcDBusProperties *self,
+                const gchar *name,
+                GValue *value)
+{
+    GPtrArray *interfaces = g_ptr_array_new ();
+    GValue standard = G_VALUE_INIT;
+    const gchar * const *iter;
+
+    mcd_dbus_get_interfaces (self, name, &standard);
+
+    for (iter = g_value_get_boxed (&standard); *iter != NULL; iter++)
+        g_ptr_array_add (interfaces, g_strdup (*iter));
+
+    g_ptr_array_add (interfaces,
+                     g_strdup (MC_IFACE_ACCOUNT_MANAGER_INTERFACE_BATCH));
+    g_ptr_array_add (interfaces, NULL);
+
+    g_value_unset (&standard);
+    g_value_init (value, G_TYPE_STRV);
+    g_value_take_boxed (value, g_ptr_array_free (interfaces, FALSE));
+}
+
 static const McdDBusProp account_manager_properties[] = {
     { "ValidAccounts", NULL, get_valid_accounts },
     { "InvalidAccounts", NULL, get_invalid_accounts },
-    { "Interfaces", NULL, mcd_dbus_get_interfaces },
+    { "Interfaces", NULL, get_interfaces },
     { "SupportedAccountProperties", NULL, get_supported_account_properties },
     { 0 },
 };
@@ -1141,6 +1490,303 @@ setup_account_loaded (McdAccount *account,
     g_object_unref (self);
 }
 
+static void
+lazy_account_loaded (McdAccount *account,
+    const GError *error,
+    gpointer user_data)
+{
+    McdAccountManager *self = MCD_ACCOUNT_MANAGER (user_data);
+
+    /* While it was a stub, the account was listed in ValidAccounts, so
+     * tell clients if that was wrong */
+    if (error)
+    {
+        g_warning ("%s: got error: %s", G_STRFUNC, error->message);
+        tp_svc_account_manager_emit_account_removed (self,
+            mcd_account_get_object_path (account));
+        g_hash_table_remove (self->priv->accounts,
+                             mcd_account_get_unique_name (account));
+    }
+    else if (!mcd_account_is_valid (account))
+    {
+        /* it started off invalid, so McdAccount won't signal this */
+        on_account_validity_changed (account, FALSE, self);
+    }
+
+    g_object_unref (self);
+}
+
+/*
+ * materialize_account:
+ * @self: the account manager
+ * @name: the unique name of an account that might not have been
+ *  materialized yet
+ *
+ * If @name is one of the stored accounts that _mcd_account_manager_setup()
+ * left for later, create its McdAccount now and export it on D-Bus.
+ *
+ * Returns: (transfer none): the new account, or %NULL if @name was not
+ *  waiting to be materialized or could not be loaded
+ */
+static McdAccount *
+materialize_account (McdAccountManager *self,
+                     const gchar *name)
+{
+    McdAccountManagerPrivate *priv = self->priv;
+    McpAccountStorage *plugin;
+    McdAccount *account;
+    gpointer k, v;
+    gchar *key;
+
+    if (!g_hash_table_lookup_extended (priv->stubs, name, &k, &v))
+        return NULL;
+
+    /* @name might be the key itself, so take ownership before anything
+     * else can modify the table */
+    key = k;
+    plugin = v;
+    g_hash_table_steal (priv->stubs, key);
+
+    DEBUG ("materializing account %s", key);
+
+    account = mcd_account_new (self, key, priv->minotaur, plugin);
+
+    if (G_UNLIKELY (account == NULL))
+    {
+        g_warning ("%s: account %s failed to instantiate", G_STRFUNC, key);
+        goto finally;
+    }
+
+    add_account (self, account, "lazy");
+    _mcd_account_load (account, lazy_account_loaded, g_object_ref (self));
+    g_object_unref (account);
+
+    /* if it failed to load, it has already been removed again */
+    account = g_hash_table_lookup (priv->accounts, key);
+
+    /* We might have been called because of a D-Bus method call addressed
+     * to the account: make sure dbus-glib can dispatch it, even if the
+     * account is still waiting for its connection manager. */
+    if (account != NULL)
+        _mcd_account_ensure_registered (account);
+
+finally:
+    g_free (key);
+    g_object_unref (plugin);
+    return account;
+}
+
+static DBusHandlerResult
+stub_filter_cb (DBusConnection *connection,
+                DBusMessage *message,
+                void *user_data)
+{
+    McdAccountManager *self = user_data;
+    const gchar *path;
+
+    if (g_hash_table_size (self->priv->stubs) == 0 ||
+        dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    path = dbus_message_get_path (message);
+
+    if (path != NULL && g_str_has_prefix (path, TP_ACCOUNT_OBJECT_PATH_BASE))
+        materialize_account (self, path + strlen (TP_ACCOUNT_OBJECT_PATH_BASE));
+
+    /* filters run before object paths are looked up, so dbus-glib will
+     * dispatch the call to the account we might just have registered */
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* Accounts with a higher ConnectionPriority come first; within the same
+ * priority, the most recently used accounts come first. */
+static gint
+compare_connection_order (gconstpointer a,
+                          gconstpointer b,
+                          gpointer user_data G_GNUC_UNUSED)
+{
+    McdAccount *account_a = MCD_ACCOUNT (a);
+    McdAccount *account_b = MCD_ACCOUNT (b);
+    gint priority_a = _mcd_account_get_connection_priority (account_a);
+    gint priority_b = _mcd_account_get_connection_priority (account_b);
+    gint64 last_used_a, last_used_b;
+
+    if (priority_a != priority_b)
+        return (priority_a > priority_b) ? -1 : 1;
+
+    last_used_a = _mcd_account_get_last_used (account_a);
+    last_used_b = _mcd_account_get_last_used (account_b);
+
+    if (last_used_a != last_used_b)
+        return (last_used_a > last_used_b) ? -1 : 1;
+
+    /* make the order deterministic */
+    return g_strcmp0 (mcd_account_get_unique_name (account_a),
+                      mcd_account_get_unique_name (account_b));
+}
+
+static gboolean
+connect_next_account (gpointer user_data)
+{
+    McdAccountManager *self = MCD_ACCOUNT_MANAGER (user_data);
+    McdAccountManagerPrivate *priv = self->priv;
+
+    while (!g_queue_is_empty (&priv->connect_queue))
+    {
+        McdAccount *account = g_queue_pop_head (&priv->connect_queue);
+        const gchar *name = mcd_account_get_unique_name (account);
+        gboolean connecting = FALSE;
+
+        /* it might have been deleted, disabled or connected by the user
+         * while it was waiting */
+        if (g_hash_table_lookup (priv->accounts, name) == account &&
+            mcd_account_would_like_to_connect (account))
+        {
+            _mcd_account_maybe_autoconnect (account);
+            connecting = TRUE;
+        }
+
+        g_object_unref (account);
+
+        if (connecting && priv->connect_interval > 0)
+            return G_SOURCE_CONTINUE;
+    }
+
+    priv->connect_source = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * connect_accounts_in_order:
+ * @self: the account manager
+ *
+ * Connect every account that would like to connect, in order of
+ * compare_connection_order(), so that the accounts that matter most come
+ * online first and the rest do not all connect in the same main loop
+ * iteration.
+ */
+static void
+connect_accounts_in_order (McdAccountManager *self)
+{
+    McdAccountManagerPrivate *priv = self->priv;
+    GHashTableIter iter;
+    gpointer v;
+
+    g_hash_table_iter_init (&iter, priv->accounts);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        if (!mcd_account_would_like_to_connect (v) ||
+            g_queue_find (&priv->connect_queue, v) != NULL)
+            continue;
+
+        g_queue_insert_sorted (&priv->connect_queue, g_object_ref (v),
+                               compare_connection_order, NULL);
+    }
+
+    if (priv->connect_interval == 0)
+    {
+        connect_next_account (self);
+    }
+    else if (priv->connect_source == 0 &&
+             !g_queue_is_empty (&priv->connect_queue))
+    {
+        /* connect the first one straight away */
+        if (connect_next_account (self))
+            priv->connect_source = mcd_timeout_add (priv->connect_interval,
+                                                    connect_next_account,
+                                                    self);
+    }
+}
+
+static void
+connectivity_state_changed_cb (McdConnectivityMonitor *monitor,
+                               gboolean connected,
+                               McdInhibit *inhibit,
+                               gpointer user_data)
+{
+    McdAccountManager *self = MCD_ACCOUNT_MANAGER (user_data);
+    McdAccountManagerPrivate *priv = self->priv;
+
+    if (connected)
+    {
+        connect_accounts_in_order (self);
+    }
+    else
+    {
+        GList *l, *next;
+
+        /* accounts that need a transport will be queued again when it
+         * comes back */
+        for (l = priv->connect_queue.head; l != NULL; l = next)
+        {
+            next = l->next;
+
+            if (!_mcd_account_needs_dispatch (l->data))
+            {
+                g_object_unref (l->data);
+                g_queue_delete_link (&priv->connect_queue, l);
+            }
+        }
+    }
+}
+
+static guint
+get_connect_interval (void)
+{
+    const gchar *from_env = g_getenv ("MC_ACCOUNT_CONNECT_INTERVAL");
+
+    if (from_env != NULL)
+        return (guint) g_ascii_strtoull (from_env, NULL, 10);
+
+    return CONNECT_INTERVAL;
+}
+
+static guint
+get_lazy_accounts_threshold (void)
+{
+    const gchar *from_env = g_getenv ("MC_LAZY_ACCOUNTS_THRESHOLD");
+
+    if (from_env != NULL)
+        return (guint) g_ascii_strtoull (from_env, NULL, 10);
+
+    return LAZY_ACCOUNTS_THRESHOLD;
+}
+
+/* Whether a stored account has no reason to do anything until a client,
+ * the dispatcher or its storage backend asks for it. */
+static gboolean
+account_can_wait (McdStorage *storage,
+                  const gchar *account_name)
+{
+    gchar *manager;
+    gchar *protocol;
+    gboolean ret;
+
+    if (mcd_storage_get_boolean (storage, account_name,
+                                 MC_ACCOUNTS_KEY_ENABLED) &&
+        (mcd_storage_get_boolean (storage, account_name,
+                                  MC_ACCOUNTS_KEY_CONNECT_AUTOMATICALLY) ||
+         mcd_storage_get_boolean (storage, account_name,
+                                  MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE)))
+        return FALSE;
+
+    manager = mcd_storage_dup_string (storage, account_name,
+                                      MC_ACCOUNTS_KEY_MANAGER);
+    protocol = mcd_storage_dup_string (storage, account_name,
+                                       MC_ACCOUNTS_KEY_PROTOCOL);
+
+    /* Implausible accounts are loaded (and rejected) straight away, so
+     * that they never appear in ValidAccounts; and butterfly accounts
+     * must be seen by migrate_accounts(). */
+    ret = (!tp_str_empty (manager) && !tp_str_empty (protocol) &&
+           tp_strdiff (manager, "butterfly"));
+
+    g_free (manager);
+    g_free (protocol);
+    return ret;
+}
+
 typedef struct
 {
     McdAccountManager *self;
@@ -1379,6 +2025,11 @@ migrate_accounts (McdAccountManager *self)
  *
  * This function must be called by the McdMaster; it reads the accounts from
  * the config file, and it needs a McdMaster instance to be active.
+ *
+ * If there are many stored accounts, those that are disabled, or that
+ * neither connect automatically nor have ever been online, are not loaded
+ * yet: they are materialized by mcd_account_manager_lookup_account() or
+ * by the first D-Bus method call on their object path.
  */
 void
 _mcd_account_manager_setup (McdAccountManager *account_manager)
@@ -1388,6 +2039,7 @@ _mcd_account_manager_setup (McdAccountManager *account_manager)
     GHashTable *accounts;
     GHashTableIter iter;
     gpointer k, v;
+    gboolean lazy;
 
     /* for simplicity we don't support re-entrant setup */
     g_return_if_fail (priv->setup_lock == 0);
@@ -1413,6 +2065,7 @@ _mcd_account_manager_setup (McdAccountManager *account_manager)
     g_signal_connect_object (priv->storage, "reconnect",
         G_CALLBACK (reconnect_cb), account_manager, 0);
 
+    lazy = (g_hash_table_size (accounts) > get_lazy_accounts_threshold ());
     g_hash_table_iter_init (&iter, accounts);
 
     while (g_hash_table_iter_next (&iter, &k, &v))
@@ -1434,6 +2087,15 @@ _mcd_account_manager_setup (McdAccountManager *account_manager)
             continue;
         }
 
+        if (lazy && account_can_wait (storage, account_name))
+        {
+            DEBUG ("not materializing account %s until it is needed",
+                   account_name);
+            g_hash_table_insert (priv->stubs, g_strdup (account_name),
+                                 g_object_ref (plugin));
+            continue;
+        }
+
         account = mcd_account_new (account_manager, account_name,
             priv->minotaur, plugin);
 
@@ -1480,10 +2142,7 @@ _mcd_account_manager_setup (McdAccountManager *account_manager)
 
     release_setup_lock (account_manager);
 
-    g_hash_table_iter_init (&iter, account_manager->priv->accounts);
-
-    while (g_hash_table_iter_next (&iter, NULL, &v))
-      _mcd_account_maybe_autoconnect (v);
+    connect_accounts_in_order (account_manager);
 }
 
 static void
@@ -1512,6 +2171,22 @@ register_dbus_service (McdAccountManager *account_manager)
     tp_dbus_daemon_register_object (priv->dbus_daemon,
                                     TP_ACCOUNT_MANAGER_OBJECT_PATH,
                                     account_manager);
+    priv->batch_export = mcd_dbus_method_export (priv->dbus_daemon,
+        TP_ACCOUNT_MANAGER_OBJECT_PATH,
+        MC_IFACE_ACCOUNT_MANAGER_INTERFACE_BATCH,
+        account_manager_batch_methods, account_manager);
+
+    if (g_hash_table_size (priv->stubs) > 0)
+    {
+        priv->stub_filter_connection = dbus_connection_ref (
+            dbus_g_connection_get_connection (
+                tp_proxy_get_dbus_connection (priv->dbus_daemon)));
+
+        if (!dbus_connection_add_filter (priv->stub_filter_connection,
+                                         stub_filter_cb, account_manager,
+                                         NULL))
+            g_error ("Out of memory");
+    }
 }
 
 static void
@@ -1566,6 +2241,7 @@ _mcd_account_manager_finalize (GObject *object)
     g_free (priv->account_connections_file);
 
     g_hash_table_unref (priv->accounts);
+    g_hash_table_unref (priv->stubs);
 
     G_OBJECT_CLASS (mcd_account_manager_parent_class)->finalize (object);
 }
@@ -1575,6 +2251,34 @@ _mcd_account_manager_dispose (GObject *object)
 {
     McdAccountManagerPrivate *priv = MCD_ACCOUNT_MANAGER_PRIV (object);
 
+    tp_clear_pointer (&priv->batch_export, mcd_dbus_method_unexport);
+
+    if (priv->storage != NULL)
+    {
+        /* the file is deleted in finalize, so there's no point in
+         * writing it */
+        mcd_slacker_cancel (priv->storage->slacker, object);
+        /* but changes to accounts must not be lost */
+        mcd_storage_finish_flushes (priv->storage);
+    }
+
+    if (priv->connect_source != 0)
+    {
+        mcd_timeout_remove (priv->connect_source);
+        priv->connect_source = 0;
+    }
+
+    g_queue_foreach (&priv->connect_queue, (GFunc) g_object_unref, NULL);
+    g_queue_clear (&priv->connect_queue);
+
+    if (priv->stub_filter_connection != NULL)
+    {
+        dbus_connection_remove_filter (priv->stub_filter_connection,
+                                       stub_filter_cb, object);
+        dbus_connection_unref (priv->stub_filter_connection);
+        priv->stub_filter_connection = NULL;
+    }
+
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->client_factory);
     tp_clear_object (&priv->minotaur);
@@ -1647,10 +2351,19 @@ _mcd_account_manager_constructed (GObject *obj)
     DEBUG ("");
 
     priv->minotaur = mcd_connectivity_monitor_new ();
+    priv->connect_interval = get_connect_interval ();
+    g_queue_init (&priv->connect_queue);
+
+    /* this is connected before any McdAccount connects to the signal, so
+     * accounts are queued in order before they react to it individually */
+    tp_g_signal_connect_object (priv->minotaur, "state-change",
+        (GCallback) connectivity_state_changed_cb, account_manager, 0);
 
     priv->storage = mcd_storage_new (priv->dbus_daemon);
     priv->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
                                             NULL, unref_account);
+    priv->stubs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, g_object_unref);
 
     priv->account_connections_dir = g_strdup (get_connections_cache_dir ());
     priv->account_connections_file =
@@ -1707,23 +2420,27 @@ mcd_account_manager_lookup_account (McdAccountManager *account_manager,
 				    const gchar *name)
 {
     McdAccountManagerPrivate *priv = account_manager->priv;
+    McdAccount *account;
+
+    account = g_hash_table_lookup (priv->accounts, name);
+
+    if (account == NULL)
+        account = materialize_account (account_manager, name);
 
-    return g_hash_table_lookup (priv->accounts, name);
+    return account;
 }
 
 McdAccount *
 mcd_account_manager_lookup_account_by_path (McdAccountManager *account_manager,
 					    const gchar *object_path)
 {
-    McdAccountManagerPrivate *priv = account_manager->priv;
-
     if (!g_str_has_prefix (object_path, TP_ACCOUNT_OBJECT_PATH_BASE))
     {
         /* can't possibly be right */
         return NULL;
     }
 
-    return g_hash_table_lookup (priv->accounts,
+    return mcd_account_manager_lookup_account (account_manager,
         object_path + strlen (TP_ACCOUNT_OBJECT_PATH_BASE));
 }
 
@@ -1773,9 +2490,67 @@ _mcd_account_manager_store_account_connections (McdAccountManager *manager)
     fclose (file);
 }
 
+/* The longest we will leave the file out of date while the device is idle;
+ * it only matters if MC crashes during that time */
+#define ACCOUNT_CONNECTIONS_MAX_DELAY 10
+
+static void
+store_account_connections_cb (gpointer owner,
+                              const gchar *name G_GNUC_UNUSED)
+{
+    _mcd_account_manager_store_account_connections (owner);
+}
+
+static void
+account_connections_changed_cb (McdAccountManager *manager)
+{
+    mcd_slacker_defer (manager->priv->storage->slacker, manager,
+                       "account-connections", ACCOUNT_CONNECTIONS_MAX_DELAY,
+                       store_account_connections_cb);
+}
+
 McdStorage *
 mcd_account_manager_get_storage (McdAccountManager *account_manager)
 {
     return account_manager->priv->storage;
 }
 
+void
+_mcd_account_manager_add_memory_report (McdAccountManager *self,
+                                        GVariantBuilder *report,
+                                        guint depth)
+{
+    McdAccountManagerPrivate *priv = self->priv;
+    GHashTable *plugins;
+    GHashTableIter iter;
+    gpointer v;
+    gsize size;
+
+    /* keys of accounts are borrowed from the accounts */
+    size = mcd_memory_instance_size (self) +
+        sizeof (McdAccountManagerPrivate) +
+        mcd_memory_hash_table_size (priv->accounts) +
+        mcd_memory_string_hash_table_size (priv->stubs, FALSE) +
+        mcd_memory_string_size (priv->account_connections_dir) +
+        mcd_memory_string_size (priv->account_connections_file) +
+        priv->connect_queue.length * sizeof (GList);
+
+    /* stubs share a handful of storage plugins, so count each one once */
+    plugins = g_hash_table_new (NULL, NULL);
+    g_hash_table_iter_init (&iter, priv->stubs);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        if (g_hash_table_add (plugins, v))
+            size += mcd_memory_instance_size (v);
+    }
+
+    g_hash_table_unref (plugins);
+
+    mcd_memory_report_add (report, depth, self, NULL, size);
+
+    g_hash_table_iter_init (&iter, priv->accounts);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+        _mcd_account_add_memory_report (v, report, depth + 1);
+}
@@ -51,12 +51,21 @@ G_GNUC_INTERNAL void _mcd_account_set_parameters (McdAccount *account,
                                                   McdAccountSetParametersCb callback,
                                                   gpointer user_data);
 
+G_GNUC_INTERNAL void _mcd_account_update_parameters (McdAccount *account,
+    GHashTable *set,
+    const gchar **unset,
+    McdAccountSetParametersCb callback,
+    gpointer user_data);
+
 G_GNUC_INTERNAL void _mcd_account_request_temporary_presence (McdAccount *self,
     TpConnectionPresenceType type, const gchar *status);
 
 G_GNUC_INTERNAL GKeyFile *_mcd_account_get_keyfile (McdAccount *account);
 
 G_GNUC_INTERNAL void _mcd_account_set_has_been_online (McdAccount *account);
+G_GNUC_INTERNAL gint _mcd_account_get_connection_priority (McdAccount *self);
+G_GNUC_INTERNAL gint64 _mcd_account_get_last_used (McdAccount *self);
+G_GNUC_INTERNAL void _mcd_account_set_last_used (McdAccount *self);
 
 G_GNUC_INTERNAL void _mcd_account_set_normalized_name (McdAccount *account,
                                                        const gchar *name);
@@ -84,6 +93,7 @@ G_GNUC_INTERNAL void _mcd_account_tp_connection_changed (McdAccount *account,
 G_GNUC_INTERNAL void _mcd_account_load (McdAccount *account,
                                         McdAccountLoadCb callback,
                                         gpointer user_data);
+G_GNUC_INTERNAL void _mcd_account_ensure_registered (McdAccount *account);
 G_GNUC_INTERNAL void _mcd_account_set_connection (McdAccount *account,
                                                   McdConnection *connection);
 G_GNUC_INTERNAL void _mcd_account_set_connection_status
@@ -150,5 +160,8 @@ G_GNUC_INTERNAL gboolean _mcd_account_needs_dispatch (McdAccount *account);
 G_GNUC_INTERNAL void _mcd_account_reconnect (McdAccount *self,
     gboolean user_initiated);
 
+G_GNUC_INTERNAL void _mcd_account_add_memory_report (McdAccount *self,
+    GVariantBuilder *report, guint depth);
+
 
 #endif /* __MCD_ACCOUNT_PRIV_H__ */
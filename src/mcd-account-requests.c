@@ -25,6 +25,8 @@
  */
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include <stdio.h>
 #include <string.h>
 #include <glib/gstdio.h>
@@ -0,0 +1,469 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-account-snapshot.c - shared-memory snapshot of account states
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_ACCOUNT
+
+#include "mcd-account-snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <glib/gstdio.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-debug.h"
+#include "mcd-misc.h"
+
+#define INITIAL_SLOTS 32
+
+struct _McdAccountSnapshotPrivate {
+    gchar *path;
+    int fd;
+
+    /* mapping of the whole file, or NULL if we could not set it up */
+    McdAccountSnapshotHeader *header;
+    gsize mapped_size;
+
+    /* unique name (owned) => GUINT_TO_POINTER (slot index + 1) */
+    GHashTable *slots;
+    /* indexes of free slots below header->n_slots, as GUINT_TO_POINTER */
+    GSList *free_slots;
+};
+
+G_DEFINE_TYPE (McdAccountSnapshot, mcd_account_snapshot, G_TYPE_OBJECT)
+
+static gpointer snapshot = NULL;
+
+static inline McdAccountSnapshotSlot *
+get_slot (McdAccountSnapshot *self,
+          guint i)
+{
+    g_assert (i < self->priv->header->n_slots);
+
+    return ((McdAccountSnapshotSlot *) (self->priv->header + 1)) + i;
+}
+
+static inline gsize
+size_for_slots (guint n_slots)
+{
+    return sizeof (McdAccountSnapshotHeader) +
+        n_slots * sizeof (McdAccountSnapshotSlot);
+}
+
+/* Seqlock write side. g_atomic_int_inc() is a full barrier, so readers can
+ * never see the slot contents change while the sequence number is even. */
+static inline void
+write_begin (McdAccountSnapshot *self)
+{
+    g_atomic_int_inc (&self->priv->header->sequence);
+}
+
+static inline void
+write_end (McdAccountSnapshot *self)
+{
+    g_atomic_int_inc (&self->priv->header->sequence);
+}
+
+static void
+copy_string (gchar *dest,
+             gsize size,
+             const gchar *src)
+{
+    gsize len;
+
+    if (src == NULL)
+        src = "";
+
+    len = strlen (src);
+
+    if (len >= size)
+    {
+        /* don't leave half a character at the end */
+        const gchar *end = g_utf8_find_prev_char (src, src + size);
+
+        len = (end == NULL ? 0 : (gsize) (end - src));
+    }
+
+    memcpy (dest, src, len);
+    memset (dest + len, '\0', size - len);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+
+static gboolean
+map_file (McdAccountSnapshot *self,
+          guint n_slots)
+{
+    McdAccountSnapshotPrivate *priv = self->priv;
+    gsize size = size_for_slots (n_slots);
+    gpointer map;
+
+    if (ftruncate (priv->fd, size) != 0)
+    {
+        WARNING ("unable to resize %s to %" G_GSIZE_FORMAT " bytes: %s",
+                 priv->path, size, g_strerror (errno));
+        return FALSE;
+    }
+
+    map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, priv->fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        WARNING ("unable to map %s: %s", priv->path, g_strerror (errno));
+        return FALSE;
+    }
+
+    if (priv->header != NULL)
+    {
+        /* the old contents are already in the file; the new mapping sees
+         * them */
+        munmap (priv->header, priv->mapped_size);
+    }
+
+    priv->header = map;
+    priv->mapped_size = size;
+    return TRUE;
+}
+
+static void
+open_snapshot (McdAccountSnapshot *self)
+{
+    McdAccountSnapshotPrivate *priv = self->priv;
+    const gchar *from_env = g_getenv ("MC_SNAPSHOT_PATH");
+    gchar *dir;
+
+    if (from_env != NULL)
+    {
+        priv->path = g_strdup (from_env);
+    }
+    else
+    {
+        priv->path = g_build_filename (g_get_user_runtime_dir (),
+                                       "telepathy", "mission-control",
+                                       "accounts.snapshot", NULL);
+    }
+
+    dir = g_path_get_dirname (priv->path);
+    g_mkdir_with_parents (dir, 0700);
+    _mcd_chmod_private (dir);
+    g_free (dir);
+
+    /* Start from an empty file every time: a reader that still has the old
+     * one mapped keeps it alive, but will see that it is no longer being
+     * updated once it reopens the path. */
+    g_unlink (priv->path);
+    priv->fd = g_open (priv->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                       0600);
+
+    if (priv->fd < 0)
+    {
+        WARNING ("unable to create %s: %s", priv->path, g_strerror (errno));
+        return;
+    }
+
+    if (!map_file (self, INITIAL_SLOTS))
+    {
+        close (priv->fd);
+        priv->fd = -1;
+        return;
+    }
+
+    priv->header->magic = MCD_ACCOUNT_SNAPSHOT_MAGIC;
+    priv->header->format = MCD_ACCOUNT_SNAPSHOT_FORMAT;
+    priv->header->sequence = 0;
+    priv->header->n_slots = INITIAL_SLOTS;
+    priv->header->slot_size = sizeof (McdAccountSnapshotSlot);
+    priv->header->n_accounts = 0;
+
+    DEBUG ("publishing account snapshot in %s", priv->path);
+}
+
+static void
+close_snapshot (McdAccountSnapshot *self)
+{
+    McdAccountSnapshotPrivate *priv = self->priv;
+
+    if (priv->header != NULL)
+    {
+        munmap (priv->header, priv->mapped_size);
+        priv->header = NULL;
+        priv->mapped_size = 0;
+    }
+
+    if (priv->fd >= 0)
+    {
+        close (priv->fd);
+        priv->fd = -1;
+        g_unlink (priv->path);
+    }
+}
+
+/* Must be called between write_begin() and write_end(), since it replaces
+ * the mapping and changes n_slots. */
+static gboolean
+grow (McdAccountSnapshot *self)
+{
+    guint old = self->priv->header->n_slots;
+    guint i;
+
+    if (!map_file (self, old * 2))
+        return FALSE;
+
+    /* ftruncate() zero-fills, so the new slots are already free */
+    for (i = old * 2; i > old; i--)
+        self->priv->free_slots = g_slist_prepend (self->priv->free_slots,
+                                                  GUINT_TO_POINTER (i - 1));
+
+    self->priv->header->n_slots = old * 2;
+    return TRUE;
+}
+
+#else /* !HAVE_SYS_MMAN_H */
+
+static void
+open_snapshot (McdAccountSnapshot *self)
+{
+    DEBUG ("no mmap() support, not publishing an account snapshot");
+}
+
+static void
+close_snapshot (McdAccountSnapshot *self)
+{
+}
+
+static gboolean
+grow (McdAccountSnapshot *self)
+{
+    return FALSE;
+}
+
+#endif /* !HAVE_SYS_MMAN_H */
+
+static void
+mcd_account_snapshot_init (McdAccountSnapshot *self)
+{
+    guint i;
+
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MCD_TYPE_ACCOUNT_SNAPSHOT,
+                                              McdAccountSnapshotPrivate);
+    self->priv->fd = -1;
+    self->priv->slots = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, NULL);
+
+    open_snapshot (self);
+
+    if (self->priv->header == NULL)
+        return;
+
+    for (i = self->priv->header->n_slots; i > 0; i--)
+        self->priv->free_slots = g_slist_prepend (self->priv->free_slots,
+                                                  GUINT_TO_POINTER (i - 1));
+}
+
+static GObject *
+mcd_account_snapshot_constructor (GType type,
+                                  guint n_construct_properties,
+                                  GObjectConstructParam *construct_properties)
+{
+    GObject *retval;
+
+    if (snapshot == NULL)
+    {
+        snapshot = G_OBJECT_CLASS (mcd_account_snapshot_parent_class)->
+            constructor (type, n_construct_properties, construct_properties);
+        retval = snapshot;
+        g_object_add_weak_pointer (retval, &snapshot);
+    }
+    else
+    {
+        retval = g_object_ref (snapshot);
+    }
+
+    return retval;
+}
+
+static void
+mcd_account_snapshot_finalize (GObject *object)
+{
+    McdAccountSnapshot *self = MCD_ACCOUNT_SNAPSHOT (object);
+
+    close_snapshot (self);
+
+    g_hash_table_unref (self->priv->slots);
+    g_slist_free (self->priv->free_slots);
+    g_free (self->priv->path);
+
+    G_OBJECT_CLASS (mcd_account_snapshot_parent_class)->finalize (object);
+}
+
+static void
+mcd_account_snapshot_class_init (McdAccountSnapshotClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->constructor = mcd_account_snapshot_constructor;
+    object_class->finalize = mcd_account_snapshot_finalize;
+
+    g_type_class_add_private (klass, sizeof (McdAccountSnapshotPrivate));
+}
+
+/*
+ * mcd_account_snapshot_dup:
+ *
+ * Returns: (transfer full): the process-wide account snapshot
+ */
+McdAccountSnapshot *
+mcd_account_snapshot_dup (void)
+{
+    return g_object_new (MCD_TYPE_ACCOUNT_SNAPSHOT, NULL);
+}
+
+/*
+ * _mcd_account_snapshot_update:
+ * @self: the snapshot
+ * @account: an account
+ *
+ * Copy the current state of @account into its slot, allocating one if
+ * necessary. This is cheap enough to call whenever the account emits
+ * AccountPropertyChanged.
+ */
+void
+_mcd_account_snapshot_update (McdAccountSnapshot *self,
+                              McdAccount *account)
+{
+    McdAccountSnapshotPrivate *priv;
+    McdAccountSnapshotSlot *slot;
+    const gchar *name;
+    gchar *display_name;
+    TpConnectionPresenceType curr_type, req_type;
+    const gchar *curr_status, *curr_message, *req_status, *req_message;
+    TpConnectionStatusReason reason;
+    guint i;
+
+    g_return_if_fail (MCD_IS_ACCOUNT_SNAPSHOT (self));
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+
+    priv = self->priv;
+
+    if (priv->header == NULL)
+        return;
+
+    name = mcd_account_get_unique_name (account);
+    i = GPOINTER_TO_UINT (g_hash_table_lookup (priv->slots, name));
+
+    /* gather everything before taking the lock, so readers spin for as
+     * short a time as possible */
+    display_name = mcd_account_dup_display_name (account);
+    mcd_account_get_current_presence (account, &curr_type, &curr_status,
+                                      &curr_message);
+    mcd_account_get_requested_presence (account, &req_type, &req_status,
+                                        &req_message);
+    reason = mcd_account_get_connection_status_reason (account);
+
+    write_begin (self);
+
+    if (i == 0)
+    {
+        if (priv->free_slots == NULL && !grow (self))
+        {
+            write_end (self);
+            g_free (display_name);
+            return;
+        }
+
+        i = GPOINTER_TO_UINT (priv->free_slots->data) + 1;
+        priv->free_slots = g_slist_delete_link (priv->free_slots,
+                                                priv->free_slots);
+        g_hash_table_insert (priv->slots, g_strdup (name),
+                             GUINT_TO_POINTER (i));
+        priv->header->n_accounts++;
+    }
+
+    slot = get_slot (self, i - 1);
+    slot->in_use = 1;
+    slot->enabled = mcd_account_is_enabled (account);
+    slot->valid = mcd_account_is_valid (account);
+    slot->changing_presence = mcd_account_get_changing_presence (account);
+    slot->connection_status = mcd_account_get_connection_status (account);
+    slot->connection_status_reason = reason;
+    slot->current_presence_type = curr_type;
+    slot->requested_presence_type = req_type;
+    copy_string (slot->unique_name, sizeof (slot->unique_name), name);
+    copy_string (slot->display_name, sizeof (slot->display_name),
+                 display_name);
+    copy_string (slot->current_status, sizeof (slot->current_status),
+                 curr_status);
+    copy_string (slot->current_message, sizeof (slot->current_message),
+                 curr_message);
+    copy_string (slot->requested_status, sizeof (slot->requested_status),
+                 req_status);
+    copy_string (slot->requested_message, sizeof (slot->requested_message),
+                 req_message);
+
+    write_end (self);
+
+    g_free (display_name);
+}
+
+/*
+ * _mcd_account_snapshot_remove:
+ * @self: the snapshot
+ * @unique_name: the unique name of an account that has gone away
+ *
+ * Free @unique_name's slot, if it has one.
+ */
+void
+_mcd_account_snapshot_remove (McdAccountSnapshot *self,
+                              const gchar *unique_name)
+{
+    McdAccountSnapshotPrivate *priv;
+    guint i;
+
+    g_return_if_fail (MCD_IS_ACCOUNT_SNAPSHOT (self));
+
+    priv = self->priv;
+
+    if (priv->header == NULL)
+        return;
+
+    i = GPOINTER_TO_UINT (g_hash_table_lookup (priv->slots, unique_name));
+
+    if (i == 0)
+        return;
+
+    write_begin (self);
+    memset (get_slot (self, i - 1), '\0', sizeof (McdAccountSnapshotSlot));
+    priv->header->n_accounts--;
+    write_end (self);
+
+    g_hash_table_remove (priv->slots, unique_name);
+    priv->free_slots = g_slist_prepend (priv->free_slots,
+                                        GUINT_TO_POINTER (i - 1));
+}
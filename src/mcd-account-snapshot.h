@@ -0,0 +1,139 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-account-snapshot.h - shared-memory snapshot of account states
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MCD_ACCOUNT_SNAPSHOT_H__
+#define __MCD_ACCOUNT_SNAPSHOT_H__
+
+#include <glib-object.h>
+
+#include "mcd-account.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The snapshot is a file in $XDG_RUNTIME_DIR/telepathy/mission-control
+ * (or $MC_SNAPSHOT_PATH, if set), which MC maps MAP_SHARED and local
+ * readers may map read-only. It consists of one McdAccountSnapshotHeader
+ * followed by header->n_slots fixed-size McdAccountSnapshotSlot records;
+ * slots with in_use == 0 are free.
+ *
+ * The header's sequence number is a seqlock: it is odd while MC is writing.
+ * A reader must copy out what it needs between
+ * mcd_account_snapshot_read_begin() and mcd_account_snapshot_read_retry(),
+ * and start again if the latter returns TRUE. If n_slots grows beyond what
+ * the reader has mapped, it must remap the file before retrying.
+ *
+ * All integers are in host byte order; strings are NUL-terminated UTF-8,
+ * truncated at a character boundary if they do not fit.
+ */
+
+#define MCD_ACCOUNT_SNAPSHOT_MAGIC 0x4e53434d   /* "MCSN" */
+#define MCD_ACCOUNT_SNAPSHOT_FORMAT 1
+
+typedef struct {
+    guint32 magic;
+    guint32 format;
+    /* seqlock: odd while an update is in progress */
+    volatile gint sequence;
+    guint32 n_slots;
+    guint32 slot_size;
+    guint32 n_accounts;
+} McdAccountSnapshotHeader;
+
+typedef struct {
+    guint32 in_use;
+    guint32 enabled;
+    guint32 valid;
+    guint32 changing_presence;
+    guint32 connection_status;
+    guint32 connection_status_reason;
+    guint32 current_presence_type;
+    guint32 requested_presence_type;
+    gchar unique_name[256];
+    gchar display_name[256];
+    gchar current_status[64];
+    gchar current_message[256];
+    gchar requested_status[64];
+    gchar requested_message[256];
+} McdAccountSnapshotSlot;
+
+static inline gint
+mcd_account_snapshot_read_begin (const McdAccountSnapshotHeader *header)
+{
+    gint seq;
+
+    do
+        seq = g_atomic_int_get (&header->sequence);
+    while (seq & 1);
+
+    return seq;
+}
+
+static inline gboolean
+mcd_account_snapshot_read_retry (const McdAccountSnapshotHeader *header,
+                                 gint seq)
+{
+    return g_atomic_int_get (&header->sequence) != seq;
+}
+
+typedef struct _McdAccountSnapshot McdAccountSnapshot;
+typedef struct _McdAccountSnapshotClass McdAccountSnapshotClass;
+typedef struct _McdAccountSnapshotPrivate McdAccountSnapshotPrivate;
+
+struct _McdAccountSnapshotClass {
+    GObjectClass parent_class;
+};
+
+struct _McdAccountSnapshot {
+    GObject parent;
+
+    McdAccountSnapshotPrivate *priv;
+};
+
+GType mcd_account_snapshot_get_type (void);
+
+G_GNUC_INTERNAL McdAccountSnapshot *mcd_account_snapshot_dup (void);
+G_GNUC_INTERNAL void _mcd_account_snapshot_update (McdAccountSnapshot *self,
+    McdAccount *account);
+G_GNUC_INTERNAL void _mcd_account_snapshot_remove (McdAccountSnapshot *self,
+    const gchar *unique_name);
+
+/* TYPE MACROS */
+#define MCD_TYPE_ACCOUNT_SNAPSHOT \
+  (mcd_account_snapshot_get_type ())
+#define MCD_ACCOUNT_SNAPSHOT(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), MCD_TYPE_ACCOUNT_SNAPSHOT, \
+                              McdAccountSnapshot))
+#define MCD_ACCOUNT_SNAPSHOT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), MCD_TYPE_ACCOUNT_SNAPSHOT, \
+                           McdAccountSnapshotClass))
+#define MCD_IS_ACCOUNT_SNAPSHOT(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), MCD_TYPE_ACCOUNT_SNAPSHOT))
+#define MCD_IS_ACCOUNT_SNAPSHOT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), MCD_TYPE_ACCOUNT_SNAPSHOT))
+#define MCD_ACCOUNT_SNAPSHOT_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), MCD_TYPE_ACCOUNT_SNAPSHOT, \
+                              McdAccountSnapshotClass))
+
+G_END_DECLS
+
+#endif /* __MCD_ACCOUNT_SNAPSHOT_H__ */
@@ -0,0 +1,261 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * This file is part of mission-control
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Each account counts what happens to it, and how long the things that
+ * take time took, so that "how many channels did this account dispatch?"
+ * and "how long does it take to connect?" can be answered on a production
+ * system. Counting is an increment; a latency is an increment of a log2
+ * histogram bucket plus a few comparisons, so this is always done. The
+ * results are only summarized when someone reads the Stats interface.
+ *
+ * Percentiles are taken from the histogram, so they are only accurate to
+ * within a factor of 2, and are never reported as more than the maximum.
+ */
+
+#include "config.h"
+
+#include "mcd-account-stats.h"
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+#include "mcd-account.h"
+
+#define N_BUCKETS 64
+
+typedef struct {
+    guint64 count;
+    guint64 total;
+    guint64 min;
+    guint64 max;
+    /* buckets[i] counts latencies of i significant bits, i.e. in the
+     * range [2**(i-1), 2**i) microseconds; buckets[0] counts zeroes */
+    guint32 buckets[N_BUCKETS];
+} McdLatency;
+
+struct _McdAccountStats {
+    /* g_get_real_time() / G_USEC_PER_SEC when counting started */
+    gint64 since;
+    guint64 counters[MCD_ACCOUNT_N_STATS];
+    McdLatency latencies[MCD_ACCOUNT_N_LATENCIES];
+};
+
+static const gchar * const counter_names[] = {
+    "requests",
+    "requests-succeeded",
+    "requests-failed",
+    "channels-dispatched",
+    "handlers-failed",
+    "connection-attempts",
+    "connections",
+    "connection-failures",
+    "connection-drops",
+    "reconnects",
+    "probation-drops",
+    "presence-changes",
+};
+
+static const gchar * const latency_names[] = {
+    "request",
+    "dispatch",
+    "connect",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (counter_names) == MCD_ACCOUNT_N_STATS);
+G_STATIC_ASSERT (G_N_ELEMENTS (latency_names) == MCD_ACCOUNT_N_LATENCIES);
+
+McdAccountStats *
+_mcd_account_stats_new (void)
+{
+    McdAccountStats *stats = g_slice_new0 (McdAccountStats);
+
+    stats->since = g_get_real_time () / G_USEC_PER_SEC;
+    return stats;
+}
+
+void
+_mcd_account_stats_free (McdAccountStats *stats)
+{
+    g_slice_free (McdAccountStats, stats);
+}
+
+void
+_mcd_account_stats_count (McdAccount *account,
+                          McdAccountStat stat)
+{
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+    g_return_if_fail (stat < MCD_ACCOUNT_N_STATS);
+
+    _mcd_account_get_stats (account)->counters[stat]++;
+}
+
+/*
+ * _mcd_account_stats_add_latency:
+ * @start_time: the g_get_monotonic_time() at which the operation started,
+ *  or 0 if unknown, in which case nothing is recorded
+ */
+void
+_mcd_account_stats_add_latency (McdAccount *account,
+                                McdAccountLatency latency,
+                                gint64 start_time)
+{
+    McdLatency *l;
+    guint64 usec;
+    guint bucket;
+
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+    g_return_if_fail (latency < MCD_ACCOUNT_N_LATENCIES);
+
+    if (start_time == 0)
+        return;
+
+    l = &_mcd_account_get_stats (account)->latencies[latency];
+    usec = (guint64) MAX (g_get_monotonic_time () - start_time, 0);
+
+    for (bucket = 0; bucket < N_BUCKETS - 1 && (usec >> bucket) != 0;
+         bucket++)
+        ;
+
+    if (l->count == 0 || usec < l->min)
+        l->min = usec;
+
+    if (usec > l->max)
+        l->max = usec;
+
+    l->count++;
+    l->total += usec;
+    l->buckets[bucket]++;
+}
+
+static guint64
+latency_percentile (const McdLatency *l,
+                    guint percent)
+{
+    guint64 rank = (l->count * percent + 99) / 100;
+    guint64 seen = 0;
+    guint i;
+
+    for (i = 0; i < N_BUCKETS; i++)
+    {
+        seen += l->buckets[i];
+
+        /* the upper bound of bucket i is 2**i - 1 */
+        if (seen >= rank)
+            return MIN (l->max, (G_GUINT64_CONSTANT (1) << i) - 1);
+    }
+
+    return l->max;
+}
+
+static void
+get_counters (TpSvcDBusProperties *self,
+              const gchar *name,
+              GValue *value)
+{
+    McdAccountStats *stats = _mcd_account_get_stats (MCD_ACCOUNT (self));
+    GVariantBuilder builder;
+    GVariant *variant;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+    for (i = 0; i < MCD_ACCOUNT_N_STATS; i++)
+        g_variant_builder_add (&builder, "{st}", counter_names[i],
+                               stats->counters[i]);
+
+    variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+    dbus_g_value_parse_g_variant (variant, value);
+    g_variant_unref (variant);
+}
+
+static void
+get_latencies (TpSvcDBusProperties *self,
+               const gchar *name,
+               GValue *value)
+{
+    McdAccountStats *stats = _mcd_account_get_stats (MCD_ACCOUNT (self));
+    GVariantBuilder builder;
+    GVariant *variant;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(ttttt)}"));
+
+    for (i = 0; i < MCD_ACCOUNT_N_LATENCIES; i++)
+    {
+        const McdLatency *l = &stats->latencies[i];
+
+        /* (count, min, mean, 95th percentile, max), in microseconds */
+        g_variant_builder_add (&builder, "{s(ttttt)}", latency_names[i],
+                               l->count, l->min,
+                               l->count == 0 ? 0 : l->total / l->count,
+                               latency_percentile (l, 95), l->max);
+    }
+
+    variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+    dbus_g_value_parse_g_variant (variant, value);
+    g_variant_unref (variant);
+}
+
+static void
+get_since (TpSvcDBusProperties *self,
+           const gchar *name,
+           GValue *value)
+{
+    McdAccountStats *stats = _mcd_account_get_stats (MCD_ACCOUNT (self));
+
+    g_value_init (value, G_TYPE_INT64);
+    g_value_set_int64 (value, stats->since);
+}
+
+const McdDBusProp account_stats_properties[] = {
+    { "Counters", NULL, get_counters },
+    { "Latencies", NULL, get_latencies },
+    { "Since", NULL, get_since },
+    { 0 }
+};
+
+/* The Stats interface has no methods or signals, so its GInterface is
+ * only a marker for mcd_dbus_init_interfaces() */
+GType
+mcd_svc_account_interface_stats_get_type (void)
+{
+    static gsize type = 0;
+
+    if (g_once_init_enter (&type))
+    {
+        GType t = g_type_register_static_simple (G_TYPE_INTERFACE,
+            g_intern_static_string ("McdSvcAccountInterfaceStats"),
+            sizeof (GTypeInterface), NULL, 0, NULL, 0);
+
+        g_once_init_leave (&type, t);
+    }
+
+    return type;
+}
+
+void
+account_stats_iface_init (gpointer g_iface G_GNUC_UNUSED,
+                          gpointer data G_GNUC_UNUSED)
+{
+}
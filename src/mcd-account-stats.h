@@ -0,0 +1,87 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * This file is part of mission-control
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __MCD_ACCOUNT_STATS_H__
+#define __MCD_ACCOUNT_STATS_H__
+
+#include "mcd-account-priv.h"
+
+G_BEGIN_DECLS
+
+#define MC_IFACE_ACCOUNT_INTERFACE_STATS \
+    "org.freedesktop.Telepathy.Account.Interface.Stats.DRAFT"
+
+/* Keep in sync with counter_names in mcd-account-stats.c */
+typedef enum {
+    MCD_ACCOUNT_STAT_REQUESTS,
+    MCD_ACCOUNT_STAT_REQUESTS_SUCCEEDED,
+    MCD_ACCOUNT_STAT_REQUESTS_FAILED,
+    MCD_ACCOUNT_STAT_CHANNELS_DISPATCHED,
+    MCD_ACCOUNT_STAT_HANDLERS_FAILED,
+    MCD_ACCOUNT_STAT_CONNECTION_ATTEMPTS,
+    MCD_ACCOUNT_STAT_CONNECTIONS,
+    MCD_ACCOUNT_STAT_CONNECTION_FAILURES,
+    MCD_ACCOUNT_STAT_CONNECTION_DROPS,
+    MCD_ACCOUNT_STAT_RECONNECTS,
+    MCD_ACCOUNT_STAT_PROBATION_DROPS,
+    MCD_ACCOUNT_STAT_PRESENCE_CHANGES,
+    MCD_ACCOUNT_N_STATS
+} McdAccountStat;
+
+/* Keep in sync with latency_names in mcd-account-stats.c */
+typedef enum {
+    /* from the ChannelRequest being created to it succeeding or failing */
+    MCD_ACCOUNT_LATENCY_REQUEST,
+    /* from the ChannelDispatchOperation being created to HandleChannels
+     * returning successfully */
+    MCD_ACCOUNT_LATENCY_DISPATCH,
+    /* from asking the connection manager to connect to reaching
+     * CONNECTED */
+    MCD_ACCOUNT_LATENCY_CONNECT,
+    MCD_ACCOUNT_N_LATENCIES
+} McdAccountLatency;
+
+typedef struct _McdAccountStats McdAccountStats;
+
+G_GNUC_INTERNAL McdAccountStats *_mcd_account_stats_new (void);
+G_GNUC_INTERNAL void _mcd_account_stats_free (McdAccountStats *stats);
+
+/* implemented in mcd-account.c */
+G_GNUC_INTERNAL McdAccountStats *_mcd_account_get_stats (McdAccount *account);
+
+G_GNUC_INTERNAL void _mcd_account_stats_count (McdAccount *account,
+                                               McdAccountStat stat);
+G_GNUC_INTERNAL void _mcd_account_stats_add_latency (McdAccount *account,
+    McdAccountLatency latency,
+    gint64 start_time);
+
+G_GNUC_INTERNAL GType mcd_svc_account_interface_stats_get_type (void);
+
+G_GNUC_INTERNAL extern const McdDBusProp account_stats_properties[];
+
+G_GNUC_INTERNAL void account_stats_iface_init (gpointer g_iface,
+                                               gpointer data);
+
+G_END_DECLS
+
+#endif
@@ -22,6 +22,9 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_ACCOUNT
+
 #include "mcd-account.h"
 
 #include <errno.h>
@@ -36,16 +39,23 @@
 #include "mcd-account-priv.h"
 #include "mcd-account-manager-priv.h"
 #include "mcd-account-addressing.h"
+#include "mcd-account-snapshot.h"
+#include "mcd-account-stats.h"
 #include "mcd-connection-priv.h"
 #include "mcd-misc.h"
 #include "mcd-manager.h"
 #include "mcd-manager-priv.h"
 #include "mcd-master.h"
 #include "mcd-master-priv.h"
+#include "mcd-memory.h"
 #include "mcd-dbusprop.h"
+#include "mcd-timeout.h"
 
 #define MC_OLD_AVATAR_FILENAME	"avatar.bin"
 
+/* Granularity, in seconds, of the LastUsed attribute in storage */
+#define LAST_USED_RESOLUTION (60 * 60)
+
 #define MCD_ACCOUNT_PRIV(account) (MCD_ACCOUNT (account)->priv)
 
 static void account_iface_init (TpSvcAccountClass *iface,
@@ -73,6 +83,9 @@ static const McdInterfaceData account_interfaces[] = {
     MCD_IMPLEMENT_IFACE (tp_svc_account_interface_addressing_get_type,
         account_addressing,
         TP_IFACE_ACCOUNT_INTERFACE_ADDRESSING),
+    MCD_IMPLEMENT_IFACE (mcd_svc_account_interface_stats_get_type,
+        account_stats,
+        MC_IFACE_ACCOUNT_INTERFACE_STATS),
 
     { NULL, }
 };
@@ -109,6 +122,7 @@ struct _McdAccountPrivate
     TpDBusDaemon *dbus_daemon;
     gboolean registered;
     McdConnectivityMonitor *connectivity;
+    McdAccountSnapshot *snapshot;
 
     McdAccountConnectionContext *connection_context;
     GKeyFile *keyfile;		/* configuration file */
@@ -150,6 +164,11 @@ struct _McdAccountPrivate
     gboolean enabled;
     gboolean loaded;
     gboolean has_been_online;
+    gint connection_priority;
+    /* seconds since the epoch; the stored copy is only updated when it is
+     * more than LAST_USED_RESOLUTION out of date */
+    gint64 last_used;
+    gint64 stored_last_used;
     gboolean removed;
     gboolean changing_presence;
     gboolean setting_avatar;
@@ -166,6 +185,8 @@ struct _McdAccountPrivate
     guint properties_source;
 
     gboolean password_saved;
+
+    McdAccountStats *stats;
 };
 
 enum
@@ -660,6 +681,9 @@ mcd_account_delete_async (McdAccount *account,
         tp_svc_account_emit_removed (account);
     }
 
+    if (priv->snapshot != NULL)
+        _mcd_account_snapshot_remove (priv->snapshot, priv->unique_name);
+
     unregister_dbus_service (account);
 
     g_task_return_boolean (task, TRUE);
@@ -862,11 +886,16 @@ emit_property_changed (gpointer userdata)
         tp_svc_account_emit_account_property_changed (account,
             priv->changed_properties);
         g_hash_table_remove_all (priv->changed_properties);
+
+        /* local readers of the snapshot see the same batches of changes as
+         * D-Bus clients do */
+        if (priv->snapshot != NULL && !priv->removed)
+            _mcd_account_snapshot_update (priv->snapshot, account);
     }
 
     if (priv->properties_source != 0)
     {
-      g_source_remove (priv->properties_source);
+      mcd_timeout_remove (priv->properties_source);
       priv->properties_source = 0;
     }
     return FALSE;
@@ -919,10 +948,10 @@ mcd_account_changed_property (McdAccount *account, const gchar *key,
     if (priv->properties_source == 0)
     {
         DEBUG ("First changed property");
-        priv->properties_source = g_timeout_add_full (G_PRIORITY_DEFAULT, 10,
-                                                      emit_property_changed,
-                                                      g_object_ref (account),
-                                                      g_object_unref);
+        priv->properties_source = mcd_timeout_add_full (10, 10,
+                                                        emit_property_changed,
+                                                        g_object_ref (account),
+                                                        g_object_unref);
     }
     g_hash_table_insert (priv->changed_properties, (gpointer) key,
                          tp_g_value_slice_dup (value));
@@ -2670,34 +2699,78 @@ out:
     g_clear_object (&protocol);
 }
 
+typedef struct {
+    McdAccountSetParametersCb callback;
+    gpointer user_data;
+} UpdateParametersData;
+
 static void
-account_update_parameters_cb (McdAccount *account, GPtrArray *not_yet,
-                              const GError *error, gpointer user_data)
+update_parameters_cb (McdAccount *account, GPtrArray *not_yet,
+                      const GError *error, gpointer user_data)
 {
+    UpdateParametersData *data = user_data;
     McdAccountPrivate *priv = account->priv;
-    DBusGMethodInvocation *context = (DBusGMethodInvocation *) user_data;
     const gchar *account_name = mcd_account_get_unique_name (account);
     GHashTable *params;
     GValue value = G_VALUE_INIT;
 
     if (error != NULL)
-    {
-        dbus_g_method_return_error (context, (GError *) error);
-        return;
-    }
+        goto out;
 
     /* Emit the PropertiesChanged signal */
     params = _mcd_account_dup_parameters (account);
-    g_return_if_fail (params != NULL);
 
-    g_value_init (&value, TP_HASH_TYPE_STRING_VARIANT_MAP);
-    g_value_take_boxed (&value, params);
-    mcd_account_changed_property (account, "Parameters", &value);
-    g_value_unset (&value);
+    if (params != NULL)
+    {
+        g_value_init (&value, TP_HASH_TYPE_STRING_VARIANT_MAP);
+        g_value_take_boxed (&value, params);
+        mcd_account_changed_property (account, "Parameters", &value);
+        g_value_unset (&value);
+    }
 
     /* Commit the changes to disk */
     mcd_storage_commit (priv->storage, account_name);
 
+out:
+    data->callback (account, not_yet, error, data->user_data);
+    g_slice_free (UpdateParametersData, data);
+}
+
+/*
+ * _mcd_account_update_parameters:
+ *
+ * Like _mcd_account_set_parameters(), but also signal the change to the
+ * Parameters property and commit the result, as UpdateParameters does.
+ */
+void
+_mcd_account_update_parameters (McdAccount *account,
+                                GHashTable *set,
+                                const gchar **unset,
+                                McdAccountSetParametersCb callback,
+                                gpointer user_data)
+{
+    UpdateParametersData *data = g_slice_new0 (UpdateParametersData);
+
+    g_return_if_fail (callback != NULL);
+
+    data->callback = callback;
+    data->user_data = user_data;
+    _mcd_account_set_parameters (account, set, unset, update_parameters_cb,
+                                 data);
+}
+
+static void
+account_update_parameters_cb (McdAccount *account, GPtrArray *not_yet,
+                              const GError *error, gpointer user_data)
+{
+    DBusGMethodInvocation *context = (DBusGMethodInvocation *) user_data;
+
+    if (error != NULL)
+    {
+        dbus_g_method_return_error (context, (GError *) error);
+        return;
+    }
+
     /* And finally, return from UpdateParameters() */
     g_ptr_array_add (not_yet, NULL);
     tp_svc_account_return_from_update_parameters (context,
@@ -2713,8 +2786,8 @@ account_update_parameters (TpSvcAccount *self, GHashTable *set,
 
     DEBUG ("called for %s", priv->unique_name);
 
-    _mcd_account_set_parameters (account, set, unset,
-                                 account_update_parameters_cb, context);
+    _mcd_account_update_parameters (account, set, unset,
+                                    account_update_parameters_cb, context);
 }
 
 void
@@ -2803,6 +2876,9 @@ register_dbus_service (McdAccount *self,
     dbus_daemon = self->priv->dbus_daemon;
     g_return_if_fail (dbus_daemon != NULL);
 
+    if (self->priv->registered)
+        return;
+
     dbus_connection = tp_proxy_get_dbus_connection (TP_PROXY (dbus_daemon));
 
     if (G_LIKELY (dbus_connection)) {
@@ -2814,6 +2890,24 @@ register_dbus_service (McdAccount *self,
     }
 }
 
+/*
+ * _mcd_account_ensure_registered:
+ * @account: the #McdAccount
+ *
+ * Export @account on D-Bus now, without waiting for it to finish loading.
+ * This is for accounts that are only created when a D-Bus method call
+ * addresses them: the call can then be dispatched to the new object. Valid
+ * and the other properties that depend on loading are signalled as usual
+ * once it has loaded.
+ */
+void
+_mcd_account_ensure_registered (McdAccount *account)
+{
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+
+    register_dbus_service (account, NULL, NULL);
+}
+
 /*
  * @account: (allow-none):
  * @dir_out: (out): e.g. ~/.local/share/telepathy/mission-control
@@ -3029,6 +3123,7 @@ mcd_account_setup (McdAccount *account)
     McdStorage *storage = priv->storage;
     const gchar *name = mcd_account_get_unique_name (account);
     GValue value = G_VALUE_INIT;
+    GVariant *variant;
 
     priv->manager_name =
       mcd_storage_dup_string (storage, name, MC_ACCOUNTS_KEY_MANAGER);
@@ -3059,30 +3154,40 @@ mcd_account_setup (McdAccount *account)
     priv->has_been_online =
       mcd_storage_get_boolean (storage, name, MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE);
 
+    priv->connection_priority = mcd_storage_get_integer (storage, name,
+        MC_ACCOUNTS_KEY_CONNECTION_PRIORITY);
+
+    variant = mcd_storage_dup_attribute (storage, name,
+                                         MC_ACCOUNTS_KEY_LAST_USED,
+                                         G_VARIANT_TYPE_INT64, NULL);
+
+    if (variant != NULL)
+    {
+        priv->last_used = g_variant_get_int64 (variant);
+        priv->stored_last_used = priv->last_used;
+        g_variant_unref (variant);
+    }
+
     /* special case flag (for ring accounts, so far) */
     priv->always_dispatch =
       mcd_storage_get_boolean (storage, name, MC_ACCOUNTS_KEY_ALWAYS_DISPATCH);
 
-    g_value_init (&value, TP_STRUCT_TYPE_SIMPLE_PRESENCE);
-
     g_free (priv->auto_presence_status);
     g_free (priv->auto_presence_message);
 
-    if (mcd_storage_get_attribute (storage, name,
-                                   MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE,
-                                   G_VARIANT_TYPE ("(uss)"), &value,
-                                   NULL))
-    {
-        GValueArray *va = g_value_get_boxed (&value);
+    variant = mcd_storage_dup_attribute (storage, name,
+                                         MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE,
+                                         G_VARIANT_TYPE ("(uss)"), NULL);
 
-        priv->auto_presence_type = g_value_get_uint (va->values + 0);
-        priv->auto_presence_status = g_value_dup_string (va->values + 1);
-        priv->auto_presence_message = g_value_dup_string (va->values + 2);
+    if (variant != NULL)
+    {
+        guint type;
 
-        if (priv->auto_presence_status == NULL)
-            priv->auto_presence_status = g_strdup ("");
-        if (priv->auto_presence_message == NULL)
-            priv->auto_presence_message = g_strdup ("");
+        g_variant_get (variant, "(uss)", &type,
+                       &priv->auto_presence_status,
+                       &priv->auto_presence_message);
+        priv->auto_presence_type = type;
+        g_variant_unref (variant);
     }
     else
     {
@@ -3103,6 +3208,7 @@ mcd_account_setup (McdAccount *account)
             priv->auto_presence_message = g_strdup ("");
 
         /* migrate to a more sensible storage format */
+        g_value_init (&value, TP_STRUCT_TYPE_SIMPLE_PRESENCE);
         g_value_take_boxed (&value, tp_value_array_build (3,
                 G_TYPE_UINT, (guint) priv->auto_presence_type,
                 G_TYPE_STRING, priv->auto_presence_status,
@@ -3124,6 +3230,8 @@ mcd_account_setup (McdAccount *account)
                                        NULL);
             mcd_storage_commit (storage, name);
         }
+
+        g_value_unset (&value);
     }
 
     /* If invalid or something, force it to AVAILABLE - we want the auto
@@ -3135,25 +3243,27 @@ mcd_account_setup (McdAccount *account)
         priv->auto_presence_status = g_strdup ("available");
     }
 
-    g_value_unset (&value);
-    g_value_init (&value, TP_ARRAY_TYPE_OBJECT_PATH_LIST);
-
     if (priv->supersedes != NULL)
         g_ptr_array_unref (priv->supersedes);
 
-    if (mcd_storage_get_attribute (storage, name,
-                                   MC_ACCOUNTS_KEY_SUPERSEDES,
-                                   G_VARIANT_TYPE_OBJECT_PATH_ARRAY,
-                                   &value, NULL))
-    {
-        priv->supersedes = g_value_dup_boxed (&value);
-    }
-    else
+    priv->supersedes = g_ptr_array_new_with_free_func (g_free);
+    variant = mcd_storage_dup_attribute (storage, name,
+                                         MC_ACCOUNTS_KEY_SUPERSEDES,
+                                         G_VARIANT_TYPE_OBJECT_PATH_ARRAY,
+                                         NULL);
+
+    if (variant != NULL)
     {
-        priv->supersedes = g_ptr_array_new ();
-    }
+        GVariantIter iter;
+        const gchar *path;
 
-    g_value_unset (&value);
+        g_variant_iter_init (&iter, variant);
+
+        while (g_variant_iter_next (&iter, "&o", &path))
+            g_ptr_array_add (priv->supersedes, g_strdup (path));
+
+        g_variant_unref (variant);
+    }
 
     /* check the manager */
     if (!priv->manager && !load_manager (account))
@@ -3254,7 +3364,7 @@ _mcd_account_finalize (GObject *object)
     if (priv->changed_properties)
 	g_hash_table_unref (priv->changed_properties);
     if (priv->properties_source != 0)
-	g_source_remove (priv->properties_source);
+	mcd_timeout_remove (priv->properties_source);
 
     tp_clear_pointer (&priv->curr_presence_status, g_free);
     tp_clear_pointer (&priv->curr_presence_message, g_free);
@@ -3270,6 +3380,8 @@ _mcd_account_finalize (GObject *object)
     tp_clear_pointer (&priv->unique_name, g_free);
     tp_clear_pointer (&priv->object_path, g_free);
 
+    tp_clear_pointer (&priv->stats, _mcd_account_stats_free);
+
     G_OBJECT_CLASS (mcd_account_parent_class)->finalize (object);
 }
 
@@ -3316,6 +3428,12 @@ _mcd_account_dispose (GObject *object)
     tp_clear_object (&priv->self_contact);
     tp_clear_object (&priv->connectivity);
 
+    if (priv->snapshot != NULL)
+    {
+        _mcd_account_snapshot_remove (priv->snapshot, priv->unique_name);
+        g_clear_object (&priv->snapshot);
+    }
+
     tp_clear_pointer (&self->priv->connection_context,
         _mcd_account_connection_context_free);
     _mcd_account_set_connection (self, NULL);
@@ -3357,16 +3475,9 @@ monitor_state_changed_cb (
 {
   McdAccount *self = MCD_ACCOUNT (user_data);
 
-  if (connected)
-    {
-      if (mcd_account_would_like_to_connect (self))
-        {
-          DEBUG ("account %s would like to connect",
-              self->priv->unique_name);
-          _mcd_account_connect_with_auto_presence (self, FALSE);
-        }
-    }
-  else
+  /* If we've gone online, the McdAccountManager connects the accounts that
+   * would like to connect, in order of priority. */
+  if (!connected)
     {
       if (_mcd_account_needs_dispatch (self))
         {
@@ -3415,6 +3526,9 @@ _mcd_account_constructed (GObject *object)
     mcd_account_migrate_avatar (account);
     mcd_account_setup (account);
 
+    account->priv->snapshot = mcd_account_snapshot_dup ();
+    _mcd_account_snapshot_update (account->priv->snapshot, account);
+
     tp_g_signal_connect_object (account->priv->connectivity, "state-change",
         (GCallback) monitor_state_changed_cb, account, 0);
 }
@@ -3514,6 +3628,8 @@ mcd_account_init (McdAccount *account)
     priv->auto_presence_status = g_strdup ("available");
     priv->auto_presence_message = g_strdup ("");
 
+    priv->stats = _mcd_account_stats_new ();
+
     /* initializes the interfaces */
     mcd_dbus_init_interfaces_instances (account);
 
@@ -3556,6 +3672,12 @@ _mcd_account_get_storage (McdAccount *account)
     return account->priv->storage;
 }
 
+McdAccountStats *
+_mcd_account_get_stats (McdAccount *account)
+{
+    return account->priv->stats;
+}
+
 McpAccountStorage *
 mcd_account_get_storage_plugin (McdAccount *account)
 {
@@ -3798,6 +3920,8 @@ mcd_account_update_self_presence (McdAccount *account,
 
     if (!changed) return;
 
+    _mcd_account_stats_count (account, MCD_ACCOUNT_STAT_PRESENCE_CHANGES);
+
     g_value_init (&value, TP_STRUCT_TYPE_SIMPLE_PRESENCE);
     g_value_take_boxed (&value,
                         tp_value_array_build (3,
@@ -4383,6 +4507,20 @@ mcd_account_get_connection_status (McdAccount *account)
     return priv->conn_status;
 }
 
+TpConnectionStatusReason
+mcd_account_get_connection_status_reason (McdAccount *account)
+{
+    McdAccountPrivate *priv = MCD_ACCOUNT_PRIV (account);
+    return priv->conn_reason;
+}
+
+gboolean
+mcd_account_get_changing_presence (McdAccount *account)
+{
+    McdAccountPrivate *priv = MCD_ACCOUNT_PRIV (account);
+    return priv->changing_presence;
+}
+
 void
 _mcd_account_tp_connection_changed (McdAccount *account,
                                     TpConnection *tp_conn)
@@ -4959,6 +5097,58 @@ _mcd_account_set_has_been_online (McdAccount *account)
     }
 }
 
+gint
+_mcd_account_get_connection_priority (McdAccount *self)
+{
+    g_return_val_if_fail (MCD_IS_ACCOUNT (self), 0);
+
+    return self->priv->connection_priority;
+}
+
+gint64
+_mcd_account_get_last_used (McdAccount *self)
+{
+    g_return_val_if_fail (MCD_IS_ACCOUNT (self), 0);
+
+    return self->priv->last_used;
+}
+
+/*
+ * _mcd_account_set_last_used:
+ * @self: the #McdAccount
+ *
+ * Record that a channel was dispatched for this account, so that it is
+ * connected before less recently used accounts next time.
+ */
+void
+_mcd_account_set_last_used (McdAccount *self)
+{
+    McdAccountPrivate *priv;
+
+    g_return_if_fail (MCD_IS_ACCOUNT (self));
+    priv = self->priv;
+
+    priv->last_used = g_get_real_time () / G_USEC_PER_SEC;
+
+    /* the ordering only needs to be approximately right, so don't write to
+     * storage for every channel */
+    if (priv->last_used - priv->stored_last_used >= LAST_USED_RESOLUTION &&
+        !priv->removed)
+    {
+        GValue value = G_VALUE_INIT;
+
+        g_value_init (&value, G_TYPE_INT64);
+        g_value_set_int64 (&value, priv->last_used);
+
+        if (mcd_storage_set_attribute (priv->storage, priv->unique_name,
+                                       MC_ACCOUNTS_KEY_LAST_USED, &value))
+            mcd_storage_commit (priv->storage, priv->unique_name);
+
+        priv->stored_last_used = priv->last_used;
+        g_value_unset (&value);
+    }
+}
+
 gboolean
 _mcd_account_needs_dispatch (McdAccount *self)
 {
@@ -5137,3 +5327,52 @@ mcd_account_connection_proceed_with_reason (McdAccount *account,
             _mcd_account_connection_context_free);
     }
 }
+
+void
+_mcd_account_add_memory_report (McdAccount *self,
+                                GVariantBuilder *report,
+                                guint depth)
+{
+    McdAccountPrivate *priv = self->priv;
+    GHashTableIter iter;
+    gpointer v;
+    gsize size;
+    guint i;
+
+    size = mcd_memory_instance_size (self) + sizeof (McdAccountPrivate) +
+        mcd_memory_string_size (priv->unique_name) +
+        mcd_memory_string_size (priv->object_path) +
+        mcd_memory_string_size (priv->manager_name) +
+        mcd_memory_string_size (priv->protocol_name) +
+        mcd_memory_string_size (priv->conn_dbus_error) +
+        mcd_memory_asv_size (priv->conn_error_details) +
+        mcd_memory_string_size (priv->curr_presence_status) +
+        mcd_memory_string_size (priv->curr_presence_message) +
+        mcd_memory_string_size (priv->req_presence_status) +
+        mcd_memory_string_size (priv->req_presence_message) +
+        mcd_memory_string_size (priv->auto_presence_status) +
+        mcd_memory_string_size (priv->auto_presence_message) +
+        g_list_length (priv->online_requests) * sizeof (GList);
+
+    if (priv->supersedes != NULL)
+    {
+        size += sizeof (GPtrArray) + priv->supersedes->len * sizeof (gpointer);
+
+        for (i = 0; i < priv->supersedes->len; i++)
+            size += mcd_memory_string_size (
+                g_ptr_array_index (priv->supersedes, i));
+    }
+
+    /* keys are static strings */
+    size += mcd_memory_hash_table_size (priv->changed_properties);
+    g_hash_table_iter_init (&iter, priv->changed_properties);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+        size += mcd_memory_value_size (v);
+
+    if (priv->invalid_reason != NULL)
+        size += sizeof (GError) +
+            mcd_memory_string_size (priv->invalid_reason->message);
+
+    mcd_memory_report_add (report, depth, self, priv->unique_name, size);
+}
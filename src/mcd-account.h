@@ -120,6 +120,9 @@ void mcd_account_get_requested_presence (McdAccount *account,
 gboolean mcd_account_would_like_to_connect (McdAccount *account);
 
 TpConnectionStatus mcd_account_get_connection_status (McdAccount *account);
+TpConnectionStatusReason mcd_account_get_connection_status_reason (
+    McdAccount *account);
+gboolean mcd_account_get_changing_presence (McdAccount *account);
 
 McdConnection *mcd_account_get_connection (McdAccount *account);
 
@@ -72,6 +72,9 @@ G_GNUC_INTERNAL gboolean _mcd_channel_is_primary_for_path (McdChannel *self,
 
 G_GNUC_INTERNAL McdChannel *_mcd_channel_new_request (McdRequest *request);
 
+G_GNUC_INTERNAL void _mcd_channel_add_memory_report (McdChannel *self,
+    GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 #endif
 
@@ -37,6 +37,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include "mcd-channel.h"
 
 #include <telepathy-glib/telepathy-glib.h>
@@ -46,6 +48,7 @@
 #include "mcd-account-priv.h"
 #include "mcd-channel-priv.h"
 #include "mcd-enum-types.h"
+#include "mcd-memory.h"
 #include "request.h"
 
 #define MCD_CHANNEL_PRIV(channel) (MCD_CHANNEL (channel)->priv)
@@ -1162,3 +1165,24 @@ _mcd_channel_is_primary_for_path (McdChannel *self,
 
     return TRUE;
 }
+
+void
+_mcd_channel_add_memory_report (McdChannel *self,
+                                GVariantBuilder *report,
+                                guint depth)
+{
+    GVariant *props = mcd_channel_dup_immutable_properties (self);
+    gsize size = mcd_memory_instance_size (self) + sizeof (McdChannelPrivate);
+
+    /* the TpChannel keeps its immutable properties, which are most of the
+     * data it holds; their serialized size is a reasonable estimate */
+    if (self->priv->tp_chan != NULL)
+        size += mcd_memory_instance_size (self->priv->tp_chan) +
+            mcd_memory_variant_size (props);
+
+    size += g_list_length (self->priv->satisfied_requests) * sizeof (GList);
+
+    mcd_memory_report_add (report, depth, self,
+                           mcd_channel_get_object_path (self), size);
+    tp_clear_pointer (&props, g_variant_unref);
+}
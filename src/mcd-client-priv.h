@@ -100,7 +100,9 @@ G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_bypass_approval
 G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_delay_approvers
     (McdClientProxy *self);
 
-G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_dup_handler_capabilities (
+G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_get_handler_capabilities (
+    McdClientProxy *self);
+G_GNUC_INTERNAL const gchar *_mcd_client_proxy_get_handler_capabilities_digest (
     McdClientProxy *self);
 
 G_GNUC_INTERNAL void _mcd_client_proxy_inc_ready_lock (McdClientProxy *self);
@@ -121,6 +123,9 @@ G_GNUC_INTERNAL void _mcd_client_proxy_handle_channels (McdClientProxy *self,
 G_GNUC_INTERNAL void _mcd_client_recover_observer (McdClientProxy *self,
     TpChannel *channel, const gchar *account_path);
 
+G_GNUC_INTERNAL void _mcd_client_proxy_add_memory_report (
+    McdClientProxy *self, GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 
 #endif
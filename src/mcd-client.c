@@ -24,6 +24,9 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_CLIENT_REGISTRY
+
 #include "mcd-client-priv.h"
 
 #include <errno.h>
@@ -36,6 +39,7 @@
 #include "channel-utils.h"
 #include "mcd-channel-priv.h"
 #include "mcd-debug.h"
+#include "mcd-memory.h"
 
 G_DEFINE_TYPE (McdClientProxy, _mcd_client_proxy, TP_TYPE_CLIENT);
 
@@ -95,9 +99,22 @@ struct _McdClientProxyPrivate
     GList *handler_filters;
     GList *observer_filters;
 
+    /* handler_filters and capability_tokens in the form used by
+     * UpdateCapabilities, and a digest of them; built on demand, and
+     * discarded when either changes */
+    GValueArray *handler_capabilities;
+    gchar *handler_capabilities_digest;
+
     gboolean disposed;
 };
 
+static void
+mcd_client_proxy_forget_handler_capabilities (McdClientProxy *self)
+{
+    tp_clear_pointer (&self->priv->handler_capabilities, g_value_array_free);
+    tp_clear_pointer (&self->priv->handler_capabilities_digest, g_free);
+}
+
 typedef enum
 {
     MCD_CLIENT_APPROVER,
@@ -515,6 +532,7 @@ _mcd_client_proxy_set_cap_tokens (McdClientProxy *self,
 {
     g_strfreev (self->priv->capability_tokens);
     self->priv->capability_tokens = g_strdupv (cap_tokens);
+    mcd_client_proxy_forget_handler_capabilities (self);
 }
 
 static void
@@ -1016,6 +1034,7 @@ mcd_client_proxy_finalize (GObject *object)
     _mcd_client_proxy_take_approver_filters (self, NULL);
     _mcd_client_proxy_take_observer_filters (self, NULL);
     _mcd_client_proxy_take_handler_filters (self, NULL);
+    mcd_client_proxy_forget_handler_capabilities (self);
 
     if (chain_up != NULL)
     {
@@ -1349,6 +1368,7 @@ _mcd_client_proxy_take_handler_filters (McdClientProxy *self,
 
     mcd_client_proxy_free_client_filters (&(self->priv->handler_filters));
     self->priv->handler_filters = filters;
+    mcd_client_proxy_forget_handler_capabilities (self);
 }
 
 gboolean
@@ -1382,6 +1402,7 @@ _mcd_client_proxy_become_incapable (McdClientProxy *self)
     _mcd_client_proxy_take_observer_filters (self, NULL);
     _mcd_client_proxy_take_handler_filters (self, NULL);
     tp_clear_pointer (&self->priv->capability_tokens, g_strfreev);
+    mcd_client_proxy_forget_handler_capabilities (self);
 
     if (handler_was_capable)
     {
@@ -1389,16 +1410,51 @@ _mcd_client_proxy_become_incapable (McdClientProxy *self)
     }
 }
 
-GValueArray *
-_mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
+static void
+checksum_filter (GChecksum *checksum,
+                 GHashTable *filter)
+{
+    GList *keys, *l;
+
+    /* hash tables have no defined order, so sort the properties */
+    keys = g_list_sort (g_hash_table_get_keys (filter),
+                        (GCompareFunc) g_strcmp0);
+
+    g_checksum_update (checksum, (const guchar *) "{", -1);
+
+    for (l = keys; l != NULL; l = l->next)
+    {
+        /* g_strdup_value_contents() would show boxed values as pointers,
+         * so equal filters could get different digests; serialize the
+         * value instead, with its type so that 1 and uint32 1 differ */
+        GVariant *v = g_variant_ref_sink (dbus_g_value_build_g_variant (
+            g_hash_table_lookup (filter, l->data)));
+        gchar *contents = g_variant_print (v, TRUE);
+
+        g_checksum_update (checksum, (const guchar *) l->data, -1);
+        g_checksum_update (checksum, (const guchar *) "=", -1);
+        g_checksum_update (checksum, (const guchar *) contents, -1);
+        g_checksum_update (checksum, (const guchar *) "\n", -1);
+        g_free (contents);
+        g_variant_unref (v);
+    }
+
+    g_checksum_update (checksum, (const guchar *) "}", -1);
+    g_list_free (keys);
+}
+
+static void
+mcd_client_proxy_build_handler_capabilities (McdClientProxy *self)
 {
     GPtrArray *filters;
     GStrv cap_tokens;
     GValueArray *va;
+    GChecksum *checksum;
     const GList *list;
     gchar *empty_strv[] = { NULL };
+    guint i;
 
-    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
 
     filters = g_ptr_array_sized_new (
         g_list_length (self->priv->handler_filters));
@@ -1412,6 +1468,7 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
                                 (GBoxedCopyFunc) g_strdup,
                                 (GBoxedCopyFunc) tp_g_value_slice_dup);
         g_ptr_array_add (filters, copy);
+        checksum_filter (checksum, list->data);
     }
 
     cap_tokens = self->priv->capability_tokens;
@@ -1419,10 +1476,14 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
     if (cap_tokens == NULL)
         cap_tokens = empty_strv;
 
-    if (DEBUGGING)
+    for (i = 0; cap_tokens[i] != NULL; i++)
     {
-        guint i;
+        g_checksum_update (checksum, (const guchar *) cap_tokens[i], -1);
+        g_checksum_update (checksum, (const guchar *) "\n", -1);
+    }
 
+    if (DEBUGGING_VERBOSE)
+    {
         DEBUG ("%s:", tp_proxy_get_bus_name (self));
 
         DEBUG ("- %u channel filters", filters->len);
@@ -1449,9 +1510,48 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
     g_value_take_boxed (va->values + 1, filters);
     g_value_set_boxed (va->values + 2, cap_tokens);
 
-    return va;
+    self->priv->handler_capabilities = va;
+    self->priv->handler_capabilities_digest =
+        g_strdup (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+}
+
+/*
+ * _mcd_client_proxy_get_handler_capabilities:
+ *
+ * Returns: (transfer none): this client's entry for UpdateCapabilities,
+ *  valid until its handler filters or capability tokens change
+ */
+GValueArray *
+_mcd_client_proxy_get_handler_capabilities (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
+
+    if (self->priv->handler_capabilities == NULL)
+        mcd_client_proxy_build_handler_capabilities (self);
+
+    return self->priv->handler_capabilities;
 }
 
+/*
+ * _mcd_client_proxy_get_handler_capabilities_digest:
+ *
+ * Returns: a string that is the same for any two sets of handler
+ *  capabilities that would be represented identically by
+ *  _mcd_client_proxy_get_handler_capabilities()
+ */
+const gchar *
+_mcd_client_proxy_get_handler_capabilities_digest (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
+
+    if (self->priv->handler_capabilities_digest == NULL)
+        mcd_client_proxy_build_handler_capabilities (self);
+
+    return self->priv->handler_capabilities_digest;
+}
+
+
 /* returns TRUE if the channel matches one property criteria
  */
 static gboolean
@@ -1711,3 +1811,38 @@ _mcd_client_proxy_handle_channels (McdClientProxy *self,
     g_ptr_array_unref (requests_satisfied);
     g_hash_table_unref (handler_info);
 }
+
+static gsize
+filters_size (GList *filters)
+{
+    gsize size = 0;
+
+    for (; filters != NULL; filters = filters->next)
+        size += sizeof (GList) + mcd_memory_asv_size (filters->data);
+
+    return size;
+}
+
+void
+_mcd_client_proxy_add_memory_report (McdClientProxy *self,
+                                     GVariantBuilder *report,
+                                     guint depth)
+{
+    McdClientProxyPrivate *priv = self->priv;
+    gsize size;
+
+    size = mcd_memory_instance_size (self) + sizeof (McdClientProxyPrivate) +
+        mcd_memory_strv_size ((const gchar * const *) priv->capability_tokens) +
+        mcd_memory_string_size (priv->unique_name) +
+        filters_size (priv->approver_filters) +
+        filters_size (priv->handler_filters) +
+        filters_size (priv->observer_filters) +
+        mcd_memory_string_size (priv->handler_capabilities_digest);
+
+    if (priv->handler_capabilities != NULL)
+        size += sizeof (GValueArray) +
+            priv->handler_capabilities->n_values * sizeof (GValue);
+
+    mcd_memory_report_add (report, depth, self,
+                           tp_proxy_get_bus_name (self), size);
+}
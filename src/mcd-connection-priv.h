@@ -64,6 +64,11 @@ G_GNUC_INTERNAL gboolean _mcd_connection_target_id_is_urgent (McdConnection *con
 G_GNUC_INTERNAL gboolean _mcd_connection_target_handle_is_urgent (McdConnection *self,
     guint handle);
 
+G_GNUC_INTERNAL void _mcd_connection_add_memory_report (McdConnection *self,
+    GVariantBuilder *report, guint depth);
+
+G_GNUC_INTERNAL void _mcd_connection_free_presence_tables (void);
+
 G_END_DECLS
 
 #endif
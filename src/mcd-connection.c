@@ -35,6 +35,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_CONNECTION
+
 #include "mcd-connection.h"
 #include "mcd-connection-service-points.h"
 
@@ -57,12 +59,15 @@
 #include <telepathy-glib/proxy-subclass.h>
 
 #include "mcd-account-priv.h"
+#include "mcd-account-stats.h"
 #include "mcd-channel-priv.h"
 #include "mcd-connection-priv.h"
 #include "mcd-dispatcher-priv.h"
+#include "mcd-memory.h"
 #include "mcd-channel.h"
 #include "mcd-misc.h"
 #include "mcd-slacker.h"
+#include "mcd-timeout.h"
 #include "sp_timestamp.h"
 
 #define INITIAL_RECONNECTION_TIME   3 /* seconds */
@@ -74,6 +79,25 @@
 G_DEFINE_TYPE (McdConnection, mcd_connection, MCD_TYPE_OPERATION);
 
 /* Private */
+typedef struct
+{
+    TpConnectionPresenceType presence;
+    gchar *status;
+    gchar *message;
+} McdPresenceRequest;
+
+typedef struct
+{
+    gint refcount;
+    /* mcd_presence_table_digest() of the statuses */
+    guint digest;
+    /* status => McdPresenceInfo */
+    GHashTable *statuses;
+    /* what to set if the requested status is not in @statuses, indexed by
+     * presence type; NULL if the type cannot be set */
+    const gchar *fallbacks[TP_NUM_CONNECTION_PRESENCE_TYPES];
+} McdPresenceTable;
+
 struct _McdConnectionPrivate
 {
     /* Factory for TpConnection objects */
@@ -98,9 +122,20 @@ struct _McdConnectionPrivate
     guint reconnect_interval;
     guint probation_timer;      /* for mcd_connection_probation_ended_cb */
     guint probation_drop_count;
+    /* g_get_monotonic_time() when we last asked the CM to connect, or 0 if
+     * that attempt has already finished; for statistics */
+    gint64 connect_started;
 
-    /* Supported presences (values are McdPresenceInfo structs) */
-    GHashTable *recognized_presences;
+    /* Supported presences, shared with other connections to the same
+     * protocol that support the same ones */
+    McdPresenceTable *presence_table;
+
+    /* At most one SetPresence call is in flight; later requests replace
+     * whatever is queued behind it. */
+    TpProxyPendingCall *presence_call;
+    McdPresenceRequest presence_in_flight;
+    McdPresenceRequest presence_queued;
+    guint presence_calls_suppressed;
 
     TpConnectionStatusReason abort_reason;
     guint got_contact_capabilities : 1;
@@ -123,6 +158,11 @@ struct _McdConnectionPrivate
     /* FALSE until connected and the supported presence statuses retrieved */
     guint presence_info_ready : 1;
 
+    /* TRUE if we preloaded the client caps before Connect, when the
+     * dispatcher's client_caps_generation was as recorded here */
+    guint sent_client_caps : 1;
+    guint client_caps_generation;
+
     gboolean is_disposed;
     gboolean service_points_watched;
 
@@ -184,30 +224,380 @@ mcd_presence_info_free (McdPresenceInfo *pi)
     g_slice_free (McdPresenceInfo, pi);
 }
 
+/* "cm/protocol" => GPtrArray of owned McdPresenceTable: each distinct
+ * status set reported by connections to that protocol, before or after
+ * Connect(), that is still in use */
+static GHashTable *presence_tables = NULL;
+
+/* "cm/protocol" => owned McdPresenceTable, the most recent status set
+ * reported before Connect(), which only depends on the protocol; never a
+ * connected connection's statuses, which may be specific to its server */
+static GHashTable *presence_tables_before_connect = NULL;
+
+static gchar *
+mcd_presence_table_dup_key (McdAccount *account)
+{
+    return g_strdup_printf ("%s/%s", mcd_account_get_manager_name (account),
+                            mcd_account_get_protocol_name (account));
+}
+
+static McdPresenceTable *
+mcd_presence_table_ref (McdPresenceTable *table)
+{
+    g_atomic_int_inc (&table->refcount);
+    return table;
+}
+
+static void
+mcd_presence_table_unref (McdPresenceTable *table)
+{
+    if (!g_atomic_int_dec_and_test (&table->refcount))
+        return;
+
+    g_hash_table_unref (table->statuses);
+    g_slice_free (McdPresenceTable, table);
+}
+
+/* A hash of @statuses, a TP_HASH_TYPE_SIMPLE_STATUS_SPEC_MAP, which does
+ * not depend on the order of its entries */
+static guint
+mcd_presence_table_digest (GHashTable *statuses)
+{
+    GHashTableIter iter;
+    gpointer k, v;
+    guint digest = g_hash_table_size (statuses);
+
+    g_hash_table_iter_init (&iter, statuses);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        GValueArray *va = v;
+        guint h = g_str_hash (k);
+
+        h = h * 33 + g_value_get_uint (va->values);
+        h = h * 4 + (g_value_get_boolean (va->values + 1) ? 2 : 0) +
+            (g_value_get_boolean (va->values + 2) ? 1 : 0);
+        digest += h;
+    }
+
+    return digest;
+}
+
+/* Does @table describe exactly the statuses in @statuses, a
+ * TP_HASH_TYPE_SIMPLE_STATUS_SPEC_MAP whose digest is @digest? */
+static gboolean
+mcd_presence_table_matches (McdPresenceTable *table,
+                            GHashTable *statuses,
+                            guint digest)
+{
+    GHashTableIter iter;
+    gpointer k, v;
+
+    if (table->digest != digest ||
+        g_hash_table_size (table->statuses) != g_hash_table_size (statuses))
+        return FALSE;
+
+    g_hash_table_iter_init (&iter, statuses);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        GValueArray *va = v;
+        McdPresenceInfo *pi = g_hash_table_lookup (table->statuses, k);
+
+        if (pi == NULL ||
+            pi->presence != g_value_get_uint (va->values) ||
+            pi->may_set_on_self != g_value_get_boolean (va->values + 1) ||
+            pi->can_have_message != g_value_get_boolean (va->values + 2))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static McdPresenceTable *
+mcd_presence_table_new (GHashTable *statuses,
+                        guint digest)
+{
+    McdPresenceTable *table = g_slice_new0 (McdPresenceTable);
+    GHashTableIter iter;
+    gpointer k, v;
+    guint type;
+
+    table->refcount = 1;
+    table->digest = digest;
+    table->statuses = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) mcd_presence_info_free);
+
+    g_hash_table_iter_init (&iter, statuses);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        GValueArray *va = v;
+        McdPresenceInfo *pi;
+
+        DEBUG ("  %s", (const gchar *) k);
+
+        pi = g_slice_new (McdPresenceInfo);
+        pi->presence = g_value_get_uint (va->values);
+        pi->may_set_on_self = g_value_get_boolean (va->values + 1);
+        pi->can_have_message = g_value_get_boolean (va->values + 2);
+        g_hash_table_insert (table->statuses, g_strdup (k), pi);
+    }
+
+    for (type = TP_CONNECTION_PRESENCE_TYPE_AVAILABLE;
+         type <= TP_CONNECTION_PRESENCE_TYPE_BUSY;
+         type++)
+    {
+        const gchar * const *fallbacks =
+            presence_fallbacks[type - TP_CONNECTION_PRESENCE_TYPE_AVAILABLE];
+
+        for (; *fallbacks != NULL; fallbacks++)
+            if (g_hash_table_lookup (table->statuses, *fallbacks))
+                break;
+
+        /* assume that "available" is always supported -- otherwise, an
+         * error will be returned by SetPresence, but it's not a big loss */
+        table->fallbacks[type] = (*fallbacks != NULL) ? *fallbacks
+                                                      : "available";
+    }
+
+    return table;
+}
+
+/*
+ * mcd_presence_table_dup_shared:
+ * @key: "cm/protocol"
+ * @statuses: statuses just retrieved from a connection
+ * @before_connect: %TRUE if the connection has not been asked to connect
+ *
+ * Returns: (transfer full): the table for @key with exactly @statuses,
+ *  which is built only if no connection to the protocol that is still
+ *  around has reported the same ones. If @before_connect, it also becomes
+ *  the table used by new connections to the protocol without asking: if
+ *  the CM's statuses have changed, it replaces the previous one.
+ */
+static McdPresenceTable *
+mcd_presence_table_dup_shared (const gchar *key,
+                               GHashTable *statuses,
+                               gboolean before_connect)
+{
+    guint digest = mcd_presence_table_digest (statuses);
+    McdPresenceTable *table = NULL;
+    GPtrArray *tables;
+    guint i;
+
+    if (G_UNLIKELY (presence_tables == NULL))
+    {
+        presence_tables = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_ptr_array_unref);
+        presence_tables_before_connect = g_hash_table_new_full (g_str_hash,
+            g_str_equal, g_free, (GDestroyNotify) mcd_presence_table_unref);
+    }
+
+    tables = g_hash_table_lookup (presence_tables, key);
+
+    if (tables == NULL)
+    {
+        tables = g_ptr_array_new_with_free_func (
+            (GDestroyNotify) mcd_presence_table_unref);
+        g_hash_table_insert (presence_tables, g_strdup (key), tables);
+    }
+
+    /* going backwards, so that removing an entry only moves one we have
+     * already looked at */
+    for (i = tables->len; i > 0; i--)
+    {
+        McdPresenceTable *t = g_ptr_array_index (tables, i - 1);
+
+        if (mcd_presence_table_matches (t, statuses, digest))
+            table = t;
+        else if (g_atomic_int_get (&t->refcount) == 1)
+            g_ptr_array_remove_index_fast (tables, i - 1);
+    }
+
+    if (table != NULL)
+    {
+        DEBUG ("reusing presence table for %s", key);
+    }
+    else
+    {
+        DEBUG ("new presence table for %s:", key);
+        table = mcd_presence_table_new (statuses, digest);
+        g_ptr_array_add (tables, table);
+    }
+
+    if (before_connect)
+        g_hash_table_replace (presence_tables_before_connect,
+            g_strdup (key), mcd_presence_table_ref (table));
+
+    return mcd_presence_table_ref (table);
+}
+
+/*
+ * mcd_presence_table_dup_before_connect:
+ * @key: "cm/protocol"
+ *
+ * Returns: (transfer full) (allow-none): the statuses most recently
+ *  reported by a connection to @key before it was asked to connect
+ */
+static McdPresenceTable *
+mcd_presence_table_dup_before_connect (const gchar *key)
+{
+    McdPresenceTable *table;
+
+    if (presence_tables_before_connect == NULL)
+        return NULL;
+
+    table = g_hash_table_lookup (presence_tables_before_connect, key);
+    return (table == NULL) ? NULL : mcd_presence_table_ref (table);
+}
+
+/* Called at shutdown; connections still holding a shared table keep it
+ * until they are disposed. */
+void
+_mcd_connection_free_presence_tables (void)
+{
+    tp_clear_pointer (&presence_tables_before_connect, g_hash_table_unref);
+    tp_clear_pointer (&presence_tables, g_hash_table_unref);
+}
+
+static void
+mcd_presence_request_clear (McdPresenceRequest *req)
+{
+    req->presence = TP_CONNECTION_PRESENCE_TYPE_UNSET;
+    tp_clear_pointer (&req->status, g_free);
+    tp_clear_pointer (&req->message, g_free);
+}
+
+static gboolean
+mcd_presence_request_equals (const McdPresenceRequest *req,
+                             TpConnectionPresenceType presence,
+                             const gchar *status,
+                             const gchar *message)
+{
+    return (req->presence == presence &&
+            !tp_strdiff (req->status, status) &&
+            !tp_strdiff (req->message, message));
+}
+
+static void mcd_connection_send_presence (McdConnection *connection,
+                                          TpConnectionPresenceType presence,
+                                          const gchar *status,
+                                          const gchar *message);
+
 static void
 presence_set_status_cb (TpConnection *proxy, const GError *error,
 			gpointer user_data, GObject *weak_object)
 {
     McdConnectionPrivate *priv = user_data;
+    McdConnection *connection = MCD_CONNECTION (weak_object);
+    McdPresenceRequest next = priv->presence_queued;
+
+    priv->presence_call = NULL;
+    mcd_presence_request_clear (&priv->presence_in_flight);
 
     if (error)
     {
-        _mcd_account_set_changing_presence (priv->account, FALSE);
-
         g_warning ("%s: Setting presence of %s failed: %s",
 		   G_STRFUNC, mcd_account_get_unique_name (priv->account),
                    error->message);
+
+        /* if another request is queued, the account is still changing
+         * presence */
+        if (next.presence == TP_CONNECTION_PRESENCE_TYPE_UNSET)
+            _mcd_account_set_changing_presence (priv->account, FALSE);
+    }
+
+    if (next.presence != TP_CONNECTION_PRESENCE_TYPE_UNSET)
+    {
+        /* steal the queued request */
+        priv->presence_queued.presence = TP_CONNECTION_PRESENCE_TYPE_UNSET;
+        priv->presence_queued.status = NULL;
+        priv->presence_queued.message = NULL;
+
+        mcd_connection_send_presence (connection, next.presence, next.status,
+                                      next.message);
+        mcd_presence_request_clear (&next);
+    }
+}
+
+/*
+ * mcd_connection_send_presence:
+ * @status: a status that is known to be supported, after fallbacks
+ *
+ * Call SetPresence, unless a call is already in flight, in which case
+ * queue the request to be made when it returns. Only the most recent
+ * request is queued, and requests for the presence that is already being
+ * set are dropped, so a burst of changes results in at most two calls.
+ */
+static void
+mcd_connection_send_presence (McdConnection *connection,
+                              TpConnectionPresenceType presence,
+                              const gchar *status,
+                              const gchar *message)
+{
+    McdConnectionPrivate *priv = connection->priv;
+
+    if (priv->presence_call != NULL)
+    {
+        if (priv->presence_queued.presence != TP_CONNECTION_PRESENCE_TYPE_UNSET)
+        {
+            /* the queued request will never be sent now */
+            priv->presence_calls_suppressed++;
+            mcd_presence_request_clear (&priv->presence_queued);
+        }
+
+        if (mcd_presence_request_equals (&priv->presence_in_flight,
+                                         presence, status, message))
+        {
+            priv->presence_calls_suppressed++;
+            DEBUG ("account %s: already setting '%s', %u call(s) suppressed",
+                   mcd_account_get_unique_name (priv->account), status,
+                   priv->presence_calls_suppressed);
+            return;
+        }
+
+        DEBUG ("account %s: queueing '%s' until SetPresence returns",
+               mcd_account_get_unique_name (priv->account), status);
+        priv->presence_queued.presence = presence;
+        priv->presence_queued.status = g_strdup (status);
+        priv->presence_queued.message = g_strdup (message);
+        return;
     }
+
+    priv->presence_in_flight.presence = presence;
+    priv->presence_in_flight.status = g_strdup (status);
+    priv->presence_in_flight.message = g_strdup (message);
+
+    priv->presence_call =
+        tp_cli_connection_interface_simple_presence_call_set_presence
+            (priv->tp_conn, -1, status, message, presence_set_status_cb,
+             priv, NULL, (GObject *) connection);
+}
+
+/* Forget about any SetPresence call on the old TpConnection. */
+static void
+mcd_connection_cancel_presence (McdConnection *connection)
+{
+    McdConnectionPrivate *priv = connection->priv;
+
+    if (priv->presence_call != NULL)
+    {
+        tp_proxy_pending_call_cancel (priv->presence_call);
+        priv->presence_call = NULL;
+    }
+
+    mcd_presence_request_clear (&priv->presence_in_flight);
+    mcd_presence_request_clear (&priv->presence_queued);
 }
 
 static gboolean
 _check_presence (McdConnectionPrivate *priv, TpConnectionPresenceType presence,
                  const gchar **status)
 {
-    const gchar * const *fallbacks;
+    McdPresenceTable *table = priv->presence_table;
 
-    if (priv->recognized_presences == NULL ||
-        g_hash_table_size (priv->recognized_presences) == 0)
+    if (table == NULL || g_hash_table_size (table->statuses) == 0)
     {
         DEBUG ("account %s: recognized presences unknown, not setting "
                "presence yet", mcd_account_get_unique_name (priv->account));
@@ -217,39 +607,17 @@ _check_presence (McdConnectionPrivate *priv, TpConnectionPresenceType presence,
     if (presence == TP_CONNECTION_PRESENCE_TYPE_UNSET || *status == NULL)
         return FALSE;
 
-    if (g_hash_table_lookup (priv->recognized_presences, *status))
+    if (g_hash_table_lookup (table->statuses, *status))
         return TRUE;
 
     if (presence < TP_CONNECTION_PRESENCE_TYPE_AVAILABLE ||
         presence > TP_CONNECTION_PRESENCE_TYPE_BUSY)
         return FALSE;
 
-    fallbacks =
-        presence_fallbacks[presence - TP_CONNECTION_PRESENCE_TYPE_AVAILABLE];
-
-    for (; *fallbacks != NULL; fallbacks++)
-        if (g_hash_table_lookup (priv->recognized_presences, *fallbacks))
-            break;
-
-    /* assume that "available" is always supported -- otherwise, an error will
-     * be returned by SetPresence, but it's not a big loss */
-
-    if (*fallbacks != NULL)
-    {
-        DEBUG ("account %s: presence %s not supported, setting %s",
-               mcd_account_get_unique_name (priv->account), *status,
-               *fallbacks);
-        *status = *fallbacks;
-    }
-    else
-    {
-        DEBUG ("account %s: presence %s not supported and no fallback is "
-               "supported either, trying \"available\" and hoping for the "
-               "best...", mcd_account_get_unique_name (priv->account),
-               *status);
-        *status = "available";
-    }
-
+    DEBUG ("account %s: presence %s not supported, setting %s",
+           mcd_account_get_unique_name (priv->account), *status,
+           table->fallbacks[presence]);
+    *status = table->fallbacks[presence];
     return TRUE;
 }
 
@@ -264,7 +632,7 @@ _mcd_connection_attempt (McdConnection *connection)
 
     if (connection->priv->reconnect_timer != 0)
     {
-        g_source_remove (connection->priv->reconnect_timer);
+        mcd_timeout_remove (connection->priv->reconnect_timer);
         connection->priv->reconnect_timer = 0;
     }
 
@@ -324,9 +692,8 @@ _mcd_connection_set_presence (McdConnection * connection,
             _mcd_account_set_changing_presence (priv->account, FALSE);
         }
 
-        tp_cli_connection_interface_simple_presence_call_set_presence
-            (priv->tp_conn, -1, adj_status, message, presence_set_status_cb,
-             priv, NULL, (GObject *)connection);
+        mcd_connection_send_presence (connection, presence, adj_status,
+                                      message);
     }
     else
     {
@@ -336,18 +703,41 @@ _mcd_connection_set_presence (McdConnection * connection,
 }
 
 
+/* Now the presence info is ready. We can set the presence */
 static void
-presence_get_statuses_cb (TpProxy *proxy, const GValue *v_statuses,
-			  const GError *error, gpointer user_data,
-			  GObject *weak_object)
+mcd_connection_presence_table_ready (McdConnection *connection)
 {
-    McdConnectionPrivate *priv = user_data;
-    McdConnection *connection = MCD_CONNECTION (weak_object);
+    McdConnectionPrivate *priv = connection->priv;
     TpConnectionPresenceType presence;
     const gchar *status, *message;
+
+    mcd_account_get_requested_presence (priv->account, &presence,
+                                         &status, &message);
+    if (priv->connected)
+    {
+        priv->presence_info_ready = TRUE;
+    }
+
+    _mcd_connection_set_presence (connection, presence, status, message);
+}
+
+/* Statuses are retrieved both before and after Connect() - before
+ * CONNECTED the Connection tells us the presences it believes it will
+ * probably support, which only depend on the protocol, so later
+ * connections to it can assume them; after CONNECTED it tells us the
+ * presences it *actually* supports (which might be less numerous, and
+ * might depend on this account's server). Either way, the table is shared
+ * with any other connection to the protocol that supports the same. */
+static void
+mcd_connection_got_statuses (McdConnection *connection,
+                             const GValue *v_statuses,
+                             const GError *error,
+                             gboolean before_connect)
+{
+    McdConnectionPrivate *priv = connection->priv;
+    McdPresenceTable *table;
     GHashTable *statuses;
-    GHashTableIter iter;
-    gpointer ht_key, ht_value;
+    gchar *key;
 
     if (error)
     {
@@ -364,49 +754,34 @@ presence_get_statuses_cb (TpProxy *proxy, const GValue *v_statuses,
         return;
     }
 
-    if (!priv->recognized_presences)
-        priv->recognized_presences =
-            g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-                                   (GDestroyNotify)mcd_presence_info_free);
-
     DEBUG ("account %s:", mcd_account_get_unique_name (priv->account));
     statuses = g_value_get_boxed (v_statuses);
 
     g_return_if_fail (statuses != NULL);
 
-    /* This function can be called both before and after Connect() - before
-     * CONNECTED the Connection tells us the presences it believes it will
-     * probably support, and after CONNECTED it tells us the presences it
-     * *actually* supports (which might be less numerous). */
-    g_hash_table_remove_all (priv->recognized_presences);
-
-    g_hash_table_iter_init (&iter, statuses);
+    key = mcd_presence_table_dup_key (priv->account);
+    table = mcd_presence_table_dup_shared (key, statuses, before_connect);
+    g_free (key);
 
-    while (g_hash_table_iter_next (&iter, &ht_key, &ht_value))
+    /* we were already using these statuses, as assumed before Connect() */
+    if (table == priv->presence_table && !priv->connected)
     {
-        GValueArray *va = ht_value;
-        McdPresenceInfo *pi;
-
-        status = ht_key;
-        DEBUG ("  %s", status);
-
-        pi = g_slice_new (McdPresenceInfo);
-        pi->presence = g_value_get_uint (va->values);
-        pi->may_set_on_self = g_value_get_boolean (va->values + 1);
-        pi->can_have_message = g_value_get_boolean (va->values + 2);
-        g_hash_table_insert (priv->recognized_presences,
-                             g_strdup (status), pi);
+        mcd_presence_table_unref (table);
+        return;
     }
 
-    /* Now the presence info is ready. We can set the presence */
-    mcd_account_get_requested_presence (priv->account, &presence,
-                                         &status, &message);
-    if (priv->connected)
-    {
-        priv->presence_info_ready = TRUE;
-    }
+    tp_clear_pointer (&priv->presence_table, mcd_presence_table_unref);
+    priv->presence_table = table;
+    mcd_connection_presence_table_ready (connection);
+}
 
-    _mcd_connection_set_presence (connection, presence, status, message);
+static void
+presence_get_statuses_cb (TpProxy *proxy, const GValue *v_statuses,
+			  const GError *error, gpointer user_data,
+			  GObject *weak_object)
+{
+    mcd_connection_got_statuses (MCD_CONNECTION (weak_object), v_statuses,
+                                 error, FALSE);
 }
 
 static void
@@ -477,7 +852,7 @@ _mcd_connection_request_presence (McdConnection *self,
         /* if a reconnection attempt is scheduled, cancel it */
         if (self->priv->reconnect_timer)
         {
-            g_source_remove (self->priv->reconnect_timer);
+            mcd_timeout_remove (self->priv->reconnect_timer);
             self->priv->reconnect_timer = 0;
         }
     }
@@ -586,11 +961,22 @@ on_connection_status_changed (TpConnection *tp_conn, GParamSpec *pspec,
             {
                 DEBUG ("setting probation timer (%d) seconds, for %s",
                        PROBATION_SEC, tp_proxy_get_object_path (tp_conn));
-                priv->probation_timer = g_timeout_add_seconds (PROBATION_SEC,
-                    mcd_connection_probation_ended_cb, connection);
+                priv->probation_timer = mcd_timeout_add_seconds (
+                    PROBATION_SEC, mcd_connection_probation_ended_cb,
+                    connection);
                 priv->probation_drop_count = 0;
             }
 
+            if (priv->connect_started != 0)
+            {
+                _mcd_account_stats_count (priv->account,
+                                          MCD_ACCOUNT_STAT_CONNECTIONS);
+                _mcd_account_stats_add_latency (priv->account,
+                                                MCD_ACCOUNT_LATENCY_CONNECT,
+                                                priv->connect_started);
+                priv->connect_started = 0;
+            }
+
             priv->connected = TRUE;
         }
         break;
@@ -703,6 +1089,13 @@ mcd_connection_invalidated_cb (TpConnection *tp_conn,
 
     _mcd_connection_release_tp_connection (connection, NULL, FALSE);
 
+    if (priv->abort_reason != TP_CONNECTION_STATUS_REASON_REQUESTED)
+        _mcd_account_stats_count (priv->account, priv->connected ?
+                                  MCD_ACCOUNT_STAT_CONNECTION_DROPS :
+                                  MCD_ACCOUNT_STAT_CONNECTION_FAILURES);
+
+    priv->connect_started = 0;
+
     if (priv->connected &&
         priv->abort_reason != TP_CONNECTION_STATUS_REASON_REQUESTED &&
         priv->probation_timer != 0)
@@ -710,6 +1103,9 @@ mcd_connection_invalidated_cb (TpConnection *tp_conn,
         DEBUG ("connection dropped while on probation: %s",
                tp_proxy_get_object_path (tp_conn));
 
+        _mcd_account_stats_count (priv->account,
+                                  MCD_ACCOUNT_STAT_PROBATION_DROPS);
+
         if (++priv->probation_drop_count > PROBATION_MAX_DROPPED)
         {
             DEBUG ("connection dropped too many times, will stop "
@@ -729,7 +1125,9 @@ mcd_connection_invalidated_cb (TpConnection *tp_conn,
         {
             DEBUG ("Preparing for reconnection in %u seconds",
                 priv->reconnect_interval);
-            priv->reconnect_timer = g_timeout_add_seconds
+            _mcd_account_stats_count (priv->account,
+                                      MCD_ACCOUNT_STAT_RECONNECTS);
+            priv->reconnect_timer = mcd_timeout_add_seconds
                 (priv->reconnect_interval,
                  (GSourceFunc)mcd_connection_reconnect, connection);
             priv->reconnect_interval *= RECONNECTION_MULTIPLIER;
@@ -823,7 +1221,7 @@ on_new_channels (TpConnection *proxy, const GPtrArray *channels,
     McdConnectionPrivate *priv = user_data;
     guint i;
 
-    if (DEBUGGING)
+    if (DEBUGGING_VERBOSE)
     {
         for (i = 0; i < channels->len; i++)
         {
@@ -1001,7 +1399,7 @@ static void get_all_requests_cb (TpProxy *proxy, GHashTable *properties,
         object_path = g_value_get_boxed (va->values);
         channel_props = g_value_get_boxed (va->values + 1);
 
-        if (DEBUGGING)
+        if (DEBUGGING_VERBOSE)
         {
             GHashTableIter iter;
             gpointer k, v;
@@ -1138,8 +1536,18 @@ _mcd_connection_start_dispatching (McdConnection *self,
         TP_IFACE_QUARK_CONNECTION_INTERFACE_REQUESTS));
     mcd_connection_setup_requests (self);
 
-    /* FIXME: why is this here? if we need to update caps before and after   *
-     * connected, it should be in the call_when_ready callback.              */
+    /* We usually preloaded the client caps before Connect; the dispatcher
+     * only tells connections that it knows about (i.e. after this) when
+     * they change, so catch up if they changed in between. */
+    if (self->priv->sent_client_caps &&
+        self->priv->client_caps_generation ==
+            _mcd_dispatcher_get_client_caps_generation (
+                self->priv->dispatcher))
+    {
+        DEBUG ("client caps already up to date");
+        return;
+    }
+
     _mcd_connection_update_client_caps (self, client_caps);
 }
 
@@ -1209,8 +1617,7 @@ mcd_connection_early_get_statuses_cb (TpProxy *proxy,
 
         /* This will trigger a call to SetPresence, but don't wait for that to
          * finish before calling Connect (there's no need to). */
-        presence_get_statuses_cb (proxy, v_statuses, error, self->priv,
-                                  weak_object);
+        mcd_connection_got_statuses (self, v_statuses, error, TRUE);
     }
     else
     {
@@ -1223,6 +1630,42 @@ mcd_connection_early_get_statuses_cb (TpProxy *proxy,
     mcd_connection_done_task_before_connect (self);
 }
 
+/* The early Get(Statuses) for a connection that went ahead with the
+ * statuses another connection reported, which Connect() did not wait for */
+static void
+mcd_connection_recheck_statuses_cb (TpProxy *proxy,
+                                    const GValue *v_statuses,
+                                    const GError *error,
+                                    gpointer user_data,
+                                    GObject *weak_object)
+{
+    McdConnection *self = MCD_CONNECTION (weak_object);
+
+    if (self->priv->tp_conn != (TpConnection *) proxy)
+    {
+        DEBUG ("Connection %p has been replaced with %p, stopping",
+               proxy, self->priv->tp_conn);
+        return;
+    }
+
+    /* once CONNECTED, the statuses may be specific to the server, and are
+     * retrieved again anyway */
+    if (self->priv->connected)
+        return;
+
+    if (error == NULL)
+    {
+        mcd_connection_got_statuses (self, v_statuses, error, TRUE);
+    }
+    else
+    {
+        DEBUG ("%s: Early Get(Statuses) failed (not a problem, will try "
+               "again later): %s #%d: %s",
+               tp_proxy_get_object_path (proxy),
+               g_quark_to_string (error->domain), error->code, error->message);
+    }
+}
+
 static void
 mcd_connection_early_get_interfaces_cb (TpProxy *proxy,
                                         const GValue *value,
@@ -1260,17 +1703,44 @@ mcd_connection_early_get_interfaces_cb (TpProxy *proxy,
 
             if (q == TP_IFACE_QUARK_CONNECTION_INTERFACE_SIMPLE_PRESENCE)
             {
+                gchar *key;
+
                 /* nail on the interface (TpConnection will eventually know
                  * how to do this for itself) */
                 tp_proxy_add_interface_by_id ((TpProxy *) tp_conn, q);
                 self->priv->has_presence_if = TRUE;
 
-                self->priv->tasks_before_connect++;
+                /* before Connect(), the statuses only depend on the
+                 * protocol, so if another connection has already told us
+                 * what they are, there's no need to wait for them; but
+                 * ask anyway, in case the CM has been upgraded since */
+                key = mcd_presence_table_dup_key (self->priv->account);
+                tp_clear_pointer (&self->priv->presence_table,
+                                  mcd_presence_table_unref);
+                self->priv->presence_table =
+                    mcd_presence_table_dup_before_connect (key);
+                g_free (key);
+
+                if (self->priv->presence_table != NULL)
+                {
+                    DEBUG ("%s: using known statuses",
+                           tp_proxy_get_object_path (tp_conn));
+                    mcd_connection_presence_table_ready (self);
+
+                    tp_cli_dbus_properties_call_get (tp_conn, -1,
+                        TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+                        "Statuses", mcd_connection_recheck_statuses_cb,
+                        NULL, NULL, (GObject *) self);
+                }
+                else
+                {
+                    self->priv->tasks_before_connect++;
 
-                tp_cli_dbus_properties_call_get (tp_conn, -1,
-                    TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE, "Statuses",
-                    mcd_connection_early_get_statuses_cb, NULL, NULL,
-                    (GObject *) self);
+                    tp_cli_dbus_properties_call_get (tp_conn, -1,
+                        TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+                        "Statuses", mcd_connection_early_get_statuses_cb,
+                        NULL, NULL, (GObject *) self);
+                }
             }
             else if (q == TP_IFACE_QUARK_CONNECTION_INTERFACE_CONTACT_CAPABILITIES)
             {
@@ -1290,8 +1760,10 @@ mcd_connection_early_get_interfaces_cb (TpProxy *proxy,
                 if (client_caps != NULL)
                 {
                     _mcd_connection_update_client_caps (self, client_caps);
-                    g_ptr_array_foreach (client_caps,
-                                         (GFunc) g_value_array_free, NULL);
+                    self->priv->client_caps_generation =
+                        _mcd_dispatcher_get_client_caps_generation (
+                            self->priv->dispatcher);
+                    self->priv->sent_client_caps = TRUE;
                     g_ptr_array_unref (client_caps);
                 }
                 /* else the McdDispatcher hasn't sorted itself out yet, so
@@ -1417,6 +1889,10 @@ request_connection_cb (TpConnectionManager *proxy, const gchar *bus_name,
         g_warning ("%s: RequestConnection failed: %s",
                    G_STRFUNC, tperror->message);
 
+        _mcd_account_stats_count (priv->account,
+                                  MCD_ACCOUNT_STAT_CONNECTION_FAILURES);
+        priv->connect_started = 0;
+
         g_signal_emit (connection, signals[CONNECTION_STATUS_CHANGED], 0,
             TP_CONNECTION_STATUS_DISCONNECTED,
             TP_CONNECTION_STATUS_REASON_NONE_SPECIFIED, NULL,
@@ -1462,6 +1938,10 @@ _mcd_connection_connect_with_params (McdConnection *connection,
     DEBUG ("Trying connect account: %s",
            mcd_account_get_unique_name (priv->account));
 
+    _mcd_account_stats_count (priv->account,
+                              MCD_ACCOUNT_STAT_CONNECTION_ATTEMPTS);
+    priv->connect_started = g_get_monotonic_time ();
+
     g_signal_emit (connection, signals[CONNECTION_STATUS_CHANGED], 0,
                    TP_CONNECTION_STATUS_CONNECTING,
                    TP_CONNECTION_STATUS_REASON_REQUESTED, NULL, NULL, NULL);
@@ -1485,8 +1965,10 @@ _mcd_connection_finalize (GObject * object)
     McdConnection *connection = MCD_CONNECTION (object);
     McdConnectionPrivate *priv = MCD_CONNECTION_PRIV (connection);
 
-    if (priv->recognized_presences)
-        g_hash_table_unref (priv->recognized_presences);
+    tp_clear_pointer (&priv->presence_table, mcd_presence_table_unref);
+
+    mcd_presence_request_clear (&priv->presence_in_flight);
+    mcd_presence_request_clear (&priv->presence_queued);
 
     tp_clear_pointer (&priv->service_point_handles, tp_intset_destroy);
     tp_clear_pointer (&priv->service_point_ids, g_hash_table_unref);
@@ -1544,15 +2026,15 @@ _mcd_connection_release_tp_connection (McdConnection *connection,
            the probation timer to go off: there's nothing for it to check  */
         if (priv->probation_timer > 0)
         {
-            g_source_remove (priv->probation_timer);
+            mcd_timeout_remove (priv->probation_timer);
             priv->probation_timer = 0;
         }
 
         tp_clear_object (&priv->tp_conn);
     }
 
-    if (priv->recognized_presences)
-        g_hash_table_remove_all (priv->recognized_presences);
+    mcd_connection_cancel_presence (connection);
+    tp_clear_pointer (&priv->presence_table, mcd_presence_table_unref);
 
   priv->dispatching_started = FALSE;
 }
@@ -1607,13 +2089,13 @@ _mcd_connection_dispose (GObject * object)
 
     if (priv->probation_timer)
     {
-        g_source_remove (priv->probation_timer);
+        mcd_timeout_remove (priv->probation_timer);
         priv->probation_timer = 0;
     }
 
     if (priv->reconnect_timer)
     {
-        g_source_remove (priv->reconnect_timer);
+        mcd_timeout_remove (priv->reconnect_timer);
         priv->reconnect_timer = 0;
     }
 
@@ -2094,7 +2576,7 @@ _mcd_connection_connect (McdConnection *connection, GHashTable *params)
 
     if (priv->reconnect_timer)
     {
-	g_source_remove (priv->reconnect_timer);
+	mcd_timeout_remove (priv->reconnect_timer);
 	priv->reconnect_timer = 0;
     }
 
@@ -2308,3 +2790,38 @@ mcd_connection_add_emergency_handle (McdConnection *self,
   /* As above, we treat emergency numbers as "sticky". */
   tp_intset_add (self->priv->service_point_handles, handle);
 }
+
+void
+_mcd_connection_add_memory_report (McdConnection *self,
+                                   GVariantBuilder *report,
+                                   guint depth)
+{
+    McdConnectionPrivate *priv = self->priv;
+    const GList *list;
+    gsize size;
+
+    size = mcd_memory_instance_size (self) + sizeof (McdConnectionPrivate) +
+        mcd_memory_string_hash_table_size (priv->service_point_ids, FALSE) +
+        mcd_memory_string_size (priv->presence_in_flight.status) +
+        mcd_memory_string_size (priv->presence_in_flight.message) +
+        mcd_memory_string_size (priv->presence_queued.status) +
+        mcd_memory_string_size (priv->presence_queued.message);
+
+    /* presence_table is shared with other connections, so it is not
+     * counted here */
+
+    if (priv->tp_conn != NULL)
+        size += mcd_memory_instance_size (priv->tp_conn);
+
+    mcd_memory_report_add (report, depth, self,
+        priv->tp_conn != NULL ? tp_proxy_get_object_path (priv->tp_conn) :
+        NULL, size);
+
+    for (list = mcd_operation_get_missions (MCD_OPERATION (self));
+         list != NULL;
+         list = list->next)
+    {
+        if (MCD_IS_CHANNEL (list->data))
+            _mcd_channel_add_memory_report (list->data, report, depth + 1);
+    }
+}
@@ -0,0 +1,572 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-dbusmethod.c - methods on extension interfaces without generated code
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Mission Control's own D-Bus API used to be generated from XML, like
+ * telepathy-glib's. Now that only the standard Telepathy interfaces are left
+ * there is no code generator in the tree, so the few MC-specific methods
+ * are dispatched from a libdbus filter on the shared session bus connection
+ * (the same technique as the regression tests' mc-debug-server), with
+ * arguments and return values converted to and from GVariant.
+ */
+
+#include "config.h"
+
+#include "mcd-dbusmethod.h"
+
+#include <string.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include "mcd-debug.h"
+
+struct _McdDBusMethodExport
+{
+    DBusConnection *connection;
+    gchar *object_path;
+    gchar *interface;
+    const McdDBusMethod *methods;
+    gpointer self;
+};
+
+struct _McdDBusMethodInvocation
+{
+    DBusConnection *connection;
+    DBusMessage *message;
+};
+
+static GVariant *
+iter_to_variant (DBusMessageIter *iter)
+{
+    DBusMessageIter sub;
+    GVariantBuilder builder;
+    gchar *signature;
+
+    switch (dbus_message_iter_get_arg_type (iter))
+    {
+        case DBUS_TYPE_BOOLEAN:
+        {
+            dbus_bool_t b;
+
+            dbus_message_iter_get_basic (iter, &b);
+            return g_variant_new_boolean (b);
+        }
+
+        case DBUS_TYPE_BYTE:
+        {
+            guchar y;
+
+            dbus_message_iter_get_basic (iter, &y);
+            return g_variant_new_byte (y);
+        }
+
+        case DBUS_TYPE_INT16:
+        {
+            dbus_int16_t n;
+
+            dbus_message_iter_get_basic (iter, &n);
+            return g_variant_new_int16 (n);
+        }
+
+        case DBUS_TYPE_UINT16:
+        {
+            dbus_uint16_t q;
+
+            dbus_message_iter_get_basic (iter, &q);
+            return g_variant_new_uint16 (q);
+        }
+
+        case DBUS_TYPE_INT32:
+        {
+            dbus_int32_t i;
+
+            dbus_message_iter_get_basic (iter, &i);
+            return g_variant_new_int32 (i);
+        }
+
+        case DBUS_TYPE_UINT32:
+        {
+            dbus_uint32_t u;
+
+            dbus_message_iter_get_basic (iter, &u);
+            return g_variant_new_uint32 (u);
+        }
+
+        case DBUS_TYPE_INT64:
+        {
+            dbus_int64_t x;
+
+            dbus_message_iter_get_basic (iter, &x);
+            return g_variant_new_int64 (x);
+        }
+
+        case DBUS_TYPE_UINT64:
+        {
+            dbus_uint64_t t;
+
+            dbus_message_iter_get_basic (iter, &t);
+            return g_variant_new_uint64 (t);
+        }
+
+        case DBUS_TYPE_DOUBLE:
+        {
+            double d;
+
+            dbus_message_iter_get_basic (iter, &d);
+            return g_variant_new_double (d);
+        }
+
+        case DBUS_TYPE_STRING:
+        {
+            const char *s;
+
+            dbus_message_iter_get_basic (iter, &s);
+            return g_variant_new_string (s);
+        }
+
+        case DBUS_TYPE_OBJECT_PATH:
+        {
+            const char *o;
+
+            dbus_message_iter_get_basic (iter, &o);
+            return g_variant_new_object_path (o);
+        }
+
+        case DBUS_TYPE_SIGNATURE:
+        {
+            const char *g;
+
+            dbus_message_iter_get_basic (iter, &g);
+            return g_variant_new_signature (g);
+        }
+
+        case DBUS_TYPE_VARIANT:
+        {
+            GVariant *child;
+
+            dbus_message_iter_recurse (iter, &sub);
+            child = iter_to_variant (&sub);
+
+            if (child == NULL)
+                return NULL;
+
+            return g_variant_new_variant (child);
+        }
+
+        case DBUS_TYPE_ARRAY:
+            signature = dbus_message_iter_get_signature (iter);
+            g_variant_builder_init (&builder, G_VARIANT_TYPE (signature));
+            dbus_free (signature);
+            break;
+
+        case DBUS_TYPE_STRUCT:
+            g_variant_builder_init (&builder, G_VARIANT_TYPE_TUPLE);
+            break;
+
+        case DBUS_TYPE_DICT_ENTRY:
+            g_variant_builder_init (&builder, G_VARIANT_TYPE_DICT_ENTRY);
+            break;
+
+        default:
+            /* Unix fds, or something newer than us */
+            return NULL;
+    }
+
+    /* it's a container */
+    dbus_message_iter_recurse (iter, &sub);
+
+    while (dbus_message_iter_get_arg_type (&sub) != DBUS_TYPE_INVALID)
+    {
+        GVariant *child = iter_to_variant (&sub);
+
+        if (child == NULL)
+        {
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+
+        g_variant_builder_add_value (&builder, child);
+        dbus_message_iter_next (&sub);
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+message_to_variant (DBusMessage *message)
+{
+    DBusMessageIter iter;
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_TUPLE);
+
+    if (dbus_message_iter_init (message, &iter))
+    {
+        do
+        {
+            GVariant *child = iter_to_variant (&iter);
+
+            if (child == NULL)
+            {
+                g_variant_builder_clear (&builder);
+                return NULL;
+            }
+
+            g_variant_builder_add_value (&builder, child);
+        }
+        while (dbus_message_iter_next (&iter));
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+append_variant (DBusMessageIter *iter,
+                GVariant *value)
+{
+    DBusMessageIter sub;
+    GVariantIter children;
+    GVariant *child;
+    int container;
+    const gchar *contained_signature = NULL;
+
+    switch (g_variant_classify (value))
+    {
+        case G_VARIANT_CLASS_BOOLEAN:
+        {
+            dbus_bool_t b = g_variant_get_boolean (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &b);
+            return;
+        }
+
+        case G_VARIANT_CLASS_BYTE:
+        {
+            guchar y = g_variant_get_byte (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_BYTE, &y);
+            return;
+        }
+
+        case G_VARIANT_CLASS_INT16:
+        {
+            dbus_int16_t n = g_variant_get_int16 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_INT16, &n);
+            return;
+        }
+
+        case G_VARIANT_CLASS_UINT16:
+        {
+            dbus_uint16_t q = g_variant_get_uint16 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT16, &q);
+            return;
+        }
+
+        case G_VARIANT_CLASS_INT32:
+        {
+            dbus_int32_t i = g_variant_get_int32 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_INT32, &i);
+            return;
+        }
+
+        case G_VARIANT_CLASS_UINT32:
+        {
+            dbus_uint32_t u = g_variant_get_uint32 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT32, &u);
+            return;
+        }
+
+        case G_VARIANT_CLASS_INT64:
+        {
+            dbus_int64_t x = g_variant_get_int64 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_INT64, &x);
+            return;
+        }
+
+        case G_VARIANT_CLASS_UINT64:
+        {
+            dbus_uint64_t t = g_variant_get_uint64 (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT64, &t);
+            return;
+        }
+
+        case G_VARIANT_CLASS_DOUBLE:
+        {
+            double d = g_variant_get_double (value);
+
+            dbus_message_iter_append_basic (iter, DBUS_TYPE_DOUBLE, &d);
+            return;
+        }
+
+        case G_VARIANT_CLASS_STRING:
+        case G_VARIANT_CLASS_OBJECT_PATH:
+        case G_VARIANT_CLASS_SIGNATURE:
+        {
+            const char *s = g_variant_get_string (value, NULL);
+
+            /* the type codes are the same in GVariant and D-Bus */
+            dbus_message_iter_append_basic (iter,
+                g_variant_get_type_string (value)[0], &s);
+            return;
+        }
+
+        case G_VARIANT_CLASS_VARIANT:
+            child = g_variant_get_variant (value);
+            dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT,
+                g_variant_get_type_string (child), &sub);
+            append_variant (&sub, child);
+            dbus_message_iter_close_container (iter, &sub);
+            g_variant_unref (child);
+            return;
+
+        case G_VARIANT_CLASS_ARRAY:
+            container = DBUS_TYPE_ARRAY;
+            contained_signature = g_variant_get_type_string (value) + 1;
+            break;
+
+        case G_VARIANT_CLASS_TUPLE:
+            container = DBUS_TYPE_STRUCT;
+            break;
+
+        case G_VARIANT_CLASS_DICT_ENTRY:
+            container = DBUS_TYPE_DICT_ENTRY;
+            break;
+
+        default:
+            /* maybe types and handles can't be sent by us */
+            g_return_if_reached ();
+    }
+
+    dbus_message_iter_open_container (iter, container, contained_signature,
+                                      &sub);
+    g_variant_iter_init (&children, value);
+
+    while ((child = g_variant_iter_next_value (&children)) != NULL)
+    {
+        append_variant (&sub, child);
+        g_variant_unref (child);
+    }
+
+    dbus_message_iter_close_container (iter, &sub);
+}
+
+static void
+send_and_unref (DBusConnection *connection,
+                DBusMessage *reply)
+{
+    if (reply == NULL || !dbus_connection_send (connection, reply, NULL))
+        g_error ("Out of memory");
+
+    dbus_message_unref (reply);
+}
+
+static void
+invocation_free (McdDBusMethodInvocation *invocation)
+{
+    dbus_message_unref (invocation->message);
+    dbus_connection_unref (invocation->connection);
+    g_slice_free (McdDBusMethodInvocation, invocation);
+}
+
+static DBusHandlerResult
+filter_cb (DBusConnection *connection,
+           DBusMessage *message,
+           void *user_data)
+{
+    McdDBusMethodExport *export = user_data;
+    McdDBusMethodInvocation *invocation;
+    const McdDBusMethod *method;
+    const gchar *member;
+    GVariant *parameters;
+
+    if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+        tp_strdiff (dbus_message_get_path (message), export->object_path) ||
+        tp_strdiff (dbus_message_get_interface (message), export->interface))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    member = dbus_message_get_member (message);
+
+    for (method = export->methods; method->name != NULL; method++)
+    {
+        if (!tp_strdiff (method->name, member))
+            break;
+    }
+
+    if (method->name == NULL)
+    {
+        send_and_unref (connection, dbus_message_new_error_printf (message,
+            DBUS_ERROR_UNKNOWN_METHOD, "%s has no method %s",
+            export->interface, member));
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    parameters = message_to_variant (message);
+
+    if (parameters == NULL ||
+        !g_variant_is_of_type (parameters,
+                               G_VARIANT_TYPE (method->in_signature)))
+    {
+        send_and_unref (connection, dbus_message_new_error_printf (message,
+            DBUS_ERROR_INVALID_ARGS, "%s.%s expects arguments %s",
+            export->interface, member, method->in_signature));
+        tp_clear_pointer (&parameters, g_variant_unref);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    DEBUG ("%s.%s from %s", export->interface, member,
+           dbus_message_get_sender (message));
+
+    invocation = g_slice_new0 (McdDBusMethodInvocation);
+    invocation->connection = dbus_connection_ref (connection);
+    invocation->message = dbus_message_ref (message);
+
+    method->func (export->self, parameters, invocation);
+    g_variant_unref (parameters);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/*
+ * mcd_dbus_method_export:
+ * @dbus_daemon: the bus
+ * @object_path: the object on which to implement @interface
+ * @interface: the D-Bus interface name
+ * @methods: (array zero-terminated=1): methods of @interface; must remain
+ *  valid until unexported
+ * @self: passed to the method implementations
+ *
+ * Start dispatching calls to @methods. The object at @object_path should
+ * usually also list @interface in its Interfaces property.
+ *
+ * Returns: a handle to pass to mcd_dbus_method_unexport() before @self
+ *  is disposed
+ */
+McdDBusMethodExport *
+mcd_dbus_method_export (TpDBusDaemon *dbus_daemon,
+                        const gchar *object_path,
+                        const gchar *interface,
+                        const McdDBusMethod *methods,
+                        gpointer self)
+{
+    McdDBusMethodExport *export;
+
+    g_return_val_if_fail (TP_IS_DBUS_DAEMON (dbus_daemon), NULL);
+    g_return_val_if_fail (g_variant_is_object_path (object_path), NULL);
+    g_return_val_if_fail (methods != NULL, NULL);
+
+    export = g_slice_new0 (McdDBusMethodExport);
+    export->connection = dbus_connection_ref (dbus_g_connection_get_connection (
+        tp_proxy_get_dbus_connection (dbus_daemon)));
+    export->object_path = g_strdup (object_path);
+    export->interface = g_strdup (interface);
+    export->methods = methods;
+    export->self = self;
+
+    if (!dbus_connection_add_filter (export->connection, filter_cb, export,
+                                     NULL))
+        g_error ("Out of memory");
+
+    return export;
+}
+
+void
+mcd_dbus_method_unexport (McdDBusMethodExport *export)
+{
+    g_return_if_fail (export != NULL);
+
+    dbus_connection_remove_filter (export->connection, filter_cb, export);
+    dbus_connection_unref (export->connection);
+    g_free (export->object_path);
+    g_free (export->interface);
+    g_slice_free (McdDBusMethodExport, export);
+}
+
+const gchar *
+mcd_dbus_method_invocation_get_sender (McdDBusMethodInvocation *invocation)
+{
+    return dbus_message_get_sender (invocation->message);
+}
+
+/*
+ * mcd_dbus_method_invocation_return_value:
+ * @invocation: (transfer full): the method call
+ * @value: a tuple of return values, or %NULL for none; if floating, it is
+ *  consumed
+ */
+void
+mcd_dbus_method_invocation_return_value (McdDBusMethodInvocation *invocation,
+                                         GVariant *value)
+{
+    DBusMessage *reply = dbus_message_new_method_return (invocation->message);
+
+    if (reply == NULL)
+        g_error ("Out of memory");
+
+    if (value != NULL)
+    {
+        DBusMessageIter iter;
+        GVariantIter children;
+        GVariant *child;
+
+        g_variant_ref_sink (value);
+        g_return_if_fail (g_variant_is_of_type (value, G_VARIANT_TYPE_TUPLE));
+
+        dbus_message_iter_init_append (reply, &iter);
+        g_variant_iter_init (&children, value);
+
+        while ((child = g_variant_iter_next_value (&children)) != NULL)
+        {
+            append_variant (&iter, child);
+            g_variant_unref (child);
+        }
+
+        g_variant_unref (value);
+    }
+
+    send_and_unref (invocation->connection, reply);
+    invocation_free (invocation);
+}
+
+/*
+ * mcd_dbus_method_invocation_return_gerror:
+ * @invocation: (transfer full): the method call
+ * @error: the error, typically in the %TP_ERROR domain
+ */
+void
+mcd_dbus_method_invocation_return_gerror (McdDBusMethodInvocation *invocation,
+                                          const GError *error)
+{
+    gchar *name = g_dbus_error_encode_gerror (error);
+
+    send_and_unref (invocation->connection,
+        dbus_message_new_error (invocation->message, name, error->message));
+    g_free (name);
+    invocation_free (invocation);
+}
@@ -0,0 +1,70 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-dbusmethod.h - methods on extension interfaces without generated code
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MCD_DBUSMETHOD_H__
+#define __MCD_DBUSMETHOD_H__
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdDBusMethodInvocation McdDBusMethodInvocation;
+typedef struct _McdDBusMethodExport McdDBusMethodExport;
+
+/*
+ * McdDBusMethodFunc:
+ * @self: the object passed to mcd_dbus_method_export()
+ * @parameters: the method's arguments, as a tuple matching the
+ *  McdDBusMethod's in_signature
+ * @invocation: must eventually be passed to one of the
+ *  mcd_dbus_method_invocation_return_*() functions, which free it
+ */
+typedef void (*McdDBusMethodFunc) (gpointer self,
+                                   GVariant *parameters,
+                                   McdDBusMethodInvocation *invocation);
+
+typedef struct _McdDBusMethod
+{
+    const gchar *name;
+    /* a tuple type string, e.g. "(sa{sv})"; "()" for no arguments */
+    const gchar *in_signature;
+    McdDBusMethodFunc func;
+} McdDBusMethod;
+
+McdDBusMethodExport *mcd_dbus_method_export (TpDBusDaemon *dbus_daemon,
+                                             const gchar *object_path,
+                                             const gchar *interface,
+                                             const McdDBusMethod *methods,
+                                             gpointer self);
+void mcd_dbus_method_unexport (McdDBusMethodExport *export);
+
+const gchar *mcd_dbus_method_invocation_get_sender (
+    McdDBusMethodInvocation *invocation);
+void mcd_dbus_method_invocation_return_value (
+    McdDBusMethodInvocation *invocation,
+    GVariant *value);
+void mcd_dbus_method_invocation_return_gerror (
+    McdDBusMethodInvocation *invocation,
+    const GError *error);
+
+G_END_DECLS
+#endif /* __MCD_DBUSMETHOD_H__ */
@@ -38,6 +38,7 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
@@ -48,6 +49,8 @@
 #include "mcd-operation.h"
 
 gint mcd_debug_level = 0;
+guint mcd_debug_active_categories = 0;
+guint mcd_debug_verbose_categories = 0;
 
 static void
 mcd_debug_print_tree_real (gpointer object, gint level)
@@ -79,27 +82,163 @@ mcd_debug_print_tree_real (gpointer object, gint level)
     g_string_free (indent_str, TRUE);
 }
 
-/* We don't really have debug categories yet */
+typedef struct {
+    const gchar *name;
+    McdDebugCategory category;
+    /* the domain reported to the Telepathy Debug interface */
+    const gchar *domain;
+} CategoryInfo;
 
-typedef enum {
-    MCD_DEBUG_MISC = 1 << 0,
-    MCD_DEBUG_TREES = 1 << 1
-} McdDebugCategory;
-
-static GDebugKey const keys[] = {
-    { "misc", MCD_DEBUG_MISC },
-    { "trees", MCD_DEBUG_TREES },
-    { NULL, 0 }
+static const CategoryInfo category_info[] = {
+    { "misc", MCD_DEBUG_MISC, G_LOG_DOMAIN },
+    { "trees", MCD_DEBUG_TREES, G_LOG_DOMAIN "/trees" },
+    { "dispatch", MCD_DEBUG_DISPATCH, G_LOG_DOMAIN "/dispatch" },
+    { "storage", MCD_DEBUG_STORAGE, G_LOG_DOMAIN "/storage" },
+    { "connection", MCD_DEBUG_CONNECTION, G_LOG_DOMAIN "/connection" },
+    { "account", MCD_DEBUG_ACCOUNT, G_LOG_DOMAIN "/account" },
+    { "client-registry", MCD_DEBUG_CLIENT_REGISTRY,
+      G_LOG_DOMAIN "/client-registry" },
+    { "connectivity", MCD_DEBUG_CONNECTIVITY, G_LOG_DOMAIN "/connectivity" },
+    { "plugins", MCD_DEBUG_PLUGINS, G_LOG_DOMAIN "/plugins" },
 };
 
-static McdDebugCategory categories = 0;
+#define N_CATEGORIES G_N_ELEMENTS (category_info)
+
+/* 0 to MCD_DEBUG_MAX_LEVEL for each entry in category_info */
+static guint levels[N_CATEGORIES];
+/* whether MC_DEBUG or mcd_debug_set_level() asked for messages to be printed
+ * via g_debug(), i.e. to stderr or $MC_LOGFILE */
+static gboolean printing = FALSE;
+/* whether a client has enabled the Telepathy Debug interface */
+static gboolean sender_enabled = FALSE;
+/* the plugin categories chosen by $MCP_DEBUG (or MC_DEBUG=all), if any */
+static McpDebugFlags plugin_env_flags = MCP_DEBUG_NONE;
+
+static const CategoryInfo *
+category_get_info (McdDebugCategory category)
+{
+    gint i = g_bit_nth_lsf (category, -1);
+
+    g_return_val_if_fail (i >= 0 && (guint) i < N_CATEGORIES,
+                          &category_info[0]);
+    return &category_info[i];
+}
+
+static gboolean
+category_is_printed (McdDebugCategory category)
+{
+    return printing && levels[category_get_info (category) - category_info] > 0;
+}
+
+static void
+update_plugin_debugging (void)
+{
+    guint plugins = category_get_info (MCD_DEBUG_PLUGINS) - category_info;
+    gboolean on;
+
+    /* only the "plugins" category decides this; an explicit $MCP_DEBUG
+     * also counts as somewhere for the messages to go */
+    on = levels[plugins] >= 1 &&
+        (printing || sender_enabled || plugin_env_flags != MCP_DEBUG_NONE);
+
+    mcp_set_debug (on);
+
+    if (!on)
+        mcp_debug_set_flags (MCP_DEBUG_NONE);
+    else if (plugin_env_flags != MCP_DEBUG_NONE)
+        mcp_debug_set_flags (plugin_env_flags);
+    else
+        mcp_debug_set_flags ((McpDebugFlags) ~MCP_DEBUG_NONE);
+}
+
+static void
+update_active_categories (void)
+{
+    guint i;
+
+    mcd_debug_active_categories = 0;
+    mcd_debug_verbose_categories = 0;
+
+    update_plugin_debugging ();
+
+    /* if the messages would go nowhere, don't produce them */
+    if (!printing && !sender_enabled)
+        return;
+
+    for (i = 0; i < N_CATEGORIES; i++)
+    {
+        if (levels[i] >= 1)
+            mcd_debug_active_categories |= category_info[i].category;
+
+        if (levels[i] >= 2)
+            mcd_debug_verbose_categories |= category_info[i].category;
+    }
+}
+
+static void
+sender_enabled_changed_cb (GObject *sender,
+                           GParamSpec *pspec G_GNUC_UNUSED,
+                           gpointer user_data G_GNUC_UNUSED)
+{
+    g_object_get (sender, "enabled", &sender_enabled, NULL);
+    update_active_categories ();
+}
+
+static void
+set_level_internal (guint i,
+                    guint level)
+{
+    levels[i] = MIN (level, MCD_DEBUG_MAX_LEVEL);
+}
+
+/*
+ * Parse a MC_DEBUG value such as "dispatch=2,storage": each category
+ * named is set to the given level, or 1. "all" sets every category to
+ * MCD_DEBUG_MAX_LEVEL, for compatibility with older versions.
+ * Unrecognised words are assumed to be for telepathy-glib.
+ */
+static void
+parse_debug_string (const gchar *str)
+{
+    gchar **words = g_strsplit_set (str, ":;, \t", -1);
+    gchar **word;
+    guint i;
+
+    for (word = words; *word != NULL; word++)
+    {
+        gchar *eq = strchr (*word, '=');
+        guint level = 1;
+
+        if (eq != NULL)
+        {
+            *eq = '\0';
+            level = (guint) strtoul (eq + 1, NULL, 10);
+        }
+
+        if (!g_ascii_strcasecmp (*word, "all"))
+        {
+            for (i = 0; i < N_CATEGORIES; i++)
+                levels[i] = MCD_DEBUG_MAX_LEVEL;
+
+            continue;
+        }
+
+        for (i = 0; i < N_CATEGORIES; i++)
+        {
+            if (!g_ascii_strcasecmp (*word, category_info[i].name))
+                levels[i] = MIN (level, MCD_DEBUG_MAX_LEVEL);
+        }
+    }
+
+    g_strfreev (words);
+}
 
 void
 mcd_debug_print_tree (gpointer object)
 {
     g_return_if_fail (MCD_IS_MISSION (object));
 
-    if (categories & MCD_DEBUG_TREES)
+    if (category_is_printed (MCD_DEBUG_TREES))
     {
 	g_debug ("Object Hierarchy of object %p", object);
 	g_debug ("[");
@@ -112,6 +251,13 @@ void mcd_debug_init ()
 {
     gchar *mc_debug_str;
     guint level;
+    guint i;
+    TpDebugSender *sender;
+
+    /* this must come first: it resets the plugin flags from the
+     * environment, which update_plugin_debugging() then adjusts */
+    mcp_debug_init ();
+    plugin_env_flags = mcp_debug_get_flags ();
 
     mc_debug_str = getenv ("MC_DEBUG");
 
@@ -124,16 +270,12 @@ void mcd_debug_init ()
          * telepathy-glib-style flags-word */
         if (level == 0)
         {
-            categories = g_parse_debug_string (mc_debug_str, keys,
-                                               G_N_ELEMENTS (keys) - 1);
+            parse_debug_string (mc_debug_str);
             tp_debug_set_flags (mc_debug_str);
+            printing = TRUE;
 
-            /* mcd-debug.h uses the value of mcd_debug_level directly, so
-             * we need to set it nonzero to get uncategorized messages */
-            if ((categories & MCD_DEBUG_MISC) != 0 && mcd_debug_level == 0)
-            {
-                mcd_debug_level = 1;
-            }
+            for (i = 0; i < N_CATEGORIES; i++)
+                mcd_debug_level = MAX (mcd_debug_level, (gint) levels[i]);
         }
         else
         {
@@ -142,9 +284,23 @@ void mcd_debug_init ()
             mcd_debug_set_level (level);
         }
     }
+    else
+    {
+        /* nothing is printed, but if a client enables the Debug interface,
+         * it gets the normal messages from every category */
+        for (i = 0; i < N_CATEGORIES; i++)
+            levels[i] = 1;
+    }
 
-    mcp_set_debug ((mcd_debug_level >= 1));
-    mcp_debug_init ();
+    /* The caller is expected to keep the default sender alive (see
+     * mc-server.c), so the signal connection lasts as long as it does */
+    sender = tp_debug_sender_dup ();
+    g_signal_connect (sender, "notify::enabled",
+                      G_CALLBACK (sender_enabled_changed_cb), NULL);
+    sender_enabled_changed_cb (G_OBJECT (sender), NULL, NULL);
+    g_object_unref (sender);
+
+    update_active_categories ();
 
     tp_debug_divert_messages (g_getenv ("MC_LOGFILE"));
 
@@ -155,40 +311,89 @@ void mcd_debug_init ()
 void
 mcd_debug_set_level (gint level)
 {
-    mcd_debug_level = level;
+    guint i;
 
-    mcp_set_debug ((mcd_debug_level >= 1));
+    mcd_debug_level = level;
+    printing = (level >= 1);
 
-    if (level >= 1)
+    /* as in older versions, object trees are only printed at level 2 */
+    for (i = 0; i < N_CATEGORIES; i++)
     {
-        categories |= MCD_DEBUG_MISC;
-    }
-    else
-    {
-        categories = 0;
+        if (category_info[i].category == MCD_DEBUG_TREES)
+            levels[i] = (level >= 2 ? 1 : 0);
+        else
+            levels[i] = MIN (MAX (level, 0), MCD_DEBUG_MAX_LEVEL);
     }
 
-    if (level >= 2)
+    update_active_categories ();
+}
+
+/*
+ * mcd_debug_set_category_level:
+ * @name: a category name, such as "dispatch"
+ * @level: 0 to disable the category, 1 for normal messages or 2 to
+ *  include verbose dumps
+ *
+ * Change one category's level while MC is running. This affects what is
+ * printed, if MC_DEBUG was set, and what is sent to the Telepathy Debug
+ * interface.
+ *
+ * Returns: %FALSE if @name is not a category
+ */
+gboolean
+mcd_debug_set_category_level (const gchar *name,
+                              guint level)
+{
+    guint i;
+
+    for (i = 0; i < N_CATEGORIES; i++)
     {
-        categories |= MCD_DEBUG_TREES;
+        if (!tp_strdiff (name, category_info[i].name))
+        {
+            set_level_internal (i, level);
+            update_active_categories ();
+            return TRUE;
+        }
     }
+
+    return FALSE;
 }
 
-void
-mcd_debug (const gchar *format, ...)
+/*
+ * mcd_debug_dup_category_levels:
+ *
+ * Returns: (transfer full): a non-floating a{su} mapping each category
+ *  name to its level
+ */
+GVariant *
+mcd_debug_dup_category_levels (void)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{su}"));
+
+    for (i = 0; i < N_CATEGORIES; i++)
+        g_variant_builder_add (&builder, "{su}", category_info[i].name,
+                               levels[i]);
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+mcd_debug_valist (McdDebugCategory category,
+                  const gchar *format,
+                  va_list args)
 {
   gchar *message = NULL;
   gchar **formatted = NULL;
   TpDebugSender *dbg = tp_debug_sender_dup ();
-  va_list args;
 
-  if (_mcd_debug_get_level () > 0)
+  if (category_is_printed (category))
     formatted = &message;
 
-  va_start (args, format);
   tp_debug_sender_add_message_vprintf (dbg, NULL, formatted,
-      G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, format, args);
-  va_end (args);
+      category_get_info (category)->domain, G_LOG_LEVEL_DEBUG, format, args);
 
   if (!tp_str_empty (message))
     {
@@ -199,3 +404,35 @@ mcd_debug (const gchar *format, ...)
   /* NOTE: the sender must be cached elsewhere, or this gets EXPENSIVE: */
   g_object_unref (dbg);
 }
+
+void
+mcd_debug (const gchar *format, ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  mcd_debug_valist (MCD_DEBUG_MISC, format, args);
+  va_end (args);
+}
+
+/*
+ * mcd_debug_category:
+ * @category: the category of the message
+ * @format: a printf-style format
+ *
+ * Send a message to the Telepathy Debug interface, and also log it with
+ * g_debug() if MC_DEBUG enabled @category. Callers should normally use the
+ * DEBUG macro, which only evaluates its arguments if the message would be
+ * used.
+ */
+void
+mcd_debug_category (McdDebugCategory category,
+                    const gchar *format,
+                    ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  mcd_debug_valist (category, format, args);
+  va_end (args);
+}
@@ -34,17 +34,48 @@ G_BEGIN_DECLS
 
 #undef DEBUG
 
+/* Source files may define MCD_DEBUG_FLAG to one of these, straight after
+ * including config.h, to put their DEBUG messages in a category other than
+ * misc.
+ * If you add categories, add them to categories[] in mcd-debug.c. */
+typedef enum {
+    MCD_DEBUG_MISC = 1 << 0,
+    MCD_DEBUG_TREES = 1 << 1,
+    MCD_DEBUG_DISPATCH = 1 << 2,
+    MCD_DEBUG_STORAGE = 1 << 3,
+    MCD_DEBUG_CONNECTION = 1 << 4,
+    MCD_DEBUG_ACCOUNT = 1 << 5,
+    MCD_DEBUG_CLIENT_REGISTRY = 1 << 6,
+    MCD_DEBUG_CONNECTIVITY = 1 << 7,
+    MCD_DEBUG_PLUGINS = 1 << 8
+} McdDebugCategory;
+
+/* Each category has a level: 0 is silent, 1 enables DEBUG, and 2 also
+ * enables the bulky dumps guarded by DEBUGGING_VERBOSE */
+#define MCD_DEBUG_MAX_LEVEL 2
+
+#ifndef MCD_DEBUG_FLAG
+#define MCD_DEBUG_FLAG MCD_DEBUG_MISC
+#endif
+
 #ifdef ENABLE_DEBUG
 
-#define DEBUGGING (_mcd_debug_get_level () > 0)
+/* The arguments are only evaluated if the message would go somewhere:
+ * either MC_DEBUG enabled this category, or a client has enabled the
+ * Telepathy Debug interface */
+#define DEBUGGING _mcd_debug_is_active (MCD_DEBUG_FLAG)
+#define DEBUGGING_VERBOSE _mcd_debug_is_verbose (MCD_DEBUG_FLAG)
 #define DEBUG(format, ...) \
-  mcd_debug ("%s: " format, G_STRFUNC, ##__VA_ARGS__)
-#define WARNING(format, ...) \
-  g_warning ("%s: " format, G_STRFUNC, ##__VA_ARGS__)
+  G_STMT_START { \
+      if (DEBUGGING) \
+          mcd_debug_category (MCD_DEBUG_FLAG, "%s: " format, G_STRFUNC, \
+                              ##__VA_ARGS__); \
+  } G_STMT_END
 
 #else /* !defined ENABLE_DEBUG */
 
 #define DEBUGGING (0)
+#define DEBUGGING_VERBOSE (0)
 #define DEBUG(format, ...) do {} while (0)
 
 #endif /* ENABLE_DEBUG */
@@ -59,6 +90,11 @@ G_BEGIN_DECLS
   g_error ("%s: " format, G_STRFUNC, ##__VA_ARGS__)
 
 extern gint mcd_debug_level;
+/* categories for which DEBUG must format its message; use
+ * _mcd_debug_is_active() rather than reading this directly */
+extern guint mcd_debug_active_categories;
+/* likewise, categories at level 2 */
+extern guint mcd_debug_verbose_categories;
 
 void mcd_debug_init (void);
 
@@ -68,9 +104,24 @@ static inline gint _mcd_debug_get_level (void)
     return mcd_debug_level;
 }
 
+static inline gboolean _mcd_debug_is_active (McdDebugCategory category)
+{
+    return G_UNLIKELY ((mcd_debug_active_categories & category) != 0);
+}
+
+static inline gboolean _mcd_debug_is_verbose (McdDebugCategory category)
+{
+    return G_UNLIKELY ((mcd_debug_verbose_categories & category) != 0);
+}
+
+gboolean mcd_debug_set_category_level (const gchar *name, guint level);
+GVariant *mcd_debug_dup_category_levels (void);
+
 void mcd_debug_print_tree (gpointer obj);
 
 void mcd_debug (const gchar *format, ...) G_GNUC_PRINTF (1, 2);
+void mcd_debug_category (McdDebugCategory category,
+                         const gchar *format, ...) G_GNUC_PRINTF (2, 3);
 
 G_END_DECLS
 
@@ -23,6 +23,9 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include "mcd-dispatch-operation-priv.h"
 
 #include <stdio.h>
@@ -37,15 +40,23 @@
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #include "channel-utils.h"
+#include "mcd-account-stats.h"
 #include "mcd-channel-priv.h"
 #include "mcd-dbusprop.h"
 #include "mcd-master-priv.h"
 #include "mcd-misc.h"
+#include "mcd-trace.h"
 #include "plugin-dispatch-operation.h"
 #include "plugin-loader.h"
 
 #define MCD_DISPATCH_OPERATION_PRIV(operation) (MCD_DISPATCH_OPERATION (operation)->priv)
 
+/* The default maximum number of observers that we are waiting for
+ * ObserveChannels from while they are being service-activated, across all
+ * dispatch operations; more are queued. Overridden by
+ * $MC_OBSERVER_ACTIVATION_LIMIT, where 0 means unlimited. */
+#define OBSERVER_ACTIVATION_LIMIT 4
+
 static void
 dispatch_operation_iface_init (TpSvcChannelDispatchOperationClass *iface,
                                gpointer iface_data);
@@ -156,6 +167,10 @@ struct _McdDispatchOperationPrivate
 {
     const gchar *unique_name;   /* borrowed from object_path */
     gchar *object_path;
+    /* the number in object_path, used to identify us in mcd-trace.c */
+    guint trace_id;
+    /* g_get_monotonic_time() when we were constructed, for statistics */
+    gint64 created_time;
     GStrv possible_handlers;
     GHashTable *properties;
 
@@ -817,6 +832,8 @@ _mcd_dispatch_operation_finish (McdDispatchOperation *operation,
     priv->result = g_error_new_valist (domain, code, format, ap);
     va_end (ap);
     DEBUG ("Result: %s", priv->result->message);
+    mcd_trace (MCD_TRACE_CDO_FINISHED, priv->trace_id,
+               g_quark_to_string (domain));
 
     for (approval = g_queue_pop_head (priv->approvals);
          approval != NULL;
@@ -1053,9 +1070,10 @@ static void
 create_object_path (McdDispatchOperationPrivate *priv)
 {
     static guint cpt = 0;
+    priv->trace_id = cpt++;
     priv->object_path =
         g_strdup_printf (MC_DISPATCH_OPERATION_DBUS_OBJECT_BASE "do%u",
-                         cpt++);
+                         priv->trace_id);
     priv->unique_name = priv->object_path +
         (sizeof (MC_DISPATCH_OPERATION_DBUS_OBJECT_BASE) - 1);
 }
@@ -1086,6 +1104,9 @@ mcd_dispatch_operation_constructor (GType type, guint n_params,
     }
 
     create_object_path (priv);
+    priv->created_time = g_get_monotonic_time ();
+    mcd_trace (MCD_TRACE_CDO_CREATED, priv->trace_id,
+               priv->needs_approval ? "needs-approval" : NULL);
 
     DEBUG ("%s/%p: needs_approval=%c", priv->unique_name, object,
            priv->needs_approval ? 'T' : 'F');
@@ -1866,12 +1887,30 @@ _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
     if (error)
     {
         DEBUG ("error: %s", error->message);
+        mcd_trace (MCD_TRACE_HANDLER_FAILED, self->priv->trace_id,
+                   tp_proxy_get_bus_name (client));
+
+        if (self->priv->account != NULL)
+            _mcd_account_stats_count (self->priv->account,
+                                      MCD_ACCOUNT_STAT_HANDLERS_FAILED);
 
         _mcd_dispatch_operation_set_handler_failed (self,
             tp_proxy_get_bus_name (client), error);
     }
     else
     {
+        mcd_trace (MCD_TRACE_HANDLER_SUCCEEDED, self->priv->trace_id,
+                   tp_proxy_get_bus_name (client));
+
+        if (self->priv->account != NULL)
+        {
+            _mcd_account_stats_count (self->priv->account,
+                                      MCD_ACCOUNT_STAT_CHANNELS_DISPATCHED);
+            _mcd_account_stats_add_latency (self->priv->account,
+                                            MCD_ACCOUNT_LATENCY_DISPATCH,
+                                            self->priv->created_time);
+        }
+
         /* FIXME: can channel ever be NULL here? */
         if (self->priv->channel != NULL)
         {
@@ -1925,22 +1964,6 @@ _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
     _mcd_dispatch_operation_check_client_locks (self);
 }
 
-static void
-observe_channels_cb (TpClient *proxy, const GError *error,
-                     gpointer user_data, GObject *weak_object)
-{
-    McdDispatchOperation *self = user_data;
-
-    /* we display the error just for debugging, but we don't really care */
-    if (error)
-        DEBUG ("Observer %s returned error: %s",
-               tp_proxy_get_object_path (proxy), error->message);
-    else
-        DEBUG ("success from %s", tp_proxy_get_object_path (proxy));
-
-    _mcd_dispatch_operation_dec_observers_pending (self, MCD_CLIENT_PROXY (proxy));
-}
-
 /*
  * @paths_out: (out) (transfer container) (element-type utf8):
  *  Requests_Satisfied
@@ -1991,15 +2014,174 @@ collect_satisfied_requests (McdChannel *channel,
         g_hash_table_unref (request_properties);
 }
 
+/* An ObserveChannels call that we have made, or are going to make once
+ * fewer observers are being activated. */
+typedef struct
+{
+    McdDispatchOperation *self;
+    McdClientProxy *client;
+    gchar *account_path;
+    gchar *connection_path;
+    GPtrArray *channels_array;
+    gchar *dispatch_operation_path;
+    GPtrArray *satisfied_requests;
+    GHashTable *observer_info;
+    /* TRUE if the observer was not running when we called it */
+    gboolean activating;
+} ObserverCall;
+
+static guint activating_observers = 0;
+static GQueue queued_observer_calls = G_QUEUE_INIT;
+
+static guint
+get_observer_activation_limit (void)
+{
+    static gboolean initialized = FALSE;
+    static guint limit = OBSERVER_ACTIVATION_LIMIT;
+
+    if (G_UNLIKELY (!initialized))
+    {
+        const gchar *from_env = g_getenv ("MC_OBSERVER_ACTIVATION_LIMIT");
+
+        if (from_env != NULL)
+            limit = (guint) g_ascii_strtoull (from_env, NULL, 10);
+
+        initialized = TRUE;
+    }
+
+    return limit;
+}
+
+static void
+observer_call_free (gpointer p)
+{
+    ObserverCall *call = p;
+
+    g_object_unref (call->self);
+    g_object_unref (call->client);
+    g_free (call->account_path);
+    g_free (call->connection_path);
+    _mcd_tp_channel_details_free (call->channels_array);
+    g_free (call->dispatch_operation_path);
+    g_ptr_array_unref (call->satisfied_requests);
+    g_hash_table_unref (call->observer_info);
+    g_slice_free (ObserverCall, call);
+}
+
+/* Lower numbers are called first: observers that delay approvers, so that
+ * approvers are reached as soon as possible, then observers that are
+ * already running, which cost nothing to call. */
+static gint
+observer_call_rank (const ObserverCall *call)
+{
+    if (_mcd_client_proxy_get_delay_approvers (call->client))
+        return 0;
+
+    if (_mcd_client_proxy_is_active (call->client))
+        return 1;
+
+    return 2;
+}
+
+static gint
+observer_call_compare (gconstpointer a,
+                       gconstpointer b)
+{
+    return observer_call_rank (a) - observer_call_rank (b);
+}
+
+/* for g_queue_insert_sorted(), which inserts before the first element
+ * for which this returns >= 0: keep calls of equal rank in FIFO order */
+static gint
+observer_call_compare_queued (gconstpointer queued,
+                              gconstpointer new_call,
+                              gpointer unused G_GNUC_UNUSED)
+{
+    return (observer_call_rank (queued) <= observer_call_rank (new_call)) ?
+        -1 : 1;
+}
+
+static void start_queued_observer_calls (void);
+
+static void
+observe_channels_cb (TpClient *proxy, const GError *error,
+                     gpointer user_data, GObject *weak_object)
+{
+    ObserverCall *call = user_data;
+
+    /* we display the error just for debugging, but we don't really care */
+    if (error)
+        DEBUG ("Observer %s returned error: %s",
+               tp_proxy_get_object_path (proxy), error->message);
+    else
+        DEBUG ("success from %s", tp_proxy_get_object_path (proxy));
+
+    mcd_trace (MCD_TRACE_OBSERVER_RETURNED, call->self->priv->trace_id,
+               tp_proxy_get_bus_name (proxy));
+
+    if (call->activating)
+    {
+        g_assert (activating_observers > 0);
+        activating_observers--;
+        call->activating = FALSE;
+    }
+
+    _mcd_dispatch_operation_dec_observers_pending (call->self, call->client);
+    start_queued_observer_calls ();
+}
+
+static void
+observer_call_start (ObserverCall *call)
+{
+    call->activating = !_mcd_client_proxy_is_active (call->client);
+
+    if (call->activating)
+        activating_observers++;
+
+    DEBUG ("calling ObserveChannels on %s for CDO %p%s",
+           tp_proxy_get_bus_name (call->client), call->self,
+           call->activating ? " (activating it)" : "");
+    mcd_trace (MCD_TRACE_OBSERVER_CALLED, call->self->priv->trace_id,
+               tp_proxy_get_bus_name (call->client));
+    tp_cli_client_observer_call_observe_channels (
+        (TpClient *) call->client, -1,
+        call->account_path, call->connection_path, call->channels_array,
+        call->dispatch_operation_path, call->satisfied_requests,
+        call->observer_info,
+        observe_channels_cb, call, observer_call_free, NULL);
+}
+
+static gboolean
+may_activate_observer (void)
+{
+    guint limit = get_observer_activation_limit ();
+
+    return (limit == 0 || activating_observers < limit);
+}
+
+static void
+start_queued_observer_calls (void)
+{
+    while (!g_queue_is_empty (&queued_observer_calls) &&
+           may_activate_observer ())
+    {
+        observer_call_start (g_queue_pop_head (&queued_observer_calls));
+    }
+}
+
 static void
 _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
 {
     const gchar *dispatch_operation_path = "/";
-    GHashTable *observer_info;
+    GList *calls = NULL;
+    GList *l;
     GHashTableIter iter;
     gpointer client_p;
 
-    observer_info = tp_asv_new (NULL, NULL);
+    if (_mcd_dispatch_operation_needs_approval (self))
+    {
+        dispatch_operation_path = _mcd_dispatch_operation_get_path (self);
+    }
 
     _mcd_client_registry_init_hash_iter (self->priv->client_registry, &iter);
 
@@ -2007,9 +2189,8 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
     {
         McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
         gboolean observed = FALSE;
-        const gchar *account_path, *connection_path;
-        GPtrArray *channels_array, *satisfied_requests;
         GHashTable *request_properties;
+        ObserverCall *call;
 
         if (!tp_proxy_has_interface_by_id (client,
                                            TP_IFACE_QUARK_CLIENT_OBSERVER))
@@ -2034,47 +2215,62 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
         /* in particular this happens if there is no channel at all */
         if (!observed) continue;
 
-        /* build up the parameters and invoke the observer */
+        /* build up the parameters; we might not invoke the observer until
+         * later, by which time we might have lost the channel */
 
-        connection_path = _mcd_dispatch_operation_get_connection_path (self);
-        account_path = _mcd_dispatch_operation_get_account_path (self);
+        call = g_slice_new0 (ObserverCall);
+        call->self = g_object_ref (self);
+        call->client = g_object_ref (client);
+        call->connection_path = g_strdup (
+            _mcd_dispatch_operation_get_connection_path (self));
+        call->account_path = g_strdup (
+            _mcd_dispatch_operation_get_account_path (self));
+        call->dispatch_operation_path = g_strdup (dispatch_operation_path);
 
         /* TODO: there's room for optimization here: reuse the channels_array,
          * if the observed list is the same */
-        channels_array = _mcd_tp_channel_details_build_from_tp_chan (
+        call->channels_array = _mcd_tp_channel_details_build_from_tp_chan (
             mcd_channel_get_tp_channel (self->priv->channel));
 
-        collect_satisfied_requests (self->priv->channel, &satisfied_requests,
+        collect_satisfied_requests (self->priv->channel,
+                                    &call->satisfied_requests,
                                     &request_properties);
 
         /* transfer ownership into observer_info */
-        tp_asv_take_boxed (observer_info, "request-properties",
+        call->observer_info = tp_asv_new (NULL, NULL);
+        tp_asv_take_boxed (call->observer_info, "request-properties",
             TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP,
             request_properties);
         request_properties = NULL;
 
-        if (_mcd_dispatch_operation_needs_approval (self))
-        {
-            dispatch_operation_path = _mcd_dispatch_operation_get_path (self);
-        }
-
         _mcd_dispatch_operation_inc_observers_pending (self, client);
+        calls = g_list_prepend (calls, call);
+    }
 
-        DEBUG ("calling ObserveChannels on %s for CDO %p",
-               tp_proxy_get_bus_name (client), self);
-        tp_cli_client_observer_call_observe_channels (
-            (TpClient *) client, -1,
-            account_path, connection_path, channels_array,
-            dispatch_operation_path, satisfied_requests, observer_info,
-            observe_channels_cb,
-            g_object_ref (self), g_object_unref, NULL);
+    calls = g_list_sort (g_list_reverse (calls), observer_call_compare);
 
-        g_ptr_array_unref (satisfied_requests);
+    for (l = calls; l != NULL; l = l->next)
+    {
+        ObserverCall *call = l->data;
 
-        _mcd_tp_channel_details_free (channels_array);
+        if (_mcd_client_proxy_is_active (call->client) ||
+            (g_queue_is_empty (&queued_observer_calls) &&
+             may_activate_observer ()))
+        {
+            observer_call_start (call);
+        }
+        else
+        {
+            DEBUG ("%u observers are being activated; queueing "
+                   "ObserveChannels on %s for CDO %p",
+                   activating_observers, tp_proxy_get_bus_name (call->client),
+                   self);
+            g_queue_insert_sorted (&queued_observer_calls, call,
+                                   observer_call_compare_queued, NULL);
+        }
     }
 
-    g_hash_table_unref (observer_info);
+    g_list_free (calls);
 }
 
 static void
@@ -2085,6 +2281,9 @@ add_dispatch_operation_cb (TpClient *proxy,
 {
     McdDispatchOperation *self = user_data;
 
+    mcd_trace (MCD_TRACE_APPROVER_RETURNED, self->priv->trace_id,
+               tp_proxy_get_bus_name (proxy));
+
     if (error)
     {
         DEBUG ("AddDispatchOperation %s (%p) on approver %s failed: "
@@ -2166,6 +2365,8 @@ _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
                tp_proxy_get_bus_name (client), dispatch_operation, self);
 
         _mcd_dispatch_operation_inc_ado_pending (self);
+        mcd_trace (MCD_TRACE_APPROVER_CALLED, self->priv->trace_id,
+                   tp_proxy_get_bus_name (client));
 
         tp_cli_client_approver_call_add_dispatch_operation (
             (TpClient *) client, -1,
@@ -2251,6 +2452,9 @@ mcd_dispatch_operation_handle_channels (McdDispatchOperation *self)
 
     g_assert (self->priv->trying_handler != NULL);
 
+    mcd_trace (MCD_TRACE_HANDLER_TRIED, self->priv->trace_id,
+               tp_proxy_get_bus_name (self->priv->trying_handler));
+
     if (self->priv->handler_unsuitable != NULL)
     {
         GError *tmp = self->priv->handler_unsuitable;
@@ -53,6 +53,11 @@ G_GNUC_INTERNAL void _mcd_dispatcher_add_connection (McdDispatcher *self,
 
 G_GNUC_INTERNAL GPtrArray *_mcd_dispatcher_dup_client_caps (
     McdDispatcher *self);
+G_GNUC_INTERNAL guint _mcd_dispatcher_get_client_caps_generation (
+    McdDispatcher *self);
+
+G_GNUC_INTERNAL void _mcd_dispatcher_add_memory_report (McdDispatcher *self,
+    GVariantBuilder *report, guint depth);
 
 G_END_DECLS
 
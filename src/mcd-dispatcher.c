@@ -37,6 +37,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include <dlfcn.h>
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -56,7 +58,10 @@
 #include "mcd-dispatcher-priv.h"
 #include "mcd-dispatch-operation-priv.h"
 #include "mcd-handler-map-priv.h"
+#include "mcd-memory.h"
 #include "mcd-misc.h"
+#include "mcd-slacker.h"
+#include "mcd-timeout.h"
 #include "plugin-loader.h"
 
 #include <telepathy-glib/telepathy-glib.h>
@@ -70,6 +75,14 @@
 
 #define MCD_DISPATCHER_PRIV(dispatcher) (MCD_DISPATCHER (dispatcher)->priv)
 
+/* How long to wait for more handlers' capabilities to change before
+ * telling the connections, in milliseconds */
+#define CLIENT_CAPS_DELAY 100
+
+/* How long to hold back those changes while the device is idle, in
+ * seconds; remote contacts only see them as our capabilities anyway */
+#define CLIENT_CAPS_MAX_DELAY 60
+
 static void dispatcher_iface_init (gpointer, gpointer);
 static void messages_iface_init (gpointer, gpointer);
 
@@ -125,6 +138,18 @@ struct _McdDispatcherPrivate
     /* connection => itself, borrowed */
     GHashTable *connections;
 
+    /* bus name => owned McdClientProxy whose handler capabilities have
+     * changed since we last told the connections */
+    GHashTable *dirty_client_caps;
+    /* bus name => digest of the handler capabilities we last sent to the
+     * connections for that client */
+    GHashTable *sent_client_caps;
+    guint client_caps_timeout;
+    /* postpones telling the connections while the device is idle */
+    McdSlacker *slacker;
+    /* incremented whenever any client's handler capabilities change */
+    guint client_caps_generation;
+
     /* Initially FALSE, meaning we suppress OperationList.DispatchOperations
      * change notification signals because nobody has retrieved that property
      * yet. Set to TRUE the first time someone reads the DispatchOperations
@@ -262,6 +287,9 @@ _mcd_dispatcher_enter_state_machine (McdDispatcher *dispatcher,
 
     priv = dispatcher->priv;
 
+    /* accounts that are actually used are connected first */
+    _mcd_account_set_last_used (account);
+
     DEBUG ("new dispatch operation for %s channel %p: %s",
            requested ? "requested" : "unrequested",
            channel,
@@ -678,7 +706,6 @@ mcd_dispatcher_client_registry_ready_cb (McdClientRegistry *clients,
         _mcd_connection_start_dispatching (p, vas);
     }
 
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
     g_ptr_array_unref (vas);
 }
 
@@ -711,6 +738,21 @@ _mcd_dispatcher_dispose (GObject * object)
 
     tp_clear_object (&priv->handler_map);
 
+    if (priv->client_caps_timeout != 0)
+    {
+        mcd_timeout_remove (priv->client_caps_timeout);
+        priv->client_caps_timeout = 0;
+    }
+
+    if (priv->slacker != NULL)
+    {
+        mcd_slacker_cancel (priv->slacker, object);
+        tp_clear_object (&priv->slacker);
+    }
+
+    tp_clear_pointer (&priv->dirty_client_caps, g_hash_table_unref);
+    tp_clear_pointer (&priv->sent_client_caps, g_hash_table_unref);
+
     if (priv->clients != NULL)
     {
         gpointer client_p;
@@ -741,36 +783,99 @@ _mcd_dispatcher_dispose (GObject * object)
 }
 
 static void
-mcd_dispatcher_update_client_caps (McdDispatcher *self,
-                                   McdClientProxy *client)
+mcd_dispatcher_send_client_caps (gpointer owner,
+                                 const gchar *name G_GNUC_UNUSED)
 {
+    McdDispatcher *self = owner;
     GPtrArray *vas;
     GHashTableIter iter;
-    gpointer k;
+    gpointer k, v;
+
+    vas = g_ptr_array_sized_new (
+        g_hash_table_size (self->priv->dirty_client_caps));
+
+    g_hash_table_iter_init (&iter, self->priv->dirty_client_caps);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        const gchar *digest =
+            _mcd_client_proxy_get_handler_capabilities_digest (v);
+
+        /* e.g. a client that fell off the bus and came back */
+        if (!tp_strdiff (digest,
+                         g_hash_table_lookup (self->priv->sent_client_caps, k)))
+        {
+            DEBUG ("%s: capabilities unchanged", (const gchar *) k);
+            continue;
+        }
+
+        g_hash_table_insert (self->priv->sent_client_caps, g_strdup (k),
+                             g_strdup (digest));
+        g_ptr_array_add (vas, _mcd_client_proxy_get_handler_capabilities (v));
+    }
+
+    if (vas->len > 0)
+    {
+        DEBUG ("sending capabilities of %u clients to %u connections",
+               vas->len, g_hash_table_size (self->priv->connections));
+
+        g_hash_table_iter_init (&iter, self->priv->connections);
+
+        while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+            _mcd_connection_update_client_caps (k, vas);
+        }
+    }
+
+    /* the capabilities in @vas are borrowed from these clients */
+    g_ptr_array_unref (vas);
+    g_hash_table_remove_all (self->priv->dirty_client_caps);
+}
+
+static gboolean
+mcd_dispatcher_flush_client_caps (gpointer data)
+{
+    McdDispatcher *self = data;
+
+    self->priv->client_caps_timeout = 0;
+    mcd_slacker_defer (self->priv->slacker, self, "client-caps",
+                       CLIENT_CAPS_MAX_DELAY, mcd_dispatcher_send_client_caps);
+    return FALSE;
+}
+
+static void
+mcd_dispatcher_update_client_caps (McdDispatcher *self,
+                                   McdClientProxy *client)
+{
+    const gchar *bus_name = tp_proxy_get_bus_name (client);
+
+    self->priv->client_caps_generation++;
 
     /* If we haven't finished inspecting initial clients yet, we'll push all
      * the client caps into all connections when we do, so do nothing.
      *
      * If we don't have any connections, on the other hand, then there's
-     * nothing to do. */
+     * nothing to do: each new connection gets everyone's capabilities.
+     *
+     * In either case, we can no longer assume that connections have
+     * whatever we last sent for this client. */
     if (!_mcd_client_registry_is_ready (self->priv->clients)
         || g_hash_table_size (self->priv->connections) == 0)
     {
+        g_hash_table_remove (self->priv->sent_client_caps, bus_name);
         return;
     }
 
-    vas = g_ptr_array_sized_new (1);
-    g_ptr_array_add (vas, _mcd_client_proxy_dup_handler_capabilities (client));
+    /* Handlers tend to appear in bursts (e.g. at login), so wait for the
+     * burst to end and send one UpdateCapabilities per connection. */
+    g_hash_table_insert (self->priv->dirty_client_caps, g_strdup (bus_name),
+                         g_object_ref (client));
 
-    g_hash_table_iter_init (&iter, self->priv->connections);
-
-    while (g_hash_table_iter_next (&iter, &k, NULL))
+    if (self->priv->client_caps_timeout == 0)
     {
-        _mcd_connection_update_client_caps (k, vas);
+        self->priv->client_caps_timeout = mcd_timeout_add (CLIENT_CAPS_DELAY,
+            mcd_dispatcher_flush_client_caps, self);
     }
-
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
-    g_ptr_array_unref (vas);
 }
 
 static void
@@ -891,6 +996,11 @@ mcd_dispatcher_init (McdDispatcher * dispatcher)
     priv->operation_list_active = FALSE;
 
     priv->connections = g_hash_table_new (NULL, NULL);
+    priv->dirty_client_caps = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     g_free, g_object_unref);
+    priv->sent_client_caps = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, g_free);
+    priv->slacker = mcd_slacker_new ();
 
     /* idempotent, not guaranteed to have been called yet */
     _mcd_plugin_loader_init ();
@@ -907,6 +1017,117 @@ mcd_dispatcher_new (TpDBusDaemon *dbus_daemon, McdMaster *master)
     return obj;
 }
 
+typedef struct {
+    McpInternalHandler *handler;
+    guint quality;
+} InternalHandlerMatch;
+
+static gint
+internal_handler_match_cmp (gconstpointer a,
+                            gconstpointer b)
+{
+    const InternalHandlerMatch *ma = a;
+    const InternalHandlerMatch *mb = b;
+
+    /* best match first */
+    if (ma->quality != mb->quality)
+        return (ma->quality > mb->quality) ? -1 : 1;
+
+    return 0;
+}
+
+/*
+ * mcd_dispatcher_try_internal_handlers:
+ *
+ * Offer @channel to plugins' #McpInternalHandler<!-- -->s whose filters
+ * match it, best match first, bypassing the ChannelDispatchOperation.
+ *
+ * Returns: %TRUE if one of them took it
+ */
+static gboolean
+mcd_dispatcher_try_internal_handlers (McdDispatcher *self,
+                                      McdChannel *channel)
+{
+    GVariant *properties = NULL;
+    GArray *matches = NULL;
+    const GList *p;
+    gboolean handled = FALSE;
+    guint i;
+
+    for (p = mcp_list_objects (); p != NULL; p = p->next)
+    {
+        InternalHandlerMatch match = { NULL, 0 };
+        GPtrArray *filters;
+
+        if (!MCP_IS_INTERNAL_HANDLER (p->data))
+            continue;
+
+        filters = mcp_internal_handler_get_filters (p->data);
+
+        if (filters == NULL || filters->len == 0)
+            continue;
+
+        if (properties == NULL)
+        {
+            properties = mcd_channel_dup_immutable_properties (channel);
+
+            if (properties == NULL)
+                return FALSE;
+        }
+
+        for (i = 0; i < filters->len; i++)
+        {
+            GList filter = { g_ptr_array_index (filters, i), NULL, NULL };
+            guint quality = _mcd_client_match_filters (properties, &filter,
+                                                       FALSE);
+
+            match.quality = MAX (match.quality, quality);
+        }
+
+        if (match.quality == 0)
+            continue;
+
+        if (matches == NULL)
+            matches = g_array_new (FALSE, FALSE,
+                                   sizeof (InternalHandlerMatch));
+
+        match.handler = p->data;
+        g_array_append_val (matches, match);
+    }
+
+    tp_clear_pointer (&properties, g_variant_unref);
+
+    if (matches == NULL)
+        return FALSE;
+
+    g_array_sort (matches, internal_handler_match_cmp);
+
+    for (i = 0; i < matches->len && !handled; i++)
+    {
+        McpInternalHandler *handler =
+            g_array_index (matches, InternalHandlerMatch, i).handler;
+        McdAccount *account = mcd_channel_get_account (channel);
+        const gchar *account_path = mcd_account_get_object_path (account);
+        TpChannel *tp_channel = mcd_channel_get_tp_channel (channel);
+
+        if (!mcp_internal_handler_handle_channel (handler, account_path,
+                                                  tp_channel))
+            continue;
+
+        DEBUG ("channel %p: %s handled by internal handler %s", channel,
+               mcd_channel_get_object_path (channel),
+               G_OBJECT_TYPE_NAME (handler));
+
+        _mcd_channel_set_status (channel, MCD_CHANNEL_STATUS_DISPATCHED);
+        _mcd_handler_map_set_channel_handled_internally (
+            self->priv->handler_map, tp_channel, account_path);
+        handled = TRUE;
+    }
+
+    g_array_unref (matches);
+    return handled;
+}
+
 /*
  * _mcd_dispatcher_add_channel:
  * @dispatcher: the #McdDispatcher.
@@ -953,6 +1174,12 @@ _mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
     request = _mcd_channel_get_request (channel);
     internal_request = _mcd_request_is_internal (request);
 
+    /* Channels that nobody asked the ChannelDispatcher for can go straight
+     * to an in-process handler, without a ChannelDispatchOperation */
+    if (request == NULL && !requested &&
+        mcd_dispatcher_try_internal_handlers (dispatcher, channel))
+        return;
+
     /* See if there are any handlers that can take all these channels */
     if (internal_request)
         possible_handlers = mcd_dispatcher_dup_internal_handlers ();
@@ -1390,7 +1617,10 @@ mcd_dispatcher_lost_connection (gpointer data,
 }
 
 /* FIXME: this only needs to exist because McdConnection calls it in order
- * to preload caps before Connect */
+ * to preload caps before Connect
+ *
+ * Returns: (transfer container): see _mcd_client_registry_dup_client_caps()
+ */
 GPtrArray *
 _mcd_dispatcher_dup_client_caps (McdDispatcher *self)
 {
@@ -1405,6 +1635,16 @@ _mcd_dispatcher_dup_client_caps (McdDispatcher *self)
     return _mcd_client_registry_dup_client_caps (self->priv->clients);
 }
 
+/* Returns: a number that changes whenever any client's handler capabilities
+ * change */
+guint
+_mcd_dispatcher_get_client_caps_generation (McdDispatcher *self)
+{
+    g_return_val_if_fail (MCD_IS_DISPATCHER (self), 0);
+
+    return self->priv->client_caps_generation;
+}
+
 void
 _mcd_dispatcher_add_connection (McdDispatcher *self,
                                 McdConnection *connection)
@@ -1425,7 +1665,6 @@ _mcd_dispatcher_add_connection (McdDispatcher *self,
 
         _mcd_connection_start_dispatching (connection, vas);
 
-        g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
         g_ptr_array_unref (vas);
     }
     /* else _mcd_connection_start_dispatching will be called when we're ready
@@ -2174,3 +2413,23 @@ dispatcher_iface_init (gpointer g_iface,
     IMPLEMENT (present_channel);
 #undef IMPLEMENT
 }
+
+void
+_mcd_dispatcher_add_memory_report (McdDispatcher *self,
+                                   GVariantBuilder *report,
+                                   guint depth)
+{
+    McdDispatcherPrivate *priv = self->priv;
+
+    /* dispatch operations are short-lived, so they are not broken down */
+    mcd_memory_report_add (report, depth, self, NULL,
+        mcd_memory_instance_size (self) + sizeof (McdDispatcherPrivate) +
+        g_list_length (priv->contexts) * sizeof (GList) +
+        g_list_length (priv->operations) * sizeof (GList) +
+        mcd_memory_hash_table_size (priv->connections) +
+        mcd_memory_string_hash_table_size (priv->dirty_client_caps, FALSE) +
+        mcd_memory_string_hash_table_size (priv->sent_client_caps, TRUE));
+
+    _mcd_client_registry_add_memory_report (priv->clients, report, depth + 1);
+    _mcd_handler_map_add_memory_report (priv->handler_map, report, depth + 1);
+}
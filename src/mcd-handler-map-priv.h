@@ -89,6 +89,9 @@ void _mcd_handler_map_set_channel_handled_internally (McdHandlerMap *self,
                                                       TpChannel *channel,
                                                       const gchar *account_path);
 
+G_GNUC_INTERNAL void _mcd_handler_map_add_memory_report (McdHandlerMap *self,
+    GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 
 #endif
@@ -24,12 +24,16 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include "mcd-handler-map-priv.h"
 
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "channel-utils.h"
 #include "mcd-channel-priv.h"
+#include "mcd-memory.h"
 
 G_DEFINE_TYPE (McdHandlerMap, _mcd_handler_map, G_TYPE_OBJECT);
 
@@ -472,3 +476,29 @@ _mcd_handler_map_set_channel_handled_internally (McdHandlerMap *self,
         tp_dbus_daemon_get_unique_name (self->priv->dbus_daemon),
         NULL, account_path);
 }
+
+void
+_mcd_handler_map_add_memory_report (McdHandlerMap *self,
+                                    GVariantBuilder *report,
+                                    guint depth)
+{
+    McdHandlerMapPrivate *priv = self->priv;
+    GHashTableIter iter;
+    gpointer v;
+    gsize size;
+
+    size = mcd_memory_instance_size (self) + sizeof (McdHandlerMapPrivate) +
+        mcd_memory_string_hash_table_size (priv->channel_processes, TRUE) +
+        mcd_memory_string_hash_table_size (priv->channel_clients, TRUE) +
+        mcd_memory_string_hash_table_size (priv->handler_processes, FALSE) +
+        g_hash_table_size (priv->handler_processes) * sizeof (gsize) +
+        mcd_memory_string_hash_table_size (priv->handled_channels, FALSE) +
+        mcd_memory_string_hash_table_size (priv->channel_accounts, TRUE);
+
+    g_hash_table_iter_init (&iter, priv->handled_channels);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+        size += mcd_memory_instance_size (v);
+
+    mcd_memory_report_add (report, depth, self, NULL, size);
+}
@@ -34,5 +34,8 @@ G_BEGIN_DECLS
 TpProtocol *_mcd_manager_dup_protocol (McdManager *manager,
     const gchar *protocol);
 
+G_GNUC_INTERNAL void _mcd_manager_add_memory_report (McdManager *self,
+    GVariantBuilder *report, guint depth);
+
 G_END_DECLS
 #endif /* MCD_MANAGER_H */
@@ -36,20 +36,30 @@
  */
 
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_CONNECTION
+
 #include "mcd-manager.h"
 #include "mcd-manager-priv.h"
+#include "mcd-memory.h"
+#include "mcd-connection-priv.h"
 #include "mcd-misc.h"
 #include "mcd-slacker.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <glib/gstdio.h>
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-connection.h"
 
 #define MANAGER_SUFFIX ".manager"
 
+/* (cache key, { protocol name => immutable properties }) */
+#define PROTOCOL_CACHE_TYPE "(sa{sa{sv}})"
+
 #define MCD_MANAGER_PRIV(manager) (MCD_MANAGER (manager)->priv)
 
 G_DEFINE_TYPE (McdManager, mcd_manager, MCD_TYPE_OPERATION);
@@ -62,6 +72,11 @@ struct _McdManagerPrivate
     McdDispatcher *dispatcher;
 
     TpConnectionManager *tp_conn_mgr;
+    /* identifies the installed version of the CM, or NULL if unknown */
+    gchar *cache_key;
+    /* protocol name => TpProtocol, if we got them from the cache instead
+     * of preparing tp_conn_mgr */
+    GHashTable *cached_protocols;
 
     McdSlacker *slacker;
 
@@ -79,6 +94,271 @@ enum
 
 static GQuark readiness_quark = 0;
 
+static gchar *
+find_data_file (const gchar *subdir,
+                const gchar *basename)
+{
+    const gchar * const *dirs;
+    gchar *path;
+
+    path = g_build_filename (g_get_user_data_dir (), subdir, basename, NULL);
+
+    if (g_file_test (path, G_FILE_TEST_EXISTS))
+        return path;
+
+    g_free (path);
+
+    for (dirs = g_get_system_data_dirs (); *dirs != NULL; dirs++)
+    {
+        path = g_build_filename (*dirs, subdir, basename, NULL);
+
+        if (g_file_test (path, G_FILE_TEST_EXISTS))
+            return path;
+
+        g_free (path);
+    }
+
+    return NULL;
+}
+
+/*
+ * Return the path to the executable named by the Exec line of the D-Bus
+ * service file at @service_path, or NULL if it can't be found.
+ */
+static gchar *
+dup_service_executable (const gchar *service_path)
+{
+    GKeyFile *keyfile = g_key_file_new ();
+    gchar *exec = NULL;
+    gchar **argv = NULL;
+    gchar *ret = NULL;
+
+    if (!g_key_file_load_from_file (keyfile, service_path, G_KEY_FILE_NONE,
+                                    NULL))
+        goto finally;
+
+    exec = g_key_file_get_string (keyfile, "D-BUS Service", "Exec", NULL);
+
+    if (exec == NULL || !g_shell_parse_argv (exec, NULL, &argv, NULL))
+        goto finally;
+
+    if (g_path_is_absolute (argv[0]))
+        ret = g_strdup (argv[0]);
+    else
+        ret = g_find_program_in_path (argv[0]);
+
+finally:
+    g_strfreev (argv);
+    g_free (exec);
+    g_key_file_free (keyfile);
+    return ret;
+}
+
+/*
+ * Return a string that changes whenever the CM is reinstalled: the path,
+ * mtime and size of its .manager file or, if it doesn't have one, of its
+ * D-Bus service file and the executable that starts it (upgrading a CM
+ * rarely touches its .service file). If we can't find those files, we
+ * can't tell whether a cache is still valid, so return NULL.
+ */
+static gchar *
+dup_cache_key (const gchar *cm_name)
+{
+    GStatBuf st;
+    gchar *basename;
+    gchar *path;
+    gchar *exec_path;
+    gchar *key = NULL;
+
+    basename = g_strconcat (cm_name, MANAGER_SUFFIX, NULL);
+    path = find_data_file ("telepathy" G_DIR_SEPARATOR_S "managers", basename);
+    g_free (basename);
+
+    if (path != NULL)
+    {
+        if (g_stat (path, &st) == 0)
+            key = g_strdup_printf ("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+                                   path, (gint64) st.st_mtime,
+                                   (gint64) st.st_size);
+
+        g_free (path);
+        return key;
+    }
+
+    basename = g_strconcat (TP_CM_BUS_NAME_BASE, cm_name, ".service", NULL);
+    path = find_data_file ("dbus-1" G_DIR_SEPARATOR_S "services", basename);
+    g_free (basename);
+
+    if (path == NULL)
+        return NULL;
+
+    exec_path = dup_service_executable (path);
+
+    if (exec_path != NULL && g_stat (path, &st) == 0)
+    {
+        GStatBuf exec_st;
+
+        if (g_stat (exec_path, &exec_st) == 0)
+            key = g_strdup_printf ("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT
+                                   ":%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+                                   path, (gint64) st.st_mtime,
+                                   (gint64) st.st_size, exec_path,
+                                   (gint64) exec_st.st_mtime,
+                                   (gint64) exec_st.st_size);
+    }
+
+    g_free (exec_path);
+    g_free (path);
+    return key;
+}
+
+static gchar *
+get_cache_path (McdManager *manager)
+{
+    gchar *basename = g_strconcat (manager->priv->name, ".gvariant", NULL);
+    gchar *path = g_build_filename (g_get_user_cache_dir (), "telepathy",
+                                    "mission-control", "managers", basename,
+                                    NULL);
+
+    g_free (basename);
+    return path;
+}
+
+/*
+ * Return the protocols that were saved by save_protocol_cache() when the
+ * CM was last introspected, or NULL if there are none or the CM has
+ * changed since.
+ */
+static GHashTable *
+load_protocol_cache (McdManager *manager)
+{
+    McdManagerPrivate *priv = manager->priv;
+    GHashTable *protocols = NULL;
+    GVariant *cache = NULL;
+    GVariant *dict = NULL;
+    GVariant *props;
+    GVariantIter iter;
+    const gchar *cached_key;
+    const gchar *name;
+    gchar *path;
+    gchar *contents;
+    gsize len;
+
+    path = get_cache_path (manager);
+
+    if (!g_file_get_contents (path, &contents, &len, NULL))
+        goto finally;
+
+    cache = g_variant_ref_sink (g_variant_new_from_data (
+        G_VARIANT_TYPE (PROTOCOL_CACHE_TYPE), contents, len, FALSE,
+        g_free, contents));
+    g_variant_get (cache, "(&s@a{sa{sv}})", &cached_key, &dict);
+
+    if (tp_strdiff (cached_key, priv->cache_key))
+    {
+        DEBUG ("%s has changed since %s was written", priv->name, path);
+        goto finally;
+    }
+
+    protocols = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                       g_object_unref);
+    g_variant_iter_init (&iter, dict);
+
+    while (g_variant_iter_next (&iter, "{&s@a{sv}}", &name, &props))
+    {
+        GError *error = NULL;
+        TpProtocol *protocol;
+
+        protocol = tp_protocol_new_vardict (priv->dbus_daemon, priv->name,
+                                            name, props, &error);
+        g_variant_unref (props);
+
+        if (protocol == NULL)
+        {
+            DEBUG ("ignoring %s: %s", path, error->message);
+            g_error_free (error);
+            tp_clear_pointer (&protocols, g_hash_table_unref);
+            break;
+        }
+
+        g_hash_table_insert (protocols, g_strdup (name), protocol);
+    }
+
+    if (protocols != NULL && g_hash_table_size (protocols) == 0)
+        tp_clear_pointer (&protocols, g_hash_table_unref);
+
+finally:
+    tp_clear_pointer (&dict, g_variant_unref);
+    tp_clear_pointer (&cache, g_variant_unref);
+    g_free (path);
+    return protocols;
+}
+
+static void
+save_protocol_cache (McdManager *manager)
+{
+    McdManagerPrivate *priv = manager->priv;
+    GVariantBuilder builder;
+    GVariant *cache;
+    GList *protocols, *l;
+    GError *error = NULL;
+    gchar *path;
+    gchar *dir;
+
+    if (priv->cache_key == NULL)
+        return;
+
+    protocols = tp_connection_manager_dup_protocols (priv->tp_conn_mgr);
+
+    if (protocols == NULL)
+        return;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+
+    for (l = protocols; l != NULL; l = l->next)
+    {
+        GVariant *props = tp_protocol_dup_immutable_properties (l->data);
+
+        g_variant_builder_add (&builder, "{s@a{sv}}",
+                               tp_protocol_get_name (l->data), props);
+        g_variant_unref (props);
+    }
+
+    cache = g_variant_ref_sink (g_variant_new ("(s@a{sa{sv}})",
+                                               priv->cache_key,
+                                               g_variant_builder_end (&builder)));
+
+    path = get_cache_path (manager);
+    dir = g_path_get_dirname (path);
+
+    if (g_mkdir_with_parents (dir, 0700) != 0 ||
+        !g_file_set_contents (path, g_variant_get_data (cache),
+                              g_variant_get_size (cache), &error))
+    {
+        DEBUG ("unable to cache %s protocols in %s: %s", priv->name, path,
+               error != NULL ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+    }
+
+    g_free (dir);
+    g_free (path);
+    g_variant_unref (cache);
+    g_list_free_full (protocols, g_object_unref);
+}
+
+static TpProtocol *
+get_protocol (McdManager *manager,
+              const gchar *protocol)
+{
+    McdManagerPrivate *priv = manager->priv;
+
+    if (priv->cached_protocols != NULL)
+        return g_hash_table_lookup (priv->cached_protocols, protocol);
+
+    return tp_connection_manager_get_protocol_object (priv->tp_conn_mgr,
+                                                      protocol);
+}
+
 static void
 on_manager_ready (GObject *source_object,
                   GAsyncResult *result, gpointer user_data)
@@ -93,6 +373,10 @@ on_manager_ready (GObject *source_object,
     priv = manager->priv;
     DEBUG ("manager %s is ready", priv->name);
     priv->ready = TRUE;
+
+    if (error == NULL)
+        save_protocol_cache (manager);
+
     _mcd_object_ready (manager, readiness_quark, error);
     g_clear_error (&error);
 }
@@ -103,6 +387,7 @@ _mcd_manager_finalize (GObject * object)
     McdManagerPrivate *priv = MCD_MANAGER_PRIV (object);
 
     g_free (priv->name);
+    g_free (priv->cache_key);
 
     G_OBJECT_CLASS (mcd_manager_parent_class)->finalize (object);
 }
@@ -123,6 +408,7 @@ _mcd_manager_dispose (GObject * object)
 
     tp_clear_object (&priv->dispatcher);
     tp_clear_object (&priv->tp_conn_mgr);
+    tp_clear_pointer (&priv->cached_protocols, g_hash_table_unref);
     tp_clear_object (&priv->client_factory);
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->slacker);
@@ -176,7 +462,30 @@ mcd_manager_setup (McdManager *manager)
         goto error;
     }
 
-    tp_proxy_prepare_async (priv->tp_conn_mgr, NULL, on_manager_ready, manager);
+    /* If we have already introspected this version of the CM, we don't
+     * need to read its .manager file or activate it again until an
+     * account actually connects.
+     *
+     * tp_conn_mgr is then left unprepared. That is safe because protocol
+     * information only comes from get_protocol(), and the proxy itself
+     * is only used for its name and for RequestConnection (in
+     * McdConnection), neither of which needs any feature: the call
+     * activates the CM if necessary. */
+    priv->cache_key = dup_cache_key (priv->name);
+
+    if (priv->cache_key != NULL)
+        priv->cached_protocols = load_protocol_cache (manager);
+
+    if (priv->cached_protocols != NULL)
+    {
+        DEBUG ("using cached protocols for manager %s", priv->name);
+        priv->ready = TRUE;
+    }
+    else
+    {
+        tp_proxy_prepare_async (priv->tp_conn_mgr, NULL, on_manager_ready,
+                                manager);
+    }
 
     DEBUG ("Manager %s created", priv->name);
     return TRUE;
@@ -350,8 +659,7 @@ _mcd_manager_dup_protocol (McdManager *manager,
     g_return_val_if_fail (MCD_IS_MANAGER (manager), NULL);
     g_return_val_if_fail (protocol != NULL, NULL);
 
-    p = tp_connection_manager_get_protocol_object (manager->priv->tp_conn_mgr,
-                                                   protocol);
+    p = get_protocol (manager, protocol);
 
     if (p == NULL)
         return NULL;
@@ -363,17 +671,13 @@ const TpConnectionManagerParam *
 mcd_manager_get_protocol_param (McdManager *manager, const gchar *protocol,
                                 const gchar *param)
 {
-    McdManagerPrivate *priv;
     TpProtocol *cm_protocol;
 
     g_return_val_if_fail (MCD_IS_MANAGER (manager), NULL);
     g_return_val_if_fail (protocol != NULL, NULL);
     g_return_val_if_fail (param != NULL, NULL);
 
-    priv = manager->priv;
-
-    cm_protocol = tp_connection_manager_get_protocol_object (priv->tp_conn_mgr,
-                                                             protocol);
+    cm_protocol = get_protocol (manager, protocol);
 
     if (cm_protocol == NULL)
         return NULL;
@@ -426,7 +730,9 @@ mcd_manager_get_tp_proxy (McdManager *manager)
  *
  * Invoke @callback when @manager is ready, i.e. when its introspection has
  * completed and all the manager protocols and parameter descriptions are
- * available.
+ * available. If they were cached by a previous run of Mission Control, and
+ * the connection manager hasn't been reinstalled since, that is
+ * immediately.
  */
 void
 mcd_manager_call_when_ready (McdManager *manager, McdManagerReadyCb callback,
@@ -442,3 +748,39 @@ mcd_manager_call_when_ready (McdManager *manager, McdManagerReadyCb callback,
                                      (McdReadyCb)callback, user_data);
 }
 
+void
+_mcd_manager_add_memory_report (McdManager *self,
+                                GVariantBuilder *report,
+                                guint depth)
+{
+    McdManagerPrivate *priv = self->priv;
+    const GList *list;
+    gsize size;
+
+    size = mcd_memory_instance_size (self) + sizeof (McdManagerPrivate) +
+        mcd_memory_string_size (priv->name) +
+        mcd_memory_string_size (priv->cache_key) +
+        mcd_memory_string_hash_table_size (priv->cached_protocols, FALSE);
+
+    if (priv->cached_protocols != NULL)
+    {
+        GHashTableIter iter;
+        gpointer v;
+
+        g_hash_table_iter_init (&iter, priv->cached_protocols);
+
+        while (g_hash_table_iter_next (&iter, NULL, &v))
+            size += mcd_memory_instance_size (v);
+    }
+
+    mcd_memory_report_add (report, depth, self, priv->name, size);
+
+    for (list = mcd_operation_get_missions (MCD_OPERATION (self));
+         list != NULL;
+         list = list->next)
+    {
+        if (MCD_IS_CONNECTION (list->data))
+            _mcd_connection_add_memory_report (list->data, report,
+                                               depth + 1);
+    }
+}
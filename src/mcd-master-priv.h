@@ -31,6 +31,11 @@
 
 G_BEGIN_DECLS
 
+/* MC-specific diagnostics, exported alongside the Telepathy Debug interface
+ * at TP_DEBUG_OBJECT_PATH */
+#define MC_IFACE_DEBUG \
+    "org.freedesktop.Telepathy.MissionControl5.Debug.DRAFT"
+
 G_GNUC_INTERNAL
 
 McdManager *_mcd_master_lookup_manager (McdMaster *master,
@@ -72,6 +72,13 @@
 #include "mcd-account-manager.h"
 #include "mcd-account-manager-priv.h"
 #include "mcd-account-priv.h"
+#include "mcd-connection-priv.h"
+#include "mcd-dbusmethod.h"
+#include "mcd-dispatcher-priv.h"
+#include "mcd-manager-priv.h"
+#include "mcd-memory.h"
+#include "mcd-timeout.h"
+#include "mcd-trace.h"
 #include "plugin-loader.h"
 
 #ifdef G_OS_UNIX
@@ -91,6 +98,9 @@ struct _McdMasterPrivate
     TpDBusDaemon *dbus_daemon;
     TpSimpleClientFactory *client_factory;
 
+    /* MC_IFACE_DEBUG */
+    McdDBusMethodExport *debug_export;
+
     /* Current pending sleep timer */
     gint shutdown_timeout_id;
 
@@ -171,10 +181,12 @@ _mcd_master_dispose (GObject * object)
     }
     priv->is_disposed = TRUE;
 
+    tp_clear_pointer (&priv->debug_export, mcd_dbus_method_unexport);
     tp_clear_object (&priv->account_manager);
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->dispatcher);
     tp_clear_object (&priv->client_factory);
+    _mcd_connection_free_presence_tables ();
 
     if (default_master == (McdMaster *) object)
     {
@@ -184,6 +196,120 @@ _mcd_master_dispose (GObject * object)
     G_OBJECT_CLASS (mcd_master_parent_class)->dispose (object);
 }
 
+static void
+mcd_master_dump_dispatch_trace (gpointer self,
+                                GVariant *parameters,
+                                McdDBusMethodInvocation *invocation)
+{
+    GVariant *events = mcd_trace_dup_events ();
+
+    mcd_dbus_method_invocation_return_value (invocation,
+        g_variant_new_tuple (&events, 1));
+    g_variant_unref (events);
+}
+
+static void
+mcd_master_get_debug_levels (gpointer self,
+                             GVariant *parameters,
+                             McdDBusMethodInvocation *invocation)
+{
+    GVariant *levels = mcd_debug_dup_category_levels ();
+
+    mcd_dbus_method_invocation_return_value (invocation,
+        g_variant_new_tuple (&levels, 1));
+    g_variant_unref (levels);
+}
+
+static void
+mcd_master_set_debug_level (gpointer self,
+                            GVariant *parameters,
+                            McdDBusMethodInvocation *invocation)
+{
+    const gchar *category;
+    guint32 level;
+
+    g_variant_get (parameters, "(&su)", &category, &level);
+
+    if (level > MCD_DEBUG_MAX_LEVEL)
+    {
+        GError *error = g_error_new (TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+                                     "Debug levels range from 0 to %d",
+                                     MCD_DEBUG_MAX_LEVEL);
+
+        mcd_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+    }
+    else if (!mcd_debug_set_category_level (category, level))
+    {
+        GError *error = g_error_new (TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+                                     "No such debug category '%s'",
+                                     category);
+
+        mcd_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+    }
+    else
+    {
+        mcd_dbus_method_invocation_return_value (invocation, NULL);
+    }
+}
+
+static void
+mcd_master_get_memory_report (gpointer self,
+                              GVariant *parameters,
+                              McdDBusMethodInvocation *invocation)
+{
+    McdMaster *master = MCD_MASTER (self);
+    McdMasterPrivate *priv = master->priv;
+    GVariantBuilder report;
+    GVariant *entries;
+    const GList *list;
+
+    g_variant_builder_init (&report, G_VARIANT_TYPE (MCD_MEMORY_REPORT));
+
+    mcd_memory_report_add (&report, 0, master, NULL,
+                           mcd_memory_instance_size (master) +
+                           sizeof (McdMasterPrivate));
+
+    for (list = mcd_operation_get_missions (MCD_OPERATION (master));
+         list != NULL;
+         list = list->next)
+    {
+        if (MCD_IS_MANAGER (list->data))
+            _mcd_manager_add_memory_report (list->data, &report, 1);
+    }
+
+    _mcd_account_manager_add_memory_report (priv->account_manager, &report,
+                                            1);
+    _mcd_dispatcher_add_memory_report (priv->dispatcher, &report, 1);
+
+    entries = g_variant_builder_end (&report);
+    mcd_dbus_method_invocation_return_value (invocation,
+        g_variant_new_tuple (&entries, 1));
+}
+
+static void
+mcd_master_get_timer_stats (gpointer self,
+                            GVariant *parameters,
+                            McdDBusMethodInvocation *invocation)
+{
+    guint per_minute;
+    guint64 wakeups, timeouts_run;
+
+    mcd_timeout_get_stats (&per_minute, &wakeups, &timeouts_run);
+    mcd_dbus_method_invocation_return_value (invocation,
+        g_variant_new ("(utt)", per_minute, wakeups, timeouts_run));
+}
+
+static const McdDBusMethod debug_methods[] = {
+    { "DumpDispatchTrace", "()", mcd_master_dump_dispatch_trace },
+    { "GetDebugLevels", "()", mcd_master_get_debug_levels },
+    { "GetMemoryReport", "()", mcd_master_get_memory_report },
+    { "GetTimerStats", "()", mcd_master_get_timer_stats },
+    { "SetDebugLevel", "(su)", mcd_master_set_debug_level },
+    { NULL }
+};
+
 static GObject *
 mcd_master_constructor (GType type, guint n_params,
 			GObjectConstructParam *params)
@@ -210,6 +336,9 @@ mcd_master_constructor (GType type, guint n_params,
 
     _mcd_account_manager_setup (priv->account_manager);
 
+    priv->debug_export = mcd_dbus_method_export (priv->dbus_daemon,
+        TP_DEBUG_OBJECT_PATH, MC_IFACE_DEBUG, debug_methods, master);
+
     dbus_connection_set_exit_on_disconnect (
         dbus_g_connection_get_connection (
             tp_proxy_get_dbus_connection (TP_PROXY (priv->dbus_daemon))),
@@ -367,9 +496,8 @@ mcd_master_shutdown (McdMaster *self,
                reason ? reason : "No reason specified",
                EXIT_COUNTDOWN_TIME);
 
-        priv->shutdown_timeout_id = g_timeout_add (EXIT_COUNTDOWN_TIME,
-                                                   _mcd_master_exit_by_timeout,
-                                                   self);
+        priv->shutdown_timeout_id = mcd_timeout_add (
+            EXIT_COUNTDOWN_TIME, _mcd_master_exit_by_timeout, self);
     }
     else
     {
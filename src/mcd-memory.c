@@ -0,0 +1,198 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-memory.c - estimates of the memory retained by MC's objects
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Each class that can retain a significant amount of memory has an
+ * _mcd_*_add_memory_report() function which adds an entry for itself,
+ * using the helpers here to size its private data, then calls the
+ * corresponding functions for the objects it owns. McdMaster starts the
+ * walk when the GetMemoryReport D-Bus method is called.
+ */
+
+#include "config.h"
+#include "mcd-memory.h"
+
+#include <string.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+/* GHashTable's own struct, approximately */
+#define HASH_TABLE_OVERHEAD (12 * sizeof (gpointer))
+/* GVariant's instance struct, approximately */
+#define VARIANT_OVERHEAD (6 * sizeof (gpointer))
+
+gsize
+mcd_memory_string_size (const gchar *str)
+{
+    if (str == NULL)
+        return 0;
+
+    return strlen (str) + 1;
+}
+
+gsize
+mcd_memory_strv_size (const gchar * const *strv)
+{
+    gsize size;
+
+    if (strv == NULL)
+        return 0;
+
+    for (size = sizeof (gchar *); *strv != NULL; strv++)
+        size += sizeof (gchar *) + mcd_memory_string_size (*strv);
+
+    return size;
+}
+
+/*
+ * The table itself, but not its keys and values: GHashTable keeps
+ * power-of-two-sized arrays of keys, values (unless they are the keys)
+ * and hashes, and never uses more than 3/4 of them... roughly.
+ */
+gsize
+mcd_memory_hash_table_size (GHashTable *table)
+{
+    gsize buckets = 8;
+    guint n;
+
+    if (table == NULL)
+        return 0;
+
+    n = g_hash_table_size (table);
+
+    while (buckets * 3 / 4 < n)
+        buckets *= 2;
+
+    return HASH_TABLE_OVERHEAD +
+        buckets * (2 * sizeof (gpointer) + sizeof (guint));
+}
+
+/* A table with string keys and either string values or values that are
+ * counted elsewhere */
+gsize
+mcd_memory_string_hash_table_size (GHashTable *table,
+                                   gboolean string_values)
+{
+    GHashTableIter iter;
+    gpointer k, v;
+    gsize size = mcd_memory_hash_table_size (table);
+
+    if (table == NULL)
+        return 0;
+
+    g_hash_table_iter_init (&iter, table);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        size += mcd_memory_string_size (k);
+
+        if (string_values)
+            size += mcd_memory_string_size (v);
+    }
+
+    return size;
+}
+
+gsize
+mcd_memory_value_size (const GValue *value)
+{
+    gsize size = sizeof (GValue);
+
+    if (value == NULL)
+        return 0;
+
+    if (G_VALUE_HOLDS_STRING (value))
+    {
+        size += mcd_memory_string_size (g_value_get_string (value));
+    }
+    else if (G_VALUE_HOLDS (value, G_TYPE_STRV))
+    {
+        size += mcd_memory_strv_size (g_value_get_boxed (value));
+    }
+    else if (G_VALUE_HOLDS (value, G_TYPE_VARIANT))
+    {
+        size += mcd_memory_variant_size (g_value_get_variant (value));
+    }
+    else if (G_VALUE_HOLDS (value, TP_HASH_TYPE_STRING_VARIANT_MAP))
+    {
+        size += mcd_memory_asv_size (g_value_get_boxed (value));
+    }
+
+    /* other boxed types are rare enough that we don't bother */
+    return size;
+}
+
+/* A{sv} in dbus-glib form: string keys, slice-allocated GValue values */
+gsize
+mcd_memory_asv_size (GHashTable *asv)
+{
+    GHashTableIter iter;
+    gpointer k, v;
+    gsize size = mcd_memory_hash_table_size (asv);
+
+    if (asv == NULL)
+        return 0;
+
+    g_hash_table_iter_init (&iter, asv);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+        size += mcd_memory_string_size (k) + mcd_memory_value_size (v);
+
+    return size;
+}
+
+gsize
+mcd_memory_variant_size (GVariant *variant)
+{
+    if (variant == NULL)
+        return 0;
+
+    /* serialized data, plus the instance; children of a serialized
+     * container share its data */
+    return VARIANT_OVERHEAD + g_variant_get_size (variant);
+}
+
+/* The public instance struct; private structs are counted by each class */
+gsize
+mcd_memory_instance_size (gpointer object)
+{
+    GTypeQuery query;
+
+    g_return_val_if_fail (G_IS_OBJECT (object), 0);
+
+    g_type_query (G_OBJECT_TYPE (object), &query);
+    return query.instance_size;
+}
+
+void
+mcd_memory_report_add (GVariantBuilder *report,
+                       guint depth,
+                       gpointer object,
+                       const gchar *identifier,
+                       gsize bytes)
+{
+    g_variant_builder_add (report, MCD_MEMORY_REPORT_ENTRY, depth,
+                           G_OBJECT_TYPE_NAME (object),
+                           identifier != NULL ? identifier : "",
+                           (guint64) bytes);
+}
@@ -0,0 +1,56 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-memory.h - estimates of the memory retained by MC's objects
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MCD_MEMORY_H__
+#define __MCD_MEMORY_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* A memory report is an array of these: depth in the object tree, type
+ * name, something to identify the object (or ""), and the estimated number
+ * of bytes retained by it, not counting the entries below it. */
+#define MCD_MEMORY_REPORT_ENTRY "(usst)"
+#define MCD_MEMORY_REPORT "a" MCD_MEMORY_REPORT_ENTRY
+
+/* All of these are estimates: they ignore malloc overhead and anything
+ * shared with other objects */
+gsize mcd_memory_string_size (const gchar *str);
+gsize mcd_memory_strv_size (const gchar * const *strv);
+gsize mcd_memory_hash_table_size (GHashTable *table);
+gsize mcd_memory_string_hash_table_size (GHashTable *table,
+                                         gboolean string_values);
+gsize mcd_memory_value_size (const GValue *value);
+gsize mcd_memory_asv_size (GHashTable *asv);
+gsize mcd_memory_variant_size (GVariant *variant);
+gsize mcd_memory_instance_size (gpointer object);
+
+void mcd_memory_report_add (GVariantBuilder *report,
+                            guint depth,
+                            gpointer object,
+                            const gchar *identifier,
+                            gsize bytes);
+
+G_END_DECLS
+
+#endif /* __MCD_MEMORY_H__ */
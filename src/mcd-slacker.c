@@ -22,16 +22,37 @@
  */
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_CONNECTIVITY
+
 #include "mcd-slacker.h"
 
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-debug.h"
+#include "mcd-timeout.h"
+
+/* a piece of work postponed by mcd_slacker_defer() */
+typedef struct {
+    gpointer owner;
+    gchar *name;
+    McdSlackerFunc func;
+    /* g_get_monotonic_time() after which we stop waiting for activity */
+    gint64 deadline;
+} DeferredWork;
 
 struct _McdSlackerPrivate {
     GDBusProxy *proxy;
+    GDBusProxy *logind_proxy;
 
+    /* each source's opinion; we are inactive if either says so */
+    gboolean session_idle;
+    gboolean logind_idle;
     gboolean is_inactive;
+
+    /* owned DeferredWork => itself */
+    GHashTable *deferred;
+    /* drains expired work at the earliest deadline, or 0 */
+    guint deadline_id;
 };
 
 G_DEFINE_TYPE (McdSlacker, mcd_slacker, G_TYPE_OBJECT)
@@ -59,6 +80,16 @@ enum {
 #define SERVICE_PROP_NAME "status"
 #define SERVICE_SIG_NAME "StatusChanged"
 
+/* systemd-logind, which knows about idleness on systems without
+ * gnome-session:
+ * http://www.freedesktop.org/wiki/Software/systemd/logind/ */
+#define LOGIND_SERVICE_NAME "org.freedesktop.login1"
+#define LOGIND_SESSION_PATH "/org/freedesktop/login1/session/auto"
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+#define LOGIND_PROP_NAME "IdleHint"
+
+static void mcd_slacker_drain (McdSlacker *self, gboolean expired_only);
+
 /**
  * mcd_slacker_is_inactive:
  * @self: do some work!
@@ -76,11 +107,31 @@ mcd_slacker_is_inactive (McdSlacker *self)
 }
 
 static void
-status_changed (McdSlacker *self,
-    GVariant *prop)
+update_inactivity (McdSlacker *self)
 {
   gboolean old = self->priv->is_inactive;
 
+  self->priv->is_inactive = (self->priv->session_idle ||
+      self->priv->logind_idle);
+
+  if (self->priv->is_inactive != old)
+    {
+      DEBUG ("device became %s",
+          self->priv->is_inactive ? "inactive" : "active");
+
+      /* catch up before anyone reacts to the device being active */
+      if (!self->priv->is_inactive)
+        mcd_slacker_drain (self, FALSE);
+
+      g_signal_emit (self, signals[SIG_INACTIVITY_CHANGED], 0,
+          self->priv->is_inactive);
+    }
+}
+
+static void
+status_changed (McdSlacker *self,
+    GVariant *prop)
+{
   if (g_variant_classify (prop) != G_VARIANT_CLASS_UINT32)
     {
       WARNING ("%s.%s property is of type %s and we expected u",
@@ -89,15 +140,24 @@ status_changed (McdSlacker *self,
       return;
     }
 
-  self->priv->is_inactive = (g_variant_get_uint32 (prop) == STATUS_IDLE);
+  self->priv->session_idle = (g_variant_get_uint32 (prop) == STATUS_IDLE);
+  update_inactivity (self);
+}
 
-  if (self->priv->is_inactive != old)
+static void
+idle_hint_changed (McdSlacker *self,
+    GVariant *prop)
+{
+  if (g_variant_classify (prop) != G_VARIANT_CLASS_BOOLEAN)
     {
-      DEBUG ("device became %s",
-          self->priv->is_inactive ? "inactive" : "active");
-      g_signal_emit (self, signals[SIG_INACTIVITY_CHANGED], 0,
-          self->priv->is_inactive);
+      WARNING ("%s.%s property is of type %s and we expected b",
+          LOGIND_SESSION_INTERFACE, LOGIND_PROP_NAME,
+          g_variant_get_type_string (prop));
+      return;
     }
+
+  self->priv->logind_idle = g_variant_get_boolean (prop);
+  update_inactivity (self);
 }
 
 static void
@@ -165,11 +225,319 @@ out:
   g_object_unref (self);
 }
 
+static void
+logind_properties_changed_cb (GDBusProxy *proxy,
+    GVariant *changed,
+    const gchar * const *invalidated,
+    gpointer user_data)
+{
+  McdSlacker *self = user_data;
+  GVariant *prop;
+
+  prop = g_variant_lookup_value (changed, LOGIND_PROP_NAME, NULL);
+
+  if (prop != NULL)
+    {
+      idle_hint_changed (self, prop);
+      g_variant_unref (prop);
+    }
+}
+
+static void
+logind_proxy_new_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  McdSlacker *self = user_data;
+  GVariant *prop;
+  GError *error = NULL;
+
+  self->priv->logind_proxy = g_dbus_proxy_new_finish (result, &error);
+
+  if (self->priv->logind_proxy == NULL)
+    {
+      DEBUG ("Error while creating logind proxy: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  g_signal_connect (self->priv->logind_proxy, "g-properties-changed",
+      G_CALLBACK (logind_properties_changed_cb), self);
+
+  prop = g_dbus_proxy_get_cached_property (self->priv->logind_proxy,
+      LOGIND_PROP_NAME);
+
+  if (g_dbus_proxy_get_name_owner (self->priv->logind_proxy) == NULL)
+    {
+      DEBUG ("%s service not found", LOGIND_SERVICE_NAME);
+    }
+  else if (prop == NULL)
+    {
+      DEBUG ("%s.%s property is missing", LOGIND_SESSION_INTERFACE,
+          LOGIND_PROP_NAME);
+    }
+  else
+    {
+      idle_hint_changed (self, prop);
+      g_variant_unref (prop);
+    }
+
+out:
+  g_object_unref (self);
+}
+
+static guint
+deferred_work_hash (gconstpointer p)
+{
+  const DeferredWork *work = p;
+
+  return g_direct_hash (work->owner) ^ g_str_hash (work->name);
+}
+
+static gboolean
+deferred_work_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const DeferredWork *left = a;
+  const DeferredWork *right = b;
+
+  return (left->owner == right->owner &&
+      !tp_strdiff (left->name, right->name));
+}
+
+static void
+deferred_work_free (gpointer p)
+{
+  DeferredWork *work = p;
+
+  g_free (work->name);
+  g_slice_free (DeferredWork, work);
+}
+
+static gboolean
+deadline_cb (gpointer user_data)
+{
+  McdSlacker *self = user_data;
+
+  self->priv->deadline_id = 0;
+  mcd_slacker_drain (self, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+/* arrange to wake up at the earliest deadline, if any */
+static void
+schedule_deadline (McdSlacker *self)
+{
+  GHashTableIter iter;
+  gpointer k;
+  gint64 earliest = G_MAXINT64;
+  gint64 now;
+
+  if (self->priv->deadline_id != 0)
+    {
+      mcd_timeout_remove (self->priv->deadline_id);
+      self->priv->deadline_id = 0;
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->deferred);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      DeferredWork *work = k;
+
+      earliest = MIN (earliest, work->deadline);
+    }
+
+  if (earliest == G_MAXINT64)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  /* Being up to a second late is fine for work we were willing to
+   * postpone, and lets this share a wakeup with other timers. */
+  self->priv->deadline_id = mcd_timeout_add_seconds (
+      earliest <= now ? 0 :
+        (guint) ((earliest - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC),
+      deadline_cb, self);
+}
+
+/*
+ * Run deferred work: all of it, or only the work whose deadline has
+ * passed, or (if @owner is not %NULL) all of @owner's work.
+ */
+static void
+drain_matching (McdSlacker *self,
+    gpointer owner,
+    gboolean expired_only)
+{
+  GHashTableIter iter;
+  gpointer k;
+  GList *to_run = NULL;
+  GList *l;
+  gint64 now = g_get_monotonic_time ();
+
+  g_hash_table_iter_init (&iter, self->priv->deferred);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      DeferredWork *work = k;
+
+      if (owner != NULL && work->owner != owner)
+        continue;
+
+      if (expired_only && work->deadline > now)
+        continue;
+
+      g_hash_table_iter_steal (&iter);
+      to_run = g_list_prepend (to_run, work);
+    }
+
+  if (to_run == NULL)
+    return;
+
+  DEBUG ("running %u deferred tasks, %u still deferred",
+      g_list_length (to_run), g_hash_table_size (self->priv->deferred));
+
+  /* the list is stolen first, because the work might defer more work */
+  for (l = to_run; l != NULL; l = l->next)
+    {
+      DeferredWork *work = l->data;
+
+      work->func (work->owner, work->name);
+      deferred_work_free (work);
+    }
+
+  g_list_free (to_run);
+  schedule_deadline (self);
+}
+
+static void
+mcd_slacker_drain (McdSlacker *self,
+    gboolean expired_only)
+{
+  drain_matching (self, NULL, expired_only);
+}
+
+/**
+ * mcd_slacker_defer:
+ * @self: the slacker
+ * @owner: the object doing the work, which must call mcd_slacker_flush()
+ *  or mcd_slacker_cancel() before it is destroyed
+ * @name: a name for this piece of work, unique within @owner
+ * @max_delay: the longest time, in seconds, that the work may be postponed
+ * @func: the work
+ *
+ * Do something that is not urgent, such as writing to disk, while the
+ * device is in use. If the device is active, @func is called immediately.
+ * Otherwise, it is called when the device becomes active, or after
+ * @max_delay seconds, whichever comes first.
+ *
+ * Deferring work that is already deferred (the same @owner and @name)
+ * only does it once, no later than the earlier of the two deadlines.
+ */
+void
+mcd_slacker_defer (McdSlacker *self,
+    gpointer owner,
+    const gchar *name,
+    guint max_delay,
+    McdSlackerFunc func)
+{
+  DeferredWork lookup = { owner, (gchar *) name, NULL, 0 };
+  DeferredWork *work;
+  gint64 deadline;
+
+  g_return_if_fail (MCD_IS_SLACKER (self));
+  g_return_if_fail (owner != NULL);
+  g_return_if_fail (name != NULL);
+  g_return_if_fail (func != NULL);
+
+  if (!self->priv->is_inactive)
+    {
+      func (owner, name);
+      return;
+    }
+
+  deadline = g_get_monotonic_time () + max_delay * G_USEC_PER_SEC;
+  work = g_hash_table_lookup (self->priv->deferred, &lookup);
+
+  if (work != NULL)
+    {
+      work->func = func;
+
+      if (work->deadline <= deadline)
+        return;
+
+      work->deadline = deadline;
+    }
+  else
+    {
+      DEBUG ("deferring %s for up to %us", name, max_delay);
+
+      work = g_slice_new (DeferredWork);
+      work->owner = owner;
+      work->name = g_strdup (name);
+      work->func = func;
+      work->deadline = deadline;
+      g_hash_table_add (self->priv->deferred, work);
+    }
+
+  schedule_deadline (self);
+}
+
+/**
+ * mcd_slacker_flush:
+ * @self: the slacker
+ * @owner: an owner previously passed to mcd_slacker_defer()
+ *
+ * Do all of @owner's deferred work now.
+ */
+void
+mcd_slacker_flush (McdSlacker *self,
+    gpointer owner)
+{
+  g_return_if_fail (MCD_IS_SLACKER (self));
+  g_return_if_fail (owner != NULL);
+
+  drain_matching (self, owner, FALSE);
+}
+
+/**
+ * mcd_slacker_cancel:
+ * @self: the slacker
+ * @owner: an owner previously passed to mcd_slacker_defer()
+ *
+ * Forget about all of @owner's deferred work without doing it.
+ */
+void
+mcd_slacker_cancel (McdSlacker *self,
+    gpointer owner)
+{
+  GHashTableIter iter;
+  gpointer k;
+
+  g_return_if_fail (MCD_IS_SLACKER (self));
+  g_return_if_fail (owner != NULL);
+
+  g_hash_table_iter_init (&iter, self->priv->deferred);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      DeferredWork *work = k;
+
+      if (work->owner == owner)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  schedule_deadline (self);
+}
+
 static void
 mcd_slacker_init (McdSlacker *self)
 {
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MCD_TYPE_SLACKER,
       McdSlackerPrivate);
+  self->priv->deferred = g_hash_table_new_full (deferred_work_hash,
+      deferred_work_equal, deferred_work_free, NULL);
 }
 
 static gpointer slacker = NULL;
@@ -207,6 +575,12 @@ mcd_slacker_constructed (GObject *object)
       SERVICE_NAME, SERVICE_OBJECT_PATH, SERVICE_INTERFACE,
       NULL,
       proxy_new_cb, g_object_ref (self));
+
+  g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+      G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START, NULL,
+      LOGIND_SERVICE_NAME, LOGIND_SESSION_PATH, LOGIND_SESSION_INTERFACE,
+      NULL,
+      logind_proxy_new_cb, g_object_ref (self));
 }
 
 static void
@@ -214,11 +588,32 @@ mcd_slacker_dispose (GObject *object)
 {
   McdSlacker *self = MCD_SLACKER (object);
 
+  /* owners are meant to have flushed or cancelled by now, but if they
+   * haven't, doing the work late is better than losing it */
+  mcd_slacker_drain (self, FALSE);
+
+  if (self->priv->deadline_id != 0)
+    {
+      mcd_timeout_remove (self->priv->deadline_id);
+      self->priv->deadline_id = 0;
+    }
+
   g_clear_object (&self->priv->proxy);
+  g_clear_object (&self->priv->logind_proxy);
 
   ((GObjectClass *) mcd_slacker_parent_class)->dispose (object);
 }
 
+static void
+mcd_slacker_finalize (GObject *object)
+{
+  McdSlacker *self = MCD_SLACKER (object);
+
+  g_hash_table_unref (self->priv->deferred);
+
+  ((GObjectClass *) mcd_slacker_parent_class)->finalize (object);
+}
+
 static void
 mcd_slacker_class_init (McdSlackerClass *klass)
 {
@@ -227,6 +622,7 @@ mcd_slacker_class_init (McdSlackerClass *klass)
   object_class->constructor = mcd_slacker_constructor;
   object_class->constructed = mcd_slacker_constructed;
   object_class->dispose = mcd_slacker_dispose;
+  object_class->finalize = mcd_slacker_finalize;
 
   g_type_class_add_private (klass, sizeof (McdSlackerPrivate));
 
@@ -235,7 +631,9 @@ mcd_slacker_class_init (McdSlackerClass *klass)
    * @self: what a slacker
    * @inactive: %TRUE if the device is inactive.
    *
-   * The ::inactivity-changed is emitted when session becomes idle.
+   * The ::inactivity-changed is emitted when session becomes idle, or
+   * stops being idle. In the latter case, deferred work has already been
+   * done.
    */
   signals[SIG_INACTIVITY_CHANGED] = g_signal_new ("inactivity-changed",
       MCD_TYPE_SLACKER, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
@@ -41,6 +41,19 @@ GType mcd_slacker_get_type (void);
 McdSlacker *mcd_slacker_new (void);
 gboolean mcd_slacker_is_inactive (McdSlacker *self);
 
+typedef void (*McdSlackerFunc) (gpointer owner,
+    const gchar *name);
+
+void mcd_slacker_defer (McdSlacker *self,
+    gpointer owner,
+    const gchar *name,
+    guint max_delay,
+    McdSlackerFunc func);
+void mcd_slacker_flush (McdSlacker *self,
+    gpointer owner);
+void mcd_slacker_cancel (McdSlacker *self,
+    gpointer owner);
+
 /* TYPE MACROS */
 #define MCD_TYPE_SLACKER \
   (mcd_slacker_get_type ())
@@ -21,12 +21,16 @@
  *
  */
 #include "config.h"
+
+#define MCD_DEBUG_FLAG MCD_DEBUG_STORAGE
+
 #include "mcd-storage.h"
 
 #include "mcd-account.h"
 #include "mcd-account-config.h"
 #include "mcd-debug.h"
 #include "mcd-misc.h"
+#include "mcd-timeout.h"
 #include "plugin-loader.h"
 
 #include <errno.h>
@@ -61,6 +65,8 @@ enum {
 
 static guint signals[N_SIGNALS] = { 0 };
 
+static void async_account_free (gpointer p);
+
 struct _McdStorageClass {
     GObjectClass parent;
 };
@@ -77,6 +83,13 @@ mcd_storage_init (McdStorage *self)
 {
   self->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, g_object_unref);
+  self->batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->pending_commits = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->async_accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, async_account_free);
+  self->slacker = mcd_slacker_new ();
 }
 
 static void
@@ -88,6 +101,9 @@ storage_finalize (GObject *object)
 
   g_hash_table_unref (self->accounts);
   self->accounts = NULL;
+  tp_clear_pointer (&self->batches, g_hash_table_unref);
+  tp_clear_pointer (&self->pending_commits, g_hash_table_unref);
+  tp_clear_pointer (&self->async_accounts, g_hash_table_unref);
 
   if (finalize != NULL)
     finalize (object);
@@ -100,6 +116,13 @@ storage_dispose (GObject *object)
   GObjectFinalizeFunc dispose =
     G_OBJECT_CLASS (mcd_storage_parent_class)->dispose;
 
+  if (self->slacker != NULL)
+    {
+      /* don't lose changes that were waiting for the device to wake up */
+      mcd_slacker_flush (self->slacker, self);
+      g_clear_object (&self->slacker);
+    }
+
   tp_clear_object (&self->dbusd);
 
   if (dispose != NULL)
@@ -243,7 +266,9 @@ static struct {
       { "s", MC_ACCOUNTS_KEY_SERVICE },
 
     /* Integers */
+      { "i", MC_ACCOUNTS_KEY_CONNECTION_PRIORITY },
       { "u", MC_ACCOUNTS_KEY_AUTO_PRESENCE_TYPE },
+      { "x", MC_ACCOUNTS_KEY_LAST_USED },
 
       { NULL, NULL }
 };
@@ -285,11 +310,16 @@ mcd_storage_init_value_for_attribute (GValue *value,
         g_value_init (value, G_TYPE_BOOLEAN);
         return TRUE;
 
+      case 'i':
       case 'u':
-        /* this seems wrong but it's how we've always done it */
+        /* this seems wrong for 'u' but it's how we've always done it */
         g_value_init (value, G_TYPE_INT);
         return TRUE;
 
+      case 'x':
+        g_value_init (value, G_TYPE_INT64);
+        return TRUE;
+
       case 'a':
           {
             switch (g_variant_type_peek_string (s)[1])
@@ -499,16 +529,14 @@ sort_and_cache_plugins ()
     plugins_cached = TRUE;
 }
 
+/* Add an account that @plugin has told us about after startup */
 static void
-created_cb (McpAccountStorage *plugin,
-    const gchar *account_name,
-    McdStorage *self)
+storage_created (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account_name)
 {
   GError *error = NULL;
 
-  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
-  g_return_if_fail (MCD_IS_STORAGE (self));
-
   if (mcd_storage_add_account_from_plugin (self, plugin, account_name, &error))
     {
       DEBUG ("%s", account_name);
@@ -521,209 +549,942 @@ created_cb (McpAccountStorage *plugin,
     }
 }
 
-static gboolean
-check_is_responsible (McdStorage *self,
-    McpAccountStorage *plugin,
-    const gchar *account_name,
-    const gchar *changing,
-    GError **error)
+/*
+ * Accounts in asynchronous plugins.
+ *
+ * The rest of MC expects to read accounts' settings synchronously, so for
+ * plugins that implement the asynchronous API we keep a copy of each
+ * account here. It is fetched with one get_async() call when the account
+ * appears, and again whenever the plugin says the account was altered;
+ * the account is only added, or the alteration signalled, when the fetch
+ * has finished. Changes made by MC are passed to the plugin in one
+ * set_async() call per commit; until the plugin has committed them, they
+ * are kept apart from what was fetched, so that a fetch which crosses
+ * them cannot undo them. Plugins need not signal MC's own changes.
+ */
+
+typedef struct {
+  /* the plugin the account is stored in (plugins are never unloaded) */
+  McpAccountStorage *plugin;
+  /* owned string => owned GVariant: as last fetched from, or passed to,
+   * the plugin */
+  GHashTable *attributes;
+  GHashTable *parameters;
+  /* owned string => owned GVariant, or NULL to delete: changes that have
+   * not been passed to the plugin yet */
+  GHashTable *pending_attributes;
+  GHashTable *pending_parameters;
+  /* the same, for changes that have been passed to the plugin but not yet
+   * committed by it */
+  GHashTable *flushed_attributes;
+  GHashTable *flushed_parameters;
+  /* TRUE while get_async() is in progress */
+  gboolean fetching;
+  /* TRUE if the account was altered again while it was being fetched */
+  gboolean fetch_again;
+  /* owned string => itself: keys to signal as altered after the fetch */
+  GHashTable *altered;
+  /* TRUE if reconnect is to be signalled after the fetch */
+  gboolean reconnect;
+  /* TRUE while set_async() or commit_async() is in progress */
+  gboolean flushing;
+  /* TRUE if the account was committed again while it was being flushed */
+  gboolean flush_again;
+} McdStorageAsyncAccount;
+
+/* the state of an asynchronous call for one account */
+typedef struct {
+  McdStorage *self;
+  gchar *account;
+} McdStorageAsyncOp;
+
+static void
+variant_unref0 (gpointer p)
 {
-  McpAccountStorage *other = g_hash_table_lookup (self->accounts,
-      account_name);
+  if (p != NULL)
+    g_variant_unref (p);
+}
 
-  if (other == NULL)
-    {
-      WARNING ("account %s does not exist, preventing plugin '%s' from "
-          "%s it", account_name, mcp_account_storage_name (plugin), changing);
-      return FALSE;
-    }
+static McdStorageAsyncAccount *
+async_account_new (McpAccountStorage *plugin)
+{
+  McdStorageAsyncAccount *aa = g_slice_new0 (McdStorageAsyncAccount);
+
+  aa->plugin = plugin;
+  aa->attributes = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_variant_unref);
+  aa->parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_variant_unref);
+  aa->pending_attributes = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, variant_unref0);
+  aa->pending_parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, variant_unref0);
+  aa->flushed_attributes = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, variant_unref0);
+  aa->flushed_parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, variant_unref0);
+  aa->altered = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  return aa;
+}
 
-  if (other != plugin)
+static void
+async_account_free (gpointer p)
+{
+  McdStorageAsyncAccount *aa = p;
+
+  g_hash_table_unref (aa->attributes);
+  g_hash_table_unref (aa->parameters);
+  g_hash_table_unref (aa->pending_attributes);
+  g_hash_table_unref (aa->pending_parameters);
+  g_hash_table_unref (aa->flushed_attributes);
+  g_hash_table_unref (aa->flushed_parameters);
+  g_hash_table_unref (aa->altered);
+  g_slice_free (McdStorageAsyncAccount, aa);
+}
+
+static McdStorageAsyncOp *
+async_op_new (McdStorage *self,
+    const gchar *account)
+{
+  McdStorageAsyncOp *op = g_slice_new0 (McdStorageAsyncOp);
+
+  op->self = g_object_ref (self);
+  op->account = g_strdup (account);
+  return op;
+}
+
+static void
+async_op_free (McdStorageAsyncOp *op)
+{
+  g_object_unref (op->self);
+  g_free (op->account);
+  g_slice_free (McdStorageAsyncOp, op);
+}
+
+/* Return a new ref to the current value of @key, or NULL */
+static GVariant *
+async_account_dup (McdStorageAsyncAccount *aa,
+    gboolean parameter,
+    const gchar *key)
+{
+  GHashTable *pending = (parameter ? aa->pending_parameters :
+      aa->pending_attributes);
+  GHashTable *flushed = (parameter ? aa->flushed_parameters :
+      aa->flushed_attributes);
+  GHashTable *values = (parameter ? aa->parameters : aa->attributes);
+  gpointer v;
+
+  if (!g_hash_table_lookup_extended (pending, key, NULL, &v) &&
+      !g_hash_table_lookup_extended (flushed, key, NULL, &v))
+    v = g_hash_table_lookup (values, key);
+
+  return (v == NULL ? NULL : g_variant_ref (v));
+}
+
+static McpAccountStorageSetResult
+async_account_set (McdStorageAsyncAccount *aa,
+    gboolean parameter,
+    const gchar *key,
+    GVariant *value)
+{
+  GHashTable *pending = (parameter ? aa->pending_parameters :
+      aa->pending_attributes);
+  GVariant *old = async_account_dup (aa, parameter, key);
+  gboolean same;
+
+  if (old == NULL || value == NULL)
+    same = (old == value);
+  else
+    same = g_variant_equal (old, value);
+
+  tp_clear_pointer (&old, g_variant_unref);
+
+  if (same)
+    return MCP_ACCOUNT_STORAGE_SET_RESULT_UNCHANGED;
+
+  g_hash_table_replace (pending, g_strdup (key),
+      value == NULL ? NULL : g_variant_ref (value));
+  return MCP_ACCOUNT_STORAGE_SET_RESULT_CHANGED;
+}
+
+/* Return the names of all the parameters that currently have values */
+static gchar **
+async_account_list_parameters (McdStorageAsyncAccount *aa)
+{
+  GHashTable *layers[] = { aa->flushed_parameters, aa->pending_parameters };
+  /* borrowed string => itself */
+  GHashTable *set = g_hash_table_new (g_str_hash, g_str_equal);
+  GPtrArray *names;
+  GHashTableIter iter;
+  gpointer k, v;
+  guint i;
+
+  g_hash_table_iter_init (&iter, aa->parameters);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    g_hash_table_add (set, k);
+
+  for (i = 0; i < G_N_ELEMENTS (layers); i++)
     {
-      WARNING ("account %s is in plugin '%s', preventing plugin '%s' from "
-          "%s it", account_name, mcp_account_storage_name (other),
-          mcp_account_storage_name (plugin), changing);
-      return FALSE;
+      g_hash_table_iter_init (&iter, layers[i]);
+
+      while (g_hash_table_iter_next (&iter, &k, &v))
+        {
+          if (v == NULL)
+            g_hash_table_remove (set, k);
+          else
+            g_hash_table_add (set, k);
+        }
     }
 
-  return TRUE;
+  names = g_ptr_array_sized_new (g_hash_table_size (set) + 1);
+  g_hash_table_iter_init (&iter, set);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    g_ptr_array_add (names, g_strdup (k));
+
+  g_hash_table_unref (set);
+  g_ptr_array_add (names, NULL);
+  return (gchar **) g_ptr_array_free (names, FALSE);
 }
 
+/* Replace @values with the contents of the a{sv} @dict */
 static void
-toggled_cb (McpAccountStorage *plugin,
-    const gchar *account_name,
-    gboolean on,
-    McdStorage *self)
+async_account_replace (GHashTable *values,
+    GVariant *dict)
 {
-  GError *error = NULL;
+  GVariantIter iter;
+  gchar *key;
+  GVariant *value;
 
-  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_hash_table_remove_all (values);
+
+  if (dict == NULL)
+    return;
 
-  if (check_is_responsible (self, plugin, account_name, "toggling", &error))
-    g_signal_emit (self, signals[SIGNAL_TOGGLED], 0, plugin,
-        account_name, on);
+  g_variant_iter_init (&iter, dict);
+
+  /* the hash table takes ownership of each key and value */
+  while (g_variant_iter_next (&iter, "{sv}", &key, &value))
+    g_hash_table_replace (values, key, value);
 }
 
+/* Apply @changes to @values and empty it */
 static void
-deleted_cb (McpAccountStorage *plugin,
-    const gchar *account_name,
-    McdStorage *self)
+async_account_apply (GHashTable *values,
+    GHashTable *changes)
 {
-  GError *error = NULL;
+  GHashTableIter iter;
+  gpointer k, v;
 
-  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_hash_table_iter_init (&iter, changes);
 
-  if (check_is_responsible (self, plugin, account_name, "deleting",
-        &error))
+  while (g_hash_table_iter_next (&iter, &k, &v))
     {
-      g_hash_table_remove (self->accounts, account_name);
-
-      g_signal_emit (self, signals[SIGNAL_DELETED], 0, plugin,
-          account_name);
+      if (v == NULL)
+        g_hash_table_remove (values, k);
+      else
+        g_hash_table_replace (values, g_strdup (k), g_variant_ref (v));
     }
+
+  g_hash_table_remove_all (changes);
 }
 
-static void
-altered_one_cb (McpAccountStorage *plugin,
-    const gchar *account_name,
-    const gchar *key,
-    McdStorage *self)
+/* Move @pending into @flushed, returning the changes as an a{smv} for
+ * set_async() */
+static GVariant *
+async_account_take_pending (GHashTable *pending,
+    GHashTable *flushed)
 {
-  GError *error = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer k, v;
 
-  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{smv}"));
+  g_hash_table_iter_init (&iter, pending);
 
-  if (check_is_responsible (self, plugin, account_name, "altering",
-        &error))
-    g_signal_emit (self, signals[SIGNAL_ALTERED_ONE], 0, plugin,
-        account_name, key);
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+      g_variant_builder_add (&builder, "{smv}", k, v);
+      g_hash_table_replace (flushed, g_strdup (k),
+          v == NULL ? NULL : g_variant_ref (v));
+    }
+
+  g_hash_table_remove_all (pending);
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
 }
 
+/* Emit the signals queued while @account was being fetched */
 static void
-reconnect_cb (McpAccountStorage *plugin,
-    const gchar *account_name,
-    McdStorage *self)
+async_account_emit_queued (McdStorage *self,
+    McpAccountStorage *plugin,
+    McdStorageAsyncAccount *aa,
+    const gchar *account)
 {
-  GError *error = NULL;
+  GHashTable *altered = aa->altered;
+  gboolean reconnect = aa->reconnect;
+  GHashTableIter iter;
+  gpointer key;
 
-  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  /* swap these out first, in case a signal handler alters the account
+   * again, or deletes it */
+  aa->altered = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  aa->reconnect = FALSE;
 
-  if (check_is_responsible (self, plugin, account_name, "reconnecting",
-        &error))
-    g_signal_emit (self, signals[SIGNAL_RECONNECT], 0, plugin,
-        account_name);
+  g_hash_table_iter_init (&iter, altered);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_signal_emit (self, signals[SIGNAL_ALTERED_ONE], 0, plugin,
+        account, key);
+
+  if (reconnect)
+    g_signal_emit (self, signals[SIGNAL_RECONNECT], 0, plugin, account);
+
+  g_hash_table_unref (altered);
 }
 
-/*
- * mcd_storage_load:
- * @storage: An object implementing the #McdStorage interface
- *
- * Load the long term account settings storage into our internal cache.
- * Should only really be called during startup, ie before our DBus names
- * have been claimed and other people might be relying on responses from us.
- */
-void
-mcd_storage_load (McdStorage *self)
+static void async_account_fetch (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account);
+
+static void
+async_account_fetch_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
 {
-  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
-  GList *store = NULL;
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  McdStorageAsyncOp *op = user_data;
+  McdStorage *self = op->self;
+  McdStorageAsyncAccount *aa;
+  McpAccountStorage *owner;
+  GVariant *attributes = NULL;
+  GVariant *parameters = NULL;
+  GError *error = NULL;
+  gboolean ok;
 
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  ok = mcp_account_storage_get_finish (plugin, res, &attributes,
+      &parameters, &error);
+  aa = g_hash_table_lookup (self->async_accounts, op->account);
 
-  sort_and_cache_plugins ();
+  /* deleted while we were fetching it */
+  if (aa == NULL)
+    goto finally;
 
-  /* fetch accounts stored in plugins, highest priority first, so that
-   * low priority plugins can be overidden by high priority */
-  for (store = stores; store != NULL; store = store->next)
+  aa->fetching = FALSE;
+
+  /* this result is already out of date, or the account was altered again
+   * after the failed fetch started: try again */
+  if (aa->fetch_again)
     {
-      GList *account;
-      McpAccountStorage *plugin = store->data;
-      GList *stored;
-      const gchar *pname = mcp_account_storage_name (plugin);
-      const gint prio = mcp_account_storage_priority (plugin);
+      if (!ok)
+        g_clear_error (&error);
 
-      DEBUG ("listing initial accounts from plugin %s [prio: %d]", pname, prio);
-      stored = mcp_account_storage_list (plugin, ma);
+      aa->fetch_again = FALSE;
+      async_account_fetch (self, plugin, op->account);
+      goto finally;
+    }
 
-      /* Connect to signals for non-initial accounts. We only do this
-       * after we have called list(), to make sure the plugins don't need
-       * to queue up change-notification signals until after we've
-       * called the old "ready" vfunc. */
-      g_signal_connect_object (plugin, "created", G_CALLBACK (created_cb),
-          self, 0);
-      g_signal_connect_object (plugin, "toggled", G_CALLBACK (toggled_cb),
-          self, 0);
-      g_signal_connect_object (plugin, "deleted", G_CALLBACK (deleted_cb),
-          self, 0);
-      g_signal_connect_object (plugin, "altered-one",
-          G_CALLBACK (altered_one_cb), self, 0);
-      g_signal_connect_object (plugin, "reconnect", G_CALLBACK (reconnect_cb),
-          self, 0);
+  if (!ok)
+    {
+      WARNING ("could not fetch account %s from plugin '%s': %s",
+          op->account, mcp_account_storage_name (plugin), error->message);
+      g_error_free (error);
 
-      for (account = stored; account != NULL; account = g_list_next (account))
+      if (g_hash_table_lookup (self->accounts, op->account) == plugin)
         {
-          GError *error = NULL;
-          gchar *name = account->data;
+          /* we have nothing new to report, but the plugin did ask for the
+           * account to be reconnected */
+          g_hash_table_remove_all (aa->altered);
+          async_account_emit_queued (self, plugin, aa, op->account);
+        }
+      else if (!g_hash_table_contains (self->accounts, op->account))
+        {
+          g_hash_table_remove (self->async_accounts, op->account);
+        }
 
-          DEBUG ("fetching %s from plugin %s [prio: %d]", name, pname, prio);
+      goto finally;
+    }
 
-          if (!mcd_storage_add_account_from_plugin (self, plugin, name,
-                &error))
-            {
-              DEBUG ("%s", error->message);
-              g_clear_error (&error);
-            }
+  /* Our changes, whether or not they have been passed to the plugin yet,
+   * still apply on top of what we fetched. */
+  async_account_replace (aa->attributes, attributes);
+  async_account_replace (aa->parameters, parameters);
 
-          g_free (name);
-        }
+  owner = g_hash_table_lookup (self->accounts, op->account);
 
-      /* already freed the contents, just need to free the list itself */
-      g_list_free (stored);
+  if (owner == NULL)
+    {
+      storage_created (self, plugin, op->account);
+    }
+  else if (owner != plugin)
+    {
+      WARNING ("account %s is in plugin '%s', ignoring it in plugin '%s'",
+          op->account, mcp_account_storage_name (owner),
+          mcp_account_storage_name (plugin));
+      g_hash_table_remove (self->async_accounts, op->account);
+    }
+  else
+    {
+      async_account_emit_queued (self, plugin, aa, op->account);
     }
-}
 
-/*
- * mcd_storage_get_accounts:
- * @storage: An object implementing the #McdStorage interface
- * @n: place for the number of accounts to be written to (or %NULL)
- *
- * Returns: (transfer none) (element-type utf8 Mcp.AccountStorage): a
- *  map from account object path tail to plugin
- */
-GHashTable *
-mcd_storage_get_accounts (McdStorage *self)
-{
-  return self->accounts;
+finally:
+  tp_clear_pointer (&attributes, g_variant_unref);
+  tp_clear_pointer (&parameters, g_variant_unref);
+  async_op_free (op);
 }
 
-/*
- * mcd_storage_get_plugin:
- * @storage: An object implementing the #McdStorage interface
- * @account: unique name of the account
- *
- * Returns: the #McpAccountStorage object which is handling the account,
- * if any (if a new account has not yet been flushed to storage this can
- * be %NULL).
- *
- * Plugins are kept in permanent storage and can never be unloaded, so
- * the returned pointer need not be reffed or unreffed. (Indeed, it's
- * probably safer not to)
- */
-McpAccountStorage *
-mcd_storage_get_plugin (McdStorage *self,
+/* (Re-)read @account from @plugin in the background */
+static void
+async_account_fetch (McdStorage *self,
+    McpAccountStorage *plugin,
     const gchar *account)
 {
-  McpAccountStorage *plugin;
+  McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+      account);
 
-  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
-  g_return_val_if_fail (account != NULL, NULL);
+  if (aa == NULL)
+    {
+      aa = async_account_new (plugin);
+      g_hash_table_insert (self->async_accounts, g_strdup (account), aa);
+    }
+  else if (aa->plugin != plugin)
+    {
+      WARNING ("account %s is in plugin '%s', ignoring it in plugin '%s'",
+          account, mcp_account_storage_name (aa->plugin),
+          mcp_account_storage_name (plugin));
+      return;
+    }
 
-  plugin = g_hash_table_lookup (self->accounts, account);
-  g_return_val_if_fail (plugin != NULL, NULL);
+  if (aa->fetching)
+    {
+      aa->fetch_again = TRUE;
+      return;
+    }
+
+  aa->fetching = TRUE;
+  mcp_account_storage_get_async (plugin, MCP_ACCOUNT_MANAGER (self), account,
+      NULL, async_account_fetch_cb, async_op_new (self, account));
+}
+
+static void async_account_flush (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account);
+
+static void
+async_account_flush_done (McdStorageAsyncOp *op,
+    McpAccountStorage *plugin,
+    gboolean ok)
+{
+  McdStorageAsyncAccount *aa = g_hash_table_lookup (op->self->async_accounts,
+      op->account);
+
+  op->self->async_flushes--;
+
+  if (aa != NULL)
+    {
+      aa->flushing = FALSE;
+
+      if (ok)
+        {
+          async_account_apply (aa->attributes, aa->flushed_attributes);
+          async_account_apply (aa->parameters, aa->flushed_parameters);
+
+          /* a fetch that started before the plugin had our changes might
+           * return the old values */
+          if (aa->fetching)
+            aa->fetch_again = TRUE;
+        }
+      else
+        {
+          GHashTableIter iter;
+          gpointer k;
+
+          /* the plugin still has the old values: fetch them, and tell the
+           * rest of MC they are back */
+          g_hash_table_iter_init (&iter, aa->flushed_attributes);
+
+          while (g_hash_table_iter_next (&iter, &k, NULL))
+            g_hash_table_add (aa->altered, g_strdup (k));
+
+          g_hash_table_iter_init (&iter, aa->flushed_parameters);
+
+          while (g_hash_table_iter_next (&iter, &k, NULL))
+            g_hash_table_add (aa->altered, g_strdup_printf ("param-%s",
+                  (const gchar *) k));
+
+          g_hash_table_remove_all (aa->flushed_attributes);
+          g_hash_table_remove_all (aa->flushed_parameters);
+          async_account_fetch (op->self, plugin, op->account);
+        }
+
+      if (aa->flush_again)
+        {
+          aa->flush_again = FALSE;
+          async_account_flush (op->self, plugin, op->account);
+        }
+    }
+
+  async_op_free (op);
+}
+
+static void
+async_account_commit_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  McdStorageAsyncOp *op = user_data;
+  GError *error = NULL;
+  gboolean ok;
+
+  ok = mcp_account_storage_commit_finish (plugin, res, &error);
+
+  if (ok)
+    {
+      DEBUG ("committed %s to plugin %s", op->account,
+          mcp_account_storage_name (plugin));
+    }
+  else
+    {
+      WARNING ("could not commit %s to plugin %s, reverting: %s",
+          op->account, mcp_account_storage_name (plugin), error->message);
+      g_error_free (error);
+    }
+
+  async_account_flush_done (op, plugin, ok);
+}
+
+static void
+async_account_set_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  McdStorageAsyncOp *op = user_data;
+  GError *error = NULL;
+
+  if (!mcp_account_storage_set_finish (plugin, res, &error))
+    {
+      WARNING ("could not store changes to %s in plugin %s, reverting: %s",
+          op->account, mcp_account_storage_name (plugin), error->message);
+      g_error_free (error);
+      async_account_flush_done (op, plugin, FALSE);
+      return;
+    }
+
+  mcp_account_storage_commit_async (plugin, MCP_ACCOUNT_MANAGER (op->self),
+      op->account, NULL, async_account_commit_cb, op);
+}
+
+/* Pass every change to @account since the last flush to @plugin in one
+ * set_async() call, then commit it */
+static void
+async_account_flush (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+      account);
+  McdStorageAsyncOp *op;
+  GVariant *attributes;
+  GVariant *parameters;
+
+  g_return_if_fail (aa != NULL);
+
+  if (aa->flushing)
+    {
+      aa->flush_again = TRUE;
+      return;
+    }
+
+  aa->flushing = TRUE;
+  self->async_flushes++;
+  op = async_op_new (self, account);
+
+  if (g_hash_table_size (aa->pending_attributes) == 0 &&
+      g_hash_table_size (aa->pending_parameters) == 0)
+    {
+      DEBUG ("committing %s to plugin %s", account,
+          mcp_account_storage_name (plugin));
+      mcp_account_storage_commit_async (plugin, ma, account, NULL,
+          async_account_commit_cb, op);
+      return;
+    }
+
+  DEBUG ("passing %u attributes and %u parameters of %s to plugin %s",
+      g_hash_table_size (aa->pending_attributes),
+      g_hash_table_size (aa->pending_parameters), account,
+      mcp_account_storage_name (plugin));
+
+  attributes = async_account_take_pending (aa->pending_attributes,
+      aa->flushed_attributes);
+  parameters = async_account_take_pending (aa->pending_parameters,
+      aa->flushed_parameters);
+
+  mcp_account_storage_set_async (plugin, ma, account, attributes,
+      parameters, NULL, async_account_set_cb, op);
+
+  g_variant_unref (attributes);
+  g_variant_unref (parameters);
+}
+
+static void
+async_list_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  McdStorage *self = user_data;
+  GList *stored;
+  GList *l;
+  GError *error = NULL;
+
+  stored = mcp_account_storage_list_finish (plugin, res, &error);
+
+  if (error != NULL)
+    {
+      WARNING ("could not list accounts in plugin %s: %s",
+          mcp_account_storage_name (plugin), error->message);
+      g_error_free (error);
+    }
+
+  for (l = stored; l != NULL; l = l->next)
+    {
+      const gchar *name = l->data;
+
+      /* it might already have been signalled as created */
+      if (g_hash_table_contains (self->async_accounts, name))
+        continue;
+
+      DEBUG ("fetching %s from plugin %s", name,
+          mcp_account_storage_name (plugin));
+      async_account_fetch (self, plugin, name);
+    }
+
+  g_list_free_full (stored, g_free);
+  g_object_unref (self);
+}
+
+/* The current value of a parameter, from our copy if @plugin is
+ * asynchronous */
+static GVariant *
+storage_dup_parameter (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account,
+    const gchar *parameter,
+    const GVariantType *type)
+{
+  if (mcp_account_storage_is_async (plugin))
+    return async_account_dup (g_hash_table_lookup (self->async_accounts,
+          account), TRUE, parameter);
+
+  return mcp_account_storage_get_parameter (plugin, MCP_ACCOUNT_MANAGER (self),
+      account, parameter, type, NULL);
+}
+
+static gchar **
+storage_list_typed_parameters (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account)
+{
+  if (mcp_account_storage_is_async (plugin))
+    return async_account_list_parameters (
+        g_hash_table_lookup (self->async_accounts, account));
+
+  return mcp_account_storage_list_typed_parameters (plugin,
+      MCP_ACCOUNT_MANAGER (self), account);
+}
+
+static void
+created_cb (McpAccountStorage *plugin,
+    const gchar *account_name,
+    McdStorage *self)
+{
+  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  /* the account is added when we have fetched it */
+  if (mcp_account_storage_is_async (plugin))
+    async_account_fetch (self, plugin, account_name);
+  else
+    storage_created (self, plugin, account_name);
+}
+
+static gboolean
+check_is_responsible (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account_name,
+    const gchar *changing,
+    GError **error)
+{
+  McpAccountStorage *other = g_hash_table_lookup (self->accounts,
+      account_name);
+
+  if (other == NULL)
+    {
+      WARNING ("account %s does not exist, preventing plugin '%s' from "
+          "%s it", account_name, mcp_account_storage_name (plugin), changing);
+      return FALSE;
+    }
+
+  if (other != plugin)
+    {
+      WARNING ("account %s is in plugin '%s', preventing plugin '%s' from "
+          "%s it", account_name, mcp_account_storage_name (other),
+          mcp_account_storage_name (plugin), changing);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+toggled_cb (McpAccountStorage *plugin,
+    const gchar *account_name,
+    gboolean on,
+    McdStorage *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  if (!check_is_responsible (self, plugin, account_name, "toggling",
+        &error))
+    return;
+
+  if (mcp_account_storage_is_async (plugin))
+    {
+      McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+          account_name);
+
+      /* the plugin has told us the new value, so no need to fetch it */
+      g_hash_table_replace (aa->attributes, g_strdup ("Enabled"),
+          g_variant_ref_sink (g_variant_new_boolean (on)));
+      g_hash_table_remove (aa->pending_attributes, "Enabled");
+      g_hash_table_remove (aa->flushed_attributes, "Enabled");
+    }
+
+  g_signal_emit (self, signals[SIGNAL_TOGGLED], 0, plugin,
+      account_name, on);
+}
+
+static void
+deleted_cb (McpAccountStorage *plugin,
+    const gchar *account_name,
+    McdStorage *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  /* forget our copy, even if we are still fetching it */
+  if (mcp_account_storage_is_async (plugin))
+    {
+      McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+          account_name);
+
+      if (aa != NULL && aa->plugin == plugin)
+        g_hash_table_remove (self->async_accounts, account_name);
+    }
+
+  if (check_is_responsible (self, plugin, account_name, "deleting",
+        &error))
+    {
+      g_hash_table_remove (self->accounts, account_name);
+
+      g_signal_emit (self, signals[SIGNAL_DELETED], 0, plugin,
+          account_name);
+    }
+}
+
+static void
+altered_one_cb (McpAccountStorage *plugin,
+    const gchar *account_name,
+    const gchar *key,
+    McdStorage *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  if (!check_is_responsible (self, plugin, account_name, "altering",
+        &error))
+    return;
+
+  if (mcp_account_storage_is_async (plugin))
+    {
+      McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+          account_name);
+
+      /* signalled when we have fetched the new value; several changes
+       * made in quick succession are fetched together */
+      g_hash_table_add (aa->altered, g_strdup (key));
+      async_account_fetch (self, plugin, account_name);
+      return;
+    }
+
+  g_signal_emit (self, signals[SIGNAL_ALTERED_ONE], 0, plugin,
+      account_name, key);
+}
+
+static void
+reconnect_cb (McpAccountStorage *plugin,
+    const gchar *account_name,
+    McdStorage *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (MCP_IS_ACCOUNT_STORAGE (plugin));
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  if (!check_is_responsible (self, plugin, account_name, "reconnecting",
+        &error))
+    return;
+
+  if (mcp_account_storage_is_async (plugin))
+    {
+      McdStorageAsyncAccount *aa = g_hash_table_lookup (self->async_accounts,
+          account_name);
+
+      /* the parameters have probably changed: fetch them first */
+      aa->reconnect = TRUE;
+      async_account_fetch (self, plugin, account_name);
+      return;
+    }
+
+  g_signal_emit (self, signals[SIGNAL_RECONNECT], 0, plugin,
+      account_name);
+}
+
+/*
+ * mcd_storage_load:
+ * @storage: An object implementing the #McdStorage interface
+ *
+ * Load the long term account settings storage into our internal cache.
+ * Should only really be called during startup, ie before our DBus names
+ * have been claimed and other people might be relying on responses from us.
+ */
+void
+mcd_storage_load (McdStorage *self)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  GList *store = NULL;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  sort_and_cache_plugins ();
+
+  /* fetch accounts stored in plugins, highest priority first, so that
+   * low priority plugins can be overidden by high priority */
+  for (store = stores; store != NULL; store = store->next)
+    {
+      GList *account;
+      McpAccountStorage *plugin = store->data;
+      GList *stored;
+      const gchar *pname = mcp_account_storage_name (plugin);
+      const gint prio = mcp_account_storage_priority (plugin);
+
+      if (mcp_account_storage_is_async (plugin))
+        {
+          /* Don't wait for it: its accounts are added as they are
+           * fetched, as though it had signalled that they were created.
+           * If a synchronous plugin has an account with the same name,
+           * that one wins, regardless of priority. */
+          DEBUG ("listing initial accounts from asynchronous plugin %s "
+              "[prio: %d]", pname, prio);
+          mcp_account_storage_list_async (plugin, ma, NULL, async_list_cb,
+              g_object_ref (self));
+          stored = NULL;
+        }
+      else
+        {
+          DEBUG ("listing initial accounts from plugin %s [prio: %d]",
+              pname, prio);
+          stored = mcp_account_storage_list (plugin, ma);
+        }
+
+      /* Connect to signals for non-initial accounts. We only do this
+       * after we have called list(), to make sure the plugins don't need
+       * to queue up change-notification signals until after we've
+       * called the old "ready" vfunc. */
+      g_signal_connect_object (plugin, "created", G_CALLBACK (created_cb),
+          self, 0);
+      g_signal_connect_object (plugin, "toggled", G_CALLBACK (toggled_cb),
+          self, 0);
+      g_signal_connect_object (plugin, "deleted", G_CALLBACK (deleted_cb),
+          self, 0);
+      g_signal_connect_object (plugin, "altered-one",
+          G_CALLBACK (altered_one_cb), self, 0);
+      g_signal_connect_object (plugin, "reconnect", G_CALLBACK (reconnect_cb),
+          self, 0);
+
+      for (account = stored; account != NULL; account = g_list_next (account))
+        {
+          GError *error = NULL;
+          gchar *name = account->data;
+
+          DEBUG ("fetching %s from plugin %s [prio: %d]", name, pname, prio);
+
+          if (!mcd_storage_add_account_from_plugin (self, plugin, name,
+                &error))
+            {
+              DEBUG ("%s", error->message);
+              g_clear_error (&error);
+            }
+
+          g_free (name);
+        }
+
+      /* already freed the contents, just need to free the list itself */
+      g_list_free (stored);
+    }
+}
+
+/*
+ * mcd_storage_get_accounts:
+ * @storage: An object implementing the #McdStorage interface
+ * @n: place for the number of accounts to be written to (or %NULL)
+ *
+ * Returns: (transfer none) (element-type utf8 Mcp.AccountStorage): a
+ *  map from account object path tail to plugin
+ */
+GHashTable *
+mcd_storage_get_accounts (McdStorage *self)
+{
+  return self->accounts;
+}
+
+/*
+ * mcd_storage_get_plugin:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: unique name of the account
+ *
+ * Returns: the #McpAccountStorage object which is handling the account,
+ * if any (if a new account has not yet been flushed to storage this can
+ * be %NULL).
+ *
+ * Plugins are kept in permanent storage and can never be unloaded, so
+ * the returned pointer need not be reffed or unreffed. (Indeed, it's
+ * probably safer not to)
+ */
+McpAccountStorage *
+mcd_storage_get_plugin (McdStorage *self,
+    const gchar *account)
+{
+  McpAccountStorage *plugin;
+
+  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (account != NULL, NULL);
+
+  plugin = g_hash_table_lookup (self->accounts, account);
+  g_return_val_if_fail (plugin != NULL, NULL);
 
   return plugin;
 }
@@ -742,77 +1503,484 @@ mcd_storage_dup_string (McdStorage *self,
     const gchar *account,
     const gchar *attribute)
 {
-  GValue tmp = G_VALUE_INIT;
+  GVariant *variant;
   gchar *ret;
 
-  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
-  g_return_val_if_fail (account != NULL, NULL);
-  g_return_val_if_fail (attribute != NULL, NULL);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), NULL);
-
-  g_value_init (&tmp, G_TYPE_STRING);
+  variant = mcd_storage_dup_attribute (self, account, attribute,
+      G_VARIANT_TYPE_STRING, NULL);
 
-  if (!mcd_storage_get_attribute (self, account, attribute,
-        G_VARIANT_TYPE_STRING, &tmp, NULL))
+  if (variant == NULL)
     return NULL;
 
-  ret = g_value_dup_string (&tmp);
-  g_value_unset (&tmp);
+  ret = g_variant_dup_string (variant, NULL);
+  g_variant_unref (variant);
+  return ret;
+}
+
+/* A number or boolean, in whichever representation can hold it exactly */
+typedef struct {
+    enum { NUMBER_SIGNED, NUMBER_UNSIGNED, NUMBER_DOUBLE } kind;
+    union {
+        gint64 s;
+        guint64 u;
+        gdouble d;
+    } v;
+} McdNumber;
+
+static gboolean
+mcd_number_parse (const gchar *str,
+    McdNumber *n)
+{
+  const gchar *p;
+  gchar *end;
+
+  /* the same spellings as GKeyFile */
+  if (!tp_strdiff (str, "true"))
+    {
+      n->kind = NUMBER_UNSIGNED;
+      n->v.u = 1;
+      return TRUE;
+    }
+
+  if (!tp_strdiff (str, "false"))
+    {
+      n->kind = NUMBER_UNSIGNED;
+      n->v.u = 0;
+      return TRUE;
+    }
+
+  if (str[0] == '\0')
+    return FALSE;
+
+  errno = 0;
+
+  /* strtoull() would skip the whitespace itself, then accept the '-' and
+   * negate, so " -5" would become 2**64 - 5 */
+  for (p = str; g_ascii_isspace (*p); p++)
+    ;
+
+  if (*p == '-')
+    {
+      n->kind = NUMBER_SIGNED;
+      n->v.s = g_ascii_strtoll (str, &end, 10);
+    }
+  else
+    {
+      n->kind = NUMBER_UNSIGNED;
+      n->v.u = g_ascii_strtoull (str, &end, 10);
+    }
+
+  if (errno == 0 && *end == '\0')
+    return TRUE;
+
+  errno = 0;
+  n->kind = NUMBER_DOUBLE;
+  n->v.d = g_ascii_strtod (str, &end);
+  return (errno == 0 && *end == '\0');
+}
+
+static gboolean
+mcd_number_from_variant (GVariant *variant,
+    McdNumber *n)
+{
+  switch (g_variant_classify (variant))
+    {
+      case G_VARIANT_CLASS_BOOLEAN:
+        n->kind = NUMBER_UNSIGNED;
+        n->v.u = g_variant_get_boolean (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_BYTE:
+        n->kind = NUMBER_UNSIGNED;
+        n->v.u = g_variant_get_byte (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT16:
+        n->kind = NUMBER_UNSIGNED;
+        n->v.u = g_variant_get_uint16 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT32:
+        n->kind = NUMBER_UNSIGNED;
+        n->v.u = g_variant_get_uint32 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT64:
+        n->kind = NUMBER_UNSIGNED;
+        n->v.u = g_variant_get_uint64 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT16:
+        n->kind = NUMBER_SIGNED;
+        n->v.s = g_variant_get_int16 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT32:
+        n->kind = NUMBER_SIGNED;
+        n->v.s = g_variant_get_int32 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT64:
+        n->kind = NUMBER_SIGNED;
+        n->v.s = g_variant_get_int64 (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_DOUBLE:
+        n->kind = NUMBER_DOUBLE;
+        n->v.d = g_variant_get_double (variant);
+        return TRUE;
+
+      case G_VARIANT_CLASS_STRING:
+        return mcd_number_parse (g_variant_get_string (variant, NULL), n);
+
+      default:
+        return FALSE;
+    }
+}
+
+static gboolean
+mcd_number_to_signed (const McdNumber *n,
+    gint64 min,
+    gint64 max,
+    gint64 *out)
+{
+  switch (n->kind)
+    {
+      case NUMBER_SIGNED:
+        *out = n->v.s;
+        break;
+
+      case NUMBER_UNSIGNED:
+        if (n->v.u > G_MAXINT64)
+          return FALSE;
+
+        *out = n->v.u;
+        break;
+
+      case NUMBER_DOUBLE:
+        /* written this way round so that NaN is rejected; 2**63 is the
+         * first double that does not fit */
+        if (!(n->v.d >= -9223372036854775808.0 &&
+              n->v.d < 9223372036854775808.0) ||
+            n->v.d != (gdouble) (gint64) n->v.d)
+          return FALSE;
+
+        *out = (gint64) n->v.d;
+        break;
+    }
+
+  return (*out >= min && *out <= max);
+}
+
+static gboolean
+mcd_number_to_unsigned (const McdNumber *n,
+    guint64 max,
+    guint64 *out)
+{
+  switch (n->kind)
+    {
+      case NUMBER_SIGNED:
+        if (n->v.s < 0)
+          return FALSE;
+
+        *out = n->v.s;
+        break;
+
+      case NUMBER_UNSIGNED:
+        *out = n->v.u;
+        break;
+
+      case NUMBER_DOUBLE:
+        if (!(n->v.d >= 0 && n->v.d < 18446744073709551616.0) ||
+            n->v.d != (gdouble) (guint64) n->v.d)
+          return FALSE;
+
+        *out = (guint64) n->v.d;
+        break;
+    }
+
+  return (*out <= max);
+}
+
+/*
+ * @n: a number
+ * @type: a basic numeric or boolean type
+ *
+ * Returns: (transfer none): a floating variant of type @type with the
+ *  value @n, or %NULL if @n is out of range
+ */
+static GVariant *
+mcd_number_to_variant (const McdNumber *n,
+    const GVariantType *type)
+{
+  gint64 s;
+  guint64 u;
+
+  switch (g_variant_type_peek_string (type)[0])
+    {
+      case G_VARIANT_CLASS_BOOLEAN:
+        if (!mcd_number_to_unsigned (n, 1, &u))
+          return NULL;
+
+        return g_variant_new_boolean (u);
+
+      case G_VARIANT_CLASS_BYTE:
+        if (!mcd_number_to_unsigned (n, G_MAXUINT8, &u))
+          return NULL;
+
+        return g_variant_new_byte (u);
+
+      case G_VARIANT_CLASS_UINT16:
+        if (!mcd_number_to_unsigned (n, G_MAXUINT16, &u))
+          return NULL;
+
+        return g_variant_new_uint16 (u);
+
+      case G_VARIANT_CLASS_UINT32:
+        if (!mcd_number_to_unsigned (n, G_MAXUINT32, &u))
+          return NULL;
+
+        return g_variant_new_uint32 (u);
+
+      case G_VARIANT_CLASS_UINT64:
+        if (!mcd_number_to_unsigned (n, G_MAXUINT64, &u))
+          return NULL;
+
+        return g_variant_new_uint64 (u);
+
+      case G_VARIANT_CLASS_INT16:
+        if (!mcd_number_to_signed (n, G_MININT16, G_MAXINT16, &s))
+          return NULL;
+
+        return g_variant_new_int16 (s);
+
+      case G_VARIANT_CLASS_INT32:
+        if (!mcd_number_to_signed (n, G_MININT32, G_MAXINT32, &s))
+          return NULL;
+
+        return g_variant_new_int32 (s);
+
+      case G_VARIANT_CLASS_INT64:
+        if (!mcd_number_to_signed (n, G_MININT64, G_MAXINT64, &s))
+          return NULL;
+
+        return g_variant_new_int64 (s);
+
+      case G_VARIANT_CLASS_DOUBLE:
+        switch (n->kind)
+          {
+            case NUMBER_SIGNED:
+              return g_variant_new_double (n->v.s);
+            case NUMBER_UNSIGNED:
+              return g_variant_new_double (n->v.u);
+            case NUMBER_DOUBLE:
+              return g_variant_new_double (n->v.d);
+          }
+
+        return NULL;
+
+      default:
+        return NULL;
+    }
+}
+
+/*
+ * mcd_storage_coerce_variant:
+ * @variant: a value from a storage plugin
+ * @type: the type the caller wants
+ * @error: used to raise an error if %NULL is returned
+ *
+ * Convert @variant to @type. Plugins that store values as text, or that
+ * predate typed storage, often return a different type from the one we
+ * asked for, so we convert directly between numbers, booleans and
+ * strings (including numbers stored as strings), checking ranges. Other
+ * conversions, which are rare, still go via the keyfile representation.
+ *
+ * Returns: (transfer full): a non-floating variant of type @type, or %NULL
+ */
+GVariant *
+mcd_storage_coerce_variant (GVariant *variant,
+    const GVariantType *type,
+    GError **error)
+{
+  GVariant *ret = NULL;
+  McdNumber n;
+  GKeyFile *keyfile;
+  gchar *escaped;
+
+  if (g_variant_is_of_type (variant, type))
+    return g_variant_ref (variant);
+
+  if (g_variant_type_is_basic (type))
+    {
+      if (g_variant_type_equal (type, G_VARIANT_TYPE_STRING) &&
+          g_variant_is_of_type (variant, G_VARIANT_TYPE_OBJECT_PATH))
+        {
+          ret = g_variant_new_string (g_variant_get_string (variant, NULL));
+        }
+      else if (g_variant_type_equal (type, G_VARIANT_TYPE_OBJECT_PATH) &&
+          g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING))
+        {
+          const gchar *str = g_variant_get_string (variant, NULL);
+
+          if (g_variant_is_object_path (str))
+            ret = g_variant_new_object_path (str);
+        }
+      else if (g_variant_type_equal (type, G_VARIANT_TYPE_STRING) &&
+          mcd_number_from_variant (variant, &n))
+        {
+          /* numbers and booleans are stored as text in the same way that
+           * GKeyFile would */
+          ret = g_variant_new_take_string (mcd_keyfile_escape_variant (
+                variant));
+        }
+      else if (mcd_number_from_variant (variant, &n))
+        {
+          ret = mcd_number_to_variant (&n, type);
+        }
+
+      if (ret == NULL)
+        {
+          g_set_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+              "Cannot convert value of type '%s' to '%s'",
+              g_variant_get_type_string (variant),
+              g_variant_type_peek_string (type));
+          return NULL;
+        }
+
+      return g_variant_ref_sink (ret);
+    }
+
+  /* Containers: this is really pretty stupid, but they're rare, and
+   * usually the right type already */
+  escaped = mcd_keyfile_escape_variant (variant);
+  keyfile = g_key_file_new ();
+  g_key_file_set_value (keyfile, "g", "k", escaped);
+  ret = mcd_keyfile_get_variant (keyfile, "g", "k", type, error);
+  g_key_file_free (keyfile);
+  g_free (escaped);
+
+  if (ret != NULL)
+    g_variant_ref_sink (ret);
+
   return ret;
 }
 
-static gboolean
-mcd_storage_coerce_variant_to_value (GVariant *variant,
+/* the D-Bus type that dbus-glib represents as @type, if it is numeric */
+static const GVariantType *
+number_variant_type (GType type)
+{
+  switch (type)
+    {
+      case G_TYPE_BOOLEAN:
+        return G_VARIANT_TYPE_BOOLEAN;
+      case G_TYPE_UCHAR:
+        return G_VARIANT_TYPE_BYTE;
+      case G_TYPE_INT:
+        return G_VARIANT_TYPE_INT32;
+      case G_TYPE_UINT:
+        return G_VARIANT_TYPE_UINT32;
+      case G_TYPE_INT64:
+        return G_VARIANT_TYPE_INT64;
+      case G_TYPE_UINT64:
+        return G_VARIANT_TYPE_UINT64;
+      case G_TYPE_DOUBLE:
+        return G_VARIANT_TYPE_DOUBLE;
+      default:
+        return NULL;
+    }
+}
+
+/*
+ * @variant: a value of the D-Bus type that corresponds to @value
+ * @value: a #GValue initialized with the desired #GType
+ *
+ * Store @variant in @value, for callers that still need a #GValue.
+ * If the types differ, numbers are converted with the same range checks
+ * as mcd_storage_coerce_variant().
+ */
+gboolean
+mcd_storage_variant_to_value (GVariant *variant,
     GValue *value,
     GError **error)
 {
   GValue tmp = G_VALUE_INIT;
-  gboolean ret;
-  gchar *escaped;
+  const GVariantType *number_type;
+  McdNumber n;
 
   dbus_g_value_parse_g_variant (variant, &tmp);
 
   if (G_VALUE_TYPE (&tmp) == G_VALUE_TYPE (value))
     {
+      g_value_unset (value);
       memcpy (value, &tmp, sizeof (tmp));
       return TRUE;
     }
 
-  /* This is really pretty stupid but it'll do for now.
-   * FIXME: implement a better similar-type-coercion mechanism than
-   * round-tripping through a GKeyFile. */
+  number_type = number_variant_type (G_VALUE_TYPE (value));
+
+  if (number_type != NULL && mcd_number_from_variant (variant, &n))
+    {
+      GVariant *number = mcd_number_to_variant (&n, number_type);
+
+      g_value_unset (&tmp);
+
+      if (number == NULL)
+        {
+          g_set_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+              "Value of type '%s' is out of range for %s",
+              g_variant_get_type_string (variant), G_VALUE_TYPE_NAME (value));
+          return FALSE;
+        }
+
+      g_variant_ref_sink (number);
+      g_value_unset (value);
+      dbus_g_value_parse_g_variant (number, value);
+      g_variant_unref (number);
+      return TRUE;
+    }
+
+  if (g_value_type_transformable (G_VALUE_TYPE (&tmp), G_VALUE_TYPE (value)))
+    {
+      g_value_transform (&tmp, value);
+      g_value_unset (&tmp);
+      return TRUE;
+    }
+
+  g_set_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+      "Cannot convert '%s' to %s", g_variant_get_type_string (variant),
+      G_VALUE_TYPE_NAME (value));
   g_value_unset (&tmp);
-  escaped = mcd_keyfile_escape_variant (variant);
-  ret = mcd_keyfile_unescape_value (escaped, value, error);
-  g_free (escaped);
-  return ret;
+  return FALSE;
 }
 
 /*
- * mcd_storage_get_attribute:
+ * mcd_storage_dup_attribute:
  * @storage: An object implementing the #McdStorage interface
  * @account: unique name of the account
  * @attribute: name of the attribute to be retrieved, e.g. 'DisplayName'
- * @value: location to return the value, initialized to the right #GType
+ * @type: the type to return, e.g. %G_VARIANT_TYPE_STRING
  * @error: a place to store any #GError<!-- -->s that occur
+ *
+ * Returns: (transfer full): a non-floating variant of type @type, or
+ *  %NULL if the attribute is unset or cannot be converted to @type
  */
-gboolean
-mcd_storage_get_attribute (McdStorage *self,
+GVariant *
+mcd_storage_dup_attribute (McdStorage *self,
     const gchar *account,
     const gchar *attribute,
     const GVariantType *type,
-    GValue *value,
     GError **error)
 {
   McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
   McpAccountStorage *plugin;
   GVariant *variant;
-  gboolean ret;
+  GVariant *ret;
 
-  g_return_val_if_fail (MCD_IS_STORAGE (self), FALSE);
-  g_return_val_if_fail (account != NULL, FALSE);
-  g_return_val_if_fail (attribute != NULL, FALSE);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), FALSE);
+  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (account != NULL, NULL);
+  g_return_val_if_fail (attribute != NULL, NULL);
+  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), NULL);
 
   plugin = g_hash_table_lookup (self->accounts, account);
 
@@ -820,49 +1988,54 @@ mcd_storage_get_attribute (McdStorage *self,
     {
       g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
           "Account %s does not exist", account);
-      return FALSE;
+      return NULL;
     }
 
-  variant = mcp_account_storage_get_attribute (plugin, ma, account,
-      attribute, type, NULL);
+  if (mcp_account_storage_is_async (plugin))
+    variant = async_account_dup (g_hash_table_lookup (self->async_accounts,
+          account), FALSE, attribute);
+  else
+    variant = mcp_account_storage_get_attribute (plugin, ma, account,
+        attribute, type, NULL);
 
   if (variant == NULL)
     {
       g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
           "Account %s has no attribute '%s'", account, attribute);
-      return FALSE;
+      return NULL;
     }
 
-  ret = mcd_storage_coerce_variant_to_value (variant, value, error);
+  ret = mcd_storage_coerce_variant (variant, type, error);
   g_variant_unref (variant);
   return ret;
 }
 
 /*
- * mcd_storage_get_parameter:
+ * mcd_storage_dup_parameter:
  * @storage: An object implementing the #McdStorage interface
  * @account: unique name of the account
  * @parameter: name of the parameter to be retrieved, e.g. 'account'
- * @value: location to return the value, initialized to the right #GType
+ * @type: the type to return, e.g. %G_VARIANT_TYPE_STRING
  * @error: a place to store any #GError<!-- -->s that occur
+ *
+ * Returns: (transfer full): a non-floating variant of type @type, or
+ *  %NULL if the parameter is unset or cannot be converted to @type
  */
-gboolean
-mcd_storage_get_parameter (McdStorage *self,
+GVariant *
+mcd_storage_dup_parameter (McdStorage *self,
     const gchar *account,
     const gchar *parameter,
     const GVariantType *type,
-    GValue *value,
     GError **error)
 {
-  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
   McpAccountStorage *plugin;
   GVariant *variant;
-  gboolean ret;
+  GVariant *ret;
 
-  g_return_val_if_fail (MCD_IS_STORAGE (self), FALSE);
-  g_return_val_if_fail (account != NULL, FALSE);
-  g_return_val_if_fail (parameter != NULL, FALSE);
-  g_return_val_if_fail (!g_str_has_prefix (parameter, "param-"), FALSE);
+  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (account != NULL, NULL);
+  g_return_val_if_fail (parameter != NULL, NULL);
+  g_return_val_if_fail (!g_str_has_prefix (parameter, "param-"), NULL);
 
   plugin = g_hash_table_lookup (self->accounts, account);
 
@@ -870,20 +2043,83 @@ mcd_storage_get_parameter (McdStorage *self,
     {
       g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
           "Account %s does not exist", account);
-      return FALSE;
+      return NULL;
     }
 
-  variant = mcp_account_storage_get_parameter (plugin, ma, account,
-      parameter, type, NULL);
+  variant = storage_dup_parameter (self, plugin, account, parameter, type);
 
   if (variant == NULL)
     {
       g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
           "Account %s has no parameter '%s'", account, parameter);
-      return FALSE;
+      return NULL;
     }
 
-  ret = mcd_storage_coerce_variant_to_value (variant, value, error);
+  ret = mcd_storage_coerce_variant (variant, type, error);
+  g_variant_unref (variant);
+  return ret;
+}
+
+/*
+ * mcd_storage_get_attribute:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: unique name of the account
+ * @attribute: name of the attribute to be retrieved, e.g. 'DisplayName'
+ * @value: location to return the value, initialized to the right #GType
+ * @error: a place to store any #GError<!-- -->s that occur
+ *
+ * Like mcd_storage_dup_attribute(), but for callers that need a #GValue.
+ */
+gboolean
+mcd_storage_get_attribute (McdStorage *self,
+    const gchar *account,
+    const gchar *attribute,
+    const GVariantType *type,
+    GValue *value,
+    GError **error)
+{
+  GVariant *variant;
+  gboolean ret;
+
+  variant = mcd_storage_dup_attribute (self, account, attribute, type,
+      error);
+
+  if (variant == NULL)
+    return FALSE;
+
+  ret = mcd_storage_variant_to_value (variant, value, error);
+  g_variant_unref (variant);
+  return ret;
+}
+
+/*
+ * mcd_storage_get_parameter:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: unique name of the account
+ * @parameter: name of the parameter to be retrieved, e.g. 'account'
+ * @value: location to return the value, initialized to the right #GType
+ * @error: a place to store any #GError<!-- -->s that occur
+ *
+ * Like mcd_storage_dup_parameter(), but for callers that need a #GValue.
+ */
+gboolean
+mcd_storage_get_parameter (McdStorage *self,
+    const gchar *account,
+    const gchar *parameter,
+    const GVariantType *type,
+    GValue *value,
+    GError **error)
+{
+  GVariant *variant;
+  gboolean ret;
+
+  variant = mcd_storage_dup_parameter (self, account, parameter, type,
+      error);
+
+  if (variant == NULL)
+    return FALSE;
+
+  ret = mcd_storage_variant_to_value (variant, value, error);
   g_variant_unref (variant);
   return ret;
 }
@@ -1377,20 +2613,18 @@ mcd_storage_get_boolean (McdStorage *self,
     const gchar *account,
     const gchar *attribute)
 {
-  GValue tmp = G_VALUE_INIT;
-
-  g_return_val_if_fail (MCD_IS_STORAGE (self), FALSE);
-  g_return_val_if_fail (account != NULL, FALSE);
-  g_return_val_if_fail (attribute != NULL, FALSE);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), FALSE);
+  GVariant *variant;
+  gboolean ret;
 
-  g_value_init (&tmp, G_TYPE_BOOLEAN);
+  variant = mcd_storage_dup_attribute (self, account, attribute,
+      G_VARIANT_TYPE_BOOLEAN, NULL);
 
-  if (!mcd_storage_get_attribute (self, account, attribute,
-        G_VARIANT_TYPE_BOOLEAN, &tmp, NULL))
+  if (variant == NULL)
     return FALSE;
 
-  return g_value_get_boolean (&tmp);
+  ret = g_variant_get_boolean (variant);
+  g_variant_unref (variant);
+  return ret;
 }
 
 /*
@@ -1406,20 +2640,18 @@ mcd_storage_get_integer (McdStorage *self,
     const gchar *account,
     const gchar *attribute)
 {
-  GValue tmp = G_VALUE_INIT;
-
-  g_return_val_if_fail (MCD_IS_STORAGE (self), 0);
-  g_return_val_if_fail (account != NULL, 0);
-  g_return_val_if_fail (attribute != NULL, 0);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), 0);
+  GVariant *variant;
+  gint ret;
 
-  g_value_init (&tmp, G_TYPE_INT);
+  variant = mcd_storage_dup_attribute (self, account, attribute,
+      G_VARIANT_TYPE_INT32, NULL);
 
-  if (!mcd_storage_get_attribute (self, account, attribute,
-        G_VARIANT_TYPE_INT32, &tmp, NULL))
-    return FALSE;
+  if (variant == NULL)
+    return 0;
 
-  return g_value_get_int (&tmp);
+  ret = g_variant_get_int32 (variant);
+  g_variant_unref (variant);
+  return ret;
 }
 
 static gboolean
@@ -1439,7 +2671,10 @@ update_storage (McdStorage *self,
   g_return_val_if_fail (plugin != NULL, FALSE);
   pn = mcp_account_storage_name (plugin);
 
-  if (parameter)
+  if (mcp_account_storage_is_async (plugin))
+    res = async_account_set (g_hash_table_lookup (self->async_accounts,
+          account), parameter, key, variant);
+  else if (parameter)
     res = mcp_account_storage_set_parameter (plugin, ma, account,
         key, variant, MCP_PARAMETER_FLAG_NONE);
   else
@@ -2017,20 +3252,47 @@ mcd_storage_delete_account (McdStorage *self,
       delete_cb, g_strdup (account));
 }
 
+/* The longest we will keep changes in memory while the device is idle */
+#define COMMIT_MAX_DELAY 30
+
+static void
+mcd_storage_commit_now (gpointer owner,
+    const gchar *account)
+{
+  McdStorage *self = owner;
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  McpAccountStorage *plugin;
+  const gchar *pname;
+
+  plugin = g_hash_table_lookup (self->accounts, account);
+
+  /* the account might have been deleted while the commit was deferred */
+  if (plugin == NULL)
+    return;
+
+  pname = mcp_account_storage_name (plugin);
+
+  /* FIXME: fd.o #29563: this should be async, really */
+  DEBUG ("flushing plugin %s %s to long term storage", pname, account);
+  mcp_account_storage_commit (plugin, ma, account);
+}
+
 /*
  * mcd_storage_commit:
  * @storage: An object implementing the #McdStorage interface
  * @account: the unique name of an account
  *
  * Sync the long term storage (whatever it might be) with the current
- * state of our internal cache.
+ * state of our internal cache. While the device is idle, this is
+ * postponed until it becomes active, or for at most COMMIT_MAX_DELAY
+ * seconds, so that several changes are written together; but not for
+ * asynchronous plugins, which write in the background anyway, and could
+ * not finish a commit that was only started at exit.
  */
 void
 mcd_storage_commit (McdStorage *self, const gchar *account)
 {
-  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
   McpAccountStorage *plugin;
-  const gchar *pname;
 
   g_return_if_fail (MCD_IS_STORAGE (self));
   g_return_if_fail (account != NULL);
@@ -2038,11 +3300,130 @@ mcd_storage_commit (McdStorage *self, const gchar *account)
   plugin = g_hash_table_lookup (self->accounts, account);
   g_return_if_fail (plugin != NULL);
 
-  pname = mcp_account_storage_name (plugin);
+  if (g_hash_table_contains (self->batches, account))
+    {
+      gchar *key = g_strdup (account);
 
-  /* FIXME: fd.o #29563: this should be async, really */
-  DEBUG ("flushing plugin %s %s to long term storage", pname, account);
-  mcp_account_storage_commit (plugin, ma, account);
+      g_hash_table_replace (self->pending_commits, key, key);
+      return;
+    }
+
+  if (mcp_account_storage_is_async (plugin))
+    {
+      async_account_flush (self, plugin, account);
+      return;
+    }
+
+  mcd_slacker_defer (self->slacker, self, account, COMMIT_MAX_DELAY,
+      mcd_storage_commit_now);
+}
+
+/* The longest we will wait at exit for asynchronous plugins to store
+ * our changes, in seconds */
+#define FLUSH_MAX_WAIT 5
+
+static gboolean
+finish_flushes_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return FALSE;
+}
+
+/*
+ * mcd_storage_finish_flushes:
+ * @self: the storage
+ *
+ * Run the main context until asynchronous plugins have committed every
+ * change passed to them, or for at most FLUSH_MAX_WAIT seconds. This is
+ * for use at exit, when the main loop has stopped.
+ */
+void
+mcd_storage_finish_flushes (McdStorage *self)
+{
+  gboolean timed_out = FALSE;
+  guint timeout;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  if (self->async_flushes == 0)
+    return;
+
+  DEBUG ("waiting for %u accounts to be committed", self->async_flushes);
+  timeout = mcd_timeout_add_seconds (FLUSH_MAX_WAIT,
+      finish_flushes_timeout_cb, &timed_out);
+
+  while (self->async_flushes > 0 && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (timed_out)
+    WARNING ("gave up waiting for %u accounts to be committed",
+        self->async_flushes);
+  else
+    mcd_timeout_remove (timeout);
+}
+
+/*
+ * mcd_storage_begin_batch:
+ * @self: the storage
+ * @account: the unique name of an account
+ *
+ * Defer calls to mcd_storage_commit() for @account until the matching
+ * mcd_storage_end_batch(), so that an operation touching the account many
+ * times flushes it to long term storage once, rather than once per change.
+ * Other accounts are committed as usual. Batches may be nested.
+ */
+void
+mcd_storage_begin_batch (McdStorage *self,
+    const gchar *account)
+{
+  guint depth;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_return_if_fail (account != NULL);
+
+  depth = GPOINTER_TO_UINT (g_hash_table_lookup (self->batches, account));
+  g_hash_table_replace (self->batches, g_strdup (account),
+      GUINT_TO_POINTER (depth + 1));
+}
+
+/*
+ * mcd_storage_end_batch:
+ * @self: the storage
+ * @account: the unique name of an account
+ *
+ * End a batch started with mcd_storage_begin_batch(). When the outermost
+ * batch for @account ends, commit it if it was committed during the batch.
+ */
+void
+mcd_storage_end_batch (McdStorage *self,
+    const gchar *account)
+{
+  guint depth;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_return_if_fail (account != NULL);
+
+  depth = GPOINTER_TO_UINT (g_hash_table_lookup (self->batches, account));
+  g_return_if_fail (depth > 0);
+
+  if (depth > 1)
+    {
+      g_hash_table_replace (self->batches, g_strdup (account),
+          GUINT_TO_POINTER (depth - 1));
+      return;
+    }
+
+  g_hash_table_remove (self->batches, account);
+
+  /* the account might have been deleted during the batch */
+  if (g_hash_table_remove (self->pending_commits, account) &&
+      g_hash_table_contains (self->accounts, account))
+    {
+      DEBUG ("committing %s at end of batch", account);
+      mcd_storage_commit (self, account);
+    }
 }
 
 /*
@@ -2144,8 +3525,13 @@ mcd_storage_add_account_from_plugin (McdStorage *self,
   g_hash_table_insert (self->accounts, g_strdup (account),
       g_object_ref (plugin));
 
-  typed_parameters = mcp_account_storage_list_typed_parameters (plugin, api,
-      account);
+  /* a new account that MC has just created has nothing to fetch */
+  if (mcp_account_storage_is_async (plugin) &&
+      !g_hash_table_contains (self->async_accounts, account))
+    g_hash_table_insert (self->async_accounts, g_strdup (account),
+        async_account_new (plugin));
+
+  typed_parameters = storage_list_typed_parameters (self, plugin, account);
   untyped_parameters = mcp_account_storage_list_untyped_parameters (plugin,
       api, account);
 
@@ -2157,8 +3543,8 @@ mcd_storage_add_account_from_plugin (McdStorage *self,
 
       for (i = 0; typed_parameters[i] != NULL; i++)
         {
-          GVariant *v = mcp_account_storage_get_parameter (plugin, api, account,
-              typed_parameters[i], NULL, NULL);
+          GVariant *v = storage_dup_parameter (self, plugin, account,
+              typed_parameters[i], NULL);
 
           if (v == NULL)
             {
@@ -2196,7 +3582,6 @@ mcd_storage_dup_typed_parameters (McdStorage *self,
     const gchar *account_name)
 {
   McpAccountStorage *plugin;
-  McpAccountManager *api = (McpAccountManager *) self;
   gsize i;
   gchar **typed_parameters;
   GHashTable *params;
@@ -2206,7 +3591,7 @@ mcd_storage_dup_typed_parameters (McdStorage *self,
   plugin = g_hash_table_lookup (self->accounts, account_name);
   g_return_val_if_fail (plugin != NULL, NULL);
 
-  typed_parameters = mcp_account_storage_list_typed_parameters (plugin, api,
+  typed_parameters = storage_list_typed_parameters (self, plugin,
       account_name);
 
   params = g_hash_table_new_full (g_str_hash, g_str_equal,
@@ -2216,8 +3601,8 @@ mcd_storage_dup_typed_parameters (McdStorage *self,
        typed_parameters != NULL && typed_parameters[i] != NULL;
        i++)
     {
-      GVariant *v = mcp_account_storage_get_parameter (plugin, api,
-          account_name, typed_parameters[i], NULL, NULL);
+      GVariant *v = storage_dup_parameter (self, plugin, account_name,
+          typed_parameters[i], NULL);
       GValue *value;
 
       if (v == NULL)
@@ -2262,6 +3647,11 @@ mcd_storage_maybe_migrate_parameters (McdStorage *self,
   plugin = g_hash_table_lookup (self->accounts, account_name);
   g_return_val_if_fail (plugin != NULL, FALSE);
 
+  /* Asynchronous plugins are required to store types, so there's no point
+   * either. */
+  if (mcp_account_storage_is_async (plugin))
+    goto finally;
+
   /* If the storage backend can't store typed parameters, there's no point. */
   if (!mcp_account_storage_has_any_flag (plugin, account_name,
         MCP_ACCOUNT_STORAGE_FLAG_STORES_TYPES))
@@ -22,6 +22,8 @@
 #include <glib-object.h>
 #include <mission-control-plugins/mission-control-plugins.h>
 
+#include "mcd-slacker.h"
+
 #ifndef MCD_STORAGE_H
 #define MCD_STORAGE_H
 
@@ -32,6 +34,19 @@ typedef struct {
   TpDBusDaemon *dbusd;
   /* owned string => owned McpAccountStorage */
   GHashTable *accounts;
+  /* owned string => GUINT_TO_POINTER (number of nested
+   * mcd_storage_begin_batch() calls) for accounts in a batch */
+  GHashTable *batches;
+  /* owned string => itself: accounts whose commit is deferred until their
+   * outermost batch ends */
+  GHashTable *pending_commits;
+  /* owned string => owned McdStorageAsyncAccount: our copies of the
+   * accounts in asynchronous plugins */
+  GHashTable *async_accounts;
+  /* postpones commits while the device is idle */
+  McdSlacker *slacker;
+  /* the number of accounts being passed to asynchronous plugins */
+  guint async_flushes;
 } McdStorage;
 
 typedef struct _McdStorageClass McdStorageClass;
@@ -97,11 +112,26 @@ gchar *mcd_storage_create_account (McdStorage *storage,
 void mcd_storage_delete_account (McdStorage *storage, const gchar *account);
 
 void mcd_storage_commit (McdStorage *storage, const gchar *account);
+void mcd_storage_begin_batch (McdStorage *storage, const gchar *account);
+void mcd_storage_end_batch (McdStorage *storage, const gchar *account);
+void mcd_storage_finish_flushes (McdStorage *storage);
 
 gchar *mcd_storage_dup_string (McdStorage *storage,
     const gchar *account,
     const gchar *attribute);
 
+GVariant *mcd_storage_dup_attribute (McdStorage *storage,
+    const gchar *account,
+    const gchar *attribute,
+    const GVariantType *type,
+    GError **error);
+
+GVariant *mcd_storage_dup_parameter (McdStorage *storage,
+    const gchar *account,
+    const gchar *parameter,
+    const GVariantType *type,
+    GError **error);
+
 gboolean mcd_storage_get_attribute (McdStorage *storage,
     const gchar *account,
     const gchar *attribute,
@@ -158,6 +188,13 @@ gboolean mcd_keyfile_unescape_value (const gchar *escaped,
     GValue *value,
     GError **error);
 
+GVariant *mcd_storage_coerce_variant (GVariant *variant,
+    const GVariantType *type,
+    GError **error);
+gboolean mcd_storage_variant_to_value (GVariant *variant,
+    GValue *value,
+    GError **error);
+
 const GVariantType *mcd_storage_get_attribute_type (const gchar *attribute);
 gboolean mcd_storage_init_value_for_attribute (GValue *value,
     const gchar *attribute,
@@ -0,0 +1,380 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-timeout.c - coalescing timeouts for MC's internal timers
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Each of MC's accounts and connections has timers of its own, and if they
+ * were all separate GLib timeouts, each of them would wake the process up
+ * separately. Instead, they are all kept here, and a single GLib timeout
+ * is armed for the latest time at which the most urgent of them may run.
+ * Every timer whose (earliest) due time has passed by then runs in the
+ * same wakeup.
+ *
+ * Each timer has a "slack": how much later than its interval it may run.
+ * By default this is a tenth of the interval for millisecond timers, and
+ * a second for timers measured in seconds, which is what GLib does for
+ * g_timeout_add_seconds().
+ *
+ * The API mirrors g_timeout_add(), except that the IDs must be passed to
+ * mcd_timeout_remove() rather than g_source_remove().
+ */
+
+#include "config.h"
+#include "mcd-timeout.h"
+
+typedef struct {
+    guint id;
+    /* g_get_monotonic_time() before which this must not run */
+    gint64 due;
+    /* g_get_monotonic_time() before which this should run */
+    gint64 latest;
+    /* both in milliseconds */
+    guint interval;
+    guint slack;
+    GSourceFunc function;
+    gpointer data;
+    GDestroyNotify notify;
+    /* TRUE while the function is being called */
+    gboolean running;
+    /* TRUE if removed while running */
+    gboolean removed;
+} McdTimeout;
+
+/* guint id => owned McdTimeout */
+static GHashTable *timeouts = NULL;
+static guint last_id = 0;
+
+/* the GLib timeout that wakes us up, and when it is due, or 0 */
+static guint wakeup_id = 0;
+static gint64 wakeup_time = 0;
+
+/* Wakeups in each of the last 60 seconds: wakeups_by_second[i] counts
+ * wakeups during the second seconds[i] of the monotonic clock */
+#define STATS_SECONDS 60
+static guint wakeups_by_second[STATS_SECONDS];
+static gint64 seconds[STATS_SECONDS];
+static guint64 total_wakeups = 0;
+static guint64 total_run = 0;
+
+static void
+mcd_timeout_free (gpointer p)
+{
+    McdTimeout *timeout = p;
+
+    if (timeout->notify != NULL)
+        timeout->notify (timeout->data);
+
+    g_slice_free (McdTimeout, timeout);
+}
+
+static void
+schedule (McdTimeout *timeout,
+          gint64 now)
+{
+    timeout->due = now + (gint64) timeout->interval * 1000;
+    timeout->latest = timeout->due + (gint64) timeout->slack * 1000;
+}
+
+static void
+count_wakeup (gint64 now)
+{
+    gint64 second = now / G_USEC_PER_SEC;
+    guint i = second % STATS_SECONDS;
+
+    if (seconds[i] != second)
+    {
+        seconds[i] = second;
+        wakeups_by_second[i] = 0;
+    }
+
+    wakeups_by_second[i]++;
+    total_wakeups++;
+}
+
+static gboolean wakeup_cb (gpointer user_data);
+
+/* (Re-)arm the GLib timeout for the most urgent timer */
+static void
+rearm (void)
+{
+    GHashTableIter iter;
+    gpointer v;
+    gint64 latest = G_MAXINT64;
+    gint64 now;
+
+    g_hash_table_iter_init (&iter, timeouts);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        McdTimeout *timeout = v;
+
+        if (!timeout->running)
+            latest = MIN (latest, timeout->latest);
+    }
+
+    if (wakeup_id != 0)
+    {
+        if (latest == wakeup_time)
+            return;
+
+        g_source_remove (wakeup_id);
+        wakeup_id = 0;
+    }
+
+    if (latest == G_MAXINT64)
+        return;
+
+    now = g_get_monotonic_time ();
+    wakeup_time = latest;
+    wakeup_id = g_timeout_add (latest <= now ? 0 : (latest - now + 999) / 1000,
+                               wakeup_cb, NULL);
+}
+
+static gint
+compare_due (gconstpointer a,
+             gconstpointer b)
+{
+    const McdTimeout *left = *(McdTimeout * const *) a;
+    const McdTimeout *right = *(McdTimeout * const *) b;
+
+    if (left->due < right->due)
+        return -1;
+
+    return (left->due > right->due);
+}
+
+static gboolean
+wakeup_cb (gpointer user_data G_GNUC_UNUSED)
+{
+    GHashTableIter iter;
+    gpointer v;
+    GPtrArray *ready;
+    gint64 now = g_get_monotonic_time ();
+    guint i;
+
+    wakeup_id = 0;
+    count_wakeup (now);
+
+    ready = g_ptr_array_new ();
+    g_hash_table_iter_init (&iter, timeouts);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        McdTimeout *timeout = v;
+
+        if (timeout->due <= now)
+        {
+            timeout->running = TRUE;
+            g_ptr_array_add (ready, timeout);
+        }
+    }
+
+    /* oldest first, as if they had been separate timeouts */
+    g_ptr_array_sort (ready, compare_due);
+
+    for (i = 0; i < ready->len; i++)
+    {
+        McdTimeout *timeout = g_ptr_array_index (ready, i);
+        gboolean again;
+
+        /* removed by an earlier timer in this batch */
+        if (timeout->removed)
+        {
+            mcd_timeout_free (timeout);
+            continue;
+        }
+
+        total_run++;
+        again = timeout->function (timeout->data);
+        timeout->running = FALSE;
+
+        if (timeout->removed)
+        {
+            mcd_timeout_free (timeout);
+        }
+        else if (again)
+        {
+            schedule (timeout, g_get_monotonic_time ());
+        }
+        else
+        {
+            g_hash_table_remove (timeouts, GUINT_TO_POINTER (timeout->id));
+        }
+    }
+
+    g_ptr_array_unref (ready);
+    rearm ();
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * mcd_timeout_add_full:
+ * @interval: the time before @function should be called, in milliseconds
+ * @slack: how much later @function may be called, in milliseconds, so
+ *  that it can share a wakeup with another timer
+ * @function: called repeatedly until it returns %FALSE, like
+ *  g_timeout_add()
+ * @data: data for @function
+ * @notify: called on @data when the timeout is removed, or %NULL
+ *
+ * Returns: an ID which can be passed to mcd_timeout_remove(), but not to
+ *  g_source_remove()
+ */
+guint
+mcd_timeout_add_full (guint interval,
+                      guint slack,
+                      GSourceFunc function,
+                      gpointer data,
+                      GDestroyNotify notify)
+{
+    McdTimeout *timeout;
+
+    g_return_val_if_fail (function != NULL, 0);
+
+    if (G_UNLIKELY (timeouts == NULL))
+        timeouts = g_hash_table_new_full (NULL, NULL, NULL,
+                                          mcd_timeout_free);
+
+    timeout = g_slice_new0 (McdTimeout);
+
+    do
+        timeout->id = ++last_id;
+    while (timeout->id == 0 ||
+           g_hash_table_contains (timeouts, GUINT_TO_POINTER (timeout->id)));
+
+    timeout->interval = interval;
+    timeout->slack = slack;
+    timeout->function = function;
+    timeout->data = data;
+    timeout->notify = notify;
+    schedule (timeout, g_get_monotonic_time ());
+
+    g_hash_table_insert (timeouts, GUINT_TO_POINTER (timeout->id), timeout);
+    rearm ();
+    return timeout->id;
+}
+
+/*
+ * mcd_timeout_add:
+ *
+ * Like mcd_timeout_add_full(), with a slack of a tenth of @interval and no
+ * @notify.
+ */
+guint
+mcd_timeout_add (guint interval,
+                 GSourceFunc function,
+                 gpointer data)
+{
+    return mcd_timeout_add_full (interval, interval / 10, function, data,
+                                 NULL);
+}
+
+/*
+ * mcd_timeout_add_seconds:
+ * @interval: the time before @function should be called, in seconds
+ *
+ * Like mcd_timeout_add_full(), with a slack of one second and no @notify.
+ */
+guint
+mcd_timeout_add_seconds (guint interval,
+                         GSourceFunc function,
+                         gpointer data)
+{
+    return mcd_timeout_add_full (interval * 1000, 1000, function, data,
+                                 NULL);
+}
+
+/*
+ * mcd_timeout_remove:
+ * @id: an ID returned by mcd_timeout_add() or similar
+ *
+ * Stop a timer. It is safe to call this from the timer's own function.
+ *
+ * Returns: %TRUE if the timer was found
+ */
+gboolean
+mcd_timeout_remove (guint id)
+{
+    McdTimeout *timeout;
+
+    g_return_val_if_fail (id != 0, FALSE);
+
+    if (timeouts == NULL)
+        return FALSE;
+
+    timeout = g_hash_table_lookup (timeouts, GUINT_TO_POINTER (id));
+
+    if (timeout == NULL)
+    {
+        g_critical ("%s: no timeout with ID %u", G_STRFUNC, id);
+        return FALSE;
+    }
+
+    if (timeout->running)
+    {
+        /* wakeup_cb() will free it */
+        timeout->removed = TRUE;
+        g_hash_table_steal (timeouts, GUINT_TO_POINTER (id));
+    }
+    else
+    {
+        g_hash_table_remove (timeouts, GUINT_TO_POINTER (id));
+        rearm ();
+    }
+
+    return TRUE;
+}
+
+/*
+ * mcd_timeout_get_stats:
+ * @wakeups_per_minute: (out) (allow-none): the number of times a timer
+ *  woke MC up in the last minute
+ * @wakeups: (out) (allow-none): the number of times a timer has woken
+ *  MC up since it started
+ * @timeouts_run: (out) (allow-none): the number of timer functions that
+ *  have been called since MC started; the difference between this and
+ *  @wakeups is the number of wakeups saved by coalescing
+ */
+void
+mcd_timeout_get_stats (guint *wakeups_per_minute,
+                       guint64 *wakeups,
+                       guint64 *timeouts_run)
+{
+    if (wakeups_per_minute != NULL)
+    {
+        gint64 now = g_get_monotonic_time () / G_USEC_PER_SEC;
+        guint i;
+
+        *wakeups_per_minute = 0;
+
+        for (i = 0; i < STATS_SECONDS; i++)
+        {
+            if (seconds[i] > now - STATS_SECONDS)
+                *wakeups_per_minute += wakeups_by_second[i];
+        }
+    }
+
+    if (wakeups != NULL)
+        *wakeups = total_wakeups;
+
+    if (timeouts_run != NULL)
+        *timeouts_run = total_run;
+}
@@ -0,0 +1,49 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-timeout.h - coalescing timeouts for MC's internal timers
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MCD_TIMEOUT_H__
+#define __MCD_TIMEOUT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL guint mcd_timeout_add_full (guint interval,
+                                            guint slack,
+                                            GSourceFunc function,
+                                            gpointer data,
+                                            GDestroyNotify notify);
+G_GNUC_INTERNAL guint mcd_timeout_add (guint interval,
+                                       GSourceFunc function,
+                                       gpointer data);
+G_GNUC_INTERNAL guint mcd_timeout_add_seconds (guint interval,
+                                               GSourceFunc function,
+                                               gpointer data);
+G_GNUC_INTERNAL gboolean mcd_timeout_remove (guint id);
+
+G_GNUC_INTERNAL void mcd_timeout_get_stats (guint *wakeups_per_minute,
+                                            guint64 *wakeups,
+                                            guint64 *timeouts_run);
+
+G_END_DECLS
+
+#endif /* __MCD_TIMEOUT_H__ */
@@ -0,0 +1,155 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-trace.c - always-on ring buffer of dispatcher events
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The dispatcher records what each ChannelDispatchOperation is doing in a
+ * fixed-size array of fixed-size records, overwriting the oldest. Recording
+ * an event is a timestamp, an atomic increment and a short string copy, so
+ * it is done whether or not debugging is enabled; the records are only
+ * formatted when someone asks for them, with the DumpDispatchTrace D-Bus
+ * method or by sending SIGUSR1 to the MC process.
+ */
+
+#include "config.h"
+#include "mcd-trace.h"
+
+#include <string.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+/* must be a power of 2 */
+#define TRACE_SIZE 1024
+
+typedef struct {
+    /* g_get_monotonic_time(), or 0 if this record has never been used */
+    gint64 time;
+    guint32 cdo_id;
+    guint32 event;
+    /* typically a client's well-known name, without the common prefix;
+     * truncated if necessary */
+    gchar detail[48];
+} McdTraceRecord;
+
+static McdTraceRecord records[TRACE_SIZE];
+/* index of the next record to write, modulo TRACE_SIZE */
+static volatile gint next_record = 0;
+
+static const gchar * const event_names[] = {
+    "cdo-created",
+    "observer-called",
+    "observer-returned",
+    "approver-called",
+    "approver-returned",
+    "handler-tried",
+    "handler-failed",
+    "handler-succeeded",
+    "cdo-finished",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (event_names) == MCD_TRACE_N_EVENTS);
+G_STATIC_ASSERT ((TRACE_SIZE & (TRACE_SIZE - 1)) == 0);
+
+void
+mcd_trace (McdTraceEvent event,
+           guint cdo_id,
+           const gchar *detail)
+{
+    McdTraceRecord *record;
+    guint i;
+
+    i = (guint) g_atomic_int_add (&next_record, 1);
+    record = &records[i % TRACE_SIZE];
+
+    record->time = g_get_monotonic_time ();
+    record->cdo_id = cdo_id;
+    record->event = event;
+
+    if (detail == NULL)
+        record->detail[0] = '\0';
+    else
+        g_strlcpy (record->detail,
+                   g_str_has_prefix (detail, TP_CLIENT_BUS_NAME_BASE) ?
+                     detail + strlen (TP_CLIENT_BUS_NAME_BASE) : detail,
+                   sizeof (record->detail));
+}
+
+/*
+ * mcd_trace_dup_events:
+ *
+ * Returns: (transfer full): the recorded events, oldest first, as a
+ *  non-floating GVariant of type a(xuss): monotonic time in microseconds,
+ *  dispatch operation number (as in its object path), event name, detail
+ */
+GVariant *
+mcd_trace_dup_events (void)
+{
+    GVariantBuilder builder;
+    guint start = (guint) g_atomic_int_get (&next_record);
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xuss)"));
+
+    for (i = 0; i < TRACE_SIZE; i++)
+    {
+        const McdTraceRecord *record = &records[(start + i) % TRACE_SIZE];
+
+        if (record->time == 0 || record->event >= MCD_TRACE_N_EVENTS)
+            continue;
+
+        g_variant_builder_add (&builder, "(xuss)", record->time,
+                               record->cdo_id, event_names[record->event],
+                               record->detail);
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/*
+ * mcd_trace_dump:
+ *
+ * Log the recorded events, oldest first. This goes wherever MC's other
+ * messages go: stderr, $MC_LOGFILE and/or the Telepathy debug interface.
+ */
+void
+mcd_trace_dump (void)
+{
+    GVariant *events = mcd_trace_dup_events ();
+    GVariantIter iter;
+    gint64 time;
+    guint32 cdo_id;
+    const gchar *event, *detail;
+
+    g_message ("Dispatch trace (%" G_GSIZE_FORMAT " events):",
+               g_variant_n_children (events));
+
+    g_variant_iter_init (&iter, events);
+
+    while (g_variant_iter_next (&iter, "(xu&s&s)", &time, &cdo_id, &event,
+                                &detail))
+    {
+        g_message ("  %" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT " do%u %s %s",
+                   time / G_USEC_PER_SEC, time % G_USEC_PER_SEC, cdo_id,
+                   event, detail);
+    }
+
+    g_variant_unref (events);
+}
@@ -0,0 +1,53 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * mcd-trace.h - always-on ring buffer of dispatcher events
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __MCD_TRACE_H__
+#define __MCD_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* If you add events, add their names to event_names in mcd-trace.c */
+typedef enum {
+    MCD_TRACE_CDO_CREATED,
+    MCD_TRACE_OBSERVER_CALLED,
+    MCD_TRACE_OBSERVER_RETURNED,
+    MCD_TRACE_APPROVER_CALLED,
+    MCD_TRACE_APPROVER_RETURNED,
+    MCD_TRACE_HANDLER_TRIED,
+    MCD_TRACE_HANDLER_FAILED,
+    MCD_TRACE_HANDLER_SUCCEEDED,
+    MCD_TRACE_CDO_FINISHED,
+    MCD_TRACE_N_EVENTS
+} McdTraceEvent;
+
+G_GNUC_INTERNAL void mcd_trace (McdTraceEvent event,
+                                guint cdo_id,
+                                const gchar *detail);
+
+G_GNUC_INTERNAL GVariant *mcd_trace_dup_events (void);
+void mcd_trace_dump (void);
+
+G_END_DECLS
+
+#endif /* __MCD_TRACE_H__ */
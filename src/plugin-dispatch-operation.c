@@ -23,6 +23,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_PLUGINS
+
 #include "plugin-dispatch-operation.h"
 
 #include "mission-control-plugins/implementation.h"
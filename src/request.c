@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#define MCD_DEBUG_FLAG MCD_DEBUG_DISPATCH
+
 #include "request.h"
 
 #include <dbus/dbus-glib.h>
@@ -29,6 +31,7 @@
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #include "mcd-account-priv.h"
+#include "mcd-account-stats.h"
 #include "mcd-connection-priv.h"
 #include "mcd-debug.h"
 #include "mcd-misc.h"
@@ -61,6 +64,8 @@ struct _McdRequest {
     McdAccount *account;
     GHashTable *properties;
     gint64 user_action_time;
+    /* g_get_monotonic_time() when we were constructed, for statistics */
+    gint64 created_time;
     gchar *preferred_handler;
     GHashTable *hints;
     gchar *object_path;
@@ -132,6 +137,9 @@ _mcd_request_constructed (GObject *object)
   g_return_if_fail (self->account != NULL);
   g_return_if_fail (self->clients != NULL);
 
+  self->created_time = g_get_monotonic_time ();
+  _mcd_account_stats_count (self->account, MCD_ACCOUNT_STAT_REQUESTS);
+
   self->dbus_daemon = _mcd_client_registry_get_dbus_daemon (self->clients);
   tp_dbus_daemon_register_object (self->dbus_daemon, self->object_path, self);
 }
@@ -820,6 +828,11 @@ _mcd_request_set_success (McdRequest *self,
       self->is_complete = TRUE;
       self->cancellable = FALSE;
 
+      _mcd_account_stats_count (self->account,
+          MCD_ACCOUNT_STAT_REQUESTS_SUCCEEDED);
+      _mcd_account_stats_add_latency (self->account,
+          MCD_ACCOUNT_LATENCY_REQUEST, self->created_time);
+
       variant = tp_channel_dup_immutable_properties (channel);
       dbus_g_value_parse_g_variant (variant, &value);
       g_assert (G_VALUE_HOLDS (&value, TP_HASH_TYPE_STRING_VARIANT_MAP));
@@ -865,6 +878,11 @@ _mcd_request_set_failure (McdRequest *self,
       self->failure_code = code;
       self->failure_message = g_strdup (message);
 
+      _mcd_account_stats_count (self->account,
+          MCD_ACCOUNT_STAT_REQUESTS_FAILED);
+      _mcd_account_stats_add_latency (self->account,
+          MCD_ACCOUNT_LATENCY_REQUEST, self->created_time);
+
       if (self->predicted_handler != NULL)
         {
           /* no callback, as we don't really care: this method call acts as a
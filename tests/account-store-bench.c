@@ -0,0 +1,468 @@
+/*
+ * MC account storage inspector: benchmarks for the default backend
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * For each fleet size, this writes that many synthetic accounts in the
+ * given format into a private XDG_DATA_HOME, then times what MC's default
+ * storage backend (McdAccountManagerDefault) does with them:
+ *
+ *  migrate  (keyfile only) list(): load accounts.cfg, write one
+ *           .account file per account and delete accounts.cfg
+ *  load     list() on a new backend: read the directory of .account files,
+ *           with no account cache
+ *  load-warm  list() on another new backend, with the account cache that
+ *           the previous one wrote when it was freed; the files are
+ *           backdated first, so none of them need to be read again
+ *  get      get_attribute() and get_parameter() on every account
+ *  set      set_attribute() on every account
+ *  commit   commit() on every account, which rewrites every file
+ *
+ * The results are printed as tab-separated values, one line per phase,
+ * after a header line starting with '#'.
+ */
+
+#include "config.h"
+#include "account-store-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include <mission-control-plugins/mission-control-plugins.h>
+
+#include "mcd-account-manager-default.h"
+
+#define CM_NAME "bench"
+#define PROTOCOL_NAME "jabber"
+
+static const gchar * const default_sizes[] = { "1000", "10000",
+    "100000", NULL };
+
+static gsize
+get_rss_kb (void)
+{
+  gchar *contents = NULL;
+  gsize rss = 0;
+
+  if (g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+    {
+      const gchar *line = strstr (contents, "\nVmRSS:");
+
+      if (line != NULL)
+        rss = strtoul (line + strlen ("\nVmRSS:"), NULL, 10);
+    }
+
+  g_free (contents);
+  return rss;
+}
+
+static void
+rm_rf (const gchar *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+
+  if (dir != NULL)
+    {
+      const gchar *name;
+
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+
+          rm_rf (child);
+          g_free (child);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_remove (path);
+}
+
+/* The account cache records files written within the last second without
+ * an mtime, so that a same-second rewrite can't be mistaken for an
+ * unchanged file; make the files look old enough for load-warm to trust */
+static void
+backdate_files (const gchar *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  struct utimbuf times;
+
+  if (dir != NULL)
+    {
+      const gchar *name;
+
+      times.actime = times.modtime = time (NULL) - 60;
+
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+
+          g_utime (child, &times);
+          g_free (child);
+        }
+
+      g_dir_close (dir);
+    }
+}
+
+static gchar *
+account_name (guint i)
+{
+  return g_strdup_printf (CM_NAME "/" PROTOCOL_NAME "/user%u_40example_2ecom",
+      i);
+}
+
+static gboolean
+generate_variant_files (const gchar *directory,
+    guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      GVariantBuilder attrs, params;
+      gchar *name = account_name (i);
+      gchar *basename = g_strdup_printf ("%s.account", name);
+      gchar *filename;
+      gchar *user = g_strdup_printf ("user%u@example.com", i);
+      GVariant *content;
+      gchar *text;
+      gboolean ok;
+
+      g_strdelimit (basename, "/", '-');
+      filename = g_build_filename (directory, basename, NULL);
+
+      g_variant_builder_init (&params, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&params, "{sv}", "account",
+          g_variant_new_string (user));
+      g_variant_builder_add (&params, "{sv}", "password",
+          g_variant_new_string ("hunter2"));
+      g_variant_builder_add (&params, "{sv}", "server",
+          g_variant_new_string ("talk.example.com"));
+      g_variant_builder_add (&params, "{sv}", "port",
+          g_variant_new_uint32 (5222));
+
+      g_variant_builder_init (&attrs, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&attrs, "{sv}", "manager",
+          g_variant_new_string (CM_NAME));
+      g_variant_builder_add (&attrs, "{sv}", "protocol",
+          g_variant_new_string (PROTOCOL_NAME));
+      g_variant_builder_add (&attrs, "{sv}", "DisplayName",
+          g_variant_new_string (user));
+      g_variant_builder_add (&attrs, "{sv}", "Nickname",
+          g_variant_new_string (user));
+      g_variant_builder_add (&attrs, "{sv}", "Enabled",
+          g_variant_new_boolean (TRUE));
+      g_variant_builder_add (&attrs, "{sv}", "ConnectAutomatically",
+          g_variant_new_boolean (TRUE));
+      g_variant_builder_add (&attrs, "{sv}", "AutomaticPresence",
+          g_variant_new ("(uss)", 2, "available", ""));
+      g_variant_builder_add (&attrs, "{sv}", "Parameters",
+          g_variant_builder_end (&params));
+      g_variant_builder_add (&attrs, "{sv}", "KeyFileParameters",
+          g_variant_new_array (G_VARIANT_TYPE ("{ss}"), NULL, 0));
+
+      content = g_variant_ref_sink (g_variant_builder_end (&attrs));
+      text = g_variant_print (content, TRUE);
+      ok = g_file_set_contents (filename, text, -1, NULL);
+
+      g_variant_unref (content);
+      g_free (text);
+      g_free (user);
+      g_free (filename);
+      g_free (basename);
+      g_free (name);
+
+      if (!ok)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+generate_keyfile (const gchar *directory,
+    guint n)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  gchar *filename = g_build_filename (directory, "accounts.cfg", NULL);
+  gchar *data;
+  gsize len;
+  gboolean ok;
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *name = account_name (i);
+      gchar *user = g_strdup_printf ("user%u@example.com", i);
+
+      g_key_file_set_string (keyfile, name, "manager", CM_NAME);
+      g_key_file_set_string (keyfile, name, "protocol", PROTOCOL_NAME);
+      g_key_file_set_string (keyfile, name, "DisplayName", user);
+      g_key_file_set_string (keyfile, name, "Nickname", user);
+      g_key_file_set_boolean (keyfile, name, "Enabled", TRUE);
+      g_key_file_set_boolean (keyfile, name, "ConnectAutomatically", TRUE);
+      g_key_file_set_string (keyfile, name, "param-account", user);
+      g_key_file_set_string (keyfile, name, "param-password", "hunter2");
+      g_key_file_set_string (keyfile, name, "param-server",
+          "talk.example.com");
+      g_key_file_set_string (keyfile, name, "param-port", "5222");
+
+      g_free (user);
+      g_free (name);
+    }
+
+  data = g_key_file_to_data (keyfile, &len, NULL);
+  ok = g_file_set_contents (filename, data, len, NULL);
+
+  g_free (data);
+  g_free (filename);
+  g_key_file_unref (keyfile);
+  return ok;
+}
+
+static void
+report (const gchar *format,
+    guint n,
+    const gchar *phase,
+    gint64 started)
+{
+  gint64 elapsed = g_get_monotonic_time () - started;
+
+  printf ("%s\t%u\t%s\t%.6f\t%.3f\t%" G_GSIZE_FORMAT "\n",
+      format, n, phase, elapsed / (gdouble) G_USEC_PER_SEC,
+      elapsed / (gdouble) n, get_rss_kb ());
+  fflush (stdout);
+}
+
+/* Create a new backend and list its accounts, returning the backend and
+ * the (sorted) accounts */
+static McpAccountStorage *
+load (const gchar *format,
+    guint n,
+    const gchar *phase,
+    GList **accounts)
+{
+  McpAccountStorage *storage;
+  gint64 started;
+
+  storage = MCP_ACCOUNT_STORAGE (mcd_account_manager_default_new ());
+
+  started = g_get_monotonic_time ();
+  *accounts = mcp_account_storage_list (storage, NULL);
+  report (format, n, phase, started);
+
+  *accounts = g_list_sort (*accounts, (GCompareFunc) g_strcmp0);
+  return storage;
+}
+
+static gboolean
+bench_one (const gchar *format,
+    const gchar *directory,
+    const gchar *cache,
+    guint n)
+{
+  McpAccountStorage *storage;
+  GList *accounts = NULL;
+  GList *l;
+  gint64 started;
+  gboolean ok = TRUE;
+  guint i;
+
+  rm_rf (directory);
+  g_mkdir_with_parents (directory, 0700);
+
+  if (!tp_strdiff (format, "keyfile"))
+    {
+      if (!generate_keyfile (directory, n))
+        return FALSE;
+
+      /* the first load migrates accounts.cfg to .account files */
+      storage = load (format, n, "migrate", &accounts);
+      g_object_unref (storage);
+      g_list_free_full (accounts, g_free);
+    }
+  else if (!generate_variant_files (directory, n))
+    {
+      return FALSE;
+    }
+
+  /* start from a cold cache, but let the first load write a cache that
+   * the second one can use in full */
+  g_remove (cache);
+  backdate_files (directory);
+  storage = load (format, n, "load", &accounts);
+  g_object_unref (storage);
+  g_list_free_full (accounts, g_free);
+
+  storage = load (format, n, "load-warm", &accounts);
+
+  if (g_list_length (accounts) != n)
+    {
+      g_printerr ("Expected %u accounts, got %u\n", n,
+          g_list_length (accounts));
+      ok = FALSE;
+      goto finally;
+    }
+
+  started = g_get_monotonic_time ();
+
+  for (l = accounts; l != NULL; l = l->next)
+    {
+      GVariant *v;
+
+      v = mcp_account_storage_get_attribute (storage, NULL, l->data,
+          "DisplayName", G_VARIANT_TYPE_STRING, NULL);
+      tp_clear_pointer (&v, g_variant_unref);
+      v = mcp_account_storage_get_attribute (storage, NULL, l->data,
+          "Enabled", G_VARIANT_TYPE_BOOLEAN, NULL);
+      tp_clear_pointer (&v, g_variant_unref);
+      /* with no type, so that untyped parameters are not unescaped, which
+       * would need a real McpAccountManager */
+      v = mcp_account_storage_get_parameter (storage, NULL, l->data,
+          "account", NULL, NULL);
+      tp_clear_pointer (&v, g_variant_unref);
+    }
+
+  report (format, n, "get", started);
+
+  started = g_get_monotonic_time ();
+
+  for (l = accounts, i = 0; l != NULL; l = l->next, i++)
+    {
+      GVariant *v = g_variant_ref_sink (g_variant_new_take_string (
+            g_strdup_printf ("Benchmark %u", i)));
+
+      mcp_account_storage_set_attribute (storage, NULL, l->data,
+          "Nickname", v, 0);
+      g_variant_unref (v);
+    }
+
+  report (format, n, "set", started);
+
+  started = g_get_monotonic_time ();
+
+  for (l = accounts; l != NULL; l = l->next)
+    {
+      if (!mcp_account_storage_commit (storage, NULL, l->data))
+        ok = FALSE;
+    }
+
+  report (format, n, "commit", started);
+
+finally:
+  g_list_free_full (accounts, g_free);
+  g_object_unref (storage);
+  return ok;
+}
+
+/*
+ * bench_run:
+ * @format: "variant-file" or "keyfile", the format in which to generate
+ *  accounts
+ * @sizes: (allow-none): numbers of accounts as strings, or %NULL for the
+ *  defaults
+ *
+ * This must be called before anything else uses the XDG directories,
+ * because GLib only looks at the environment once.
+ */
+gboolean
+bench_run (const gchar *format,
+    const gchar * const *sizes)
+{
+  GError *error = NULL;
+  gchar *tmpdir;
+  gchar *data_home;
+  gchar *directory;
+  gchar *cache;
+  gchar *value;
+  gboolean ok = TRUE;
+
+  if (tp_strdiff (format, "variant-file") && tp_strdiff (format, "keyfile"))
+    {
+      g_printerr ("Benchmarks can only use variant-file or keyfile\n");
+      return FALSE;
+    }
+
+  if (sizes == NULL || *sizes == NULL)
+    sizes = default_sizes;
+
+  tmpdir = g_dir_make_tmp ("account-store-bench-XXXXXX", &error);
+
+  if (tmpdir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  /* Keep the real accounts, and any lower-priority ones, out of it */
+  data_home = g_build_filename (tmpdir, "data", NULL);
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  value = g_build_filename (tmpdir, "system", NULL);
+  g_setenv ("XDG_DATA_DIRS", value, TRUE);
+  g_free (value);
+  value = g_build_filename (tmpdir, "old", NULL);
+  g_setenv ("MC_ACCOUNT_DIR", value, TRUE);
+  g_free (value);
+  cache = g_build_filename (tmpdir, "accounts.cache", NULL);
+  g_setenv ("MC_ACCOUNT_CACHE_PATH", cache, TRUE);
+
+  directory = g_build_filename (data_home, "telepathy", "mission-control",
+      NULL);
+
+  printf ("# format\taccounts\tphase\tseconds\tusec_per_account\trss_kb\n");
+
+  for (; *sizes != NULL; sizes++)
+    {
+      gchar *end;
+      guint64 n = g_ascii_strtoull (*sizes, &end, 10);
+
+      if (*end != '\0' || n == 0 || n > G_MAXUINT)
+        {
+          g_printerr ("Invalid number of accounts: %s\n", *sizes);
+          ok = FALSE;
+          break;
+        }
+
+      if (!bench_one (format, directory, cache, n))
+        {
+          g_printerr ("Benchmark with %s accounts in %s failed\n", *sizes,
+              directory);
+          ok = FALSE;
+          break;
+        }
+    }
+
+  rm_rf (tmpdir);
+  g_free (cache);
+  g_free (directory);
+  g_free (data_home);
+  g_free (tmpdir);
+  return ok;
+}
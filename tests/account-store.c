@@ -27,6 +27,7 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "account-store-bench.h"
 #include "account-store-keyfile.h"
 #include "account-store-variant-file.h"
 
@@ -41,6 +42,11 @@
   "  KEY     := <manager | protocol | DisplayName | param-<PARAMETER>>\n" \
   "  VALUE   := <STRING>\n\n"
 
+#define DOCSTRING_BENCH \
+  "%s bench FORMAT [N...]\n\n"                                          \
+  "  FORMAT  := <variant-file | keyfile>\n"                             \
+  "  N       := number of accounts (default: 1000 10000 100000)\n\n"
+
 typedef struct {
   const gchar *name;
   gchar *  (*get) (const gchar *account, const gchar *key);
@@ -102,6 +108,11 @@ int main (int argc, char **argv)
   op_name = argv[1];
   backend = argv[2];
 
+  /* this must come first, because it changes where GLib looks for
+   * user data */
+  if (g_str_equal (op_name, "bench"))
+    return bench_run (backend, (const gchar * const *) argv + 3) ? 0 : 1;
+
   for (i = 0; backends[i].name != NULL; i++)
     {
       if (g_str_equal (backends[i].name, backend))
@@ -231,6 +242,7 @@ usage (const gchar *name, const gchar *fmt, ...)
     fprintf (stderr, " | %s", backends[i].name);
 
   fprintf (stderr, DOCSTRING_B);
+  fprintf (stderr, DOCSTRING_BENCH, name);
 
   va_start (ap, fmt);
   vfprintf (stderr, fmt, ap);
@@ -0,0 +1,281 @@
+/*
+ * Regression test for converting values from storage plugins to the
+ * type that MC wants
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-storage.h"
+
+/* Values are in GVariant text format; a NULL result means the conversion
+ * is meant to fail */
+typedef struct {
+    const gchar *value;
+    const gchar *type;
+    const gchar *result;
+} CoercionTest;
+
+static const CoercionTest number_tests[] = {
+      /* already the right type */
+      { "int32 5", "i", "5" },
+      /* widening, and signed to unsigned and back within range */
+      { "byte 0xff", "u", "255" },
+      { "uint32 7", "x", "7" },
+      { "uint16 65535", "i", "65535" },
+      { "int64 2147483647", "i", "2147483647" },
+      { "int64 -2147483648", "i", "-2147483648" },
+      { "uint64 18446744073709551615", "t", "18446744073709551615" },
+      /* out of range */
+      { "int32 -1", "u", NULL },
+      { "int32 -1", "y", NULL },
+      { "uint32 70000", "q", NULL },
+      { "int64 2147483648", "i", NULL },
+      { "int64 -2147483649", "i", NULL },
+      { "uint64 18446744073709551615", "x", NULL },
+      /* doubles convert to integers only if they are whole */
+      { "3.0", "i", "3" },
+      { "-3.0", "u", NULL },
+      { "3.5", "i", NULL },
+      { "1e20", "t", NULL },
+      { "int32 -2", "d", "-2.0" },
+      { "uint64 18446744073709551615", "d", "18446744073709551615.0" },
+      { NULL }
+};
+
+static const CoercionTest boolean_tests[] = {
+      { "true", "u", "1" },
+      { "false", "x", "0" },
+      { "uint32 1", "b", "true" },
+      { "int32 0", "b", "false" },
+      { "0.0", "b", "false" },
+      { "uint32 2", "b", NULL },
+      { "int32 -1", "b", NULL },
+      { NULL }
+};
+
+static const CoercionTest string_tests[] = {
+      /* numbers stored as text, as GKeyFile-based plugins do */
+      { "'42'", "u", "42" },
+      { "'-3'", "i", "-3" },
+      { "'-3'", "u", NULL },
+      { "' -5'", "i", "-5" },
+      { "' -5'", "u", NULL },
+      { "'\\t-5'", "t", NULL },
+      { "' 5'", "u", "5" },
+      { "'4.5'", "d", "4.5" },
+      { "'4.5'", "i", NULL },
+      { "'1e3'", "u", "1000" },
+      { "'18446744073709551615'", "t", "18446744073709551615" },
+      { "'18446744073709551615'", "x", NULL },
+      { "'-9223372036854775808'", "x", "-9223372036854775808" },
+      { "'99999999999999999999'", "t", NULL },
+      { "'true'", "b", "true" },
+      { "'false'", "b", "false" },
+      { "'42abc'", "u", NULL },
+      { "'abc'", "i", NULL },
+      { "''", "i", NULL },
+      { "'TRUE'", "b", NULL },
+      /* and back, spelt as GKeyFile would */
+      { "uint32 42", "s", "'42'" },
+      { "int64 -3", "s", "'-3'" },
+      { "true", "s", "'true'" },
+      /* object paths */
+      { "objectpath '/a/b'", "s", "'/a/b'" },
+      { "'/a/b'", "o", "objectpath '/a/b'" },
+      { "'not a path'", "o", NULL },
+      { "uint32 42", "o", NULL },
+      { NULL }
+};
+
+static const CoercionTest container_tests[] = {
+      { "['a', 'b']", "as", "['a', 'b']" },
+      { "['/a', '/b']", "ao", "[objectpath '/a', '/b']" },
+      { "(uint32 2, 'away', 'back soon')", "(uss)",
+        "(uint32 2, 'away', 'back soon')" },
+      { "['a', 'b']", "u", NULL },
+      { NULL }
+};
+
+static void
+test_coercions (gconstpointer data)
+{
+  const CoercionTest *tests = data;
+  guint i;
+
+  for (i = 0; tests[i].value != NULL; i++)
+    {
+      const GVariantType *type = G_VARIANT_TYPE (tests[i].type);
+      GVariant *value, *result;
+      GError *error = NULL;
+
+      value = g_variant_parse (NULL, tests[i].value, NULL, NULL, &error);
+      g_assert_no_error (error);
+      g_variant_ref_sink (value);
+
+      result = mcd_storage_coerce_variant (value, type, &error);
+
+      if (tests[i].result == NULL)
+        {
+          if (result != NULL)
+            g_error ("Converting %s to '%s' was meant to fail, but gave %s",
+                tests[i].value, tests[i].type, g_variant_print (result, TRUE));
+
+          g_assert_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT);
+          g_clear_error (&error);
+        }
+      else
+        {
+          GVariant *expected;
+
+          if (error != NULL)
+            g_error ("Converting %s to '%s' was meant to succeed: %s",
+                tests[i].value, tests[i].type, error->message);
+
+          g_assert (result != NULL);
+          g_assert (!g_variant_is_floating (result));
+          g_assert (g_variant_is_of_type (result, type));
+
+          expected = g_variant_parse (type, tests[i].result, NULL, NULL,
+              &error);
+          g_assert_no_error (error);
+          g_variant_ref_sink (expected);
+
+          if (!g_variant_equal (result, expected))
+            g_error ("Converting %s to '%s' gave %s, not %s",
+                tests[i].value, tests[i].type,
+                g_variant_print (result, TRUE), tests[i].result);
+
+          g_variant_unref (expected);
+          g_variant_unref (result);
+        }
+
+      g_variant_unref (value);
+    }
+}
+
+/* Values are in GVariant text format; a NULL result means the conversion
+ * is meant to fail */
+typedef struct {
+    const gchar *value;
+    GType type;
+    const gchar *result;
+} ValueTest;
+
+static const ValueTest value_tests[] = {
+      { "int32 5", G_TYPE_INT, "5" },
+      { "uint32 5", G_TYPE_INT, "5" },
+      { "uint32 4294967295", G_TYPE_INT, NULL },
+      { "int32 -1", G_TYPE_UINT, NULL },
+      { "int64 -1", G_TYPE_UINT64, NULL },
+      { "uint64 4294967296", G_TYPE_UINT, NULL },
+      { "int32 256", G_TYPE_UCHAR, NULL },
+      { "uint32 2", G_TYPE_BOOLEAN, NULL },
+      { "uint32 1", G_TYPE_BOOLEAN, "true" },
+      { "3.5", G_TYPE_INT, NULL },
+      { "int32 -2", G_TYPE_DOUBLE, "-2.0" },
+      { NULL }
+};
+
+static void
+test_values (void)
+{
+  guint i;
+
+  for (i = 0; value_tests[i].value != NULL; i++)
+    {
+      GValue value = G_VALUE_INIT;
+      GVariant *variant;
+      GError *error = NULL;
+      gboolean ok;
+
+      variant = g_variant_parse (NULL, value_tests[i].value, NULL, NULL,
+          &error);
+      g_assert_no_error (error);
+      g_variant_ref_sink (variant);
+
+      g_value_init (&value, value_tests[i].type);
+      ok = mcd_storage_variant_to_value (variant, &value, &error);
+
+      if (value_tests[i].result == NULL)
+        {
+          if (ok)
+            g_error ("Storing %s in a %s was meant to fail, but gave %s",
+                value_tests[i].value, g_type_name (value_tests[i].type),
+                g_strdup_value_contents (&value));
+
+          g_assert_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT);
+          g_clear_error (&error);
+        }
+      else
+        {
+          GVariant *expected, *result;
+
+          if (!ok)
+            g_error ("Storing %s in a %s was meant to succeed: %s",
+                value_tests[i].value, g_type_name (value_tests[i].type),
+                error->message);
+
+          g_assert_cmpstr (G_VALUE_TYPE_NAME (&value), ==,
+              g_type_name (value_tests[i].type));
+
+          result = dbus_g_value_build_g_variant (&value);
+          g_variant_ref_sink (result);
+          expected = g_variant_parse (g_variant_get_type (result),
+              value_tests[i].result, NULL, NULL, &error);
+          g_assert_no_error (error);
+          g_variant_ref_sink (expected);
+
+          if (!g_variant_equal (result, expected))
+            g_error ("Storing %s in a %s gave %s, not %s",
+                value_tests[i].value, g_type_name (value_tests[i].type),
+                g_variant_print (result, TRUE), value_tests[i].result);
+
+          g_variant_unref (expected);
+          g_variant_unref (result);
+        }
+
+      if (G_IS_VALUE (&value))
+        g_value_unset (&value);
+
+      g_variant_unref (variant);
+    }
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_data_func ("/coerce-variant/numbers", number_tests,
+      test_coercions);
+  g_test_add_data_func ("/coerce-variant/booleans", boolean_tests,
+      test_coercions);
+  g_test_add_data_func ("/coerce-variant/strings", string_tests,
+      test_coercions);
+  g_test_add_data_func ("/coerce-variant/containers", container_tests,
+      test_coercions);
+  g_test_add_func ("/coerce-variant/values", test_values);
+
+  return g_test_run ();
+}
@@ -0,0 +1,714 @@
+/*
+ * hammer-accounts: a load generator for MC's AccountManager and Account API
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * This starts a private D-Bus session bus and a private Mission Control on
+ * it, with its own XDG directories so that only the default storage backend
+ * is used, creates a number of accounts, then has a number of clients (each
+ * with its own D-Bus connection, and one call in flight at a time) call
+ * UpdateParameters, set RequestedPresence and Enabled, and GetAll on
+ * randomly-chosen accounts for a while. It reports the rate and latency
+ * of each kind of call, and how much MC's resident set grew.
+ *
+ * The accounts belong to a connection manager that is described by a
+ * .manager file but does not exist, so when an account is asked to come
+ * online its connection attempt fails quickly: this measures MC, not
+ * a connection manager.
+ *
+ * The latencies include the time the request spends queued in MC behind
+ * other clients' requests, which is the point.
+ */
+
+#include "config.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#define AM_BUS_NAME "org.freedesktop.Telepathy.AccountManager"
+#define AM_PATH "/org/freedesktop/Telepathy/AccountManager"
+#define AM_IFACE "org.freedesktop.Telepathy.AccountManager"
+#define ACCOUNT_IFACE "org.freedesktop.Telepathy.Account"
+#define PROPERTIES_IFACE "org.freedesktop.DBus.Properties"
+
+#define CM_NAME "hammer"
+#define PROTOCOL_NAME "hammerproto"
+
+#define MANAGER_FILE \
+  "[ConnectionManager]\n" \
+  "BusName=org.freedesktop.Telepathy.ConnectionManager." CM_NAME "\n" \
+  "ObjectPath=/org/freedesktop/Telepathy/ConnectionManager/" CM_NAME "\n" \
+  "\n" \
+  "[Protocol " PROTOCOL_NAME "]\n" \
+  "param-account=s required\n" \
+  "param-password=s required secret\n" \
+  "param-server=s\n" \
+  "param-port=u\n"
+
+/* how many CreateAccount calls to have in flight at once */
+#define CREATE_WINDOW 32
+
+/* how long to wait for MC to start */
+#define STARTUP_TIMEOUT_SEC 30
+
+typedef enum {
+  OP_CREATE_ACCOUNT,
+  OP_UPDATE_PARAMETERS,
+  OP_REQUESTED_PRESENCE,
+  OP_ENABLED,
+  OP_GET_ALL,
+  N_OPS
+} Op;
+
+static const gchar * const op_names[] = {
+  "CreateAccount",
+  "UpdateParameters",
+  "RequestedPresence",
+  "Enabled",
+  "GetAll",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (op_names) == N_OPS);
+
+typedef struct {
+  /* gint64 microseconds per successful call */
+  GArray *latencies;
+  guint errors;
+} OpStats;
+
+typedef struct {
+  GDBusConnection *conn;
+} Client;
+
+/* one D-Bus call in flight */
+typedef struct {
+  Client *client;
+  Op op;
+  gint64 started;
+} Call;
+
+static gint n_accounts = 100;
+static gint n_clients = 8;
+static gint duration = 10;
+static gint seed = 0;
+static gboolean keep = FALSE;
+
+static GOptionEntry entries[] = {
+  { "accounts", 'a', 0, G_OPTION_ARG_INT, &n_accounts,
+    "Number of accounts to create (default 100)", "N" },
+  { "clients", 'c', 0, G_OPTION_ARG_INT, &n_clients,
+    "Number of concurrent clients (default 8)", "M" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+    "Seconds to run for after creating accounts (default 10)", "SECONDS" },
+  { "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+    "Seed for choosing operations and accounts (default 0)", "SEED" },
+  { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+    "Don't delete the temporary directory with MC's accounts and log",
+    NULL },
+  { NULL }
+};
+
+static GMainLoop *loop;
+static GRand *rand_;
+static OpStats stats[N_OPS];
+static Client *clients;
+static GPtrArray *account_paths;
+static gint64 deadline;
+static guint accounts_requested = 0;
+static guint calls_in_flight = 0;
+
+/* ---- process and file helpers ---- */
+
+static gsize
+get_rss_kb (GPid pid)
+{
+  gchar *path = g_strdup_printf ("/proc/%d/status", (gint) pid);
+  gchar *contents = NULL;
+  gsize rss = 0;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      const gchar *line = strstr (contents, "\nVmRSS:");
+
+      if (line != NULL)
+        rss = strtoul (line + strlen ("\nVmRSS:"), NULL, 10);
+    }
+
+  g_free (contents);
+  g_free (path);
+  return rss;
+}
+
+static void
+rm_rf (const gchar *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+
+  if (dir != NULL)
+    {
+      const gchar *name;
+
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+
+          rm_rf (child);
+          g_free (child);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_remove (path);
+}
+
+static gchar **
+make_environment (const gchar *tmpdir,
+    const gchar *bus_address)
+{
+  gchar **env = g_get_environ ();
+  gchar *managers = g_build_filename (tmpdir, "share", "telepathy",
+      "managers", NULL);
+  gchar *manager_file = g_build_filename (managers, CM_NAME ".manager", NULL);
+  gchar *plugins = g_build_filename (tmpdir, "plugins", NULL);
+  gchar *clients_dir = g_build_filename (tmpdir, "clients", NULL);
+  struct { const gchar *variable; const gchar *subdir; } dirs[] = {
+      { "XDG_DATA_HOME", "data" },
+      { "XDG_CONFIG_HOME", "config" },
+      { "XDG_CACHE_HOME", "cache" },
+      { "XDG_DATA_DIRS", "share" },
+      { "MC_ACCOUNT_DIR", "old-accounts" },
+      { "MC_SNAPSHOT_PATH", "accounts.snapshot" },
+      { "MC_LOGFILE", "missioncontrol.log" },
+  };
+  guint i;
+
+  g_mkdir_with_parents (managers, 0700);
+  g_mkdir_with_parents (plugins, 0700);
+  g_mkdir_with_parents (clients_dir, 0700);
+  g_file_set_contents (manager_file, MANAGER_FILE, -1, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (dirs); i++)
+    {
+      gchar *value = g_build_filename (tmpdir, dirs[i].subdir, NULL);
+
+      env = g_environ_setenv (env, dirs[i].variable, value, TRUE);
+      g_free (value);
+    }
+
+  /* no plugins, so that only the default storage backend is used */
+  env = g_environ_setenv (env, "MC_FILTER_PLUGIN_DIR", plugins, TRUE);
+  env = g_environ_setenv (env, "MC_CLIENTS_DIR", clients_dir, TRUE);
+  /* keep MC away from the real system bus, as the regression tests do */
+  env = g_environ_setenv (env, "DBUS_SESSION_BUS_ADDRESS", bus_address,
+      TRUE);
+  env = g_environ_setenv (env, "DBUS_SYSTEM_BUS_ADDRESS", bus_address, TRUE);
+  /* don't let debug output slow MC down */
+  env = g_environ_unsetenv (env, "MC_DEBUG");
+  env = g_environ_unsetenv (env, "G_MESSAGES_DEBUG");
+
+  g_free (clients_dir);
+  g_free (plugins);
+  g_free (manager_file);
+  g_free (managers);
+  return env;
+}
+
+/* ---- statistics ---- */
+
+static void
+record (Op op,
+    gint64 started,
+    const GError *error)
+{
+  gint64 latency = g_get_monotonic_time () - started;
+
+  if (error != NULL)
+    {
+      /* only report the first few, there could be thousands */
+      if (stats[op].errors++ < 5)
+        g_printerr ("%s failed: %s\n", op_names[op], error->message);
+
+      return;
+    }
+
+  g_array_append_val (stats[op].latencies, latency);
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+    gconstpointer b)
+{
+  gint64 left = *(const gint64 *) a;
+  gint64 right = *(const gint64 *) b;
+
+  return (left > right) - (left < right);
+}
+
+static gdouble
+percentile_ms (GArray *sorted,
+    guint percent)
+{
+  if (sorted->len == 0)
+    return 0;
+
+  return g_array_index (sorted, gint64,
+      (sorted->len - 1) * percent / 100) / 1000.0;
+}
+
+static void
+report_op (Op op,
+    gdouble seconds)
+{
+  GArray *l = stats[op].latencies;
+
+  g_array_sort (l, compare_gint64);
+  printf ("%-18s %8u %6u %10.1f %8.2f %8.2f %8.2f %8.2f\n",
+      op_names[op], l->len, stats[op].errors,
+      seconds > 0 ? l->len / seconds : 0,
+      percentile_ms (l, 50), percentile_ms (l, 90), percentile_ms (l, 99),
+      percentile_ms (l, 100));
+}
+
+static void
+report_header (void)
+{
+  printf ("%-18s %8s %6s %10s %8s %8s %8s %8s\n",
+      "operation", "calls", "errors", "calls/s", "p50 ms", "p90 ms",
+      "p99 ms", "max ms");
+}
+
+/* ---- calls ---- */
+
+static Call *
+call_new (Client *client,
+    Op op)
+{
+  Call *call = g_slice_new (Call);
+
+  call->client = client;
+  call->op = op;
+  call->started = g_get_monotonic_time ();
+  calls_in_flight++;
+  return call;
+}
+
+/* Record the result of @call and free it; return the reply, if any */
+static GVariant *
+call_finish (Call *call,
+    GObject *source,
+    GAsyncResult *res)
+{
+  GError *error = NULL;
+  GVariant *reply;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res,
+      &error);
+  record (call->op, call->started, error);
+  g_clear_error (&error);
+
+  calls_in_flight--;
+  g_slice_free (Call, call);
+  return reply;
+}
+
+/* ---- creating accounts ---- */
+
+static void create_next (Client *client);
+
+static void
+create_account_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  Call *call = user_data;
+  Client *client = call->client;
+  GVariant *reply = call_finish (call, source, res);
+
+  if (reply != NULL)
+    {
+      gchar *path;
+
+      g_variant_get (reply, "(o)", &path);
+      g_ptr_array_add (account_paths, path);
+      g_variant_unref (reply);
+    }
+
+  create_next (client);
+
+  if (calls_in_flight == 0)
+    g_main_loop_quit (loop);
+}
+
+static void
+create_next (Client *client)
+{
+  GVariantBuilder params, properties;
+  gchar *account, *display_name;
+
+  if (accounts_requested >= (guint) n_accounts)
+    return;
+
+  accounts_requested++;
+  account = g_strdup_printf ("user%u@example.com", accounts_requested);
+  display_name = g_strdup_printf ("Account %u", accounts_requested);
+
+  g_variant_builder_init (&params, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&params, "{sv}", "account",
+      g_variant_new_string (account));
+  g_variant_builder_add (&params, "{sv}", "password",
+      g_variant_new_string ("hunter2"));
+  g_variant_builder_init (&properties, G_VARIANT_TYPE_VARDICT);
+
+  g_dbus_connection_call (client->conn, AM_BUS_NAME, AM_PATH, AM_IFACE,
+      "CreateAccount",
+      g_variant_new ("(sssa{sv}a{sv})", CM_NAME, PROTOCOL_NAME,
+          display_name, &params, &properties),
+      G_VARIANT_TYPE ("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+      create_account_cb, call_new (client, OP_CREATE_ACCOUNT));
+
+  g_free (display_name);
+  g_free (account);
+}
+
+/* ---- hammering ---- */
+
+static void hammer_next (Client *client);
+
+static void
+hammer_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  Call *call = user_data;
+  Client *client = call->client;
+  GVariant *reply = call_finish (call, source, res);
+
+  if (reply != NULL)
+    g_variant_unref (reply);
+
+  if (g_get_monotonic_time () < deadline)
+    hammer_next (client);
+  else if (calls_in_flight == 0)
+    g_main_loop_quit (loop);
+}
+
+static void
+hammer_next (Client *client)
+{
+  const gchar *path = g_ptr_array_index (account_paths,
+      g_rand_int_range (rand_, 0, account_paths->len));
+  Op op = g_rand_int_range (rand_, OP_UPDATE_PARAMETERS, N_OPS);
+  const gchar *method = "Set";
+  const gchar *iface = PROPERTIES_IFACE;
+  const GVariantType *reply_type = NULL;
+  GVariant *args;
+
+  switch (op)
+    {
+      case OP_UPDATE_PARAMETERS:
+        {
+          GVariantBuilder set;
+          gchar *server = g_strdup_printf ("server%u.example.com",
+              g_rand_int_range (rand_, 0, 1000));
+          const gchar *unset[] = { "port", NULL };
+
+          g_variant_builder_init (&set, G_VARIANT_TYPE_VARDICT);
+          g_variant_builder_add (&set, "{sv}", "server",
+              g_variant_new_string (server));
+          args = g_variant_new ("(a{sv}^as)", &set, unset);
+          method = "UpdateParameters";
+          iface = ACCOUNT_IFACE;
+          g_free (server);
+        }
+        break;
+
+      case OP_REQUESTED_PRESENCE:
+        {
+          /* offline, available or away */
+          static const struct {
+            guint type;
+            const gchar *status;
+          } presences[] = { { 1, "offline" }, { 2, "available" },
+              { 3, "away" } };
+          guint i = g_rand_int_range (rand_, 0, G_N_ELEMENTS (presences));
+
+          args = g_variant_new ("(ssv)", ACCOUNT_IFACE, "RequestedPresence",
+              g_variant_new ("(uss)", presences[i].type, presences[i].status,
+                  ""));
+        }
+        break;
+
+      case OP_ENABLED:
+        args = g_variant_new ("(ssv)", ACCOUNT_IFACE, "Enabled",
+            g_variant_new_boolean (g_rand_boolean (rand_)));
+        break;
+
+      case OP_GET_ALL:
+        args = g_variant_new ("(s)", ACCOUNT_IFACE);
+        method = "GetAll";
+        reply_type = G_VARIANT_TYPE ("(a{sv})");
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  g_dbus_connection_call (client->conn, AM_BUS_NAME, path, iface, method,
+      args, reply_type, G_DBUS_CALL_FLAGS_NONE, -1, NULL, hammer_cb,
+      call_new (client, op));
+}
+
+/* ---- startup ---- */
+
+static gboolean
+startup_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+name_appeared_cb (GDBusConnection *conn,
+    const gchar *name,
+    const gchar *owner,
+    gpointer user_data)
+{
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+wait_for_mc (GDBusConnection *conn)
+{
+  gboolean timed_out = FALSE;
+  guint watch, timeout;
+
+  watch = g_bus_watch_name_on_connection (conn, AM_BUS_NAME,
+      G_BUS_NAME_WATCHER_FLAGS_NONE, name_appeared_cb, NULL, NULL, NULL);
+  timeout = g_timeout_add_seconds (STARTUP_TIMEOUT_SEC, startup_timeout_cb,
+      &timed_out);
+  g_main_loop_run (loop);
+
+  if (!timed_out)
+    g_source_remove (timeout);
+
+  g_bus_unwatch_name (watch);
+  return !timed_out;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  const gchar *mc = MC_EXECUTABLE;
+  gchar *mc_argv[] = { NULL, NULL };
+  gchar *tmpdir = NULL;
+  gchar **env = NULL;
+  GTestDBus *bus = NULL;
+  GPid pid = 0;
+  gsize rss_start, rss_created, rss_end;
+  gint64 started;
+  gdouble seconds;
+  gint i, ret = 1;
+
+  context = g_option_context_new ("[MISSION-CONTROL-EXECUTABLE]");
+  g_option_context_set_summary (context,
+      "Create accounts on a private Mission Control and call methods on "
+      "them from several clients at once, then report how fast that was.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_option_context_free (context);
+      g_error_free (error);
+      return 2;
+    }
+
+  g_option_context_free (context);
+
+  if (argc > 2 || n_accounts < 1 || n_clients < 1 || duration < 0)
+    {
+      g_printerr ("%s: invalid arguments, try --help\n", g_get_prgname ());
+      return 2;
+    }
+
+  if (argc == 2)
+    mc = argv[1];
+
+  mc_argv[0] = (gchar *) mc;
+
+  tmpdir = g_dir_make_tmp ("hammer-accounts-XXXXXX", &error);
+
+  if (tmpdir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  loop = g_main_loop_new (NULL, FALSE);
+  rand_ = g_rand_new_with_seed (seed);
+  account_paths = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < N_OPS; i++)
+    stats[i].latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+  env = make_environment (tmpdir, g_test_dbus_get_bus_address (bus));
+
+  if (!g_spawn_async (NULL, mc_argv, env, G_SPAWN_DO_NOT_REAP_CHILD,
+          NULL, NULL, &pid, &error))
+    {
+      g_printerr ("Unable to start %s: %s\n", mc, error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  clients = g_new0 (Client, n_clients);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      clients[i].conn = g_dbus_connection_new_for_address_sync (
+          g_test_dbus_get_bus_address (bus),
+          G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+          NULL, NULL, &error);
+
+      if (clients[i].conn == NULL)
+        {
+          g_printerr ("Unable to connect to the private bus: %s\n",
+              error->message);
+          g_error_free (error);
+          goto out;
+        }
+    }
+
+  if (!wait_for_mc (clients[0].conn))
+    {
+      g_printerr ("%s did not start within %d seconds\n", mc,
+          STARTUP_TIMEOUT_SEC);
+      goto out;
+    }
+
+  rss_start = get_rss_kb (pid);
+
+  started = g_get_monotonic_time ();
+
+  for (i = 0; i < MIN (CREATE_WINDOW, n_accounts); i++)
+    create_next (&clients[i % n_clients]);
+
+  g_main_loop_run (loop);
+  seconds = (g_get_monotonic_time () - started) / (gdouble) G_USEC_PER_SEC;
+  rss_created = get_rss_kb (pid);
+
+  report_header ();
+  report_op (OP_CREATE_ACCOUNT, seconds);
+
+  if (account_paths->len == 0)
+    {
+      g_printerr ("No accounts were created\n");
+      goto out;
+    }
+
+  started = g_get_monotonic_time ();
+  deadline = started + (gint64) duration * G_USEC_PER_SEC;
+
+  if (duration > 0)
+    {
+      for (i = 0; i < n_clients; i++)
+        hammer_next (&clients[i]);
+
+      g_main_loop_run (loop);
+    }
+
+  seconds = (g_get_monotonic_time () - started) / (gdouble) G_USEC_PER_SEC;
+  rss_end = get_rss_kb (pid);
+
+  for (i = OP_UPDATE_PARAMETERS; i < N_OPS; i++)
+    report_op (i, seconds);
+
+  printf ("\n%u accounts, %d clients, %.1f seconds\n",
+      account_paths->len, n_clients, seconds);
+  printf ("MC RSS: %" G_GSIZE_FORMAT " kB at start, "
+      "%" G_GSIZE_FORMAT " kB after creating accounts (%+" G_GSSIZE_FORMAT
+      " kB), %" G_GSIZE_FORMAT " kB at end (%+" G_GSSIZE_FORMAT " kB)\n",
+      rss_start, rss_created, (gssize) (rss_created - rss_start),
+      rss_end, (gssize) (rss_end - rss_created));
+
+  ret = 0;
+
+  for (i = 0; i < N_OPS; i++)
+    {
+      if (stats[i].errors > 0)
+        ret = 1;
+    }
+
+out:
+  if (pid != 0)
+    {
+      kill (pid, SIGTERM);
+      waitpid (pid, NULL, 0);
+      g_spawn_close_pid (pid);
+    }
+
+  if (clients != NULL)
+    {
+      for (i = 0; i < n_clients; i++)
+        g_clear_object (&clients[i].conn);
+
+      g_free (clients);
+    }
+
+  if (bus != NULL)
+    {
+      g_test_dbus_down (bus);
+      g_object_unref (bus);
+    }
+
+  if (keep)
+    printf ("MC's accounts and log are in %s\n", tmpdir);
+  else
+    rm_rf (tmpdir);
+
+  for (i = 0; i < N_OPS; i++)
+    g_array_unref (stats[i].latencies);
+
+  g_ptr_array_unref (account_paths);
+  g_rand_free (rand_);
+  g_main_loop_unref (loop);
+  g_strfreev (env);
+  g_free (tmpdir);
+  return ret;
+}
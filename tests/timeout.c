@@ -0,0 +1,149 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Regression test for MC's coalescing timers
+ *
+ * Copyright © 2014 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "mcd-timeout.h"
+
+#define N_TIMERS 5
+
+typedef struct {
+    GMainLoop *loop;
+    /* how many timer functions have been called */
+    guint run;
+    /* quit the loop when run reaches this */
+    guint expected;
+    /* a timer for the first function called to remove, or 0 */
+    guint victim;
+    guint64 wakeups;
+    guint64 timeouts_run;
+} Fixture;
+
+static void
+setup (Fixture *f,
+       gconstpointer data G_GNUC_UNUSED)
+{
+    f->loop = g_main_loop_new (NULL, FALSE);
+    mcd_timeout_get_stats (NULL, &f->wakeups, &f->timeouts_run);
+}
+
+static void
+teardown (Fixture *f,
+          gconstpointer data G_GNUC_UNUSED)
+{
+    g_main_loop_unref (f->loop);
+}
+
+static gboolean
+count_cb (gpointer data)
+{
+    Fixture *f = data;
+
+    if (f->victim != 0)
+    {
+        g_assert (mcd_timeout_remove (f->victim));
+        f->victim = 0;
+    }
+
+    if (++f->run == f->expected)
+        g_main_loop_quit (f->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Return how many times the process was woken up, and check that each
+ * timer function was called once */
+static guint64
+run_until_done (Fixture *f)
+{
+    guint64 wakeups;
+    guint64 timeouts_run;
+
+    g_main_loop_run (f->loop);
+    mcd_timeout_get_stats (NULL, &wakeups, &timeouts_run);
+
+    g_assert_cmpuint (f->run, ==, f->expected);
+    g_assert_cmpuint (timeouts_run - f->timeouts_run, ==, f->expected);
+    return wakeups - f->wakeups;
+}
+
+static void
+test_coalesce (Fixture *f,
+               gconstpointer data G_GNUC_UNUSED)
+{
+    guint i;
+
+    /* armed together, each may wait for the others' slack, so they all
+     * run in the wakeup for the first one's latest time */
+    for (i = 0; i < N_TIMERS; i++)
+        mcd_timeout_add_full (50, 50, count_cb, f, NULL);
+
+    f->expected = N_TIMERS;
+    g_assert_cmpuint (run_until_done (f), ==, 1);
+}
+
+static void
+test_separate (Fixture *f,
+               gconstpointer data G_GNUC_UNUSED)
+{
+    /* the second can't run early, and the first can't wait for it */
+    mcd_timeout_add_full (10, 0, count_cb, f, NULL);
+    mcd_timeout_add_full (200, 0, count_cb, f, NULL);
+
+    f->expected = 2;
+    g_assert_cmpuint (run_until_done (f), ==, 2);
+}
+
+static void
+test_remove (Fixture *f,
+             gconstpointer data G_GNUC_UNUSED)
+{
+    /* the first timer removes the second, which was due in the same
+     * wakeup, so it is never called */
+    mcd_timeout_add_full (50, 50, count_cb, f, NULL);
+    f->victim = mcd_timeout_add_full (60, 50, count_cb, f, NULL);
+    mcd_timeout_add_full (70, 50, count_cb, f, NULL);
+
+    f->expected = 2;
+    g_assert_cmpuint (run_until_done (f), ==, 1);
+    g_assert_cmpuint (f->victim, ==, 0);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/timeout/coalesce", Fixture, NULL, setup, test_coalesce,
+        teardown);
+    g_test_add ("/timeout/separate", Fixture, NULL, setup, test_separate,
+        teardown);
+    g_test_add ("/timeout/remove", Fixture, NULL, setup, test_remove,
+        teardown);
+
+    return g_test_run ();
+}
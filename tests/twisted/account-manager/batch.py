@@ -0,0 +1,86 @@
+# vim: set fileencoding=utf-8 :
+# Copyright © 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import dbus
+
+from servicetest import call_async, assertEquals, assertContains
+from mctest import exec_test, SimulatedConnectionManager
+import constants as cs
+
+def test(q, bus, mc):
+    simulated_cm = SimulatedConnectionManager(q, bus)
+    account_manager = bus.get_object(cs.AM, cs.AM_PATH)
+    am_props = account_manager.GetAll(cs.AM,
+            dbus_interface=cs.PROPERTIES_IFACE)
+    assertContains(cs.AM_IFACE_BATCH, am_props['Interfaces'])
+
+    am_batch = dbus.Interface(account_manager, cs.AM_IFACE_BATCH)
+
+    good = dbus.Dictionary({"account": "batch@example.com",
+        "password": "secrecy"}, signature='sv')
+    # a parameter that fakeprotocol does not have
+    bad = dbus.Dictionary({"account": "oops@example.com",
+        "password": "secrecy", "no-such-param": 42}, signature='sv')
+
+    call_async(q, am_batch, 'CreateAccounts', dbus.Array([
+            ('fakecm', 'fakeprotocol', 'One', good, {}),
+            ('fakecm', 'fakeprotocol', 'Two', bad, {}),
+            ('fakecm', 'fakeprotocol', 'Three', good,
+                {cs.ACCOUNT + '.Enabled': False}),
+        ], signature='(sssa{sv}a{sv})'))
+
+    results = q.expect('dbus-return', method='CreateAccounts').value[0]
+    assertEquals(3, len(results))
+
+    path1, error1, _ = results[0]
+    assert path1.startswith(cs.ACCOUNT_PATH_PREFIX), path1
+    assertEquals('', error1)
+
+    path2, error2, _ = results[1]
+    assertEquals('/', path2)
+    assertEquals(cs.INVALID_ARGUMENT, error2)
+
+    path3, error3, _ = results[2]
+    assert path3.startswith(cs.ACCOUNT_PATH_PREFIX), path3
+    assertEquals('', error3)
+    assert path1 != path3
+
+    call_async(q, am_batch, 'UpdateAccounts', dbus.Array([
+            (path1, {'password': 'new secret'}, []),
+            (cs.ACCOUNT_PATH_PREFIX + 'fakecm/fakeprotocol/nope', {}, []),
+            (path3, {}, ['password']),
+        ], signature='(oa{sv}as)'))
+
+    results = q.expect('dbus-return', method='UpdateAccounts').value[0]
+    assertEquals(3, len(results))
+    assertEquals('', results[0][1])
+    assertEquals(cs.INVALID_ARGUMENT, results[1][1])
+    assertEquals('', results[2][1])
+
+    account1 = bus.get_object(cs.AM, path1)
+    params = account1.Get(cs.ACCOUNT, 'Parameters',
+            dbus_interface=cs.PROPERTIES_IFACE)
+    assertEquals('new secret', params['password'])
+
+    account3 = bus.get_object(cs.AM, path3)
+    params = account3.Get(cs.ACCOUNT, 'Parameters',
+            dbus_interface=cs.PROPERTIES_IFACE)
+    assert 'password' not in params, params
+
+if __name__ == '__main__':
+    exec_test(test, {})
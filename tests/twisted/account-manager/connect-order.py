@@ -0,0 +1,81 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that accounts are connected at startup in order of
+ConnectionPriority, then of LastUsed, one at a time.
+"""
+
+import dbus
+
+from servicetest import assertEquals
+from mctest import (exec_test, set_mc_environment,
+    SimulatedConnectionManager, MC)
+import constants as cs
+
+# unique name => (ConnectionPriority, LastUsed); the expected order is
+# the opposite of the alphabetical order that MC falls back to
+ACCOUNTS = {
+    'fakecm/fakeprotocol/alice_40example_2ecom': (0, 1000),
+    'fakecm/fakeprotocol/bob_40example_2ecom': (0, 2000),
+    'fakecm/fakeprotocol/carol_40example_2ecom': (5, 0),
+    }
+
+def preseed(fake_accounts_service):
+    for account_id, (priority, last_used) in ACCOUNTS.items():
+        address = account_id.split('/')[-1].replace('_40', '@').replace(
+                '_2e', '.')
+
+        fake_accounts_service.update_attributes(account_id, changed={
+            'manager': 'fakecm',
+            'protocol': 'fakeprotocol',
+            'DisplayName': address,
+            'Enabled': True,
+            'ConnectAutomatically': True,
+            'AutomaticPresence': dbus.Struct(
+                (dbus.UInt32(cs.PRESENCE_AVAILABLE), 'available', ''),
+                signature='uss'),
+            'ConnectionPriority': dbus.Int32(priority),
+            'LastUsed': dbus.Int64(last_used),
+            })
+        fake_accounts_service.update_parameters(account_id, changed={
+            'account': address,
+            'password': 'secrecy',
+            })
+
+def test(q, bus, unused, **kwargs):
+    simulated_cm = SimulatedConnectionManager(q, bus)
+    preseed(kwargs['fake_accounts_service'])
+
+    # run-test.sh connects every account in the same main loop iteration;
+    # check the spaced-out order that users get
+    set_mc_environment(bus, MC_ACCOUNT_CONNECT_INTERVAL='100')
+
+    mc = MC(q, bus)
+
+    order = []
+
+    for i in range(len(ACCOUNTS)):
+        e = q.expect('dbus-method-call', method='RequestConnection',
+                interface=cs.CM, handled=False)
+        order.append(e.args[1]['account'])
+
+    assertEquals(['carol@example.com', 'bob@example.com',
+        'alice@example.com'], order)
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False, use_fake_accounts_service=True,
+            pass_kwargs=True)
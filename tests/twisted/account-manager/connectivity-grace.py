@@ -0,0 +1,189 @@
+# vim: set fileencoding=utf-8 :
+# Copyright © 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that brief network drops are ridden out rather than causing a
+reconnection, without delaying the disconnection before a suspend.
+run-test.sh turns the grace period and settling time off, so this test
+turns them back on."""
+
+import os
+import select
+import time
+
+import dbus
+import dbus.service
+
+from twisted.internet import reactor
+
+from servicetest import EventPattern, sync_dbus, assertEquals
+from mctest import (
+    exec_test, set_mc_environment, create_fakecm_account,
+    enable_fakecm_account, expect_fakecm_connection, MC,
+)
+from connectivity import sync_connectivity_state
+import constants as cs
+
+# milliseconds, as in $MC_CONNECTIVITY_OFFLINE_GRACE etc.
+OFFLINE_GRACE = 2000
+ONLINE_SETTLE = 1000
+
+LOGIN1 = 'org.freedesktop.login1'
+LOGIN1_PATH = '/org/freedesktop/login1'
+LOGIN1_MANAGER = 'org.freedesktop.login1.Manager'
+
+class SimulatedLogin1(object):
+    """Just enough of logind to delay suspend; our bus is also MC's
+    system bus"""
+
+    def __init__(self, q, bus):
+        self.q = q
+        self._name_ref = dbus.service.BusName(LOGIN1, bus)
+        # our end of a pipe whose other end MC holds while it delays sleep
+        self.inhibitor = None
+
+        q.add_dbus_method_impl(self.Inhibit, path=LOGIN1_PATH,
+                interface=LOGIN1_MANAGER, method='Inhibit')
+
+    def Inhibit(self, e):
+        r, w = os.pipe()
+        fd = dbus.types.UnixFd(w)
+        os.close(w)
+
+        if self.inhibitor is not None:
+            os.close(self.inhibitor)
+
+        self.inhibitor = r
+        self.q.dbus_return(e.message, fd, signature='h')
+
+    def inhibited(self):
+        """True if MC has not closed its end of the pipe yet"""
+        readable, _, _ = select.select([self.inhibitor], [], [], 0)
+        return not readable
+
+    def prepare_for_sleep(self, sleeping):
+        self.q.dbus_emit(LOGIN1_PATH, LOGIN1_MANAGER, 'PrepareForSleep',
+                sleeping, signature='b')
+
+def run_for(seconds):
+    """Let MC's timers run while we process D-Bus traffic"""
+    deadline = time.time() + seconds
+
+    while time.time() < deadline:
+        reactor.iterate(0.01)
+
+def test(q, bus, unused):
+    set_mc_environment(bus,
+            MC_CONNECTIVITY_OFFLINE_GRACE=str(OFFLINE_GRACE),
+            MC_CONNECTIVITY_ONLINE_SETTLE=str(ONLINE_SETTLE))
+    login1 = SimulatedLogin1(q, bus)
+
+    # Connections in here have their Disconnect calls intercepted, to check
+    # that MC still delays sleep at the time, before they reply and so let
+    # MC stop delaying it
+    connections = {}
+    inhibited_at_disconnect = []
+
+    def disconnect(e):
+        inhibited_at_disconnect.append(login1.inhibited())
+        connections[e.path].Disconnect(e)
+
+    q.add_dbus_method_impl(disconnect, interface=cs.CONN,
+            method='Disconnect', predicate=lambda e: e.path in connections)
+
+    mc = MC(q, bus)
+
+    params = dbus.Dictionary({"account": "someone@example.com",
+        "password": "secrecy"}, signature='sv')
+    (simulated_cm, account) = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    reconnection = [
+        EventPattern('dbus-method-call', method='Disconnect'),
+        EventPattern('dbus-method-call', method='RequestConnection'),
+    ]
+    q.forbid_events(reconnection)
+
+    # A drop that is shorter than the grace period goes unnoticed, even
+    # once the grace period would have run out
+    mc.connectivity.go_offline()
+    sync_connectivity_state(mc)
+    mc.connectivity.go_online()
+    sync_connectivity_state(mc)
+
+    run_for(OFFLINE_GRACE / 1000.0 + 0.5)
+    sync_dbus(bus, q, mc)
+
+    assertEquals(cs.CONN_STATUS_CONNECTED,
+            account.Properties.Get(cs.ACCOUNT, 'ConnectionStatus'))
+    assertEquals(conn.object_path,
+            account.Properties.Get(cs.ACCOUNT, 'Connection'))
+
+    # A longer one disconnects the account, but only when the grace period
+    # has run out
+    mc.connectivity.go_offline()
+    sync_connectivity_state(mc)
+    run_for(OFFLINE_GRACE / 2000.0)
+    sync_dbus(bus, q, mc)
+
+    q.unforbid_events(reconnection)
+    q.expect('dbus-method-call', method='Disconnect', path=conn.object_path,
+            handled=True)
+
+    # The account is not reconnected until the network has been back for
+    # the settling time
+    q.forbid_events(reconnection)
+    mc.connectivity.go_online()
+    sync_connectivity_state(mc)
+    run_for(ONLINE_SETTLE / 2000.0)
+    sync_dbus(bus, q, mc)
+
+    q.unforbid_events(reconnection)
+    conn = expect_fakecm_connection(q, bus, mc, account, params)
+    connections[conn.object_path] = conn
+
+    sync_dbus(bus, q, mc)
+    assert login1.inhibitor is not None
+    assert login1.inhibited()
+
+    # If we are about to suspend while waiting out the grace period, the
+    # account is disconnected straight away, and only then does MC let the
+    # suspend go ahead
+    mc.connectivity.go_offline()
+    sync_connectivity_state(mc)
+    login1.prepare_for_sleep(True)
+
+    q.expect('dbus-method-call', method='Disconnect', path=conn.object_path,
+            handled=True)
+    assertEquals([True], inhibited_at_disconnect)
+
+    deadline = time.time() + OFFLINE_GRACE / 2000.0
+
+    while login1.inhibited():
+        assert time.time() < deadline, 'suspend still delayed'
+        reactor.iterate(0.01)
+
+    # On resume, MC delays the next suspend, and reconnects once the
+    # network is back
+    login1.prepare_for_sleep(False)
+    q.expect('dbus-method-call', path=LOGIN1_PATH, interface=LOGIN1_MANAGER,
+            method='Inhibit')
+    mc.connectivity.go_online()
+    expect_fakecm_connection(q, bus, mc, account, params)
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=10, preload_mc=False)
@@ -0,0 +1,128 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test GetDebugLevels and SetDebugLevel on MC's private Debug interface,
+and that they control what is sent to the Telepathy Debug interface.
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async, sync_dbus, assertEquals
+from mctest import (exec_test, create_fakecm_account, tell_mc_to_die,
+        set_mc_environment, resuscitate_mc, Account)
+import constants as cs
+
+MC_DEBUG_IFACE = 'org.freedesktop.Telepathy.MissionControl5.Debug.DRAFT'
+
+CATEGORIES = ['misc', 'trees', 'dispatch', 'storage', 'connection',
+        'account', 'client-registry', 'connectivity', 'plugins']
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    (simulated_cm, account) = create_fakecm_account(q, bus, mc, params)
+
+    debug = bus.get_object(cs.AM, cs.DEBUG_PATH)
+    mc_debug = dbus.Interface(debug, MC_DEBUG_IFACE)
+
+    # run-test.sh sets MC_DEBUG=all, which is the highest level
+    levels = mc_debug.GetDebugLevels()
+    assertEquals(sorted(CATEGORIES), sorted(levels.keys()))
+
+    for category in CATEGORIES:
+        assertEquals(2, levels[category])
+
+    # Changing one category leaves the others alone
+    mc_debug.SetDebugLevel('account', 0)
+    levels['account'] = 0
+    assertEquals(levels, mc_debug.GetDebugLevels())
+
+    call_async(q, mc_debug, 'SetDebugLevel', 'no-such-category', 1)
+    q.expect('dbus-error', method='SetDebugLevel', name=cs.INVALID_ARGUMENT)
+
+    call_async(q, mc_debug, 'SetDebugLevel', 'dispatch', 3)
+    q.expect('dbus-error', method='SetDebugLevel', name=cs.INVALID_ARGUMENT)
+    assertEquals(levels, mc_debug.GetDebugLevels())
+
+    # Messages from each category go to the Telepathy Debug interface with
+    # a domain of their own, unless the category is turned off
+    debug.Set(cs.DEBUG_IFACE, 'Enabled', True,
+            dbus_interface=cs.PROPERTIES_IFACE)
+
+    account_messages = [EventPattern('dbus-signal', path=cs.DEBUG_PATH,
+        signal='NewDebugMessage',
+        predicate=lambda e: e.args[1] == 'mcd/account')]
+    q.forbid_events(account_messages)
+
+    account.Properties.Set(cs.ACCOUNT, 'Nickname', 'Ezio')
+    q.expect('dbus-signal', path=account.object_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT)
+    sync_dbus(bus, q, mc)
+
+    q.unforbid_events(account_messages)
+    mc_debug.SetDebugLevel('account', 1)
+    assertEquals(1, mc_debug.GetDebugLevels()['account'])
+
+    account.Properties.Set(cs.ACCOUNT, 'Nickname', 'Il Mentore')
+    q.expect('dbus-signal', path=cs.DEBUG_PATH, signal='NewDebugMessage',
+            predicate=lambda e: e.args[1] == 'mcd/account')
+
+    debug.Set(cs.DEBUG_IFACE, 'Enabled', False,
+            dbus_interface=cs.PROPERTIES_IFACE)
+    mc_debug.SetDebugLevel('account', 2)
+
+    # Plugins' messages (here, from the account storage wrappers) follow
+    # the "plugins" category and nothing else: MC_DEBUG=plugins turns them
+    # on, and a high level for some other category does not
+    plugin_messages = [EventPattern('dbus-signal', path=cs.DEBUG_PATH,
+        signal='NewDebugMessage',
+        predicate=lambda e: e.args[1] == 'mc-plugins')]
+
+    for mc_debug_str, plugins_level in (('plugins', 1), ('dispatch=2', 0)):
+        tell_mc_to_die(q, bus)
+        set_mc_environment(bus, MC_DEBUG=mc_debug_str)
+        resuscitate_mc(q, bus, mc)
+
+        debug = bus.get_object(cs.AM, cs.DEBUG_PATH)
+        mc_debug = dbus.Interface(debug, MC_DEBUG_IFACE)
+        account = Account(bus, account.object_path)
+
+        assertEquals(plugins_level, mc_debug.GetDebugLevels()['plugins'])
+        debug.Set(cs.DEBUG_IFACE, 'Enabled', True,
+                dbus_interface=cs.PROPERTIES_IFACE)
+
+        if plugins_level == 0:
+            q.forbid_events(plugin_messages)
+            account.Properties.Set(cs.ACCOUNT, 'Nickname',
+                    'Quiet %s' % mc_debug_str)
+            q.expect('dbus-signal', path=account.object_path,
+                    signal='AccountPropertyChanged', interface=cs.ACCOUNT)
+            sync_dbus(bus, q, mc)
+            q.unforbid_events(plugin_messages)
+
+            mc_debug.SetDebugLevel('plugins', 1)
+
+        account.Properties.Set(cs.ACCOUNT, 'Nickname',
+                'Loud %s' % mc_debug_str)
+        q.expect('dbus-signal', path=cs.DEBUG_PATH, signal='NewDebugMessage',
+                predicate=lambda e: e.args[1] == 'mc-plugins')
+
+        debug.Set(cs.DEBUG_IFACE, 'Enabled', False,
+                dbus_interface=cs.PROPERTIES_IFACE)
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,108 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that logind's IdleHint makes MC idle, and that account changes made
+while idle are only written to storage when the device becomes active."""
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern, assertEquals, sync_dbus
+from mctest import (exec_test, create_fakecm_account, enable_fakecm_account,
+    read_account_keyfile)
+import constants as cs
+
+# Fake logind constants, cloned from mcd-slacker.c
+SERVICE_NAME = "org.freedesktop.login1"
+SESSION_PATH = "/org/freedesktop/login1/session/auto"
+SESSION_INTERFACE = "org.freedesktop.login1.Session"
+PROP_NAME = "IdleHint"
+
+class SimulatedLogind(object):
+    def __init__(self, q, bus, idle=False):
+        self.bus = bus
+        self.q = q
+        self.idle = idle
+        self._name_ref = dbus.service.BusName(SERVICE_NAME, bus)
+
+        self.q.add_dbus_method_impl(self.GetAll,
+                path=SESSION_PATH,
+                interface=cs.PROPERTIES_IFACE, method='GetAll')
+
+    def GetAll(self, e):
+        ret = dbus.Dictionary({}, signature='sv')
+
+        if e.args[0] == SESSION_INTERFACE:
+            ret[PROP_NAME] = dbus.Boolean(self.idle)
+
+        self.q.dbus_return(e.message, ret, signature='a{sv}')
+
+    def set_idle(self, idle):
+        self.idle = idle
+        self.q.dbus_emit(SESSION_PATH, cs.PROPERTIES_IFACE,
+                'PropertiesChanged', SESSION_INTERFACE,
+                dbus.Dictionary({PROP_NAME: dbus.Boolean(idle)},
+                    signature='sv'),
+                dbus.Array([], signature='s'),
+                signature='sa{sv}as')
+
+    def release_name(self):
+        del self._name_ref
+
+def test(q, bus, mc):
+    logind = SimulatedLogind(q, bus, False)
+
+    params = dbus.Dictionary({"account": "idler@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params,
+            extra_interfaces=[cs.CONN_IFACE_POWER_SAVING])
+
+    if isinstance(conn, tuple):
+        conn = conn[0]
+
+    group = account.object_path[len(cs.ACCOUNT_PATH_PREFIX):]
+
+    logind.set_idle(True)
+    q.expect('dbus-method-call', method='SetPowerSaving', args=[True],
+            interface=cs.CONN_IFACE_POWER_SAVING, path=conn.object_path)
+
+    # While we are idle, the change is visible on D-Bus but is not written
+    # out yet
+    account.Properties.Set(cs.ACCOUNT, 'Nickname', 'Sleepy')
+    assertEquals('Sleepy',
+            account.Properties.Get(cs.ACCOUNT, 'Nickname'))
+    sync_dbus(bus, q, account)
+    kf = read_account_keyfile()
+    assert kf[group].get('Nickname') != 'Sleepy', kf[group]
+
+    # When we become active again, deferred work is done before connections
+    # are told to stop saving power
+    logind.set_idle(False)
+    q.expect('dbus-method-call', method='SetPowerSaving', args=[False],
+            interface=cs.CONN_IFACE_POWER_SAVING, path=conn.object_path)
+    kf = read_account_keyfile()
+    assertEquals('Sleepy', kf[group]['Nickname'])
+
+    account.Properties.Set(cs.ACCOUNT, 'Enabled', False)
+    q.expect('dbus-method-call', method='Disconnect',
+            path=conn.object_path, handled=True)
+
+    logind.release_name()
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,87 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test accounts that are not materialized until they are needed."""
+
+from servicetest import assertEquals
+from mctest import (exec_test, set_mc_environment,
+    SimulatedConnectionManager, AccountManager, Account, MC)
+import constants as cs
+
+dormant_id = 'fakecm/fakeprotocol/dormant_40example_2ecom'
+broken_id = 'fakecm/fakeprotocol/broken_40example_2ecom'
+dormant_path = cs.ACCOUNT_PATH_PREFIX + dormant_id
+broken_path = cs.ACCOUNT_PATH_PREFIX + broken_id
+
+def preseed(fake_accounts_service):
+    for account_id, params in (
+            (dormant_id, {'account': 'dormant@example.com',
+                'password': 'secrecy'}),
+            # fakeprotocol requires a password, so this account is invalid
+            (broken_id, {'account': 'broken@example.com'}),
+            ):
+        fake_accounts_service.update_attributes(account_id, changed={
+            'manager': 'fakecm',
+            'protocol': 'fakeprotocol',
+            'DisplayName': params['account'],
+            'Enabled': False,
+            })
+        fake_accounts_service.update_parameters(account_id, changed=params)
+
+def test(q, bus, unused, **kwargs):
+    simulated_cm = SimulatedConnectionManager(q, bus)
+    fake_accounts_service = kwargs['fake_accounts_service']
+    preseed(fake_accounts_service)
+
+    # leave every account that can wait as a stub
+    set_mc_environment(bus, MC_LAZY_ACCOUNTS_THRESHOLD='0')
+    mc = MC(q, bus)
+
+    # Stubs are listed as valid, because they were when they were stored
+    am = AccountManager(bus)
+    props = am.Properties.GetAll(cs.AM)
+    assertEquals(sorted([dormant_path, broken_path]),
+            sorted(props['ValidAccounts']))
+    assertEquals([], props['InvalidAccounts'])
+
+    # The storage backend telling MC about a change looks the account up,
+    # which creates the real account so that it can signal the change
+    fake_accounts_service.update_attributes(dormant_id,
+            changed={'Enabled': True})
+    q.expect('dbus-signal', path=dormant_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e: e.args[0].get('Enabled') == True)
+
+    account = Account(bus, dormant_path)
+    assertEquals(True, account.Properties.Get(cs.ACCOUNT, 'Enabled'))
+
+    # A stub that turns out to be invalid when a method call materializes it
+    # leaves ValidAccounts, noisily
+    account = Account(bus, broken_path)
+    assertEquals('broken@example.com',
+            account.Properties.Get(cs.ACCOUNT, 'DisplayName'))
+    q.expect('dbus-signal', path=cs.AM_PATH,
+            signal='AccountValidityChanged', args=[broken_path, False])
+
+    assertEquals(False, account.Properties.Get(cs.ACCOUNT, 'Valid'))
+    props = am.Properties.GetAll(cs.AM)
+    assertEquals([dormant_path], props['ValidAccounts'])
+    assertEquals([broken_path], props['InvalidAccounts'])
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False, use_fake_accounts_service=True,
+            pass_kwargs=True)
@@ -0,0 +1,108 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test mc-tool's batch mode and JSON output."""
+
+import json
+import os
+import subprocess
+
+import dbus
+
+from twisted.internet import reactor
+
+from servicetest import assertEquals, assertContains
+from mctest import exec_test, create_fakecm_account
+import constants as cs
+
+def mc_tool(args, stdin=''):
+    """Run mc-tool, servicing D-Bus while it runs: MC calls back into
+    the fake accounts service in this process."""
+    p = subprocess.Popen([os.environ['MC_TOOL']] + args,
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE)
+    p.stdin.write(stdin)
+    p.stdin.close()
+
+    while p.poll() is None:
+        reactor.iterate(0.01)
+
+    return p.returncode, p.stdout.read(), p.stderr.read()
+
+def json_lines(stdout):
+    return [json.loads(line) for line in stdout.splitlines()]
+
+def test(q, bus, mc):
+    simulated_cm = None
+    names = []
+
+    for address in ('ezio@example.com', 'ezia@example.com'):
+        params = dbus.Dictionary({"account": address,
+            "password": "secrecy"}, signature='sv')
+        simulated_cm, account = create_fakecm_account(q, bus, mc, params,
+                simulated_cm=simulated_cm)
+        names.append(account.object_path[len(cs.ACCOUNT_PATH_PREFIX):])
+
+    names.sort()
+
+    # One object per account, in order
+    ret, out, err = mc_tool(['--json', 'list'])
+    assertEquals(0, ret)
+    assertEquals([{'Account': name} for name in names], json_lines(out))
+
+    ret, out, err = mc_tool(['--json', 'summary'])
+    assertEquals(0, ret)
+    summary = json_lines(out)
+    assertEquals(names, [o['Account'] for o in summary])
+
+    for o in summary:
+        assertEquals(False, o['Enabled'])
+        assertEquals(3, len(o['RequestedPresence']))
+
+    # A bad command is reported with its line number, but does not stop
+    # the commands after it
+    ret, out, err = mc_tool(['batch'], stdin='\n'.join([
+        '# set the names',
+        '',
+        'display %s "Ezio Auditore"' % names[0],
+        'frobnicate %s' % names[0],
+        "nick %s 'Il Mentore'" % names[0],
+        '']))
+    assertEquals(1, ret)
+    assertContains('line 4', err)
+
+    ret, out, err = mc_tool(['--json', 'show', names[0]])
+    assertEquals(0, ret)
+    [shown] = json_lines(out)
+    assertEquals(names[0], shown['Account'])
+    assertEquals('Ezio Auditore', shown['DisplayName'])
+    assertEquals('Il Mentore', shown['Nickname'])
+
+    # Every command in the batch runs on the same connection, and --json
+    # applies to each of them
+    ret, out, err = mc_tool(['--json', 'batch'], stdin='\n'.join([
+        'display %s Ezia' % names[1],
+        'show %s' % names[1],
+        'list',
+        '']))
+    assertEquals(0, ret)
+    lines = json_lines(out)
+    assertEquals('Ezia', lines[0]['DisplayName'])
+    assertEquals([{'Account': name} for name in names], lines[1:])
+
+if __name__ == '__main__':
+    exec_test(test, {})
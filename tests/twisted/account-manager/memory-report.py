@@ -0,0 +1,65 @@
+# vim: set fileencoding=utf-8 :
+# Copyright © 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test MC's private Debug interface: the memory report and timer
+statistics. Debug levels are tested in debug-levels.py.
+"""
+
+import dbus
+
+from servicetest import assertEquals, assertContains
+from mctest import exec_test, create_fakecm_account
+import constants as cs
+
+MC_DEBUG_IFACE = 'org.freedesktop.Telepathy.MissionControl5.Debug.DRAFT'
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    (simulated_cm, account) = create_fakecm_account(q, bus, mc, params)
+
+    mc_debug = dbus.Interface(bus.get_object(cs.AM, cs.DEBUG_PATH),
+            MC_DEBUG_IFACE)
+
+    report = mc_debug.GetMemoryReport()
+
+    # the root is the McdMaster (or a subclass)
+    depth, type_name, identifier, size = report[0]
+    assertEquals(0, depth)
+    assert size > 0, report[0]
+
+    entries = {}
+    for depth, type_name, identifier, size in report:
+        assert size > 0, (type_name, identifier, size)
+        entries.setdefault(type_name, []).append((depth, identifier))
+
+    assertEquals([(1, '')], entries['McdAccountManager'])
+    assertEquals([(1, '')], entries['McdDispatcher'])
+    assertEquals([(2, '')], entries['McdClientRegistry'])
+    assertEquals([(2, '')], entries['McdHandlerMap'])
+    assertContains((2, account.object_path[len(cs.ACCOUNT_PATH_PREFIX):]),
+            entries['McdAccount'])
+
+    # each wakeup runs at least one timer; whether they are coalesced is
+    # tested deterministically in tests/timeout.c
+    per_minute, wakeups, timeouts_run = mc_debug.GetTimerStats()
+    assert per_minute <= wakeups, (per_minute, wakeups)
+    assert wakeups <= timeouts_run, (wakeups, timeouts_run)
+
+if __name__ == '__main__':
+    exec_test(test, {})
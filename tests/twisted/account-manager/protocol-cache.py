@@ -0,0 +1,61 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that a restarted MC uses the protocol descriptions it cached,
+without introspecting the connection manager, and can still connect."""
+
+import os
+import os.path
+
+import dbus
+
+from servicetest import EventPattern, assertContains
+from mctest import (exec_test, create_fakecm_account, enable_fakecm_account,
+    tell_mc_to_die, resuscitate_mc, get_fakecm_account)
+import constants as cs
+
+def test(q, bus, mc):
+    cache_name = os.path.join(os.environ['XDG_CACHE_HOME'], 'telepathy',
+            'mission-control', 'managers', 'fakecm.gvariant')
+
+    params = dbus.Dictionary({"account": "someone@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    account_path = account.object_path
+
+    # Introspecting the CM to validate the new account cached its protocols
+    assert os.path.exists(cache_name)
+
+    tell_mc_to_die(q, bus)
+
+    introspection = [EventPattern('dbus-method-call', method='GetAll',
+        path=simulated_cm.object_path, args=[cs.CM])]
+    q.forbid_events(introspection)
+
+    # The account is validated using the cache...
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    assertContains(account_path, properties['ValidAccounts'])
+
+    # ... and the CM proxy, which has not been prepared, can still be used
+    # to connect
+    account = get_fakecm_account(bus, mc, account_path)
+    enable_fakecm_account(q, bus, mc, account, params)
+
+    q.unforbid_events(introspection)
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,302 @@
+# Test for a storage plugin that implements the asynchronous API
+#
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern, call_async, assertEquals
+from mctest import (exec_test, set_mc_environment, enable_fakecm_account,
+    expect_fakecm_connection, AccountManager, Account, MC,
+    SimulatedConnectionManager)
+import constants as cs
+
+REGRESSION_TESTS = 'org.freedesktop.Telepathy.MissionControl5.RegressionTests'
+
+LOGIND = 'org.freedesktop.login1'
+LOGIND_SESSION_PATH = '/org/freedesktop/login1/session/auto'
+LOGIND_SESSION = 'org.freedesktop.login1.Session'
+
+class SimulatedLogind(object):
+    """Just enough of logind to make MC think the device is idle"""
+
+    def __init__(self, q, bus):
+        self.q = q
+        self.idle = False
+        self._name_ref = dbus.service.BusName(LOGIND, bus)
+
+        q.add_dbus_method_impl(self.GetAll, path=LOGIND_SESSION_PATH,
+                interface=cs.PROPERTIES_IFACE, method='GetAll')
+
+    def GetAll(self, e):
+        ret = dbus.Dictionary({}, signature='sv')
+
+        if e.args[0] == LOGIND_SESSION:
+            ret['IdleHint'] = dbus.Boolean(self.idle)
+
+        self.q.dbus_return(e.message, ret, signature='a{sv}')
+
+    def set_idle(self, idle):
+        self.idle = idle
+        self.q.dbus_emit(LOGIND_SESSION_PATH, cs.PROPERTIES_IFACE,
+                'PropertiesChanged', LOGIND_SESSION,
+                dbus.Dictionary({'IdleHint': dbus.Boolean(idle)},
+                    signature='sv'),
+                dbus.Array([], signature='s'),
+                signature='sa{sv}as')
+
+def tail_to_path(tail):
+    return cs.ACCOUNT_PATH_PREFIX + tail
+
+def create_account(fake_accounts_service, tail, display_name, address):
+    fake_accounts_service.create_account(tail,
+            {'Enabled': False,
+                'manager': 'fakecm',
+                'protocol': 'fakeprotocol',
+                'DisplayName': display_name},
+            {}, # attr flags
+            {'account': address, 'password': 'nothing is true'},
+            {}, # untyped parameters
+            {'password': cs.PARAM_SECRET}) # param flags
+
+def fetching(tail):
+    return [
+        EventPattern('dbus-signal',
+            path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='Fetching', args=[tail_to_path(tail)]),
+        EventPattern('dbus-method-call',
+            interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+            method='GetAccount', args=[tail]),
+        ]
+
+def test(q, bus, unused, **kwargs):
+    fake_accounts_service = kwargs['fake_accounts_service']
+    simulated_cm = SimulatedConnectionManager(q, bus)
+    logind = SimulatedLogind(q, bus)
+
+    ezio_tail = 'fakecm/fakeprotocol/ezio_40firenze_2efic0'
+    ezio_path = tail_to_path(ezio_tail)
+    altair_tail = 'fakecm/fakeprotocol/altair_40masyaf_2efic0'
+    malik_tail = 'fakecm/fakeprotocol/malik_40jerusalem_2efic0'
+    leonardo_tail = 'fakecm/fakeprotocol/leonardo_40firenze_2efic0'
+
+    # The plugin only implements the asynchronous API if this is set
+    set_mc_environment(bus, MC_TEST_ASYNC_ACCOUNT_PLUGIN='1')
+
+    create_account(fake_accounts_service, ezio_tail, 'Ezio',
+            'ezio@firenze.fic')
+
+    # MC does not wait for the accounts to be fetched before it claims its
+    # names
+    fake_accounts_service.hold_get_account()
+    mc = MC(q, bus, wait_for_names=False)
+    mc.wait_for_names(
+            EventPattern('dbus-signal',
+                path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH, signal='Listing'),
+            EventPattern('dbus-method-call',
+                interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                method='GetAccounts'),
+            *fetching(ezio_tail))
+
+    am = AccountManager(bus)
+    assertEquals([], am.Properties.Get(cs.AM, 'ValidAccounts'))
+
+    # The account appears when it has been fetched
+    fake_accounts_service.release_get_account()
+    q.expect('dbus-signal', path=cs.AM_PATH,
+            signal='AccountValidityChanged', args=[ezio_path, True])
+    account = Account(bus, ezio_path)
+    assertEquals('Ezio', account.Properties.Get(cs.ACCOUNT, 'DisplayName'))
+
+    # An account created by the plugin is also fetched before it appears
+    create_account(fake_accounts_service, altair_tail, 'Altair',
+            'altair@masyaf.fic')
+    q.expect_many(*(fetching(altair_tail) + [
+        EventPattern('dbus-signal', path=cs.AM_PATH,
+            signal='AccountValidityChanged',
+            args=[tail_to_path(altair_tail), True]),
+        ]))
+    assertEquals('Altair', Account(bus, tail_to_path(altair_tail)
+        ).Properties.Get(cs.ACCOUNT, 'DisplayName'))
+
+    # An alteration is signalled when the account has been fetched again.
+    # If it is altered again while it is being fetched, the result is out of
+    # date, so MC fetches it again before signalling anything.
+    fake_accounts_service.hold_get_account()
+    fake_accounts_service.update_attributes(ezio_tail,
+            {'Nickname': 'Ezio'})
+    q.expect_many(*(fetching(ezio_tail) + [
+        EventPattern('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='AttributeChanged', args=[ezio_path, 'Nickname']),
+        ]))
+
+    refetch = fetching(ezio_tail)
+    q.forbid_events(refetch)
+    fake_accounts_service.update_attributes(ezio_tail,
+            {'DisplayName': 'Ezio Auditore'})
+    q.expect('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='AttributeChanged', args=[ezio_path, 'DisplayName'])
+    q.unforbid_events(refetch)
+
+    fake_accounts_service.release_get_account()
+    q.expect_many(*(fetching(ezio_tail) + [
+        EventPattern('dbus-signal', path=ezio_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e: e.args[0].get('Nickname') == 'Ezio'),
+        EventPattern('dbus-signal', path=ezio_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e:
+                e.args[0].get('DisplayName') == 'Ezio Auditore'),
+        ]))
+
+    # A fetch that crosses a change made by MC does not undo it: the
+    # result of this fetch predates the new nickname
+    fake_accounts_service.hold_get_account()
+    fake_accounts_service.update_attributes(ezio_tail,
+            {'DisplayName': 'Ezio da Firenze'})
+    q.expect_many(*fetching(ezio_tail))
+
+    reverted = [EventPattern('dbus-signal', path=ezio_path,
+        signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+        predicate=lambda e: e.args[0].get('Nickname') == 'Ezio')]
+    q.forbid_events(reverted)
+
+    call_async(q, account.Properties, 'Set', cs.ACCOUNT, 'Nickname',
+            'Il Mentore')
+    q.expect_many(
+            EventPattern('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+                signal='SettingAsync', args=[ezio_path, ['Nickname'], []]),
+            EventPattern('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+                signal='CommittingOne', args=[ezio_path]),
+            EventPattern('dbus-method-call',
+                interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                method='UpdateAttributes',
+                args=[ezio_tail, {'Nickname': 'Il Mentore'},
+                    {'Nickname': 0}, []]),
+            EventPattern('dbus-return', method='Set'),
+            )
+
+    fake_accounts_service.release_get_account()
+    q.expect('dbus-signal', path=ezio_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e:
+                e.args[0].get('DisplayName') == 'Ezio da Firenze')
+    assertEquals('Il Mentore',
+            account.Properties.Get(cs.ACCOUNT, 'Nickname'))
+
+    # Several changes in one commit are passed to the plugin together
+    settings = [EventPattern('dbus-signal',
+        path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH, signal='SettingAsync')]
+    call_async(q, account, 'UpdateParameters',
+            {'nickname': 'Ezio', 'register': False}, [],
+            dbus_interface=cs.ACCOUNT)
+    e = q.expect('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='SettingAsync')
+    assertEquals(ezio_path, e.args[0])
+    assertEquals([], e.args[1])
+    assertEquals(set(['nickname', 'register']), set(e.args[2]))
+
+    q.forbid_events(settings)
+    q.expect_many(
+            EventPattern('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+                signal='CommittingOne', args=[ezio_path]),
+            EventPattern('dbus-method-call',
+                interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                method='UpdateParameters',
+                predicate=lambda e: e.args[0] == ezio_tail and
+                    e.args[1] == {'nickname': 'Ezio', 'register': False}),
+            EventPattern('dbus-return', method='UpdateParameters'),
+            )
+    q.unforbid_events(settings)
+    q.unforbid_events(reverted)
+
+    # A reconnection is signalled when the new parameters have been fetched
+    params = {'account': 'ezio@firenze.fic', 'password': 'nothing is true',
+            'nickname': 'Ezio', 'register': False}
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    fake_accounts_service.update_parameters(ezio_tail,
+            {'password': 'requiescat in pace'})
+    fake_accounts_service.reconnect_account(ezio_tail)
+    q.expect_many(*(fetching(ezio_tail) + [
+        EventPattern('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='Reconnected', args=[ezio_path]),
+        EventPattern('dbus-method-call', method='Disconnect',
+            path=conn.object_path, handled=True),
+        ]))
+
+    params['password'] = 'requiescat in pace'
+    expect_fakecm_connection(q, bus, mc, account, params)
+
+    # An account that is deleted while it is being fetched never appears,
+    # even though the fetch succeeds
+    fake_accounts_service.hold_get_account()
+    create_account(fake_accounts_service, malik_tail, 'Malik',
+            'malik@jerusalem.fic')
+    q.expect_many(*fetching(malik_tail))
+
+    malik_appeared = [EventPattern('dbus-signal', path=cs.AM_PATH,
+        signal='AccountValidityChanged',
+        predicate=lambda e: e.args[0] == tail_to_path(malik_tail))]
+    q.forbid_events(malik_appeared)
+
+    fake_accounts_service.delete_account(malik_tail)
+    q.expect('dbus-signal', path=cs.TEST_DBUS_ACCOUNT_PLUGIN_PATH,
+            signal='AccountDeleted', args=[tail_to_path(malik_tail)])
+    fake_accounts_service.release_get_account()
+
+    # MC has dealt with the reply by the time it has fetched an account
+    # created afterwards
+    create_account(fake_accounts_service, leonardo_tail, 'Leonardo',
+            'leonardo@firenze.fic')
+    q.expect('dbus-signal', path=cs.AM_PATH,
+            signal='AccountValidityChanged',
+            args=[tail_to_path(leonardo_tail), True])
+
+    props = am.Properties.GetAll(cs.AM)
+    assert tail_to_path(malik_tail) not in props['ValidAccounts']
+    assert tail_to_path(malik_tail) not in props['InvalidAccounts']
+    q.unforbid_events(malik_appeared)
+
+    # Changes made while the device is idle are not held back until it
+    # becomes active, so they still reach the plugin if MC is told to exit
+    # straight away
+    logind.set_idle(True)
+    # this also waits for MC to see the new IdleHint on the system bus
+    mc.BillyIdle(dbus_interface=REGRESSION_TESTS)
+
+    call_async(q, account.Properties, 'Set', cs.ACCOUNT, 'Nickname',
+            'Requiescat')
+    q.expect('dbus-return', method='Set')
+
+    dbus.Interface(bus.get_object(cs.AM, '/'), REGRESSION_TESTS).Abort()
+    q.expect_many(
+            EventPattern('dbus-method-call',
+                interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                method='UpdateAttributes',
+                args=[ezio_tail, {'Nickname': 'Requiescat'},
+                    {'Nickname': 0}, []]),
+            EventPattern('dbus-signal', signal='NameOwnerChanged',
+                predicate=lambda e: e.args[0] == cs.AM and e.args[2] == ''),
+            )
+    assertEquals('Requiescat',
+            fake_accounts_service.accounts[ezio_tail].attrs['Nickname'])
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False, use_fake_accounts_service=True,
+            pass_kwargs=True)
@@ -0,0 +1,101 @@
+# Test for the default storage backend noticing .account files being
+# created, changed and deleted by another process while MC is running
+#
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import os
+import os.path
+
+import dbus
+
+from servicetest import (
+    EventPattern, assertEquals,
+    )
+from mctest import (
+    exec_test, create_fakecm_account, connect_to_mc,
+    )
+import constants as cs
+
+def write_account_file(path, text):
+    # write it under a temporary name and rename it into place, as
+    # g_file_set_contents() would
+    open(path + '.tmp', 'w').write(text)
+    os.rename(path + '.tmp', path)
+
+def test(q, bus, mc):
+    variant_dir = os.path.join(os.environ['XDG_DATA_HOME'],
+            'telepathy', 'mission-control')
+    variant_file_name = os.path.join(variant_dir,
+            'fakecm-fakeprotocol-dontdivert_40example_2ecom0.account')
+    other_file_name = os.path.join(variant_dir,
+            'fakecm-fakeprotocol-ezio_40firenze_2efic0.account')
+    other_path = (cs.ACCOUNT_PATH_PREFIX +
+            'fakecm/fakeprotocol/ezio_40firenze_2efic0')
+
+    account_manager, properties, interfaces = connect_to_mc(q, bus, mc)
+
+    params = dbus.Dictionary({"account": "dontdivert@example.com",
+        "password": "secrecy"}, signature='sv')
+    (simulated_cm, account) = create_fakecm_account(q, bus, mc, params)
+    account_path = account.__dbus_object_path__
+
+    account.Properties.Set(cs.ACCOUNT, 'Nickname', 'Joe Bloggs')
+    assert os.path.exists(variant_file_name)
+    assert 'Joe Bloggs' in open(variant_file_name).read()
+
+    # Another process edits the file behind MC's back
+    write_account_file(variant_file_name,
+            "{'manager': <'fakecm'>, 'protocol': <'fakeprotocol'>, "
+            "'Nickname': <'Joseph Bloggs'>, "
+            "'Parameters': <{'account': <'dontdivert@example.com'>, "
+            "'password': <'secrecy'>}>}")
+    q.expect('dbus-signal',
+            path=account_path,
+            signal='AccountPropertyChanged',
+            interface=cs.ACCOUNT,
+            predicate=(lambda e:
+                e.args[0].get('Nickname') == 'Joseph Bloggs'))
+    assertEquals('Joseph Bloggs',
+            account.Properties.Get(cs.ACCOUNT, 'Nickname'))
+
+    # ... and adds a new account
+    write_account_file(other_file_name,
+            "{'manager': <'fakecm'>, 'protocol': <'fakeprotocol'>, "
+            "'DisplayName': <'Ezio'>, "
+            "'Parameters': <{'account': <'ezio@firenze.fic'>, "
+            "'password': <'nothing is true'>}>}")
+    q.expect('dbus-signal',
+            path=cs.AM_PATH,
+            signal='AccountValidityChanged',
+            interface=cs.AM,
+            args=[other_path, True])
+
+    # ... and deletes it again
+    os.remove(other_file_name)
+    q.expect('dbus-signal',
+            path=cs.AM_PATH,
+            signal='AccountRemoved',
+            interface=cs.AM,
+            args=[other_path])
+
+    properties = account_manager.GetAll(cs.AM,
+            dbus_interface=cs.PROPERTIES_IFACE)
+    assertEquals([account_path], properties.get('ValidAccounts'))
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=10, use_fake_accounts_service=False)
@@ -0,0 +1,101 @@
+# Test for the default storage backend reusing its cache of .account files
+# when MC starts again
+#
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import os
+import os.path
+import stat
+import time
+
+from servicetest import assertEquals, sync_dbus
+from mctest import (
+    exec_test, MC, connect_to_mc, tell_mc_to_die, resuscitate_mc, Account,
+    )
+import constants as cs
+
+ACCOUNT_TEXT = ("{'manager': <'fakecm'>, 'protocol': <'fakeprotocol'>, "
+        "'DisplayName': <'%s'>, "
+        "'Parameters': <{'account': <'ezio@firenze.fic'>, "
+        "'password': <'nothing is true'>}>}")
+
+def write_account_file(path, display_name, mtime):
+    open(path, 'w').write(ACCOUNT_TEXT % display_name)
+    os.utime(path, (mtime, mtime))
+
+def test(q, bus, unused):
+    variant_dir = os.path.join(os.environ['XDG_DATA_HOME'],
+            'telepathy', 'mission-control')
+    file_name = os.path.join(variant_dir,
+            'fakecm-fakeprotocol-ezio_40firenze_2efic0.account')
+    account_path = (cs.ACCOUNT_PATH_PREFIX +
+            'fakecm/fakeprotocol/ezio_40firenze_2efic0')
+    cache_name = os.path.join(os.environ['XDG_CACHE_HOME'],
+            'telepathy', 'mission-control', 'accounts.cache')
+
+    try:
+        os.makedirs(variant_dir, 0700)
+    except OSError:
+        pass
+
+    # MC does not trust the mtime of a file written in the last second,
+    # so make it older
+    mtime = time.time() - 3600
+    write_account_file(file_name, 'Ezio', mtime)
+
+    mc = MC(q, bus)
+    connect_to_mc(q, bus, mc)
+    account = Account(bus, account_path)
+    assertEquals('Ezio', account.Properties.Get(cs.ACCOUNT, 'DisplayName'))
+
+    # The cache is written a few seconds after loading
+    for i in range(100):
+        if os.path.exists(cache_name):
+            break
+
+        time.sleep(0.1)
+        sync_dbus(bus, q, mc)
+    else:
+        raise AssertionError('%s was not written' % cache_name)
+
+    # It contains the accounts' passwords
+    assertEquals(0, stat.S_IMODE(os.stat(cache_name).st_mode) & 0077)
+
+    tell_mc_to_die(q, bus)
+
+    # Change the file behind MC's back, without changing its size or
+    # mtime: the next MC must use what it cached instead of reading it,
+    # so it still sees the old name
+    write_account_file(file_name, 'Ezia', mtime)
+
+    resuscitate_mc(q, bus, mc)
+    account = Account(bus, account_path)
+    assertEquals('Ezio', account.Properties.Get(cs.ACCOUNT, 'DisplayName'))
+
+    tell_mc_to_die(q, bus)
+
+    # A file that has been touched is read again
+    write_account_file(file_name, 'Ezia', mtime + 1)
+
+    resuscitate_mc(q, bus, mc)
+    account = Account(bus, account_path)
+    assertEquals('Ezia', account.Properties.Get(cs.ACCOUNT, 'DisplayName'))
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=20, preload_mc=False,
+            use_fake_accounts_service=False)
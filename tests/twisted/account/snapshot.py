@@ -0,0 +1,118 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test the shared-memory snapshot of account states."""
+
+import os
+import struct
+
+import dbus
+
+from servicetest import assertEquals
+from mctest import exec_test, create_fakecm_account, enable_fakecm_account
+import constants as cs
+
+# McdAccountSnapshotHeader and McdAccountSnapshotSlot in
+# src/mcd-account-snapshot.h
+MAGIC = 0x4e53434d
+FORMAT = 1
+HEADER = struct.Struct('=IIiIII')
+SLOT = struct.Struct('=8I256s256s64s256s64s256s')
+SLOT_FIELDS = ('in_use', 'enabled', 'valid', 'changing_presence',
+        'connection_status', 'connection_status_reason',
+        'current_presence_type', 'requested_presence_type',
+        'unique_name', 'display_name', 'current_status', 'current_message',
+        'requested_status', 'requested_message')
+
+def read_snapshot():
+    """Return a dict mapping unique names to slots, each a dict"""
+
+    # MC is single-threaded and not writing while we are running, so the
+    # seqlock must be even and stay put
+    data = open(os.environ['MC_SNAPSHOT_PATH'], 'rb').read()
+    magic, format, sequence, n_slots, slot_size, n_accounts = \
+            HEADER.unpack_from(data, 0)
+
+    assertEquals(MAGIC, magic)
+    assertEquals(FORMAT, format)
+    assertEquals(0, sequence % 2)
+    assertEquals(SLOT.size, slot_size)
+    assert len(data) >= HEADER.size + n_slots * slot_size, \
+            (len(data), n_slots)
+
+    slots = {}
+
+    for i in range(n_slots):
+        values = SLOT.unpack_from(data, HEADER.size + i * slot_size)
+        slot = dict(zip(SLOT_FIELDS, values))
+
+        if not slot['in_use']:
+            continue
+
+        for k in SLOT_FIELDS[8:]:
+            slot[k] = slot[k].rstrip(b'\0').decode('utf-8')
+
+        slots[slot['unique_name']] = slot
+
+    assertEquals(n_accounts, len(slots))
+    return slots
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someone@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    unique_name = account.object_path[len(cs.ACCOUNT_PATH_PREFIX):]
+
+    slot = read_snapshot()[unique_name]
+    assertEquals(0, slot['enabled'])
+    assertEquals(1, slot['valid'])
+    assertEquals(cs.CONN_STATUS_DISCONNECTED, slot['connection_status'])
+
+    account.Properties.Set(cs.ACCOUNT, 'DisplayName', u'Jos\xe9')
+    q.expect('dbus-signal', path=account.object_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e: 'DisplayName' in e.args[0])
+    assertEquals(u'Jos\xe9', read_snapshot()[unique_name]['display_name'])
+
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    slot = read_snapshot()[unique_name]
+    assertEquals(1, slot['enabled'])
+    assertEquals(cs.CONN_STATUS_CONNECTED, slot['connection_status'])
+    assertEquals(cs.PRESENCE_AVAILABLE, slot['requested_presence_type'])
+    assertEquals('available', slot['requested_status'])
+
+    # A requested disconnection is reported with its reason
+    account.Properties.Set(cs.ACCOUNT, 'Enabled', False)
+    q.expect('dbus-signal', path=account.object_path,
+            signal='AccountPropertyChanged', interface=cs.ACCOUNT,
+            predicate=lambda e: e.args[0].get('ConnectionStatus') ==
+                cs.CONN_STATUS_DISCONNECTED)
+
+    slot = read_snapshot()[unique_name]
+    assertEquals(0, slot['enabled'])
+    assertEquals(cs.CONN_STATUS_DISCONNECTED, slot['connection_status'])
+    assertEquals(cs.CSR_REQUESTED, slot['connection_status_reason'])
+
+    # Removing the account frees its slot
+    account.Remove(dbus_interface=cs.ACCOUNT)
+    q.expect('dbus-signal', path=cs.AM_PATH, signal='AccountRemoved',
+            args=[account.object_path])
+    assert unique_name not in read_snapshot()
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,189 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test the per-account statistics."""
+
+import dbus
+
+from servicetest import (EventPattern, call_async, sync_dbus,
+        assertContains, assertEquals)
+from mctest import (exec_test, create_fakecm_account, enable_fakecm_account,
+        SimulatedClient, SimulatedChannel, SimulatedConnection,
+        expect_client_setup)
+import constants as cs
+
+def get_stats(account):
+    return account.Properties.GetAll(cs.ACCOUNT_IFACE_STATS)
+
+def check_latency(latency, count):
+    n, lowest, mean, p95, highest = latency
+    assertEquals(count, n)
+    assert lowest <= mean <= highest, latency
+    assert p95 <= highest, latency
+
+def presence(type, status, message=''):
+    return dbus.Struct((dbus.UInt32(type), status, message), signature='uss')
+
+def became_current(account, presence):
+    return EventPattern('dbus-signal', path=account.object_path,
+            interface=cs.ACCOUNT, signal='AccountPropertyChanged',
+            predicate=lambda e: e.args[0].get('CurrentPresence') == presence)
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someone@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+
+    assertContains(cs.ACCOUNT_IFACE_STATS,
+            account.Properties.Get(cs.ACCOUNT, 'Interfaces'))
+
+    stats = get_stats(account)
+    assert stats['Since'] > 0, stats
+    assertEquals(0, sum(stats['Counters'].values()))
+
+    for name in ('request', 'dispatch', 'connect'):
+        assertEquals((0, 0, 0, 0, 0), stats['Latencies'][name])
+
+    available = presence(cs.PRESENCE_AVAILABLE, 'available')
+    conn, _ = enable_fakecm_account(q, bus, mc, account, params,
+            has_presence=True, requested_presence=available,
+            expect_after_connect=[became_current(account, available)])
+
+    stats = get_stats(account)
+    counters = stats['Counters']
+    assertEquals(1, counters['connection-attempts'])
+    assertEquals(1, counters['connections'])
+    assertEquals(0, counters['connection-failures'])
+    check_latency(stats['Latencies']['connect'], 1)
+    presence_changes = counters['presence-changes']
+    assert presence_changes >= 1, counters
+
+    # A channel request, dispatched to the handler that asked for it
+    text = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+    client = SimulatedClient(q, bus, 'Empathy', handle=[text])
+    expect_client_setup(q, [client])
+
+    request = dbus.Dictionary(text, signature='sv')
+    request[cs.CHANNEL + '.TargetID'] = 'juliet'
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    call_async(q, cd, 'CreateChannel', account.object_path, request,
+            dbus.Int64(0), client.bus_name, dbus_interface=cs.CD)
+    request_path = q.expect('dbus-return', method='CreateChannel').value[0]
+
+    cr = bus.get_object(cs.AM, request_path)
+    cr.Proceed(dbus_interface=cs.CR)
+
+    cm_request_call, add_request_call = q.expect_many(
+            EventPattern('dbus-method-call', interface=cs.CONN_IFACE_REQUESTS,
+                method='CreateChannel', path=conn.object_path,
+                args=[request], handled=False),
+            EventPattern('dbus-method-call', path=client.object_path,
+                interface=cs.CLIENT_IFACE_REQUESTS, method='AddRequest',
+                handled=False))
+    q.dbus_return(add_request_call.message, signature='')
+
+    immutable = dbus.Dictionary(request)
+    immutable[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    immutable[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    immutable[cs.CHANNEL + '.Requested'] = True
+    immutable[cs.CHANNEL + '.Interfaces'] = dbus.Array([], signature='s')
+    immutable[cs.CHANNEL + '.TargetHandle'] = \
+        conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel = SimulatedChannel(conn, immutable)
+    q.dbus_return(cm_request_call.message, channel.object_path,
+            channel.immutable, signature='oa{sv}')
+    channel.announce()
+
+    e = q.expect('dbus-method-call', path=client.object_path,
+            interface=cs.HANDLER, method='HandleChannels', handled=False)
+    q.dbus_return(e.message, signature='')
+    q.expect('dbus-signal', path=request_path, interface=cs.CR,
+            signal='Succeeded')
+    sync_dbus(bus, q, mc)
+
+    stats = get_stats(account)
+    counters = stats['Counters']
+    assertEquals(1, counters['requests'])
+    assertEquals(1, counters['requests-succeeded'])
+    assertEquals(0, counters['requests-failed'])
+    assertEquals(1, counters['channels-dispatched'])
+    assertEquals(0, counters['handlers-failed'])
+    check_latency(stats['Latencies']['request'], 1)
+    check_latency(stats['Latencies']['dispatch'], 1)
+
+    channel.close()
+
+    # A change to the current presence
+    away = presence(cs.PRESENCE_AWAY, 'away', 'In Verona')
+    account.Properties.Set(cs.ACCOUNT, 'RequestedPresence', away)
+    q.expect_many(
+            EventPattern('dbus-method-call', path=conn.object_path,
+                interface=cs.CONN_IFACE_SIMPLE_PRESENCE, method='SetPresence',
+                args=list(away[1:]), handled=True),
+            became_current(account, away))
+
+    counters = get_stats(account)['Counters']
+    assertEquals(presence_changes + 1, counters['presence-changes'])
+
+    # The connection drops soon after connecting, so while it is still on
+    # probation, and MC reconnects
+    conn.StatusChanged(cs.CONN_STATUS_DISCONNECTED, cs.CSR_NETWORK_ERROR)
+
+    e = q.expect('dbus-method-call', method='RequestConnection',
+            args=['fakeprotocol', params], handled=False)
+    conn = SimulatedConnection(q, bus, 'fakecm', 'fakeprotocol', 'second',
+            'myself', has_presence=True)
+    q.dbus_return(e.message, conn.bus_name, conn.object_path, signature='so')
+
+    q.expect('dbus-method-call', method='Connect', path=conn.object_path,
+            handled=True)
+    conn.StatusChanged(cs.CONN_STATUS_CONNECTED, cs.CSR_NONE_SPECIFIED)
+    q.expect_many(became_current(account, away))
+
+    stats = get_stats(account)
+    counters = stats['Counters']
+    assertEquals(2, counters['connection-attempts'])
+    assertEquals(2, counters['connections'])
+    assertEquals(0, counters['connection-failures'])
+    assertEquals(1, counters['connection-drops'])
+    assertEquals(1, counters['probation-drops'])
+    assertEquals(1, counters['reconnects'])
+    check_latency(stats['Latencies']['connect'], 2)
+    # away => offline => away, perhaps via whatever the new connection
+    # reports before MC sets its presence
+    assert counters['presence-changes'] >= presence_changes + 3, counters
+
+    # Nothing else happened to the channel statistics
+    assertEquals(1, counters['requests'])
+    assertEquals(1, counters['channels-dispatched'])
+
+    # A requested disconnection is not a failure or a drop
+    account.Properties.Set(cs.ACCOUNT, 'Enabled', False)
+    q.expect('dbus-method-call', method='Disconnect',
+            path=conn.object_path, handled=True)
+
+    counters = get_stats(account)['Counters']
+    assertEquals(0, counters['connection-failures'])
+    assertEquals(1, counters['connection-drops'])
+    assertEquals(1, counters['probation-drops'])
+    assertEquals(1, counters['reconnects'])
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -591,10 +591,12 @@ CLIENT_IFACE_REQUESTS = CLIENT + '.Interface.Requests'
 ACCOUNT = PREFIX + '.Account'
 ACCOUNT_IFACE_AVATAR = ACCOUNT + '.Interface.Avatar'
 ACCOUNT_IFACE_ADDRESSING = ACCOUNT + '.Interface.Addressing'
+ACCOUNT_IFACE_STATS = ACCOUNT + '.Interface.Stats.DRAFT'
 ACCOUNT_PATH_PREFIX = PATH_PREFIX + '/Account/'
 
 AM = PREFIX + '.AccountManager'
 AM_PATH = PATH_PREFIX + '/AccountManager'
+AM_IFACE_BATCH = AM + '.Interface.Batch.DRAFT'
 
 CR = PREFIX + '.ChannelRequest'
 CDO = PREFIX + '.ChannelDispatchOperation'
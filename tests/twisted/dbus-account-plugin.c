@@ -101,16 +101,34 @@ G_DEFINE_TYPE_WITH_CODE (TestDBusAccountPlugin, test_dbus_account_plugin,
 typedef struct {
     TestDBusAccountPlugin *self;
     gchar *account_name;
+    /* the commit_async() call this is part of, or NULL */
+    GTask *task;
 } AsyncData;
 
+/* task data for commit_async() */
+typedef struct {
+    guint calls;
+    GError *error;
+} CommitState;
+
 static AsyncData *
 async_data_new (TestDBusAccountPlugin *self,
-    const gchar *account_name)
+    const gchar *account_name,
+    GTask *task)
 {
   AsyncData *ret = g_slice_new0 (AsyncData);
 
   ret->self = g_object_ref (self);
   ret->account_name = g_strdup (account_name);
+
+  if (task != NULL)
+    {
+      CommitState *state = g_task_get_task_data (task);
+
+      ret->task = g_object_ref (task);
+      state->calls++;
+    }
+
   return ret;
 }
 
@@ -118,10 +136,50 @@ static void
 async_data_free (AsyncData *ad)
 {
   g_clear_object (&ad->self);
+  g_clear_object (&ad->task);
   g_free (ad->account_name);
   g_slice_free (AsyncData, ad);
 }
 
+static void
+commit_state_free (gpointer p)
+{
+  CommitState *state = p;
+
+  g_clear_error (&state->error);
+  g_slice_free (CommitState, state);
+}
+
+/* One of the D-Bus calls made by commit_async() has finished; if it was
+ * the last, so has the commit */
+static void
+async_data_call_done (AsyncData *ad,
+    const GError *error)
+{
+  CommitState *state;
+
+  if (ad->task == NULL)
+    return;
+
+  state = g_task_get_task_data (ad->task);
+
+  if (error != NULL && state->error == NULL)
+    state->error = g_error_copy (error);
+
+  if (--state->calls > 0)
+    return;
+
+  if (state->error != NULL)
+    {
+      g_task_return_error (ad->task, state->error);
+      state->error = NULL;
+    }
+  else
+    {
+      g_task_return_boolean (ad->task, TRUE);
+    }
+}
+
 static Account *
 lookup_account (TestDBusAccountPlugin *self,
     const gchar *account_name)
@@ -631,22 +689,43 @@ parameters_changed_cb (GDBusConnection *bus,
   g_variant_unref (deleted);
 }
 
-static GList *
-test_dbus_account_plugin_list (McpAccountStorage *storage,
-    McpAccountManager *am)
+static void
+account_reconnected_cb (GDBusConnection *bus,
+    const gchar *sender_name,
+    const gchar *object_path,
+    const gchar *iface_name,
+    const gchar *signal_name,
+    GVariant *tuple,
+    gpointer user_data)
 {
-  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
-  GError *error = NULL;
-  GVariant *tuple, *accounts;
-  GVariant *attributes, *attribute_flags;
-  GVariant *parameters, *untyped_parameters, *param_flags;
-  GVariantIter account_iter;
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (user_data);
   const gchar *account_name;
-  GList *ret = NULL;
-  guint32 restrictions;
+  Account *account;
 
-  DEBUG ("called");
+  g_variant_get (tuple, "(&s)", &account_name);
+  DEBUG ("%s", account_name);
+  account = lookup_account (self, account_name);
+
+  if (account == NULL)
+    {
+      CRITICAL ("accounts service reconnected %s but we don't "
+          "have any record of that account", account_name);
+    }
+  else
+    {
+      mcp_account_storage_emit_reconnect (MCP_ACCOUNT_STORAGE (self),
+          account_name);
+
+      g_dbus_connection_emit_signal (self->bus, NULL,
+          TEST_DBUS_ACCOUNT_PLUGIN_PATH, TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+          "Reconnected", g_variant_new_parsed ("(%o,)", account->path),
+          NULL);
+    }
+}
 
+static void
+test_dbus_account_plugin_subscribe (TestDBusAccountPlugin *self)
+{
   g_dbus_connection_emit_signal (self->bus, NULL,
       TEST_DBUS_ACCOUNT_PLUGIN_PATH, TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
       "Listing", NULL, NULL);
@@ -695,31 +774,33 @@ test_dbus_account_plugin_list (McpAccountStorage *storage,
       g_object_ref (self),
       g_object_unref);
 
-  /* list is allowed to block */
-  tuple = g_dbus_connection_call_sync (self->bus,
+  g_dbus_connection_signal_subscribe (self->bus,
       TEST_DBUS_ACCOUNT_SERVICE,
-      TEST_DBUS_ACCOUNT_SERVICE_PATH,
       TEST_DBUS_ACCOUNT_SERVICE_IFACE,
-      "GetAccounts",
-      NULL, /* no parameters */
-      G_VARIANT_TYPE ("(a{s(a{sv}a{su}a{sv}a{ss}a{su}u)})"),
-      G_DBUS_CALL_FLAGS_NONE,
-      -1,
-      NULL, /* no cancellable */
-      &error);
+      "AccountReconnected",
+      TEST_DBUS_ACCOUNT_SERVICE_PATH,
+      NULL, /* no arg0 */
+      G_DBUS_SIGNAL_FLAGS_NONE,
+      account_reconnected_cb,
+      g_object_ref (self),
+      g_object_unref);
+}
 
-  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER) ||
-      g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN))
-    {
-      /* this regression test isn't using the fake accounts service */
-      g_clear_error (&error);
-      return NULL;
-    }
+/* Add the accounts from the result of GetAccounts, and return their names */
+static GList *
+test_dbus_account_plugin_add_accounts (TestDBusAccountPlugin *self,
+    GVariant *tuple)
+{
+  GVariant *accounts;
+  GVariant *attributes, *attribute_flags;
+  GVariant *parameters, *untyped_parameters, *param_flags;
+  GVariantIter account_iter;
+  const gchar *account_name;
+  GList *ret = NULL;
+  guint32 restrictions;
 
   self->active = TRUE;
 
-  g_assert_no_error (error);
-
   g_variant_get (tuple, "(@*)", &accounts);
 
   g_variant_iter_init (&account_iter, accounts);
@@ -737,6 +818,46 @@ test_dbus_account_plugin_list (McpAccountStorage *storage,
     }
 
   g_variant_unref (accounts);
+  return ret;
+}
+
+static GList *
+test_dbus_account_plugin_list (McpAccountStorage *storage,
+    McpAccountManager *am)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+  GError *error = NULL;
+  GVariant *tuple;
+  GList *ret;
+
+  DEBUG ("called");
+
+  test_dbus_account_plugin_subscribe (self);
+
+  /* list is allowed to block */
+  tuple = g_dbus_connection_call_sync (self->bus,
+      TEST_DBUS_ACCOUNT_SERVICE,
+      TEST_DBUS_ACCOUNT_SERVICE_PATH,
+      TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+      "GetAccounts",
+      NULL, /* no parameters */
+      G_VARIANT_TYPE ("(a{s(a{sv}a{su}a{sv}a{ss}a{su}u)})"),
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      NULL, /* no cancellable */
+      &error);
+
+  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER) ||
+      g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN))
+    {
+      /* this regression test isn't using the fake accounts service */
+      g_clear_error (&error);
+      return NULL;
+    }
+
+  g_assert_no_error (error);
+
+  ret = test_dbus_account_plugin_add_accounts (self, tuple);
   g_variant_unref (tuple);
   return ret;
 }
@@ -1129,13 +1250,14 @@ create_account_cb (GObject *source_object,
     {
       g_warning ("Unable to create account %s: %s", ad->account_name,
           error->message);
-      g_clear_error (&error);
       /* FIXME: we could roll back the creation by claiming that
        * the service deleted the account? If we do, we will have
        * to do it in an idle because we might be iterating over
        * all accounts in commit() */
     }
 
+  async_data_call_done (ad, error);
+  g_clear_error (&error);
   async_data_free (ad);
 }
 
@@ -1165,11 +1287,12 @@ update_attributes_cb (GObject *source_object,
     {
       g_warning ("Unable to update attributes on %s: %s", ad->account_name,
           error->message);
-      g_clear_error (&error);
       /* FIXME: we could roll back the creation by claiming that
        * the service restored the old attributes? */
     }
 
+  async_data_call_done (ad, error);
+  g_clear_error (&error);
   async_data_free (ad);
 }
 
@@ -1199,20 +1322,22 @@ update_parameters_cb (GObject *source_object,
     {
       g_warning ("Unable to update parameters on %s: %s", ad->account_name,
           error->message);
-      g_clear_error (&error);
       /* FIXME: we could roll back the creation by claiming that
        * the service restored the old parameters? */
     }
 
+  async_data_call_done (ad, error);
+  g_clear_error (&error);
   async_data_free (ad);
 }
 
+/* Send the uncommitted changes to @account_name to the service; if @task is
+ * not NULL, it is completed when the service has replied */
 static gboolean
-test_dbus_account_plugin_commit (McpAccountStorage *storage,
-    McpAccountManager *am,
-    const gchar *account_name)
+test_dbus_account_plugin_commit_internal (TestDBusAccountPlugin *self,
+    const gchar *account_name,
+    GTask *task)
 {
-  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
   Account *account;
   GHashTableIter iter;
   gpointer k;
@@ -1245,7 +1370,7 @@ test_dbus_account_plugin_commit (McpAccountStorage *storage,
           -1,
           NULL, /* no cancellable */
           create_account_cb,
-          async_data_new (self, account_name));
+          async_data_new (self, account_name, task));
     }
 
   if (g_hash_table_size (account->uncommitted_attributes) != 0)
@@ -1289,7 +1414,7 @@ test_dbus_account_plugin_commit (McpAccountStorage *storage,
           -1,
           NULL, /* no cancellable */
           update_attributes_cb,
-          async_data_new (self, account_name));
+          async_data_new (self, account_name, task));
     }
   else
     {
@@ -1347,7 +1472,7 @@ test_dbus_account_plugin_commit (McpAccountStorage *storage,
           -1,
           NULL, /* no cancellable */
           update_parameters_cb,
-          async_data_new (self, account_name));
+          async_data_new (self, account_name, task));
     }
   else
     {
@@ -1357,6 +1482,15 @@ test_dbus_account_plugin_commit (McpAccountStorage *storage,
   return TRUE;
 }
 
+static gboolean
+test_dbus_account_plugin_commit (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account_name)
+{
+  return test_dbus_account_plugin_commit_internal (
+      TEST_DBUS_ACCOUNT_PLUGIN (storage), account_name, NULL);
+}
+
 static void
 test_dbus_account_plugin_get_identifier (McpAccountStorage *storage,
     const gchar *account_name,
@@ -1419,6 +1553,270 @@ test_dbus_account_plugin_get_flags (McpAccountStorage *storage,
   return MCP_ACCOUNT_STORAGE_FLAG_STORES_TYPES;
 }
 
+static void
+string_list_free (gpointer p)
+{
+  g_list_free_full (p, g_free);
+}
+
+static void
+list_async_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  GTask *task = user_data;
+  TestDBusAccountPlugin *self = g_task_get_source_object (task);
+  GVariant *tuple;
+  GError *error = NULL;
+
+  tuple = g_dbus_connection_call_finish (self->bus, res, &error);
+
+  if (tuple != NULL)
+    {
+      g_task_return_pointer (task,
+          test_dbus_account_plugin_add_accounts (self, tuple),
+          string_list_free);
+      g_variant_unref (tuple);
+    }
+  else if (g_error_matches (error, G_DBUS_ERROR,
+        G_DBUS_ERROR_NAME_HAS_NO_OWNER) ||
+      g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN))
+    {
+      /* this regression test isn't using the fake accounts service */
+      g_clear_error (&error);
+      g_task_return_pointer (task, NULL, NULL);
+    }
+  else
+    {
+      g_task_return_error (task, error);
+    }
+
+  g_object_unref (task);
+}
+
+static void
+test_dbus_account_plugin_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+
+  DEBUG ("called");
+
+  test_dbus_account_plugin_subscribe (self);
+
+  g_dbus_connection_call (self->bus,
+      TEST_DBUS_ACCOUNT_SERVICE,
+      TEST_DBUS_ACCOUNT_SERVICE_PATH,
+      TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+      "GetAccounts",
+      NULL, /* no parameters */
+      G_VARIANT_TYPE ("(a{s(a{sv}a{su}a{sv}a{ss}a{su}u)})"),
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      cancellable,
+      list_async_cb,
+      g_task_new (self, cancellable, callback, user_data));
+}
+
+static GList *
+test_dbus_account_plugin_list_finish (McpAccountStorage *storage,
+    GAsyncResult *res,
+    GError **error)
+{
+  return g_task_propagate_pointer (G_TASK (res), error);
+}
+
+static void
+get_account_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  GTask *task = user_data;
+  TestDBusAccountPlugin *self = g_task_get_source_object (task);
+  GVariant *tuple;
+  GError *error = NULL;
+
+  tuple = g_dbus_connection_call_finish (self->bus, res, &error);
+
+  if (tuple != NULL)
+    g_task_return_pointer (task, tuple, (GDestroyNotify) g_variant_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+static void
+test_dbus_account_plugin_get_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account_name,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+  Account *account = lookup_account (self, account_name);
+  GTask *task = g_task_new (self, cancellable, callback, user_data);
+
+  DEBUG ("%s", account_name);
+
+  if (account == NULL)
+    {
+      g_task_return_new_error (task, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+          "No such account %s", account_name);
+      g_object_unref (task);
+      return;
+    }
+
+  g_dbus_connection_emit_signal (self->bus, NULL,
+      TEST_DBUS_ACCOUNT_PLUGIN_PATH, TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+      "Fetching", g_variant_new_parsed ("(%o,)", account->path), NULL);
+
+  g_dbus_connection_call (self->bus,
+      TEST_DBUS_ACCOUNT_SERVICE,
+      TEST_DBUS_ACCOUNT_SERVICE_PATH,
+      TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+      "GetAccount",
+      g_variant_new ("(s)", account_name),
+      G_VARIANT_TYPE ("(a{sv}a{su}a{sv}a{ss}a{su}u)"),
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      cancellable,
+      get_account_cb,
+      task);
+}
+
+static gboolean
+test_dbus_account_plugin_get_finish (McpAccountStorage *storage,
+    GAsyncResult *res,
+    GVariant **attributes,
+    GVariant **parameters,
+    GError **error)
+{
+  GVariant *tuple = g_task_propagate_pointer (G_TASK (res), error);
+
+  if (tuple == NULL)
+    return FALSE;
+
+  /* asynchronous plugins must store the types of parameters, so untyped
+   * parameters are not returned */
+  if (attributes != NULL)
+    *attributes = g_variant_get_child_value (tuple, 0);
+
+  if (parameters != NULL)
+    *parameters = g_variant_get_child_value (tuple, 2);
+
+  g_variant_unref (tuple);
+  return TRUE;
+}
+
+static void
+test_dbus_account_plugin_set_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account_name,
+    GVariant *attributes,
+    GVariant *parameters,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+  Account *account = lookup_account (self, account_name);
+  GTask *task = g_task_new (self, cancellable, callback, user_data);
+  GVariantBuilder attr_builder;
+  GVariantBuilder param_builder;
+  GVariantIter iter;
+  const gchar *k;
+  GVariant *v;
+
+  DEBUG ("%s", account_name);
+
+  if (!self->active || account == NULL)
+    {
+      g_task_return_new_error (task, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+          "No such account %s", account_name);
+      g_object_unref (task);
+      return;
+    }
+
+  g_variant_builder_init (&attr_builder, G_VARIANT_TYPE_STRING_ARRAY);
+  g_variant_builder_init (&param_builder, G_VARIANT_TYPE_STRING_ARRAY);
+
+  g_variant_iter_init (&iter, attributes);
+
+  while (g_variant_iter_loop (&iter, "{&smv}", &k, &v))
+    g_variant_builder_add (&attr_builder, "s", k);
+
+  g_variant_iter_init (&iter, parameters);
+
+  while (g_variant_iter_loop (&iter, "{&smv}", &k, &v))
+    g_variant_builder_add (&param_builder, "s", k);
+
+  /* the regression tests check that this happens once per commit */
+  g_dbus_connection_emit_signal (self->bus, NULL,
+      TEST_DBUS_ACCOUNT_PLUGIN_PATH, TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+      "SettingAsync", g_variant_new ("(oasas)", account->path,
+        &attr_builder, &param_builder), NULL);
+
+  g_variant_iter_init (&iter, attributes);
+
+  while (g_variant_iter_loop (&iter, "{&smv}", &k, &v))
+    test_dbus_account_plugin_set_attribute (storage, am, account_name, k, v,
+        MCP_ATTRIBUTE_FLAG_NONE);
+
+  g_variant_iter_init (&iter, parameters);
+
+  while (g_variant_iter_loop (&iter, "{&smv}", &k, &v))
+    test_dbus_account_plugin_set_parameter (storage, am, account_name, k, v,
+        MCP_PARAMETER_FLAG_NONE);
+
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+static gboolean
+test_dbus_account_plugin_set_finish (McpAccountStorage *storage,
+    GAsyncResult *res,
+    GError **error)
+{
+  return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+test_dbus_account_plugin_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account_name,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+  GTask *task = g_task_new (self, cancellable, callback, user_data);
+  CommitState *state = g_slice_new0 (CommitState);
+
+  g_task_set_task_data (task, state, commit_state_free);
+
+  if (!test_dbus_account_plugin_commit_internal (self, account_name, task))
+    g_task_return_new_error (task, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+        "Unable to commit %s", account_name);
+  /* if there was nothing to send, the commit has already finished */
+  else if (state->calls == 0)
+    g_task_return_boolean (task, TRUE);
+
+  g_object_unref (task);
+}
+
+static gboolean
+test_dbus_account_plugin_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *res,
+    GError **error)
+{
+  return g_task_propagate_boolean (G_TASK (res), error);
+}
+
 static void
 account_storage_iface_init (McpAccountStorageIface *iface)
 {
@@ -1444,4 +1842,17 @@ account_storage_iface_init (McpAccountStorageIface *iface)
   iface->get_additional_info = test_dbus_account_plugin_get_additional_info;
   iface->get_restrictions = test_dbus_account_plugin_get_restrictions;
   iface->create = test_dbus_account_plugin_create;
+
+  /* account-storage/async-plugin.py runs us as an asynchronous plugin */
+  if (g_getenv ("MC_TEST_ASYNC_ACCOUNT_PLUGIN") != NULL)
+    {
+      iface->list_async = test_dbus_account_plugin_list_async;
+      iface->list_finish = test_dbus_account_plugin_list_finish;
+      iface->get_async = test_dbus_account_plugin_get_async;
+      iface->get_finish = test_dbus_account_plugin_get_finish;
+      iface->set_async = test_dbus_account_plugin_set_async;
+      iface->set_finish = test_dbus_account_plugin_set_finish;
+      iface->commit_async = test_dbus_account_plugin_commit_async;
+      iface->commit_finish = test_dbus_account_plugin_commit_finish;
+    }
 }
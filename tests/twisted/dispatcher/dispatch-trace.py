@@ -0,0 +1,156 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that DumpDispatchTrace reports what a dispatch operation did."""
+
+import dbus
+
+from servicetest import EventPattern, call_async, sync_dbus, assertEquals
+from mctest import exec_test, SimulatedClient, create_fakecm_account, \
+        enable_fakecm_account, SimulatedChannel, expect_client_setup
+import constants as cs
+
+MC_DEBUG_IFACE = 'org.freedesktop.Telepathy.MissionControl5.Debug.DRAFT'
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    text_fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+    vague_fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+
+    # Everything is on one connection, so that MC sees the clients'
+    # replies and our calls in the order we send them
+    empathy = SimulatedClient(q, bus, 'Empathy',
+            observe=[text_fixed_properties], approve=[text_fixed_properties],
+            handle=[text_fixed_properties], bypass_approval=False)
+    kopete = SimulatedClient(q, bus, 'Kopete',
+            handle=[vague_fixed_properties], bypass_approval=False)
+
+    # wait for MC to download the properties
+    expect_client_setup(q, [empathy, kopete])
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_props = dbus.Interface(cd, cs.PROPERTIES_IFACE)
+    assert cd_props.Get(cs.CD_IFACE_OP_LIST, 'DispatchOperations') == []
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties)
+    chan.announce()
+
+    e = q.expect('dbus-signal',
+            path=cs.CD_PATH,
+            interface=cs.CD_IFACE_OP_LIST,
+            signal='NewDispatchOperation')
+    cdo_path = e.args[0]
+    cdo_iface = dbus.Interface(bus.get_object(cs.CD, cdo_path), cs.CDO)
+
+    # the number in the object path, /.../do<n>
+    cdo_id = int(cdo_path.split('/')[-1][2:])
+
+    o, a = q.expect_many(
+            EventPattern('dbus-method-call',
+                path=empathy.object_path,
+                interface=cs.OBSERVER, method='ObserveChannels',
+                handled=False),
+            EventPattern('dbus-method-call',
+                path=empathy.object_path,
+                interface=cs.APPROVER, method='AddDispatchOperation',
+                handled=False),
+            )
+    q.dbus_return(o.message, signature='')
+    q.dbus_return(a.message, signature='')
+    sync_dbus(bus, q, mc)
+
+    # Empathy fails to handle the channel, then Kopete succeeds
+    call_async(q, cdo_iface, 'HandleWith',
+            cs.tp_name_prefix + '.Client.Empathy')
+    e = q.expect('dbus-method-call',
+            path=empathy.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    q.dbus_raise(e.message, cs.NOT_AVAILABLE, 'Blind drunk')
+    q.expect('dbus-error', method='HandleWith')
+
+    call_async(q, cdo_iface, 'HandleWith',
+            cs.tp_name_prefix + '.Client.Kopete')
+    e = q.expect('dbus-method-call',
+            path=kopete.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    q.dbus_return(e.message, signature='')
+
+    q.expect_many(
+            EventPattern('dbus-return', method='HandleWith'),
+            EventPattern('dbus-signal', interface=cs.CDO, signal='Finished'),
+            )
+
+    mc_debug = dbus.Interface(bus.get_object(cs.AM, cs.DEBUG_PATH),
+            MC_DEBUG_IFACE)
+    trace = mc_debug.DumpDispatchTrace()
+
+    # Oldest first
+    times = [t for t, n, event, detail in trace]
+    assertEquals(sorted(times), times)
+
+    # Client names are recorded without the common prefix
+    events = [(event, detail) for t, n, event, detail in trace
+            if n == cdo_id]
+
+    assertEquals(('cdo-created', 'needs-approval'), events[0])
+
+    # Observers and approvers are called in parallel
+    assertEquals(sorted([
+        ('observer-called', 'Empathy'),
+        ('observer-returned', 'Empathy'),
+        ('approver-called', 'Empathy'),
+        ('approver-returned', 'Empathy'),
+        ]), sorted(events[1:5]))
+    assert events.index(('observer-called', 'Empathy')) < \
+            events.index(('observer-returned', 'Empathy')), events
+    assert events.index(('approver-called', 'Empathy')) < \
+            events.index(('approver-returned', 'Empathy')), events
+
+    assertEquals([
+        ('handler-tried', 'Empathy'),
+        ('handler-failed', 'Empathy'),
+        ('handler-tried', 'Kopete'),
+        ('handler-succeeded', 'Kopete'),
+        ], events[5:9])
+
+    assertEquals(10, len(events))
+    assertEquals('cdo-finished', events[9][0])
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,95 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for plugins handling incoming channels in-process,
+without a ChannelDispatchOperation.
+"""
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern, sync_dbus
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+def announce_text_channel(q, conn, target):
+    channel_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = target
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, target)
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = target
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, target)
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties)
+    chan.announce()
+    return chan
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    text_fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+
+    empathy = SimulatedClient(q, bus, 'Empathy',
+            observe=[text_fixed_properties], approve=[text_fixed_properties],
+            handle=[text_fixed_properties], bypass_approval=False)
+    expect_client_setup(q, [empathy])
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_props = dbus.Interface(cd, cs.PROPERTIES_IFACE)
+    assert cd_props.Get(cs.CD_IFACE_OP_LIST, 'DispatchOperations') == []
+
+    # This ID matches the filter of the internal handler in mcp-plugin,
+    # which takes the channel (and closes it) without any client seeing it
+    forbidden = [
+            EventPattern('dbus-signal', signal='NewDispatchOperation'),
+            EventPattern('dbus-method-call', method='ObserveChannels'),
+            EventPattern('dbus-method-call', method='AddDispatchOperation'),
+            EventPattern('dbus-method-call', method='HandleChannels'),
+            ]
+    q.forbid_events(forbidden)
+
+    chan = announce_text_channel(q, conn, 'answering.machine@example.net')
+    q.expect('dbus-method-call', path=chan.object_path,
+            interface=cs.CHANNEL, method='Close')
+
+    sync_dbus(bus, q, mc)
+    q.unforbid_events(forbidden)
+
+    # Other channels are dispatched as usual
+    chan = announce_text_channel(q, conn, 'juliet@example.com')
+    e = q.expect('dbus-signal', path=cs.CD_PATH,
+            interface=cs.CD_IFACE_OP_LIST, signal='NewDispatchOperation')
+    assert e.args[1][cs.CDO + '.Account'] == account.object_path
+
+    chan.close()
+
+if __name__ == '__main__':
+    exec_test(test, {})
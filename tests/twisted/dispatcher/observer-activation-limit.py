@@ -0,0 +1,130 @@
+# Copyright (C) 2014 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Test that MC does not activate more observers at once than
+$MC_OBSERVER_ACTIVATION_LIMIT, but still calls running observers at once.
+"""
+
+import dbus
+
+from servicetest import EventPattern, sync_dbus, assertContains
+from mctest import (exec_test, set_mc_environment, SimulatedClient,
+    create_fakecm_account, enable_fakecm_account, SimulatedChannel,
+    expect_client_setup, MC)
+import constants as cs
+
+# the activatable observers in telepathy/clients that observe this type
+ACTIVATABLE = [cs.tp_name_prefix + '.Client.Archivist',
+        cs.tp_name_prefix + '.Client.Auditor']
+
+def test(q, bus, unused):
+    set_mc_environment(bus, MC_OBSERVER_ACTIVATION_LIMIT='1')
+    mc = MC(q, bus)
+
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL + '.Type.ThrottledObservers'
+        }, signature='sv')
+
+    # Clerk is a running Observer, Kopete a running Handler
+    clerk = SimulatedClient(q, bus, 'Clerk',
+            observe=[fixed_properties], bypass_approval=False)
+    kopete = SimulatedClient(q, bus, 'Kopete',
+            handle=[fixed_properties], bypass_approval=True)
+
+    # wait for MC to download the properties
+    expect_client_setup(q, [clerk, kopete])
+
+    channel_properties = dbus.Dictionary(fixed_properties, signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+
+    startup = EventPattern('dbus-signal',
+            path=cs.tp_path_prefix + '/RegressionTests',
+            interface=cs.tp_name_prefix + '.RegressionTests',
+            signal='FakeStartup')
+    handle_channels = EventPattern('dbus-method-call',
+            path=kopete.object_path,
+            interface=cs.HANDLER, method='HandleChannels')
+    q.forbid_events([handle_channels])
+
+    chan = SimulatedChannel(conn, channel_properties)
+    chan.announce()
+
+    # The running observer is called straight away, alongside the one
+    # activation that the limit allows
+    e, s = q.expect_many(
+            EventPattern('dbus-method-call',
+                path=clerk.object_path,
+                interface=cs.OBSERVER, method='ObserveChannels',
+                handled=False),
+            startup,
+            )
+    assertContains(s.args[0], ACTIVATABLE)
+    q.dbus_return(e.message, signature='')
+
+    # the other one is activated once this one has returned
+    order = [s.args[0]] + [n for n in ACTIVATABLE if n != s.args[0]]
+
+    for i, name in enumerate(order):
+        # Until the observer being activated has returned, the next one
+        # is not activated
+        q.forbid_events([startup])
+
+        # We take on its identity to be able to continue with the test
+        observer = SimulatedClient(q, bus, name.split('.')[-1],
+                observe=[fixed_properties])
+
+        e = q.expect('dbus-method-call',
+                path=observer.object_path,
+                interface=cs.OBSERVER, method='ObserveChannels',
+                handled=False)
+        assert e.args[0] == account.object_path, e.args
+        assert e.args[2][0][0] == chan.object_path, e.args
+
+        sync_dbus(bus, q, mc)
+        q.unforbid_events([startup])
+        q.dbus_return(e.message, signature='')
+
+        if i + 1 < len(order):
+            q.expect('dbus-signal',
+                    path=cs.tp_path_prefix + '/RegressionTests',
+                    interface=cs.tp_name_prefix + '.RegressionTests',
+                    signal='FakeStartup', args=[order[i + 1]])
+
+    # Only once every observer has returned is the handler called
+    q.unforbid_events([handle_channels])
+    e = q.expect('dbus-method-call',
+            path=kopete.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    assert e.args[2][0][0] == chan.object_path, e.args
+    q.dbus_return(e.message, signature='')
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False)
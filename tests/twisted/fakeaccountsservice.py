@@ -47,6 +47,17 @@ class FakeAccount(object):
                 dbus.UInt32(self.restrictions),
                 )
 
+    def snapshot(self):
+        """Like to_dbus(), but not affected by later changes"""
+        return (
+                dbus.Dictionary(self.attrs, signature='sv'),
+                dbus.Dictionary(self.attr_flags, signature='su'),
+                dbus.Dictionary(self.params, signature='sv'),
+                dbus.Dictionary(self.untyped_params, signature='ss'),
+                dbus.Dictionary(self.param_flags, signature='su'),
+                dbus.UInt32(self.restrictions),
+                )
+
 class FakeAccountsService(object):
     def __init__(self, q, bus):
         self.q = q
@@ -56,12 +67,19 @@ class FakeAccountsService(object):
         self.object_path = cs.TEST_DBUS_ACCOUNT_SERVICE_PATH
 
         self.accounts = {}
+        # if not None, GetAccount calls waiting for release_get_account()
+        self.held_gets = None
 
         q.add_dbus_method_impl(self.GetAccounts,
                 path=self.object_path,
                 interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
                 method='GetAccounts')
 
+        q.add_dbus_method_impl(self.GetAccount,
+                path=self.object_path,
+                interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                method='GetAccount')
+
         q.add_dbus_method_impl(self.CreateAccount,
                 path=self.object_path,
                 interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
@@ -135,6 +153,46 @@ class FakeAccountsService(object):
         self.q.dbus_return(e.message, accounts,
                 signature='a{s(' + FakeAccount.SIGNATURE + ')}')
 
+    def GetAccount(self, e):
+        account = e.args[0]
+
+        # reply with the account as it is now, even if the reply is held
+        # until after it changes
+        if account in self.accounts:
+            reply = self.accounts[account].snapshot()
+        else:
+            reply = None
+
+        if self.held_gets is None:
+            self.reply_get_account(e, reply)
+        else:
+            self.held_gets.append((e, reply))
+
+    def reply_get_account(self, e, reply):
+        if reply is None:
+            self.q.dbus_raise(e.message, cs.NOT_AVAILABLE,
+                    'No such account %s' % e.args[0])
+        else:
+            self.q.dbus_return(e.message, *reply,
+                    signature=FakeAccount.SIGNATURE)
+
+    def hold_get_account(self):
+        """Delay replies to GetAccount until release_get_account()"""
+        self.held_gets = []
+
+    def release_get_account(self):
+        """Reply to GetAccount calls made since hold_get_account(), and stop
+        delaying replies"""
+        held = self.held_gets
+        self.held_gets = None
+
+        for (e, reply) in held:
+            self.reply_get_account(e, reply)
+
+    def reconnect_account(self, account):
+        self.q.dbus_emit(self.object_path, cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+                'AccountReconnected', account, signature='s')
+
     def update_attributes(self, account, changed={}, flags={}, deleted=[]):
         if account not in self.accounts:
             self.create_account(account)
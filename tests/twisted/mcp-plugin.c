@@ -560,6 +560,86 @@ rej_req_policy_iface_init (McpRequestPolicyIface *iface,
       test_rejection_plugin_check_request);
 }
 
+/* ------ TestInternalHandlerPlugin --------------------------------- */
+
+typedef struct {
+    GObject parent;
+    GPtrArray *filters;
+} TestInternalHandlerPlugin;
+
+typedef struct {
+    GObjectClass parent_class;
+} TestInternalHandlerPluginClass;
+
+GType test_internal_handler_plugin_get_type (void) G_GNUC_CONST;
+static void internal_handler_iface_init (McpInternalHandlerIface *,
+    gpointer);
+
+G_DEFINE_TYPE_WITH_CODE (TestInternalHandlerPlugin,
+    test_internal_handler_plugin,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (MCP_TYPE_INTERNAL_HANDLER,
+      internal_handler_iface_init))
+
+static void
+test_internal_handler_plugin_init (TestInternalHandlerPlugin *self)
+{
+  self->filters = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_hash_table_unref);
+
+  /* an "auto-reply service" that only deals with one contact */
+  g_ptr_array_add (self->filters, tp_asv_new (
+        TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+          TP_IFACE_CHANNEL_TYPE_TEXT,
+        TP_PROP_CHANNEL_TARGET_ID, G_TYPE_STRING,
+          "answering.machine@example.net",
+        NULL));
+}
+
+static void
+test_internal_handler_plugin_finalize (GObject *object)
+{
+  TestInternalHandlerPlugin *self = (TestInternalHandlerPlugin *) object;
+
+  g_ptr_array_unref (self->filters);
+
+  G_OBJECT_CLASS (test_internal_handler_plugin_parent_class)->finalize (
+      object);
+}
+
+static void
+test_internal_handler_plugin_class_init (TestInternalHandlerPluginClass *cls)
+{
+  GObjectClass *object_class = (GObjectClass *) cls;
+
+  object_class->finalize = test_internal_handler_plugin_finalize;
+}
+
+static GPtrArray *
+test_internal_handler_plugin_get_filters (McpInternalHandler *handler)
+{
+  return ((TestInternalHandlerPlugin *) handler)->filters;
+}
+
+static gboolean
+test_internal_handler_plugin_handle_channel (McpInternalHandler *handler,
+    const gchar *account_path,
+    TpChannel *channel)
+{
+  DEBUG ("handling %s for %s internally, by closing it",
+      tp_proxy_get_object_path (channel), account_path);
+  tp_cli_channel_call_close (channel, -1, NULL, NULL, NULL, NULL);
+  return TRUE;
+}
+
+static void
+internal_handler_iface_init (McpInternalHandlerIface *iface,
+    gpointer unused G_GNUC_UNUSED)
+{
+  iface->get_filters = test_internal_handler_plugin_get_filters;
+  iface->handle_channel = test_internal_handler_plugin_handle_channel;
+}
+
 /* ------ Initialization -------------------------------------------- */
 
 GObject *
@@ -589,6 +669,10 @@ mcp_plugin_ref_nth_object (guint n)
       return g_object_new (test_dbus_account_plugin_get_type (),
           NULL);
 
+    case 5:
+      return g_object_new (test_internal_handler_plugin_get_type (),
+          NULL);
+
     default:
       return NULL;
     }
@@ -104,6 +104,18 @@ class MC(dbus.proxies.ProxyObject):
 
         return events[3:]
 
+def set_mc_environment(bus, **env):
+    """
+    Set environment variables for MC, overriding the ones from
+    run-test.sh. MC must not have been started yet, so this is only useful
+    in tests that use preload_mc=False.
+    """
+    bus_daemon = dbus.Interface(
+            bus.get_object(dbus.BUS_DAEMON_NAME, dbus.BUS_DAEMON_PATH),
+            dbus.BUS_DAEMON_IFACE)
+    bus_daemon.UpdateActivationEnvironment(
+            dbus.Dictionary(env, signature='ss'))
+
 def exec_test_deferred (fun, params, protocol=None, timeout=None,
         preload_mc=True, initially_online=True, use_fake_accounts_service=True,
         pass_kwargs=False):
@@ -24,6 +24,7 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -34,19 +35,35 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+/* MC-specific diagnostics, from src/mcd-master-priv.h */
+#define MC_IFACE_DEBUG \
+    "org.freedesktop.Telepathy.MissionControl5.Debug.DRAFT"
+/* from src/mcd-account-stats.h */
+#define MC_IFACE_ACCOUNT_INTERFACE_STATS \
+    "org.freedesktop.Telepathy.Account.Interface.Stats.DRAFT"
+
+/* Accounts are printed by dump without waiting for the rest to be ready,
+ * with at most this many being prepared at a time */
+#define DUMP_MAX_IN_FLIGHT 16
+
 static gchar *app_name;
 static GMainLoop *main_loop;
+static GQuark account_features[4];
+
+/* --json: print accounts as JSON objects, one per line */
+static gboolean json_output = FALSE;
+/* reading commands from stdin: errors in one command are not fatal */
+static gboolean batch_mode = FALSE;
 
 static void
-show_help (gchar * err)
+print_usage (void)
 {
-    if (err)
-	printf ("Error: %s\n", err);
-
     printf ("Usage:\n"
 	    "    %1$s list\n"
 	    "    %1$s summary\n"
 	    "    %1$s dump\n"
+	    "    %1$s memory\n"
+	    "    %1$s batch\n"
 	    "    %1$s add <manager>/<protocol> <display name> [<param> ...]\n"
 	    "    %1$s update <account name> [<param>|clear:key] ...\n"
 	    "    %1$s display <account name> <display name>\n"
@@ -54,6 +71,7 @@ show_help (gchar * err)
 	    "    %1$s service <account name> <service name>\n"
 	    "    %1$s icon <account name> <icon name>\n"
 	    "    %1$s show <account name>\n"
+	    "    %1$s stats <account name>\n"
 	    "    %1$s get <account name> [key...]\n"
 	    "    %1$s enable <account name>\n"
 	    "    %1$s disable <account name>\n"
@@ -62,8 +80,20 @@ show_help (gchar * err)
 	    "    %1$s auto-connect <account name> [(on|off)]\n"
 	    "    %1$s reconnect <account name>\n"
 	    "    %1$s remove <account name>\n"
-	    "  where <param> matches (int|uint|bool|string|path):<key>=<value>\n",
+	    "  where <param> matches (int|uint|bool|string|path):<key>=<value>\n"
+	    "  batch reads commands from standard input, one per line\n"
+	    "  --json before the command makes list, summary, show and dump\n"
+	    "  print one JSON object per account per line\n",
 	    app_name);
+}
+
+static void
+show_help (gchar * err)
+{
+    if (err)
+	printf ("Error: %s\n", err);
+
+    print_usage ();
 
     if (err)
 	exit (-1);
@@ -71,6 +101,18 @@ show_help (gchar * err)
 	exit (0);
 }
 
+/* In batch mode, report a bad command and carry on with the next one;
+ * otherwise, show the usage and exit */
+static gboolean
+usage_error (gchar *err)
+{
+    if (!batch_mode)
+	show_help (err);
+
+    fprintf (stderr, "%s: %s\n", app_name, err);
+    return FALSE;
+}
+
 static
 union command {
     struct common {
@@ -78,11 +120,16 @@ union command {
 	gchar const *name;
 	gchar const *account;
 	int ret;
+	/* if TRUE, ready.stream is called without preparing anything */
+	gboolean stream;
+	/* frees whatever parse() allocated for this command, or NULL */
+	void (*clear) (void);
     } common;
 
     union {
 	gboolean (*manager) (TpAccountManager *manager);
 	gboolean (*account) (TpAccount *account);
+	gboolean (*stream) (TpSimpleClientFactory *factory);
     } ready;
 
     struct {
@@ -509,82 +556,471 @@ getter_by_name(char *name)
 
 /* ====================================================================== */
 
+static void
+json_append_string (GString *out, gchar const *s)
+{
+    if (s == NULL) {
+	g_string_append (out, "null");
+	return;
+    }
+
+    g_string_append_c (out, '"');
+
+    for (; *s != '\0'; s++) {
+	guchar c = *s;
+
+	switch (c) {
+	case '"': g_string_append (out, "\\\""); break;
+	case '\\': g_string_append (out, "\\\\"); break;
+	case '\n': g_string_append (out, "\\n"); break;
+	case '\r': g_string_append (out, "\\r"); break;
+	case '\t': g_string_append (out, "\\t"); break;
+	default:
+	    if (c < 0x20)
+		g_string_append_printf (out, "\\u%04x", c);
+	    else
+		g_string_append_c (out, c);
+	}
+    }
+
+    g_string_append_c (out, '"');
+}
+
+static void
+json_append_variant (GString *out, GVariant *v)
+{
+    gsize i, n;
+
+    switch (g_variant_classify (v)) {
+    case G_VARIANT_CLASS_BOOLEAN:
+	g_string_append (out, g_variant_get_boolean (v) ? "true" : "false");
+	break;
+    case G_VARIANT_CLASS_BYTE:
+	g_string_append_printf (out, "%u", g_variant_get_byte (v));
+	break;
+    case G_VARIANT_CLASS_INT16:
+	g_string_append_printf (out, "%d", g_variant_get_int16 (v));
+	break;
+    case G_VARIANT_CLASS_UINT16:
+	g_string_append_printf (out, "%u", g_variant_get_uint16 (v));
+	break;
+    case G_VARIANT_CLASS_INT32:
+	g_string_append_printf (out, "%d", g_variant_get_int32 (v));
+	break;
+    case G_VARIANT_CLASS_UINT32:
+	g_string_append_printf (out, "%u", g_variant_get_uint32 (v));
+	break;
+    case G_VARIANT_CLASS_HANDLE:
+	g_string_append_printf (out, "%d", g_variant_get_handle (v));
+	break;
+    case G_VARIANT_CLASS_INT64:
+	g_string_append_printf (out, "%" G_GINT64_FORMAT,
+				g_variant_get_int64 (v));
+	break;
+    case G_VARIANT_CLASS_UINT64:
+	g_string_append_printf (out, "%" G_GUINT64_FORMAT,
+				g_variant_get_uint64 (v));
+	break;
+    case G_VARIANT_CLASS_DOUBLE:
+	{
+	    gdouble d = g_variant_get_double (v);
+	    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	    /* JSON has no NaN or infinity */
+	    if (isfinite (d))
+		g_string_append (out, g_ascii_dtostr (buf, sizeof (buf), d));
+	    else
+		g_string_append (out, "null");
+	}
+	break;
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+	json_append_string (out, g_variant_get_string (v, NULL));
+	break;
+    case G_VARIANT_CLASS_VARIANT:
+	{
+	    GVariant *child = g_variant_get_variant (v);
+
+	    json_append_variant (out, child);
+	    g_variant_unref (child);
+	}
+	break;
+    case G_VARIANT_CLASS_MAYBE:
+	{
+	    GVariant *child = g_variant_get_maybe (v);
+
+	    if (child == NULL) {
+		g_string_append (out, "null");
+	    }
+	    else {
+		json_append_variant (out, child);
+		g_variant_unref (child);
+	    }
+	}
+	break;
+    case G_VARIANT_CLASS_ARRAY:
+	if (g_variant_type_is_dict_entry (g_variant_type_element (
+		    g_variant_get_type (v))) &&
+	    g_variant_type_equal (g_variant_type_key (g_variant_type_element (
+		    g_variant_get_type (v))), G_VARIANT_TYPE_STRING)) {
+	    /* a{s*} maps naturally to an object */
+	    n = g_variant_n_children (v);
+	    g_string_append_c (out, '{');
+
+	    for (i = 0; i < n; i++) {
+		GVariant *key, *value;
+
+		g_variant_get_child (v, i, "{@s@*}", &key, &value);
+
+		if (i > 0)
+		    g_string_append_c (out, ',');
+
+		json_append_string (out, g_variant_get_string (key, NULL));
+		g_string_append_c (out, ':');
+		json_append_variant (out, value);
+		g_variant_unref (key);
+		g_variant_unref (value);
+	    }
+
+	    g_string_append_c (out, '}');
+	    break;
+	}
+	/* else fall through: other arrays, and tuples, are lists */
+    case G_VARIANT_CLASS_TUPLE:
+    case G_VARIANT_CLASS_DICT_ENTRY:
+	n = g_variant_n_children (v);
+	g_string_append_c (out, '[');
+
+	for (i = 0; i < n; i++) {
+	    GVariant *child = g_variant_get_child_value (v, i);
+
+	    if (i > 0)
+		g_string_append_c (out, ',');
+
+	    json_append_variant (out, child);
+	    g_variant_unref (child);
+	}
+
+	g_string_append_c (out, ']');
+	break;
+    default:
+	g_string_append (out, "null");
+    }
+}
+
+/* Start a member of the object at the end of @out */
+static void
+json_append_member (GString *out, gchar const *name)
+{
+    if (out->str[out->len - 1] != '{')
+	g_string_append_c (out, ',');
+
+    json_append_string (out, name);
+    g_string_append_c (out, ':');
+}
+
+static void
+json_append_strv (GString *out, gchar const * const *strv)
+{
+    gsize i;
+
+    g_string_append_c (out, '[');
+
+    for (i = 0; strv != NULL && strv[i] != NULL; i++) {
+	if (i > 0)
+	    g_string_append_c (out, ',');
+
+	json_append_string (out, strv[i]);
+    }
+
+    g_string_append_c (out, ']');
+}
+
+static void
+json_append_presence (GString *out,
+		      TpConnectionPresenceType type,
+		      gchar const *status,
+		      gchar const *message)
+{
+    g_string_append_printf (out, "[%u,", type);
+    json_append_string (out, status);
+    g_string_append_c (out, ',');
+    json_append_string (out, message);
+    g_string_append_c (out, ']');
+}
+
+/* ====================================================================== */
+
 static gint
-compare_accounts (gconstpointer a,
-                  gconstpointer b)
+compare_paths (gconstpointer a,
+               gconstpointer b)
 {
-    return strcmp (tp_account_get_path_suffix (TP_ACCOUNT (a)),
-                   tp_account_get_path_suffix (TP_ACCOUNT (b)));
+    return strcmp (*(gchar * const *) a, *(gchar * const *) b);
 }
 
-static GList *
-dup_valid_accounts_sorted (TpAccountManager *manager)
+/* called with the sorted object paths (transfer full), or %NULL on error */
+static void (*valid_accounts_callback) (gchar **paths);
+
+static void
+valid_accounts_cb (TpProxy *proxy G_GNUC_UNUSED,
+                   const GValue *value,
+                   const GError *error,
+                   gpointer user_data G_GNUC_UNUSED,
+                   GObject *weak_object G_GNUC_UNUSED)
 {
-    return g_list_sort (tp_account_manager_dup_valid_accounts (manager),
-                        compare_accounts);
+    gchar **paths = NULL;
+
+    if (error != NULL) {
+        fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                 error->message);
+    }
+    else if (G_VALUE_HOLDS (value, TP_ARRAY_TYPE_OBJECT_PATH_LIST)) {
+        GPtrArray *array = g_value_get_boxed (value);
+        guint i;
+
+        paths = g_new0 (gchar *, array->len + 1);
+
+        for (i = 0; i < array->len; i++)
+            paths[i] = g_strdup (g_ptr_array_index (array, i));
+
+        qsort (paths, array->len, sizeof (gchar *), compare_paths);
+    }
+    else {
+        fprintf (stderr, "%s %s: ValidAccounts has unexpected type %s\n",
+                 app_name, command.common.name, G_VALUE_TYPE_NAME (value));
+    }
+
+    valid_accounts_callback (paths);
 }
 
+/* The account manager's ValidAccounts, without preparing any accounts: with
+ * thousands of accounts, that takes a long time and a lot of memory. This
+ * uses the same connection as the rest of mc-tool, through an account
+ * manager proxy that is never prepared. */
 static gboolean
-command_list (TpAccountManager *manager)
+get_valid_accounts_async (TpSimpleClientFactory *factory,
+                          void (*callback) (gchar **paths))
 {
-    GList *accounts = dup_valid_accounts_sorted (manager);
+    TpAccountManager *manager = tp_account_manager_new_with_factory (factory);
+
+    valid_accounts_callback = callback;
+    tp_cli_dbus_properties_call_get (manager, -1, TP_IFACE_ACCOUNT_MANAGER,
+                                     "ValidAccounts", valid_accounts_cb,
+                                     NULL, NULL, NULL);
+    /* the pending call keeps the proxy alive */
+    g_object_unref (manager);
+    return TRUE;
+}
 
-    if (accounts != NULL) {
-	GList *ptr;
+static void
+list_cb (gchar **paths)
+{
+    gchar **p;
 
+    if (paths != NULL && paths[0] != NULL)
 	command.common.ret = 0;
 
-	for (ptr = accounts; ptr != NULL; ptr = ptr->next) {
-	    puts (tp_account_get_path_suffix (ptr->data));
-	}
+    for (p = paths; p != NULL && *p != NULL; p++) {
+	gchar const *suffix = *p + strlen (TP_ACCOUNT_OBJECT_PATH_BASE);
+
+	if (json_output) {
+	    GString *out = g_string_new ("{");
 
-	g_list_free_full (accounts, g_object_unref);
+	    json_append_member (out, "Account");
+	    json_append_string (out, suffix);
+	    g_string_append_c (out, '}');
+	    puts (out->str);
+	    g_string_free (out, TRUE);
+	}
+	else {
+	    puts (suffix);
+	}
     }
 
-    return FALSE;                 /* stop mainloop */
+    g_strfreev (paths);
+    g_main_loop_quit (main_loop);
 }
 
 static gboolean
-command_summary (TpAccountManager *manager)
+command_list (TpSimpleClientFactory *factory)
+{
+    return get_valid_accounts_async (factory, list_cb);
+}
+
+typedef struct {
+    gboolean ok;
+    gboolean enabled;
+    TpConnectionPresenceType type;
+    gchar *status;
+    gchar *message;
+} SummaryRow;
+
+/* Like dump, summary only fetches the properties it prints, rather than
+ * preparing every account */
+static struct {
+    TpSimpleClientFactory *factory;
+    gchar **paths;
+    SummaryRow *rows;
+    guint next;
+    guint in_flight;
+} summary;
+
+static void summary_next (void);
+
+static void
+summary_print (void)
 {
-    GList *accounts, *l;
     guint longest_account = 0;
+    guint i;
 
-    accounts = tp_account_manager_dup_valid_accounts (manager);
-    if (accounts == NULL) {
-        return FALSE;
-    }
-    command.common.ret = 0;
+    for (i = 0; summary.paths[i] != NULL; i++) {
+        gchar const *suffix =
+            summary.paths[i] + strlen (TP_ACCOUNT_OBJECT_PATH_BASE);
+        SummaryRow *row = &summary.rows[i];
+
+        if (!row->ok)
+            continue;
 
-    for (l = accounts; l != NULL; l = l->next) {
-        TpAccount *account = TP_ACCOUNT (l->data);
+        command.common.ret = 0;
+
+        if (json_output) {
+            GString *out = g_string_new ("{");
+
+            json_append_member (out, "Account");
+            json_append_string (out, suffix);
+            json_append_member (out, "Enabled");
+            g_string_append (out, row->enabled ? "true" : "false");
+            json_append_member (out, "RequestedPresence");
+            json_append_presence (out, row->type, row->status, row->message);
+            g_string_append_c (out, '}');
+            puts (out->str);
+            g_string_free (out, TRUE);
+        }
 
-        longest_account = MAX (longest_account,
-            strlen (tp_account_get_path_suffix (account)));
+        longest_account = MAX (longest_account, strlen (suffix));
     }
 
+    if (json_output || command.common.ret != 0)
+        return;
+
     /* The -6 is so we can line up the "Enabled" header to have the ticks and
      * crosses below the 7th and final character. We're only guaranteed
      * longest_account ≥ 5 in theory (a/b/c is the shortest legal suffix) but
      * in practice it's always going to be ≥ 7.
      */
-    g_return_val_if_fail (longest_account >= 7, FALSE);
+    g_return_if_fail (longest_account >= 7);
     printf ("%-*s %s %s\n", longest_account - 6, "Account", "Enabled", "Requested");
     printf ("%-*s %s %s\n", longest_account - 6, "=======", "=======", "=========");
 
-    for (l = accounts; l != NULL; l = l->next) {
-        TpAccount *account = TP_ACCOUNT (l->data);
-        gchar *status;
+    for (i = 0; summary.paths[i] != NULL; i++) {
+        SummaryRow *row = &summary.rows[i];
+
+        if (!row->ok)
+            continue;
 
-        tp_account_get_requested_presence (account, &status, NULL);
         printf ("%-*s %s %s\n",
-            longest_account, tp_account_get_path_suffix (account),
-            tp_account_is_enabled (account) ? "✓" : "☐",
-            status);
+            longest_account,
+            summary.paths[i] + strlen (TP_ACCOUNT_OBJECT_PATH_BASE),
+            row->enabled ? "✓" : "☐",
+            row->status);
+    }
+}
+
+static void
+summary_props_cb (TpProxy *proxy,
+                  GHashTable *properties,
+                  const GError *error,
+                  gpointer user_data,
+                  GObject *weak_object G_GNUC_UNUSED)
+{
+    SummaryRow *row = &summary.rows[GPOINTER_TO_UINT (user_data)];
+
+    if (error != NULL) {
+        fprintf (stderr, "%s %s: couldn't load account '%s': %s\n",
+                 app_name, command.common.name,
+                 tp_account_get_path_suffix (TP_ACCOUNT (proxy)),
+                 error->message);
+    }
+    else {
+        GValueArray *presence = tp_asv_get_boxed (properties,
+            "RequestedPresence", TP_STRUCT_TYPE_SIMPLE_PRESENCE);
+        const gchar *status = "", *message = "";
+        guint type = TP_CONNECTION_PRESENCE_TYPE_UNSET;
+
+        if (presence != NULL)
+            tp_value_array_unpack (presence, 3, &type, &status, &message);
+
+        row->ok = TRUE;
+        row->enabled = tp_asv_get_boolean (properties, "Enabled", NULL);
+        row->type = type;
+        row->status = g_strdup (status);
+        row->message = g_strdup (message);
     }
 
-    g_list_free_full (accounts, g_object_unref);
-    return FALSE; /* stop mainloop */
+    /* the ref is the one taken in summary_next */
+    g_object_unref (proxy);
+    summary.in_flight--;
+    summary_next ();
+}
+
+static void
+summary_next (void)
+{
+    while (summary.in_flight < DUMP_MAX_IN_FLIGHT &&
+           summary.paths != NULL && summary.paths[summary.next] != NULL) {
+        TpAccount *account;
+        GError *error = NULL;
+        guint i = summary.next++;
+
+        account = tp_simple_client_factory_ensure_account (summary.factory,
+            summary.paths[i], NULL, &error);
+
+        if (account == NULL) {
+            fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                     error->message);
+            g_error_free (error);
+            continue;
+        }
+
+        summary.in_flight++;
+        tp_cli_dbus_properties_call_get_all (account, -1, TP_IFACE_ACCOUNT,
+            summary_props_cb, GUINT_TO_POINTER (i), NULL, NULL);
+    }
+
+    if (summary.in_flight == 0) {
+        guint i;
+
+        if (summary.paths != NULL) {
+            summary_print ();
+
+            for (i = 0; summary.paths[i] != NULL; i++) {
+                g_free (summary.rows[i].status);
+                g_free (summary.rows[i].message);
+            }
+        }
+
+        tp_clear_pointer (&summary.rows, g_free);
+        tp_clear_pointer (&summary.paths, g_strfreev);
+        g_main_loop_quit (main_loop);
+    }
+}
+
+static void
+summary_cb (gchar **paths)
+{
+    summary.paths = paths;
+    summary.rows = g_new0 (SummaryRow, paths == NULL ? 0 :
+                           g_strv_length (paths));
+    summary.next = 0;
+    summary_next ();
+}
+
+static gboolean
+command_summary (TpSimpleClientFactory *factory)
+{
+    summary.factory = factory;
+    return get_valid_accounts_async (factory, summary_cb);
 }
 
 static void
@@ -716,6 +1152,107 @@ dup_storage_restrictions (TpAccount *account)
   return result;
 }
 
+static void
+show_account_json (TpAccount *account)
+{
+    GString *out = g_string_new ("{");
+    struct presence presence;
+    const gchar *storage_provider;
+    const gchar * const *supersedes;
+    GVariant *v;
+
+    json_append_member (out, "Account");
+    json_append_string (out, tp_account_get_path_suffix (account));
+    json_append_member (out, "DisplayName");
+    json_append_string (out, tp_account_get_display_name (account));
+    json_append_member (out, "NormalizedName");
+    json_append_string (out, tp_account_get_normalized_name (account));
+    json_append_member (out, "Enabled");
+    g_string_append (out, tp_account_is_enabled (account) ? "true" : "false");
+    json_append_member (out, "Valid");
+    g_string_append (out, tp_account_is_valid (account) ? "true" : "false");
+    json_append_member (out, "Icon");
+    json_append_string (out, tp_account_get_icon_name (account));
+    json_append_member (out, "ConnectAutomatically");
+    g_string_append (out, tp_account_get_connect_automatically (account) ?
+                     "true" : "false");
+    json_append_member (out, "Nickname");
+    json_append_string (out, tp_account_get_nickname (account));
+    json_append_member (out, "Service");
+    json_append_string (out, tp_account_get_service (account));
+
+    presence.type = tp_account_get_automatic_presence (account,
+                                                       &presence.status,
+                                                       &presence.message);
+    json_append_member (out, "AutomaticPresence");
+    json_append_presence (out, presence.type, presence.status,
+                          presence.message);
+    free_presence (&presence);
+
+    presence.type = tp_account_get_current_presence (account,
+                                                     &presence.status,
+                                                     &presence.message);
+    json_append_member (out, "CurrentPresence");
+    json_append_presence (out, presence.type, presence.status,
+                          presence.message);
+    free_presence (&presence);
+
+    presence.type = tp_account_get_requested_presence (account,
+                                                       &presence.status,
+                                                       &presence.message);
+    json_append_member (out, "RequestedPresence");
+    json_append_presence (out, presence.type, presence.status,
+                          presence.message);
+    free_presence (&presence);
+
+    json_append_member (out, "ChangingPresence");
+    g_string_append (out, tp_account_get_changing_presence (account) ?
+                     "true" : "false");
+    json_append_member (out, "URISchemes");
+    json_append_strv (out, tp_account_get_uri_schemes (account));
+
+    storage_provider = tp_account_get_storage_provider (account);
+    if (!tp_str_empty (storage_provider)) {
+        json_append_member (out, "StorageProvider");
+        json_append_string (out, storage_provider);
+
+        v = tp_account_dup_storage_identifier_variant (account);
+        if (v != NULL) {
+            json_append_member (out, "StorageIdentifier");
+            json_append_variant (out, v);
+            g_variant_unref (v);
+        }
+
+        json_append_member (out, "StorageRestrictions");
+        g_string_append_printf (out, "%u",
+            tp_account_get_storage_restrictions (account));
+    }
+
+    json_append_member (out, "Supersedes");
+    g_string_append_c (out, '[');
+
+    for (supersedes = tp_account_get_supersedes (account);
+         supersedes != NULL && *supersedes != NULL;
+         supersedes++) {
+        if (out->str[out->len - 1] != '[')
+            g_string_append_c (out, ',');
+
+        json_append_string (out,
+            *supersedes + strlen (TP_ACCOUNT_OBJECT_PATH_BASE));
+    }
+
+    g_string_append_c (out, ']');
+
+    v = tp_account_dup_parameters_vardict (account);
+    json_append_member (out, "Parameters");
+    json_append_variant (out, v);
+    g_variant_unref (v);
+
+    g_string_append_c (out, '}');
+    puts (out->str);
+    g_string_free (out, TRUE);
+}
+
 static gboolean
 command_show (TpAccount *account)
 {
@@ -727,6 +1264,12 @@ command_show (TpAccount *account)
     const gchar *storage_provider;
     const gchar * const *supersedes;
 
+    if (json_output) {
+        show_account_json (account);
+        command.common.ret = 0;
+        return FALSE;
+    }
+
     show ("Account", tp_account_get_path_suffix (account));
     show ("Display Name", tp_account_get_display_name (account));
     show ("Normalized", tp_account_get_normalized_name (account));
@@ -820,28 +1363,241 @@ command_show (TpAccount *account)
     return FALSE;
 }
 
+static struct {
+    TpSimpleClientFactory *factory;
+    gchar **paths;
+    guint next;
+    guint in_flight;
+    guint shown;
+} dump;
+
+static void dump_next (void);
+
+static void
+dump_account_ready_cb (GObject *source,
+                       GAsyncResult *res,
+                       gpointer user_data G_GNUC_UNUSED)
+{
+    TpAccount *account = TP_ACCOUNT (source);
+    GError *error = NULL;
+
+    if (!tp_proxy_prepare_finish (account, res, &error)) {
+        fprintf (stderr, "%s %s: couldn't load account '%s': %s\n",
+                 app_name, command.common.name,
+                 tp_account_get_path_suffix (account), error->message);
+        g_error_free (error);
+    }
+    else {
+        if (dump.shown++ > 0 && !json_output)
+          printf ("\n------------------------------------------------------------\n\n");
+
+        command_show (account);
+        /* let provisioning scripts see each account as soon as it's ready */
+        fflush (stdout);
+    }
+
+    g_object_unref (account);
+    dump.in_flight--;
+    dump_next ();
+}
+
+static void
+dump_next (void)
+{
+    while (dump.in_flight < DUMP_MAX_IN_FLIGHT &&
+           dump.paths != NULL && dump.paths[dump.next] != NULL) {
+        TpAccount *account;
+        GError *error = NULL;
+
+        account = tp_simple_client_factory_ensure_account (dump.factory,
+            dump.paths[dump.next++], NULL, &error);
+
+        if (account == NULL) {
+            fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                     error->message);
+            g_error_free (error);
+            continue;
+        }
+
+        dump.in_flight++;
+        /* the ref is released in dump_account_ready_cb */
+        tp_proxy_prepare_async (account, account_features,
+                                dump_account_ready_cb, NULL);
+    }
+
+    if (dump.in_flight == 0) {
+        /* like the other commands, fail if there are no accounts at all */
+        if (dump.shown > 0)
+            command.common.ret = 0;
+
+        tp_clear_pointer (&dump.paths, g_strfreev);
+        g_main_loop_quit (main_loop);
+    }
+}
+
+static void
+dump_cb (gchar **paths)
+{
+    dump.paths = paths;
+    dump.next = 0;
+    dump.shown = 0;
+    dump_next ();
+}
+
+/* Rather than waiting for every account to be prepared, as the account
+ * manager would, prepare a few at a time and print each as it becomes
+ * ready, so that the time to the first account and the memory used don't
+ * grow with the number of accounts */
+static gboolean
+command_dump (TpSimpleClientFactory *factory)
+{
+    dump.factory = factory;
+    return get_valid_accounts_async (factory, dump_cb);
+}
+
+static void
+memory_report_cb (GObject *source,
+                  GAsyncResult *res,
+                  gpointer user_data)
+{
+    GVariant *reply;
+    GError *error = NULL;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res,
+                                           &error);
+
+    if (reply == NULL) {
+        fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                 error->message);
+        g_error_free (error);
+    }
+    else {
+        GVariantIter *iter;
+        guint32 depth;
+        const gchar *type, *identifier;
+        guint64 bytes, total = 0;
+
+        command.common.ret = 0;
+
+        g_variant_get (reply, "(a(usst))", &iter);
+
+        while (g_variant_iter_next (iter, "(u&s&st)", &depth, &type,
+                                    &identifier, &bytes)) {
+            printf ("%10" G_GUINT64_FORMAT "  %*s%s%s%s\n", bytes,
+                    (int) depth * 2, "", type,
+                    identifier[0] != '\0' ? " " : "", identifier);
+            total += bytes;
+        }
+
+        printf ("%10" G_GUINT64_FORMAT "  total (estimated bytes)\n", total);
+
+        g_variant_iter_free (iter);
+        g_variant_unref (reply);
+    }
+
+    g_main_loop_quit (main_loop);
+}
+
 static gboolean
-command_dump (TpAccountManager *manager)
+command_memory (TpAccountManager *manager)
 {
-    GList *accounts, *l;
+    GDBusConnection *bus;
+    GError *error = NULL;
 
-    accounts = tp_account_manager_dup_valid_accounts (manager);
-    if (accounts == NULL) {
+    bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+
+    if (bus == NULL) {
+        fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                 error->message);
+        g_error_free (error);
         return FALSE;
     }
-    command.common.ret = 0;
 
-    for (l = accounts; l != NULL; l = l->next) {
-        TpAccount *account = TP_ACCOUNT (l->data);
+    g_dbus_connection_call (bus, TP_ACCOUNT_MANAGER_BUS_NAME,
+                            TP_DEBUG_OBJECT_PATH, MC_IFACE_DEBUG,
+                            "GetMemoryReport", NULL,
+                            G_VARIANT_TYPE ("(a(usst))"),
+                            G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                            memory_report_cb, NULL);
+    g_object_unref (bus);
+    return TRUE;
+}
 
-        command_show (account);
+static void
+account_stats_cb (TpProxy *proxy G_GNUC_UNUSED,
+                  GHashTable *properties,
+                  const GError *error,
+                  gpointer user_data G_GNUC_UNUSED,
+                  GObject *weak_object G_GNUC_UNUSED)
+{
+    GVariant *props, *v;
 
-        if (l->next != NULL)
-          printf ("\n------------------------------------------------------------\n\n");
+    if (error != NULL) {
+        fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+                 error->message);
     }
+    else {
+        GVariantIter iter;
+        const gchar *name;
+        gint64 since;
+        guint64 count, min, mean, p95, max;
+
+        command.common.ret = 0;
+        props = g_variant_ref_sink (tp_asv_to_vardict (properties));
+
+        if (g_variant_lookup (props, "Since", "x", &since)) {
+            GDateTime *dt = g_date_time_new_from_unix_local (since);
+            gchar *s = g_date_time_format (dt, "%Y-%m-%d %H:%M:%S");
+
+            printf ("Since: %s\n", s);
+            g_free (s);
+            g_date_time_unref (dt);
+        }
+
+        v = g_variant_lookup_value (props, "Counters",
+                                    G_VARIANT_TYPE ("a{st}"));
+
+        if (v != NULL) {
+            printf ("\n");
+            g_variant_iter_init (&iter, v);
+
+            while (g_variant_iter_next (&iter, "{&st}", &name, &count))
+                printf ("%20s: %" G_GUINT64_FORMAT "\n", name, count);
+
+            g_variant_unref (v);
+        }
 
-    g_list_free_full (accounts, g_object_unref);
-    return FALSE; /* stop mainloop */
+        v = g_variant_lookup_value (props, "Latencies",
+                                    G_VARIANT_TYPE ("a{s(ttttt)}"));
+
+        if (v != NULL) {
+            printf ("\n%20s  %8s %10s %10s %10s %10s\n", "latency (ms)",
+                    "count", "min", "mean", "95%", "max");
+            g_variant_iter_init (&iter, v);
+
+            while (g_variant_iter_next (&iter, "{&s(ttttt)}", &name, &count,
+                                        &min, &mean, &p95, &max))
+                printf ("%20s  %8" G_GUINT64_FORMAT
+                        " %10.1f %10.1f %10.1f %10.1f\n",
+                        name, count, min / 1000.0, mean / 1000.0,
+                        p95 / 1000.0, max / 1000.0);
+
+            g_variant_unref (v);
+        }
+
+        g_variant_unref (props);
+    }
+
+    g_main_loop_quit (main_loop);
+}
+
+static gboolean
+command_stats (TpAccount *account)
+{
+    tp_cli_dbus_properties_call_get_all (account, -1,
+                                         MC_IFACE_ACCOUNT_INTERFACE_STATS,
+                                         account_stats_cb, NULL, NULL, NULL);
+    return TRUE;
 }
 
 static gboolean
@@ -1069,18 +1825,65 @@ command_request (TpAccount *account)
     return TRUE;
 }
 
+/* Something is wrong with the command, and the reason has been printed */
+static gboolean
+parse_failed (void)
+{
+    if (!batch_mode)
+	exit (1);
+
+    return FALSE;
+}
+
+static void
+clear_add (void)
+{
+    g_hash_table_unref (command.add.parameters);
+}
+
+static void
+clear_update (void)
+{
+    g_hash_table_unref (command.update.set);
+    g_ptr_array_foreach (command.update.unset, (GFunc) g_free, NULL);
+    g_ptr_array_free (command.update.unset, TRUE);
+}
+
 static void
+clear_get (void)
+{
+    guint i;
+
+    /* param=... getters are allocated; the others are static */
+    for (i = 0; i < command.get.args->len; i++) {
+	Getter *getter = g_ptr_array_index (command.get.args, i);
+
+	if (getter->type == GET_PARAM)
+	    g_free (getter);
+    }
+
+    g_ptr_array_free (command.get.args, TRUE);
+}
+
+static gboolean
+command_help (TpSimpleClientFactory *factory G_GNUC_UNUSED)
+{
+    print_usage ();
+    command.common.ret = 0;
+    return FALSE;
+}
+
+/* Returns: %FALSE if the command is invalid, in batch mode (otherwise the
+ * usage is shown and mc-tool exits) */
+static gboolean
 parse (int argc, char **argv)
 {
     int i;
     gboolean status;
 
-    app_name = basename (argv[0]);
-
     if (argc < 2)
-	show_help ("No command specified");
+	return usage_error ("No command specified");
 
-    g_type_init ();
     /* Command processing */
 
     command.common.name = argv[1];
@@ -1091,34 +1894,35 @@ parse (int argc, char **argv)
 
 	/* Add account */
 	if (argc < 4)
-	    show_help ("Invalid add command.");
+	    return usage_error ("Invalid add command.");
 
 	if (strchr (argv[2], '/') != NULL)
 	{
 	    strv = g_strsplit (argv[2], "/", 2);
 
 	    if (strv[0] == NULL || strv[1] == NULL || strv[2] != NULL)
-		show_help ("Invalid add command.");
+		return usage_error ("Invalid add command.");
 
 	    command.add.manager = strv[0];
 	    command.add.protocol = strv[1];
 	}
 	else
 	{
-	    show_help ("Invalid add command.");
+	    return usage_error ("Invalid add command.");
 	}
 
 	command.ready.manager = command_add;
 	command.add.display = argv[3];
 
 	command.add.parameters = new_params ();
+	command.common.clear = clear_add;
 
 	for (i = 4; i < argc; i++)
 	{
 	    status = set_param (command.add.parameters, NULL, argv[i]);
 	    if (!status) {
 		g_warning ("%s: bad parameter: %s", argv[1], argv[i]);
-		exit (1);
+		return parse_failed ();
 	    }
 	}
     }
@@ -1126,32 +1930,43 @@ parse (int argc, char **argv)
     {
 	/* List accounts */
 	if (argc != 2)
-	    show_help ("Invalid list command.");
+	    return usage_error ("Invalid list command.");
 
-	command.ready.manager = command_list;
+	command.ready.stream = command_list;
+	command.common.stream = TRUE;
     }
     else if (strcmp (argv[1], "summary") == 0)
     {
         /* List accounts */
         if (argc != 2)
-            show_help ("Invalid summary command.");
+            return usage_error ("Invalid summary command.");
 
-        command.ready.manager = command_summary;
+        command.ready.stream = command_summary;
+        command.common.stream = TRUE;
     }
     else if (strcmp (argv[1], "dump") == 0)
     {
         /* Dump all accounts */
         if (argc != 2)
-            show_help ("Invalid dump command.");
+            return usage_error ("Invalid dump command.");
+
+        command.ready.stream = command_dump;
+        command.common.stream = TRUE;
+    }
+    else if (strcmp (argv[1], "memory") == 0)
+    {
+        /* Estimate MC's memory use */
+        if (argc != 2)
+            return usage_error ("Invalid memory command.");
 
-        command.ready.manager = command_dump;
+        command.ready.manager = command_memory;
     }
     else if (strcmp  (argv[1], "remove") == 0
 	     || strcmp (argv[1], "delete") == 0)
     {
 	/* Remove account */
 	if (argc != 3)
-	    show_help ("Invalid remove command.");
+	    return usage_error ("Invalid remove command.");
 
 	command.ready.account = command_remove;
 	command.common.account = argv[2];
@@ -1161,21 +1976,31 @@ parse (int argc, char **argv)
 	/* Show account details */
 
 	if (argc != 3)
-	    show_help ("Invalid show command.");
+	    return usage_error ("Invalid show command.");
 
 	command.ready.account = command_show;
 	command.common.account = argv[2];
     }
+    else if (strcmp (argv[1], "stats") == 0)
+    {
+        /* Show account statistics */
+        if (argc != 3)
+            return usage_error ("Invalid stats command.");
+
+        command.ready.account = command_stats;
+        command.common.account = argv[2];
+    }
     else if (strcmp (argv[1], "get") == 0)
     {
 	/* Get account details */
 
 	if (argc < 3)
-	    show_help ("Invalid get command.");
+	    return usage_error ("Invalid get command.");
 
 	command.ready.account = command_get;
 	command.common.account = argv[2];
 	command.get.args = g_ptr_array_new();
+	command.common.clear = clear_get;
 
 	for (i = 3; argv[i]; i++) {
 	    char *name = argv[i];
@@ -1193,7 +2018,7 @@ parse (int argc, char **argv)
 		if (getter == NULL) {
 		    fprintf(stderr, "%s %s: %s: unknown\n", app_name,
 			    "get", name);
-		    exit(1);
+		    return parse_failed ();
 		}
 	    }
 
@@ -1205,7 +2030,7 @@ parse (int argc, char **argv)
 	/* Show connection status  */
 
 	if (argc != 3)
-	    show_help ("Invalid connection command.");
+	    return usage_error ("Invalid connection command.");
 
 	command.ready.account = command_connection;
 	command.common.account = argv[2];
@@ -1214,7 +2039,7 @@ parse (int argc, char **argv)
     {
 	/* Enable account */
 	if (argc != 3)
-	    show_help ("Invalid enable command.");
+	    return usage_error ("Invalid enable command.");
 
 	command.ready.account = command_enable;
 	command.common.account = argv[2];
@@ -1223,7 +2048,7 @@ parse (int argc, char **argv)
     {
 	/* Disable account */
 	if (argc != 3)
-	    show_help ("Invalid disable command.");
+	    return usage_error ("Invalid disable command.");
 
 	command.ready.account = command_disable;
 	command.common.account = argv[2];
@@ -1232,7 +2057,7 @@ parse (int argc, char **argv)
     {
 	/* Set display name */
 	if (argc != 4)
-	    show_help ("Invalid display command.");
+	    return usage_error ("Invalid display command.");
 
 	command.ready.account = command_display;
 	command.common.account = argv[2];
@@ -1242,7 +2067,7 @@ parse (int argc, char **argv)
     {
 	/* Set nickname */
 	if (argc != 4)
-	    show_help ("Invalid nick command.");
+	    return usage_error ("Invalid nick command.");
 
 	command.ready.account = command_nick;
 	command.common.account = argv[2];
@@ -1252,7 +2077,7 @@ parse (int argc, char **argv)
     {
         /* Set service */
 	if (argc != 4)
-	    show_help ("Invalid service command.");
+	    return usage_error ("Invalid service command.");
 
 	command.ready.account = command_service;
 	command.common.account = argv[2];
@@ -1262,7 +2087,7 @@ parse (int argc, char **argv)
     {
 	/* Set icon */
 	if (argc != 4)
-	    show_help ("Invalid icon command.");
+	    return usage_error ("Invalid icon command.");
 
 	command.ready.account = command_icon;
 	command.common.account = argv[2];
@@ -1273,12 +2098,13 @@ parse (int argc, char **argv)
     {
 	/* Set account parameter (s) */
 	if (argc < 4)
-	    show_help ("Invalid update command.");
+	    return usage_error ("Invalid update command.");
 
 	command.ready.account = command_update;
 	command.common.account = argv[2];
 	command.update.set = new_params ();
 	command.update.unset = g_ptr_array_new ();
+	command.common.clear = clear_update;
 
 	for (i = 3; i < argc; i++)
 	{
@@ -1286,7 +2112,7 @@ parse (int argc, char **argv)
 				argv[i]);
 	    if (!status) {
 		g_warning ("%s: bad parameter: %s", argv[1], argv[i]);
-		exit (1);
+		return parse_failed ();
 	    }
 	}
 
@@ -1296,7 +2122,7 @@ parse (int argc, char **argv)
     {
 	/* Set automatic presence */
 	if (argc != 4 && argc != 5)
-	    show_help ("Invalid auto-presence command.");
+	    return usage_error ("Invalid auto-presence command.");
 
 	command.ready.account = command_auto_presence;
 	command.common.account = argv[2];
@@ -1309,7 +2135,7 @@ parse (int argc, char **argv)
 	case TP_CONNECTION_PRESENCE_TYPE_ERROR:
 	    fprintf(stderr, "%s: %s: unknown presence %s\n",
 		    app_name, argv[1], argv[3]);
-	    exit(1);
+	    return parse_failed ();
 	    break;
 	default:
 	    break;
@@ -1319,7 +2145,7 @@ parse (int argc, char **argv)
     {
 	/* Set presence  */
 	if (argc != 4 && argc != 5)
-	    show_help ("Invalid request command.");
+	    return usage_error ("Invalid request command.");
 
 	command.ready.account = command_request;
 	command.common.account = argv[2];
@@ -1332,7 +2158,7 @@ parse (int argc, char **argv)
 	case TP_CONNECTION_PRESENCE_TYPE_ERROR:
 	    fprintf(stderr, "%s: %s: unknown presence %s\n",
 		    app_name, argv[1], argv[3]);
-	    exit(1);
+	    return parse_failed ();
 	    break;
 	default:
 	    break;
@@ -1341,7 +2167,7 @@ parse (int argc, char **argv)
     else if (strcmp (argv[1], "auto-connect") == 0) {
 	/* Turn on (or off) auto-connect  */
 	if (argc != 3 && argc != 4)
-	    show_help ("Invalid auto-connect command.");
+	    return usage_error ("Invalid auto-connect command.");
 
 	command.ready.account = command_auto_connect;
 	command.common.account = argv[2];
@@ -1355,11 +2181,11 @@ parse (int argc, char **argv)
 		 g_ascii_strcasecmp (argv[3], "0") == 0)
 	    command.boolean.value = FALSE;
 	else
-	    show_help ("Invalid auto-connect command.");
+	    return usage_error ("Invalid auto-connect command.");
     }
     else if (strcmp (argv[1], "reconnect") == 0) {
         if (argc != 3)
-            show_help ("Invalid reconnect command.");
+            return usage_error ("Invalid reconnect command.");
 
         command.ready.account = command_reconnect;
         command.common.account = argv[2];
@@ -1367,13 +2193,18 @@ parse (int argc, char **argv)
     else if (strcmp (argv[1], "help") == 0
 	     || strcmp (argv[1], "-h") == 0 || strcmp (argv[1], "--help") == 0)
     {
-	show_help (NULL);
+	if (!batch_mode)
+	    show_help (NULL);
 
+	command.ready.stream = command_help;
+	command.common.stream = TRUE;
     }
     else
     {
-	show_help ("Unknown command.");
+	return usage_error ("Unknown command.");
     }
+
+    return TRUE;
 }
 
 static
@@ -1417,70 +2248,199 @@ void account_ready (GObject *source,
     g_main_loop_quit (main_loop);
 }
 
+/* Run the command that parse() set up, and return its exit status */
+static int
+run_command (TpDBusDaemon *dbus,
+             TpSimpleClientFactory *client_factory,
+             TpAccountManager **am)
+{
+    TpAccount *a = NULL;
+    gchar *path = NULL;
+    GError *error = NULL;
+
+    command.common.ret = 1;
+
+    if (command.common.stream) {
+        if (command.ready.stream (client_factory))
+            g_main_loop_run (main_loop);
+    }
+    else if (command.common.account == NULL) {
+        /* in batch mode, the account manager is only prepared once */
+        if (*am == NULL) {
+            TpSimpleClientFactory *factory;
+
+            *am = tp_account_manager_new (dbus);
+            factory = tp_proxy_get_factory (*am);
+
+            tp_simple_client_factory_add_account_features (factory,
+                account_features);
+        }
+
+        tp_proxy_prepare_async (*am, NULL, manager_ready, NULL);
+        g_main_loop_run (main_loop);
+    }
+    else {
+        path = ensure_prefix (command.common.account);
+        a = tp_simple_client_factory_ensure_account (client_factory,
+            path, NULL, &error);
+
+        if (error != NULL) {
+            fprintf (stderr, "%s %s: %s\n",
+                     app_name, command.common.name,
+                     error->message);
+            g_error_free (error);
+        }
+        else {
+            tp_proxy_prepare_async (a, account_features, account_ready, NULL);
+            g_main_loop_run (main_loop);
+        }
+    }
+
+    tp_clear_object (&a);
+    g_free (path);
+    return command.common.ret;
+}
+
+/* Read commands from stdin, one per line, quoted as they would be in a
+ * shell, and run them in turn, so that scripts that change many accounts
+ * don't have to start mc-tool (and connect to D-Bus) for each. Blank
+ * lines and lines starting with '#' are ignored. */
+static int
+run_batch (TpDBusDaemon *dbus,
+           TpSimpleClientFactory *client_factory,
+           TpAccountManager **am)
+{
+    GIOChannel *input = g_io_channel_unix_new (0);
+    gchar *line = NULL;
+    guint line_number = 0;
+    guint failures = 0;
+    GError *error = NULL;
+
+    batch_mode = TRUE;
+    /* we only care about the bytes, not their encoding */
+    g_io_channel_set_encoding (input, NULL, NULL);
+
+    while (g_io_channel_read_line (input, &line, NULL, NULL, &error) ==
+           G_IO_STATUS_NORMAL) {
+        gchar **args = NULL;
+        gchar **argv;
+        gint argc;
+
+        line_number++;
+        g_strstrip (line);
+
+        if (line[0] == '\0' || line[0] == '#') {
+            g_free (line);
+            continue;
+        }
+
+        if (!g_shell_parse_argv (line, &argc, &args, &error)) {
+            fprintf (stderr, "%s: line %u: %s\n", app_name, line_number,
+                     error->message);
+            g_clear_error (&error);
+            g_free (line);
+            failures++;
+            continue;
+        }
+
+        /* parse() expects our own name in argv[0] */
+        argv = g_new0 (gchar *, argc + 2);
+        argv[0] = app_name;
+        memcpy (argv + 1, args, argc * sizeof (gchar *));
+
+        memset (&command, 0, sizeof (command));
+
+        if (strcmp (argv[1], "batch") == 0) {
+            fprintf (stderr, "%s: line %u: batch cannot be nested\n",
+                     app_name, line_number);
+            failures++;
+        }
+        else if (!parse (argc + 1, argv) ||
+                 run_command (dbus, client_factory, am) != 0) {
+            fprintf (stderr, "%s: line %u: %s failed\n", app_name,
+                     line_number, argv[1]);
+            failures++;
+        }
+
+        if (command.common.clear != NULL)
+            command.common.clear ();
+
+        /* don't interleave our output with that of whatever is reading it */
+        fflush (stdout);
+
+        g_free (argv);
+        g_strfreev (args);
+        g_free (line);
+    }
+
+    if (error != NULL) {
+        fprintf (stderr, "%s: reading commands: %s\n", app_name,
+                 error->message);
+        g_error_free (error);
+        failures++;
+    }
+
+    g_io_channel_unref (input);
+    return failures == 0 ? 0 : 1;
+}
+
 int
 main (int argc, char **argv)
 {
     TpAccountManager *am = NULL;
-    TpAccount *a = NULL;
     TpDBusDaemon *dbus = NULL;
     TpSimpleClientFactory *client_factory = NULL;
     GError *error = NULL;
-    const GQuark features[] = { TP_ACCOUNT_FEATURE_CORE,
-        TP_ACCOUNT_FEATURE_ADDRESSING, TP_ACCOUNT_FEATURE_STORAGE, 0 };
+    gboolean batch = FALSE;
+    int ret = 1;
 
     g_type_init ();
 
     app_name = basename (argv[0]);
 
-    parse (argc, argv);
-
-    command.common.ret = 1;
-
-    dbus = tp_dbus_daemon_dup (&error);
-    if (error != NULL) {
-        fprintf (stderr, "%s %s: Failed to connect to D-Bus: %s\n",
-            app_name, command.common.name, error->message);
-        goto out;
+    /* options come before the command */
+    while (argc > 1 && strcmp (argv[1], "--json") == 0) {
+        json_output = TRUE;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
     }
-    client_factory = tp_simple_client_factory_new (dbus);
-
-    if (command.common.account == NULL) {
-        TpSimpleClientFactory *factory;
 
-        am = tp_account_manager_new (dbus);
-        factory = tp_proxy_get_factory (am);
-
-        tp_simple_client_factory_add_account_features (factory, features);
+    if (argc > 1 && strcmp (argv[1], "batch") == 0) {
+        if (argc != 2)
+            show_help ("Invalid batch command.");
 
-        tp_proxy_prepare_async (am, NULL, manager_ready, NULL);
+        batch = TRUE;
     }
     else {
+        parse (argc, argv);
+    }
 
-	command.common.account = ensure_prefix (command.common.account);
-        a = tp_simple_client_factory_ensure_account (client_factory,
-            command.common.account, NULL, &error);
-
-	if (error != NULL)
-	{
-	    fprintf (stderr, "%s %s: %s\n",
-		     app_name, command.common.name,
-		     error->message);
-	    goto out;
-	}
+    account_features[0] = TP_ACCOUNT_FEATURE_CORE;
+    account_features[1] = TP_ACCOUNT_FEATURE_ADDRESSING;
+    account_features[2] = TP_ACCOUNT_FEATURE_STORAGE;
+    account_features[3] = 0;
 
-	tp_proxy_prepare_async (a, features, account_ready, NULL);
+    dbus = tp_dbus_daemon_dup (&error);
+    if (error != NULL) {
+        fprintf (stderr, "%s %s: Failed to connect to D-Bus: %s\n",
+            app_name, batch ? "batch" : command.common.name, error->message);
+        goto out;
     }
-
+    client_factory = tp_simple_client_factory_new (dbus);
     main_loop = g_main_loop_new (NULL, FALSE);
-    g_main_loop_run (main_loop);
+
+    if (batch)
+        ret = run_batch (dbus, client_factory, &am);
+    else
+        ret = run_command (dbus, client_factory, &am);
 
 out:
     g_clear_error (&error);
     tp_clear_object (&client_factory);
     tp_clear_object (&dbus);
     tp_clear_object (&am);
-    tp_clear_object (&a);
     tp_clear_pointer (&main_loop, g_main_loop_unref);
 
-    return command.common.ret;
+    return ret;
 }